@@ -134,9 +134,8 @@ void print_it(const char *label, const char *fmt, const char *fmt2, ...)
 static void convert_bitmaps(struct gfs2_sbd *sdp, struct rgrp_tree *rg)
 {
 	uint32_t blk;
-	int x, y;
+	int x;
 	struct gfs2_rindex *ri;
-	unsigned char state;
 
 	ri = &rg->ri;
 	for (blk = 0; blk < ri->ri_length; blk++) {
@@ -145,14 +144,21 @@ static void convert_bitmaps(struct gfs2_sbd *sdp, struct rgrp_tree *rg)
 			sizeof(struct gfs2_rgrp);
 
 		bi = &rg->bits[blk];
-		for (; x < sdp->bsize; x++)
-			for (y = 0; y < GFS2_NBBY; y++) {
-				state = (bi->bi_data[x] >> (GFS2_BIT_SIZE * y)) & 0x03;
-				if (state == 0x02) {/* unallocated metadata state invalid */
-					bi->bi_data[x] &= ~(0x02 << (GFS2_BIT_SIZE * y));
-					bi->bi_modified = 1;
-				}
-			}
+		/* 32 blocks at a time; the pairs of bits don't straddle bytes,
+		   so the byte order doesn't matter */
+		for (; x < sdp->bsize; x += sizeof(uint64_t)) {
+			uint64_t w, unalloc;
+
+			memcpy(&w, bi->bi_data + x, sizeof(w));
+			/* unallocated metadata state (0x02) invalid */
+			unalloc = (w >> 1) & ~w & 0x5555555555555555ULL;
+			if (unalloc == 0)
+				continue;
+			w &= ~(unalloc << 1);
+			memcpy(bi->bi_data + x, &w, sizeof(w));
+			bi->bi_modified = 1;
+			bi->bi_summary = 0;
+		}
 	}
 }/* convert_bitmaps */
 
@@ -1098,6 +1104,7 @@ static int inode_renumber(struct gfs2_sbd *sbp, uint64_t root_inode_addr, osi_li
 						bi->bi_data[buf_offset + bitmap_byte] |=
 						            (0x01 << (GFS2_BIT_SIZE * byte_bit));
 						bi->bi_modified = 1;
+						bi->bi_summary = 0;
 						break;
 					}
 					bitmap_byte -= (sbp->bsize - buf_offset);
@@ -1927,7 +1934,8 @@ static int journ_space_to_rg(struct gfs2_sbd *sdp)
 		for (unsigned i = 1; i < rgd->ri.ri_length; i++)
 			rgd->bits[i].bi_data = rgd->bits[0].bi_data + (i * sdp->bsize);
 
-		convert_bitmaps(sdp, rgd);
+		/* The bitmaps start out with every block free, as rg_free says,
+		   so there's nothing in them to convert */
 		gfs2_rgrp_out(&rgd->rg, rgd->bits[0].bi_data);
 		rgd->bits[0].bi_modified = 1;
 
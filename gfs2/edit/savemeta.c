@@ -296,16 +296,9 @@ static int block_is_systemfile(uint64_t blk)
 
 static size_t di_save_len(const char *buf, uint64_t owner)
 {
-	const struct gfs2_dinode *dn;
-	uint16_t di_height;
-	uint32_t di_mode;
-	int gfs1dir;
-
-	dn = (void *)buf;
-	di_mode = be32_to_cpu(dn->di_mode);
-	di_height = be16_to_cpu(dn->di_height);
-	/* __pad1 is di_type in gfs1 */
-	gfs1dir = sbd.gfs1 && (be16_to_cpu(dn->__pad1) == GFS_FILE_DIR);
+	uint16_t di_height = lgfs2_get_di_height(buf);
+	uint32_t di_mode = lgfs2_get_di_mode(buf);
+	int gfs1dir = sbd.gfs1 && lgfs2_get_gfs_di_type(buf) == GFS_FILE_DIR;
 
 	/* Do not save (user) data from the inode block unless they are
 	   indirect pointers, dirents, symlinks or fs internal data */
@@ -329,7 +322,7 @@ static size_t di_save_len(const char *buf, uint64_t owner)
 static int get_gfs_struct_info(const char *buf, uint64_t owner, unsigned *block_type,
                                unsigned *gstruct_len)
 {
-	struct gfs2_meta_header mh;
+	uint32_t mh_type;
 
 	if (block_type != NULL)
 		*block_type = 0;
@@ -337,17 +330,17 @@ static int get_gfs_struct_info(const char *buf, uint64_t owner, unsigned *block_
 	if (gstruct_len != NULL)
 		*gstruct_len = sbd.bsize;
 
-	gfs2_meta_header_in(&mh, buf);
-	if (mh.mh_magic != GFS2_MAGIC)
+	if (lgfs2_get_mh_magic(buf) != GFS2_MAGIC)
 		return -1;
 
+	mh_type = lgfs2_get_mh_type(buf);
 	if (block_type != NULL)
-		*block_type = mh.mh_type;
+		*block_type = mh_type;
 
 	if (gstruct_len == NULL)
 		return 0;
 
-	switch (mh.mh_type) {
+	switch (mh_type) {
 	case GFS2_METATYPE_SB:   /* 1 (superblock) */
 		if (sbd.gfs1)
 			*gstruct_len = sizeof(struct gfs_sb);
@@ -854,32 +847,31 @@ static void save_leaf_blocks(struct metafd *mfd, struct block_range_queue *q)
 static void save_inode_data(struct metafd *mfd, char *ibuf, uint64_t iblk)
 {
 	struct block_range_queue indq[GFS2_MAX_META_HEIGHT] = {{NULL}};
-	uint32_t height;
-	struct gfs2_dinode _di = {0};
+	uint32_t height = lgfs2_get_di_height(ibuf);
+	uint32_t di_mode = lgfs2_get_di_mode(ibuf);
+	uint32_t di_flags = lgfs2_get_di_flags(ibuf);
+	uint64_t di_eattr = lgfs2_get_di_eattr(ibuf);
 	int is_exhash;
 
 	for (unsigned i = 0; i < GFS2_MAX_META_HEIGHT; i++)
 		block_range_queue_init(&indq[i]);
 
-	gfs2_dinode_in(&_di, ibuf);
-	height = _di.di_height;
-
 	/* If this is a user inode, we don't follow to the file height.
 	   We stop one level less.  That way we save off the indirect
 	   pointer blocks but not the actual file contents. The exception
 	   is directories, where the height represents the level at which
 	   the hash table exists, and we have to save the directory data. */
 
-	is_exhash = (S_ISDIR(_di.di_mode) || (sbd.gfs1 && _di.__pad1 == GFS_FILE_DIR)) &&
-	             _di.di_flags & GFS2_DIF_EXHASH;
+	is_exhash = (S_ISDIR(di_mode) || (sbd.gfs1 && lgfs2_get_gfs_di_type(ibuf) == GFS_FILE_DIR)) &&
+	             di_flags & GFS2_DIF_EXHASH;
 	if (is_exhash)
 		height++;
-	else if (height > 0 && !(_di.di_flags & GFS2_DIF_SYSTEM) &&
-		 !block_is_systemfile(iblk) && !S_ISDIR(_di.di_mode))
+	else if (height > 0 && !(di_flags & GFS2_DIF_SYSTEM) &&
+		 !block_is_systemfile(iblk) && !S_ISDIR(di_mode))
 		height--;
 
 	if (height > 0)
-		save_indirect_blocks(mfd, ibuf, iblk, height == 1 ? NULL : &indq[0], sizeof(_di));
+		save_indirect_blocks(mfd, ibuf, iblk, height == 1 ? NULL : &indq[0], sizeof(struct gfs2_dinode));
 	for (unsigned i = 1; i < height; i++) {
 		struct block_range_queue *nextq = &indq[i];
 
@@ -892,7 +884,7 @@ static void save_inode_data(struct metafd *mfd, char *ibuf, uint64_t iblk)
 			for (unsigned j = 0; j < q->len; j++) {
 				char *_buf = q->buf + (j * sbd.bsize);
 
-				save_indirect_blocks(mfd, _buf, iblk, nextq, sizeof(_di.di_header));
+				save_indirect_blocks(mfd, _buf, iblk, nextq, sizeof(struct gfs2_meta_header));
 			}
 			report_progress(q->start + q->len, 0);
 			block_range_free(&q);
@@ -900,20 +892,20 @@ static void save_inode_data(struct metafd *mfd, char *ibuf, uint64_t iblk)
 	}
 	if (is_exhash)
 		save_leaf_blocks(mfd, &indq[height - 1]);
-	if (_di.di_eattr) { /* if this inode has extended attributes */
+	if (di_eattr) { /* if this inode has extended attributes */
 		size_t blklen;
 		uint64_t blk;
 		int mhtype;
 		char *buf;
 
-		blk = _di.di_eattr;
+		blk = di_eattr;
 		buf = check_read_block(sbd.device_fd, blk, iblk, &mhtype, &blklen);
 		if (buf != NULL) {
 			save_buf(mfd, buf, blk, blklen);
 			if (mhtype == GFS2_METATYPE_EA)
 				save_ea_block(mfd, buf, iblk);
 			else if (mhtype == GFS2_METATYPE_IN)
-				save_indirect_blocks(mfd, buf, iblk, NULL, sizeof(_di.di_header));
+				save_indirect_blocks(mfd, buf, iblk, NULL, sizeof(struct gfs2_meta_header));
 			free(buf);
 		}
 	}
@@ -1062,8 +1054,10 @@ static void save_rgrp(struct gfs2_sbd *sdp, struct metafd *mfd, struct rgrp_tree
 	else
 		gfs2_rgrp_in(&rgd->rg, buf);
 
-	for (unsigned i = 0; i < rgd->ri.ri_length; i++)
+	for (unsigned i = 0; i < rgd->ri.ri_length; i++) {
 		rgd->bits[i].bi_data = buf + (i * sdp->bsize);
+		rgd->bits[i].bi_summary = 0;
+	}
 
 	log_debug("RG at %"PRIu64" is %"PRIu32" long\n", addr, (uint32_t)rgd->ri.ri_length);
 	/* Save the rg and bitmaps */
@@ -1076,8 +1070,10 @@ static void save_rgrp(struct gfs2_sbd *sdp, struct metafd *mfd, struct rgrp_tree
 		save_allocated(rgd, mfd);
 
 	free(buf);
-	for (unsigned i = 0; i < rgd->ri.ri_length; i++)
+	for (unsigned i = 0; i < rgd->ri.ri_length; i++) {
 		rgd->bits[i].bi_data = NULL;
+		rgd->bits[i].bi_summary = 0;
+	}
 }
 
 static int save_header(struct metafd *mfd, uint64_t fsbytes)
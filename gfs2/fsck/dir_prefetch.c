@@ -0,0 +1,355 @@
+#include "clusterautoconfig.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <libintl.h>
+#define _(String) gettext(String)
+
+#include <logging.h>
+#include "libgfs2.h"
+#include "fsck.h"
+#include "dir_prefetch.h"
+
+/*
+ * Pass2 checks one directory at a time, in block order. Every check may
+ * repair the directory, change the link counts kept in the inode and
+ * directory trees or ask the user a question, so the checks and all of their
+ * side effects stay serialized in the main thread. What can be done in
+ * parallel is the reading: a small pool of threads walks ahead of pass2
+ * through the same list of directories and reads each dinode, its hash table
+ * and its leaf blocks, including any lf_next chains, so that they are already
+ * in the page cache when pass2 gets to them. The threads never write to the
+ * device and never look at the fsck trees.
+ */
+
+#define PREFETCH_THREADS  (4)   /* Most reader threads to start */
+#define PREFETCH_WINDOW   (256) /* Directories to read ahead of pass2 */
+#define PREFETCH_MAXRUN   (32)  /* Blocks per read */
+#define PREFETCH_MAXCHAIN (64)  /* Leaf chain links to follow */
+
+struct dir_prefetch {
+	struct gfs2_sbd *sdp;
+	uint64_t *dirs;   /* Directory dinode addresses, in pass2 order */
+	uint64_t ndirs;
+	uint64_t next;    /* Index of the next directory to read */
+	uint64_t cur;     /* Index of the directory pass2 is checking */
+	uint64_t pos;     /* Value of cur last seen by the readers */
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t more;
+	unsigned nthreads;
+	pthread_t threads[PREFETCH_THREADS];
+};
+
+struct pf_list {
+	uint64_t *blks;
+	size_t n;
+	size_t max;
+};
+
+struct pf_worker {
+	struct gfs2_sbd *sdp;
+	char *buf;
+	struct pf_list cur;  /* Blocks being read */
+	struct pf_list next; /* Blocks they point to */
+};
+
+static int u64cmp(const void *p1, const void *p2)
+{
+	uint64_t a = *(uint64_t *)p1;
+	uint64_t b = *(uint64_t *)p2;
+
+	if (a > b)
+		return 1;
+	if (a < b)
+		return -1;
+
+	return 0;
+}
+
+static void pf_add(struct pf_worker *w, uint64_t blk)
+{
+	struct pf_list *l = &w->next;
+
+	if (blk <= LGFS2_SB_ADDR(w->sdp) || blk >= w->sdp->fssize)
+		return;
+	if (l->n == l->max) {
+		size_t max = l->max ? l->max * 2 : 512;
+		uint64_t *blks = realloc(l->blks, max * sizeof(*blks));
+
+		if (blks == NULL)
+			return;
+		l->blks = blks;
+		l->max = max;
+	}
+	l->blks[l->n++] = blk;
+}
+
+static void pf_add_ptrs(struct pf_worker *w, const char *start, const char *end)
+{
+	const uint64_t *p;
+	uint64_t prev = 0;
+
+	for (p = (const uint64_t *)start; p < (const uint64_t *)end; p++) {
+		uint64_t blk = be64_to_cpu(*p);
+
+		/* Runs of hash table entries usually point to the same leaf */
+		if (blk == 0 || blk == prev)
+			continue;
+		pf_add(w, blk);
+		prev = blk;
+	}
+}
+
+/* Make the blocks found at the previous level the ones to read next, in
+   block order and without duplicates. */
+static void pf_next_level(struct pf_worker *w)
+{
+	struct pf_list tmp = w->cur;
+	struct pf_list *l = &w->cur;
+	size_t i, n = 0;
+
+	w->cur = w->next;
+	w->next = tmp;
+	w->next.n = 0;
+	if (l->n == 0)
+		return;
+
+	qsort(l->blks, l->n, sizeof(uint64_t), u64cmp);
+	for (i = 1; i < l->n; i++)
+		if (l->blks[i] != l->blks[n])
+			l->blks[++n] = l->blks[i];
+	l->n = n + 1;
+}
+
+static void pf_indirect(struct pf_worker *w, const char *buf)
+{
+	/* Indirect blocks and hash table blocks have the same layout */
+	if (gfs2_check_meta(buf, 0))
+		return;
+	pf_add_ptrs(w, buf + sizeof(struct gfs2_meta_header), buf + w->sdp->bsize);
+}
+
+static void pf_leaf(struct pf_worker *w, const char *buf)
+{
+	const struct gfs2_leaf *lf = (const struct gfs2_leaf *)buf;
+
+	if (gfs2_check_meta(buf, GFS2_METATYPE_LF) == 0 && lf->lf_next)
+		pf_add(w, be64_to_cpu(lf->lf_next));
+}
+
+/* Read the current list of blocks, coalescing contiguous blocks into larger
+   reads, and pass each block that was read to fn */
+static void pf_read_level(struct pf_worker *w,
+			  void (*fn)(struct pf_worker *w, const char *buf))
+{
+	struct gfs2_sbd *sdp = w->sdp;
+	struct pf_list *l = &w->cur;
+	size_t i = 0;
+
+	while (i < l->n) {
+		size_t j, len = 1;
+		ssize_t ret;
+
+		while (i + len < l->n && len < PREFETCH_MAXRUN &&
+		       l->blks[i + len] == l->blks[i] + len)
+			len++;
+		ret = pread(sdp->device_fd, w->buf, len * sdp->bsize,
+			    l->blks[i] * sdp->bsize);
+		for (j = 0; ret > 0 && j < len && (j + 1) * sdp->bsize <= ret; j++)
+			fn(w, w->buf + j * sdp->bsize);
+		i += len;
+	}
+}
+
+static void pf_dir(struct pf_worker *w, uint64_t dirblk)
+{
+	struct gfs2_sbd *sdp = w->sdp;
+	struct gfs2_dinode *di = (struct gfs2_dinode *)w->buf;
+	unsigned height, h;
+
+	w->cur.n = w->next.n = 0;
+	if (pread(sdp->device_fd, w->buf, sdp->bsize, dirblk * sdp->bsize) != sdp->bsize)
+		return;
+	/* A linear directory lives entirely in its dinode block */
+	if (gfs2_check_meta(w->buf, GFS2_METATYPE_DI) ||
+	    !(be32_to_cpu(di->di_flags) & GFS2_DIF_EXHASH))
+		return;
+	/* Leave anything odd-looking for pass2 to sort out */
+	height = be16_to_cpu(di->di_height);
+	if (height > sdp->sd_max_height ||
+	    be16_to_cpu(di->di_depth) > GFS2_DIR_MAX_DEPTH)
+		return;
+
+	pf_add_ptrs(w, w->buf + sizeof(struct gfs2_dinode), w->buf + sdp->bsize);
+	/* Indirect blocks and then the hash table, one height at a time */
+	for (h = 0; h < height; h++) {
+		pf_next_level(w);
+		pf_read_level(w, pf_indirect);
+	}
+	/* The leaf blocks and then each link of the leaf chains */
+	for (h = 0; h < PREFETCH_MAXCHAIN && w->next.n; h++) {
+		pf_next_level(w);
+		pf_read_level(w, pf_leaf);
+	}
+}
+
+static void *pf_thread(void *arg)
+{
+	struct dir_prefetch *dp = arg;
+	struct pf_worker w = { .sdp = dp->sdp, };
+	uint64_t dirblk;
+
+	w.buf = malloc(PREFETCH_MAXRUN * dp->sdp->bsize);
+	if (w.buf == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&dp->lock);
+	while (1) {
+		/* Don't waste time on directories pass2 has already checked */
+		if (dp->next < dp->pos)
+			dp->next = dp->pos;
+		if (dp->stop || dp->next >= dp->ndirs)
+			break;
+		if (dp->next >= dp->pos + PREFETCH_WINDOW) {
+			pthread_cond_wait(&dp->more, &dp->lock);
+			continue;
+		}
+		dirblk = dp->dirs[dp->next++];
+		pthread_mutex_unlock(&dp->lock);
+		pf_dir(&w, dirblk);
+		pthread_mutex_lock(&dp->lock);
+	}
+	pthread_mutex_unlock(&dp->lock);
+
+	free(w.cur.blks);
+	free(w.next.blks);
+	free(w.buf);
+	return NULL;
+}
+
+/**
+ * dir_prefetch_start - start reading ahead of pass2
+ * @sdp: the superblock
+ * @dirs: the tree of directories that pass2 is about to check
+ *
+ * Returns: a handle to pass to dir_prefetch_advance() as pass2 moves along
+ *          and to dir_prefetch_stop() when it is done, or NULL if readahead
+ *          could not be started, which the other functions accept.
+ */
+struct dir_prefetch *dir_prefetch_start(struct gfs2_sbd *sdp,
+					struct osi_root *dirs)
+{
+	struct dir_prefetch *dp;
+	struct osi_node *n;
+	sigset_t all, old;
+	uint64_t count = 0;
+	unsigned i, nthreads;
+	long ncpus;
+
+	/* gfs1 dinodes have a different layout; not worth the trouble. */
+	if (sdp->gfs1)
+		return NULL;
+	/* Leave a cpu for pass2 itself; the readers would only slow it down */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 2)
+		return NULL;
+	nthreads = ncpus - 1 < PREFETCH_THREADS ? ncpus - 1 : PREFETCH_THREADS;
+
+	for (n = osi_first(dirs); n; n = osi_next(n))
+		count++;
+	if (count == 0)
+		return NULL;
+
+	dp = calloc(1, sizeof(*dp));
+	if (dp == NULL)
+		return NULL;
+	/* Take a copy of the directory addresses: pass2 may delete
+	   directories from the tree while the threads are running. */
+	dp->dirs = malloc(count * sizeof(uint64_t));
+	if (dp->dirs == NULL) {
+		free(dp);
+		return NULL;
+	}
+	for (n = osi_first(dirs); n; n = osi_next(n))
+		dp->dirs[dp->ndirs++] = ((struct dir_info *)n)->dinode.no_addr;
+	dp->sdp = sdp;
+	pthread_mutex_init(&dp->lock, NULL);
+	pthread_cond_init(&dp->more, NULL);
+
+	/* Signals, SIGINT in particular, must go to the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&dp->threads[dp->nthreads], NULL, pf_thread, dp))
+			break;
+		dp->nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (dp->nthreads == 0) {
+		dir_prefetch_stop(&dp);
+		return NULL;
+	}
+	log_debug(_("Prefetching %"PRIu64" directories with %u threads\n"),
+		  dp->ndirs, dp->nthreads);
+	return dp;
+}
+
+/**
+ * dir_prefetch_advance - tell the readers where pass2 is up to
+ * @dp: the prefetch handle
+ * @dirblk: the directory pass2 is about to check
+ */
+void dir_prefetch_advance(struct dir_prefetch *dp, uint64_t dirblk)
+{
+	uint64_t cur;
+
+	if (dp == NULL)
+		return;
+
+	/* Only this thread changes dp->cur so it's safe to read unlocked */
+	cur = dp->cur;
+	while (cur < dp->ndirs && dp->dirs[cur] < dirblk)
+		cur++;
+	dp->cur = cur;
+	/* Wake the readers in batches rather than for every directory */
+	if (cur < dp->pos + PREFETCH_WINDOW / 4)
+		return;
+
+	pthread_mutex_lock(&dp->lock);
+	dp->pos = cur;
+	pthread_cond_broadcast(&dp->more);
+	pthread_mutex_unlock(&dp->lock);
+}
+
+/**
+ * dir_prefetch_stop - stop the readers and free the handle
+ * @dpp: pointer to the prefetch handle, which is set to NULL
+ */
+void dir_prefetch_stop(struct dir_prefetch **dpp)
+{
+	struct dir_prefetch *dp = *dpp;
+	unsigned i;
+
+	if (dp == NULL)
+		return;
+
+	pthread_mutex_lock(&dp->lock);
+	dp->stop = 1;
+	pthread_cond_broadcast(&dp->more);
+	pthread_mutex_unlock(&dp->lock);
+	for (i = 0; i < dp->nthreads; i++)
+		pthread_join(dp->threads[i], NULL);
+
+	pthread_cond_destroy(&dp->more);
+	pthread_mutex_destroy(&dp->lock);
+	free(dp->dirs);
+	free(dp);
+	*dpp = NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef __DIR_PREFETCH_H__
+#define __DIR_PREFETCH_H__
+
+#include "libgfs2.h"
+#include "osi_tree.h"
+
+struct dir_prefetch;
+
+extern struct dir_prefetch *dir_prefetch_start(struct gfs2_sbd *sdp,
+					       struct osi_root *dirs);
+extern void dir_prefetch_advance(struct dir_prefetch *dp, uint64_t dirblk);
+extern void dir_prefetch_stop(struct dir_prefetch **dpp);
+
+#endif /* __DIR_PREFETCH_H__ */
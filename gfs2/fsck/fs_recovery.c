@@ -14,6 +14,7 @@
 #include "fs_recovery.h"
 #include "libgfs2.h"
 #include "metawalk.h"
+#include "scope.h"
 #include "util.h"
 
 #define JOURNAL_NAME_SIZE 18
@@ -109,6 +110,7 @@ static void refresh_rgrp(struct gfs2_sbd *sdp, struct rgrp_tree *rgd,
 
 		memcpy(rgd->bits[i].bi_data, bh->b_data, sdp->bsize);
 		rgd->bits[i].bi_modified = 1;
+		rgd->bits[i].bi_summary = 0;
 		if (i == 0) { /* this is the rgrp itself */
 			if (sdp->gfs1)
 				gfs_rgrp_in((struct gfs_rgrp *)&rgd->rg, rgd->bits[0].bi_data);
@@ -171,6 +173,7 @@ static int buf_lo_scan_elements(struct gfs2_inode *ip, unsigned int start,
 			error = -EIO;
 		} else {
 			bmodified(bh_ip);
+			scope_note_block(blkno);
 			rgd = gfs2_blk2rgrpd(sdp, blkno);
 			if (rgd && blkno < rgd->ri.ri_data0)
 				refresh_rgrp(sdp, rgd, bh_ip, blkno);
@@ -288,6 +291,7 @@ static int databuf_lo_scan_elements(struct gfs2_inode *ip, unsigned int start,
 
 		brelse(bh_log);
 		bmodified(bh_ip);
+		scope_note_block(blkno);
 		brelse(bh_ip);
 
 		sd_replayed_jblocks++;
@@ -137,9 +137,13 @@ struct dir_info *dirtree_insert(struct gfs2_inum inum);
 
 struct gfs2_options {
 	char *device;
+	char *stats_file;
+	unsigned int time_limit;
 	unsigned int yes:1;
 	unsigned int no:1;
 	unsigned int query:1;
+	unsigned int stats:1;
+	unsigned int scoped:1;
 };
 
 extern struct gfs2_options opts;
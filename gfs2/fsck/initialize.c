@@ -288,6 +288,7 @@ static void check_rgrp_integrity(struct gfs2_sbd *sdp, struct rgrp_tree *rgd,
 				*byte &= ~(GFS2_BIT_MASK <<
 					   (GFS2_BIT_SIZE * y));
 				rgd->bits[rgb].bi_modified = 1;
+				rgd->bits[rgb].bi_summary = 0;
 				rg_reclaimed++;
 				rg_free++;
 				rgd->rg.rg_free++;
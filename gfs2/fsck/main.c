@@ -1,6 +1,7 @@
 #include "clusterautoconfig.h"
 
 #include <unistd.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -23,6 +24,8 @@
 #include "link.h"
 #include "osi_list.h"
 #include "metawalk.h"
+#include "scope.h"
+#include "stats.h"
 #include "util.h"
 
 struct gfs2_options opts = {0};
@@ -57,7 +60,9 @@ void print_it(const char *label, const char *fmt, const char *fmt2, ...)
 
 static void usage(char *name)
 {
-	printf("Usage: %s [-afhnpqvVy] <device> \n", basename(name));
+	printf("Usage: %s [-afhnpqvVy] [--stats=json --stats-file=<file>]\n"
+	       "       [--rgrps=<block>[,...]|journal] [--time-limit=<seconds>] <device> \n",
+	       basename(name));
 }
 
 static void version(void)
@@ -67,11 +72,26 @@ static void version(void)
 	printf(REDHAT_COPYRIGHT "\n");
 }
 
+enum {
+	OPT_STATS = 256,
+	OPT_STATS_FILE,
+	OPT_RGRPS,
+	OPT_TIME_LIMIT,
+};
+
+static const struct option longopts[] = {
+	{ "stats", required_argument, NULL, OPT_STATS },
+	{ "stats-file", required_argument, NULL, OPT_STATS_FILE },
+	{ "rgrps", required_argument, NULL, OPT_RGRPS },
+	{ "time-limit", required_argument, NULL, OPT_TIME_LIMIT },
+	{ NULL, 0, NULL, 0 }
+};
+
 static int read_cmdline(int argc, char **argv, struct gfs2_options *gopts)
 {
 	int c;
 
-	while ((c = getopt(argc, argv, "afhnpqvyV")) != -1) {
+	while ((c = getopt_long(argc, argv, "afhnpqvyV", longopts, NULL)) != -1) {
 		switch(c) {
 
 		case 'a':
@@ -114,6 +134,32 @@ static int read_cmdline(int argc, char **argv, struct gfs2_options *gopts)
 			}
 			gopts->yes = 1;
 			break;
+		case OPT_STATS:
+			if (strcmp(optarg, "json")) {
+				fprintf(stderr, _("Unsupported statistics format '%s'\n"), optarg);
+				return FSCK_USAGE;
+			}
+			gopts->stats = 1;
+			break;
+		case OPT_STATS_FILE:
+			gopts->stats = 1;
+			gopts->stats_file = optarg;
+			break;
+		case OPT_RGRPS:
+			if (scope_parse(optarg))
+				return FSCK_USAGE;
+			gopts->scoped = 1;
+			break;
+		case OPT_TIME_LIMIT: {
+			char *end;
+
+			gopts->time_limit = strtoul(optarg, &end, 10);
+			if (*end != '\0' || end == optarg || gopts->time_limit == 0) {
+				fprintf(stderr, _("Invalid time limit '%s'\n"), optarg);
+				return FSCK_USAGE;
+			}
+			break;
+		}
 		case ':':
 		case '?':
 			fprintf(stderr, _("Please use '-h' for help.\n"));
@@ -124,6 +170,14 @@ static int read_cmdline(int argc, char **argv, struct gfs2_options *gopts)
 
 		}
 	}
+	if (gopts->stats && gopts->stats_file == NULL) {
+		fprintf(stderr, _("--stats=json needs --stats-file to write the report to\n"));
+		return FSCK_USAGE;
+	}
+	if (gopts->time_limit && !gopts->scoped) {
+		fprintf(stderr, _("--time-limit may only be used with --rgrps\n"));
+		return FSCK_USAGE;
+	}
 	if (argc > optind) {
 		gopts->device = (argv[optind]);
 		if (!gopts->device) {
@@ -251,6 +305,15 @@ static const struct fsck_pass passes[] = {
 	{ .name = NULL, }
 };
 
+static int scoped_check(struct gfs2_sbd *sdp)
+{
+	return scope_check(sdp, opts.time_limit);
+}
+
+static const struct fsck_pass scoped_pass = {
+	.name = "scoped check", .f = scoped_check
+};
+
 static int fsck_pass(const struct fsck_pass *p, struct gfs2_sbd *sdp)
 {
 	int ret;
@@ -263,9 +326,11 @@ static int fsck_pass(const struct fsck_pass *p, struct gfs2_sbd *sdp)
 	log_notice( _("Starting %s\n"), p->name);
 	gettimeofday(&timer, NULL);
 
+	fsck_stats_pass_start(p->name);
 	ret = p->f(sdp);
 	if (ret)
 		exit(ret);
+	fsck_stats_pass_end(skip_this_pass || fsck_abort);
 	if (skip_this_pass || fsck_abort) {
 		skip_this_pass = 0;
 		log_notice( _("%s interrupted   \n"), p->name);
@@ -329,9 +394,14 @@ int main(int argc, char **argv)
 	if ((error = read_cmdline(argc, argv, &opts)))
 		exit(error);
 	setbuf(stdout, NULL);
+	if (opts.stats && fsck_stats_init(sdp, opts.stats_file))
+		exit(FSCK_ERROR);
 	log_notice( _("Initializing fsck\n"));
+	fsck_stats_pass_start("initialize");
 	if ((error = initialize(sdp, force_check, preen, &all_clean)))
 		exit(error);
+	fsck_stats_pass_end(0);
+	fsck_stats_rgrps(sdp);
 
 	if (!force_check && all_clean && preen) {
 		log_err( _("%s: clean.\n"), opts.device);
@@ -341,8 +411,12 @@ int main(int argc, char **argv)
 
 	sigaction(SIGINT, &act, NULL);
 
-	for (i = 0; passes[i].name; i++)
-		error = fsck_pass(passes + i, sdp);
+	if (opts.scoped)
+		error = fsck_pass(&scoped_pass, sdp);
+	else {
+		for (i = 0; passes[i].name; i++)
+			error = fsck_pass(passes + i, sdp);
+	}
 
 	/* Free up our system inodes */
 	if (!sdp->gfs1)
@@ -18,6 +18,7 @@
 #include "osi_tree.h"
 #include "fsck.h"
 #include "util.h"
+#include "stats.h"
 #include "metawalk.h"
 #include "inode_hash.h"
 
@@ -275,8 +276,12 @@ struct gfs2_inode *fsck_load_inode(struct gfs2_sbd *sdp, uint64_t block)
 	if (ip)
 		return ip;
 	if (sdp->gfs1)
-		return lgfs2_gfs_inode_read(sdp, block);
-	return lgfs2_inode_read(sdp, block);
+		ip = lgfs2_gfs_inode_read(sdp, block);
+	else
+		ip = lgfs2_inode_read(sdp, block);
+	if (ip)
+		fsck_stats_inode(ip);
+	return ip;
 }
 
 /* fsck_inode_get - same as inode_get() in libgfs2 but system inodes
@@ -295,8 +300,10 @@ struct gfs2_inode *fsck_inode_get(struct gfs2_sbd *sdp, struct rgrp_tree *rgd,
 		ip = lgfs2_gfs_inode_get(sdp, bh->b_data);
 	else
 		ip = lgfs2_inode_get(sdp, bh);
-	if (ip)
+	if (ip) {
 		ip->i_rgd = rgd;
+		fsck_stats_inode(ip);
+	}
 	return ip;
 }
 
@@ -379,6 +386,7 @@ static void dirblk_truncate(struct gfs2_inode *ip, struct gfs2_dirent *fixb,
 	de.de_rec_len = bh_end - (char *)fixb;
 	gfs2_dirent_out(&de, (char *)fixb);
 	bmodified(bh);
+	lgfs2_dir_index_drop(ip);
 }
 
 /*
@@ -400,6 +408,8 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 {
 	struct gfs2_dirent *dent;
 	struct gfs2_dirent de, *prev;
+	uint64_t no_addr, no_formal_ino;
+	uint16_t rec_len, name_len;
 	int error = 0;
 	char *bh_end;
 	char *filename;
@@ -419,17 +429,24 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 	prev = NULL;
 	if (!pass->check_dentry)
 		return 0;
+	/* The dirents are changed in place here and by check_dentry, so
+	   names indexed for the directory can't be trusted while it's
+	   being checked */
+	lgfs2_dir_index_drop(ip);
 
 	while (1) {
 		if (skip_this_pass || fsck_abort)
 			return FSCK_OK;
-		memset(&de, 0, sizeof(struct gfs2_dirent));
-		gfs2_dirent_in(&de, (char *)dent);
+		/* Only the few fields needed are read from the buffer
+		   rather than converting every dirent */
+		no_addr = lgfs2_get_de_inum_addr((char *)dent);
+		no_formal_ino = lgfs2_get_de_inum_formal_ino((char *)dent);
+		rec_len = lgfs2_get_de_rec_len((char *)dent);
+		name_len = lgfs2_get_de_name_len((char *)dent);
 		filename = (char *)dent + sizeof(struct gfs2_dirent);
 
-		if (de.de_rec_len < sizeof(struct gfs2_dirent) +
-		    de.de_name_len ||
-		    (de.de_inum.no_formal_ino && !de.de_name_len && !first)) {
+		if (rec_len < sizeof(struct gfs2_dirent) + name_len ||
+		    (no_formal_ino && !name_len && !first)) {
 			log_err( _("Directory block %llu (0x%llx"
 				"), entry %d of directory %llu "
 				"(0x%llx) is corrupt.\n"),
@@ -439,6 +456,8 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 				(unsigned long long)ip->i_di.di_num.no_addr,
 				(unsigned long long)ip->i_di.di_num.no_addr);
 			if (query( _("Attempt to repair it? (y/n) "))) {
+				gfs2_dirent_in(&de, (char *)dent);
+				lgfs2_dir_index_drop(ip);
 				if (dirent_repair(ip, bh, &de, dent, type,
 						  first)) {
 					if (first) /* make a new sentinel */
@@ -453,6 +472,7 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 				} else {
 					log_err( _("Corrupt directory entry "
 						   "repaired.\n"));
+					rec_len = de.de_rec_len;
 					/* keep looping through dentries */
 				}
 			} else {
@@ -462,7 +482,7 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 				return 0;
 			}
 		}
-		if (!de.de_inum.no_formal_ino){
+		if (!no_formal_ino){
 			if (first){
 				log_debug( _("First dirent is a sentinel (place holder).\n"));
 				first = 0;
@@ -487,13 +507,13 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 				return 0;
 			}
 		} else {
-			if (!de.de_inum.no_addr && first) { /* reverse sentinel */
+			if (!no_addr && first) { /* reverse sentinel */
 				log_debug( _("First dirent is a Sentinel (place holder).\n"));
 				/* Swap the two to silently make it a proper sentinel */
-				de.de_inum.no_addr = de.de_inum.no_formal_ino;
-				de.de_inum.no_formal_ino = 0;
-				gfs2_dirent_out(&de, (char *)dent);
+				lgfs2_set_de_inum_addr((char *)dent, no_formal_ino);
+				lgfs2_set_de_inum_formal_ino((char *)dent, 0);
 				bmodified(bh);
+				lgfs2_dir_index_drop(ip);
 				/* Mark dirent buffer as modified */
 				first = 0;
 			} else {
@@ -501,6 +521,7 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 							   filename, count,
 							   &lindex,
 							   pass->private);
+				lgfs2_dir_index_drop(ip);
 				if (error < 0) {
 					stack;
 					return error;
@@ -508,7 +529,7 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 			}
 		}
 
-		if ((char *)dent + de.de_rec_len >= bh_end){
+		if ((char *)dent + rec_len >= bh_end){
 			log_debug( _("Last entry processed for %lld->%lld "
 				     "(0x%llx->0x%llx), di_blocks=%llu.\n"),
 				   (unsigned long long)ip->i_di.di_num.no_addr,
@@ -524,7 +545,7 @@ static int check_entries(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 		if (!error || first)
 			prev = dent;
 		first = 0;
-		dent = (struct gfs2_dirent *)((char *)dent + de.de_rec_len);
+		dent = (struct gfs2_dirent *)((char *)dent + rec_len);
 	}
 	return 0;
 }
@@ -540,6 +561,7 @@ int check_leaf(struct gfs2_inode *ip, int lindex, struct metawalk_fxns *pass,
 	int error = 0, fix;
 	struct gfs2_buffer_head *lbh = NULL;
 	uint32_t count = 0;
+	uint64_t leaf_next;
 	struct gfs2_sbd *sdp = ip->i_sbd;
 	const char *msg;
 	int di_depth = ip->i_di.di_depth;
@@ -564,6 +586,11 @@ int check_leaf(struct gfs2_inode *ip, int lindex, struct metawalk_fxns *pass,
 		msg = _("that is not really a leaf");
 		goto bad_leaf;
 	}
+	/* Start reading the next leaf of a chain while this one is checked */
+	leaf_next = be64_to_cpu(((struct gfs2_leaf *)lbh->b_data)->lf_next);
+	if (leaf_next && valid_block_ip(ip, leaf_next))
+		posix_fadvise(sdp->device_fd, leaf_next * sdp->bsize,
+			      sdp->bsize, POSIX_FADV_WILLNEED);
 	if (pass->check_leaf_depth)
 		error = pass->check_leaf_depth(ip, *leaf_no, *ref_count, lbh);
 
@@ -696,22 +723,52 @@ static int u64cmp(const void *p1, const void *p2)
 	return 0;
 }
 
+/**
+ * reada_blocks - start reading a list of blocks into the cache
+ * The list is sorted and each run of adjacent blocks is requested with a
+ * single readahead, which the kernel can service with large asynchronous
+ * reads while we get on with checking.
+ */
+static void reada_blocks(struct gfs2_sbd *sdp, uint64_t *blks, unsigned n)
+{
+	unsigned i, start;
+
+	qsort(blks, n, sizeof(uint64_t), u64cmp);
+	for (i = 0; i < n; i++) {
+		start = i;
+		while (i + 1 < n && blks[i + 1] - blks[i] <= 1)
+			i++;
+		posix_fadvise(sdp->device_fd, blks[start] * sdp->bsize,
+			      (blks[i] - blks[start] + 1) * sdp->bsize,
+			      POSIX_FADV_WILLNEED);
+	}
+}
+
+/**
+ * dir_leaf_reada - start reading a directory's leaf blocks into the cache
+ * Hash table entries are mostly runs of pointers to the same leaf, so those
+ * are collapsed first.
+ */
 static void dir_leaf_reada(struct gfs2_inode *ip, uint64_t *tbl, unsigned hsize)
 {
-	uint64_t *t = alloca(hsize * sizeof(uint64_t));
-	uint64_t leaf_no;
-	struct gfs2_sbd *sdp = ip->i_sbd;
+	uint64_t leaf_no, prev = 0;
+	uint64_t *t;
 	unsigned n = 0;
 	unsigned i;
 
+	t = malloc(hsize * sizeof(uint64_t));
+	if (t == NULL)
+		return;
 	for (i = 0; i < hsize; i++) {
 		leaf_no = be64_to_cpu(tbl[i]);
+		if (leaf_no == prev)
+			continue;
+		prev = leaf_no;
 		if (valid_block_ip(ip, leaf_no))
-			t[n++] = leaf_no * sdp->bsize;
+			t[n++] = leaf_no;
 	}
-	qsort(t, n, sizeof(uint64_t), u64cmp);
-	for (i = 0; i < n; i++)
-		posix_fadvise(sdp->device_fd, t[i], sdp->bsize, POSIX_FADV_WILLNEED);
+	reada_blocks(ip->i_sbd, t, n);
+	free(t);
 }
 
 /* Checks exhash directory entries */
@@ -1156,59 +1213,57 @@ static void free_metalist(struct gfs2_inode *ip, osi_list_t *mlp)
 				brelse(nbh);
 		}
 	}
+	/* The walk may have changed the tree through its own buffers */
+	lgfs2_mpcache_drop(ip);
 }
 
-static void file_ra(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
-		    int head_size, int maxptrs, int h)
+#define METALIST_RA_MAX (65536) /* Pointers to collect before reading */
+
+/**
+ * metalist_ra - start reading the next level of a metadata tree
+ * @list: the buffers at the current level
+ *
+ * Gathers the pointers from every block at one height so that the whole of
+ * the next height is requested in as few large reads as possible, instead of
+ * seeking for each indirect block as it is checked.
+ */
+static void metalist_ra(struct gfs2_inode *ip, osi_list_t *list,
+			int head_size, int iblk_type)
 {
 	struct gfs2_sbd *sdp = ip->i_sbd;
-	uint64_t *p, sblock = 0, block;
-	int extlen = 0;
-
-	if (h + 2 == ip->i_di.di_height) {
-		p = (uint64_t *)(bh->b_data + head_size);
-		if (*p && *(p + 1)) {
-			sblock = be64_to_cpu(*p);
-			p++;
-			block = be64_to_cpu(*p);
-			extlen = block - sblock;
-			if (extlen > 1 && extlen <= maxptrs) {
-				posix_fadvise(sdp->device_fd,
-					      sblock * sdp->bsize,
-					      (extlen + 1) * sdp->bsize,
-					      POSIX_FADV_WILLNEED);
-				return;
-			}
-		}
-		extlen = 0;
-	}
-	for (p = (uint64_t *)(bh->b_data + head_size);
-	     p < (uint64_t *)(bh->b_data + sdp->bsize); p++) {
-		if (*p) {
-			if (!sblock) {
-				sblock = be64_to_cpu(*p);
-				extlen = 1;
-				continue;
-			}
+	struct gfs2_buffer_head *bh;
+	osi_list_t *tmp;
+	uint64_t *blks, *p, block;
+	unsigned n = 0, max = 0;
+
+	/* Room for every pointer at this level, up to METALIST_RA_MAX */
+	for (tmp = list->next; tmp != list && max < METALIST_RA_MAX; tmp = tmp->next)
+		max += (sdp->bsize - head_size) / sizeof(uint64_t);
+	if (max == 0)
+		return;
+	if (max > METALIST_RA_MAX)
+		max = METALIST_RA_MAX;
+	blks = malloc(max * sizeof(uint64_t));
+	if (blks == NULL)
+		return;
+	for (tmp = list->next; tmp != list; tmp = tmp->next) {
+		bh = osi_list_entry(tmp, struct gfs2_buffer_head, b_altlist);
+		if (gfs2_check_meta(bh->b_data, iblk_type))
+			continue;
+		for (p = (uint64_t *)(bh->b_data + head_size);
+		     p < (uint64_t *)(bh->b_data + sdp->bsize); p++) {
 			block = be64_to_cpu(*p);
-			if (block == sblock + extlen) {
-				extlen++;
+			if (block == 0 || !valid_block_ip(ip, block))
 				continue;
+			blks[n++] = block;
+			if (n == max) {
+				reada_blocks(sdp, blks, n);
+				n = 0;
 			}
 		}
-		if (extlen && sblock) {
-			if (extlen > 1)
-				extlen--;
-			posix_fadvise(sdp->device_fd, sblock * sdp->bsize,
-				      extlen * sdp->bsize,
-				      POSIX_FADV_WILLNEED);
-			extlen = 0;
-			p--;
-		}
 	}
-	if (extlen)
-		posix_fadvise(sdp->device_fd, sblock * sdp->bsize,
-			      extlen * sdp->bsize, POSIX_FADV_WILLNEED);
+	reada_blocks(sdp, blks, n);
+	free(blks);
 }
 
 static int do_check_metalist(struct iptr iptr, int height, struct gfs2_buffer_head **bhp,
@@ -1278,7 +1333,6 @@ static int build_and_check_metalist(struct gfs2_inode *ip, osi_list_t *mlp,
 	struct iptr iptr = { .ipt_ip = ip, 0};
 	int h, head_size, iblk_type;
 	uint64_t *undoptr;
-	int maxptrs;
 	int error;
 
 	osi_list_add(&metabh->b_altlist, &mlp[0]);
@@ -1301,22 +1355,19 @@ static int build_and_check_metalist(struct gfs2_inode *ip, osi_list_t *mlp,
 				iblk_type = GFS2_METATYPE_JD;
 			else
 				iblk_type = GFS2_METATYPE_IN;
-			if (ip->i_sbd->gfs1) {
+			if (ip->i_sbd->gfs1)
 				head_size = sizeof(struct gfs_indirect);
-				maxptrs = (ip->i_sbd->bsize - head_size) /
-					sizeof(uint64_t);
-			} else {
+			else
 				head_size = sizeof(struct gfs2_meta_header);
-				maxptrs = ip->i_sbd->sd_inptrs;
-			}
 		} else {
 			iblk_type = GFS2_METATYPE_DI;
 			head_size = sizeof(struct gfs2_dinode);
-			maxptrs = ip->i_sbd->sd_diptrs;
 		}
 		prev_list = &mlp[h - 1];
 		cur_list = &mlp[h];
 
+		if (pass->readahead)
+			metalist_ra(ip, prev_list, head_size, iblk_type);
 		for (tmp = prev_list->next; tmp != prev_list; tmp = tmp->next) {
 			iptr.ipt_off = head_size;
 			iptr.ipt_bh = osi_list_entry(tmp, struct gfs2_buffer_head, b_altlist);
@@ -1327,9 +1378,6 @@ static int build_and_check_metalist(struct gfs2_inode *ip, osi_list_t *mlp,
 
 				continue;
 			}
-			if (pass->readahead)
-				file_ra(ip, iptr.ipt_bh, head_size, maxptrs, h);
-
 			/* Now check the metadata itself */
 			for (; iptr.ipt_off < ip->i_sbd->bsize; iptr.ipt_off += sizeof(uint64_t)) {
 				struct gfs2_buffer_head *nbh = NULL;
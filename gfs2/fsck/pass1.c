@@ -176,6 +176,7 @@ static int pass1_repair_leaf(struct gfs2_inode *ip, uint64_t *leaf_no,
 	else
 		gfs2_writei(ip, padbuf, lindex * sizeof(uint64_t), pad_size);
 	free(padbuf);
+	lgfs2_dir_index_drop(ip);
 	log_err( _("Directory Inode %llu (0x%llx) patched.\n"),
 		 (unsigned long long)ip->i_di.di_num.no_addr,
 		 (unsigned long long)ip->i_di.di_num.no_addr);
@@ -404,6 +405,7 @@ static int pass1_check_metalist(struct iptr iptr, struct gfs2_buffer_head **bh,
 		if (query(_("Zero the indirect block pointer? (y/n) "))){
 			*iptr_ptr(iptr) = 0;
 			bmodified(iptr.ipt_bh);
+			lgfs2_mpcache_drop(ip);
 			*is_valid = 1;
 			return META_SKIP_ONE;
 		} else {
@@ -1609,50 +1611,66 @@ static void check_i_goal(struct gfs2_sbd *sdp, struct gfs2_inode *ip)
 /*
  * handle_di - This is now a wrapper function that takes a gfs2_buffer_head
  *             and calls handle_ip, which takes an in-code dinode structure.
+ *             The inode address is checked and fixed in the buffer before
+ *             the inode is read from it.
  */
 static int handle_di(struct gfs2_sbd *sdp, struct rgrp_tree *rgd,
 		     struct gfs2_buffer_head *bh)
 {
 	int error = 0;
 	uint64_t block = bh->b_blocknr;
+	uint64_t no_addr = lgfs2_get_di_num_addr(bh->b_data);
+	uint64_t no_formal_ino = lgfs2_get_di_num_formal_ino(bh->b_data);
 	struct gfs2_inode *ip;
+	int fixed = 0;
 
-	ip = fsck_inode_get(sdp, rgd, bh);
-
-	if (ip->i_di.di_num.no_addr != block) {
+	if (no_addr != block) {
 		log_err( _("Inode #%llu (0x%llx): Bad inode address found: %llu "
 			"(0x%llx)\n"), (unsigned long long)block,
 			(unsigned long long)block,
-			(unsigned long long)ip->i_di.di_num.no_addr,
-			(unsigned long long)ip->i_di.di_num.no_addr);
+			(unsigned long long)no_addr,
+			(unsigned long long)no_addr);
 		if (query( _("Fix address in inode at block #%llu"
 			    " (0x%llx)? (y/n) "),
 			  (unsigned long long)block, (unsigned long long)block)) {
-			ip->i_di.di_num.no_addr = ip->i_di.di_num.no_formal_ino = block;
-			bmodified(ip->i_bh);
+			lgfs2_set_di_num_addr(bh->b_data, block);
+			lgfs2_set_di_num_formal_ino(bh->b_data, block);
+			no_formal_ino = block;
+			bmodified(bh);
+			fixed = 1;
 		} else
 			log_err( _("Address in inode at block #%llu"
 				 " (0x%llx) not fixed\n"),
 				(unsigned long long)block,
 				(unsigned long long)block);
 	}
-	if (sdp->gfs1 && ip->i_di.di_num.no_formal_ino != block) {
+	if (sdp->gfs1 && no_formal_ino != block) {
 		log_err( _("Inode #%llu (0x%llx): GFS1 formal inode number "
 			   "mismatch: was %llu (0x%llx)\n"),
 			 (unsigned long long)block, (unsigned long long)block,
-			 (unsigned long long)ip->i_di.di_num.no_formal_ino,
-			 (unsigned long long)ip->i_di.di_num.no_formal_ino);
+			 (unsigned long long)no_formal_ino,
+			 (unsigned long long)no_formal_ino);
 		if (query( _("Fix formal inode number in inode #%llu"
 			    " (0x%llx)? (y/n) "), (unsigned long long)block,
 			   (unsigned long long)block)) {
-			ip->i_di.di_num.no_formal_ino = block;
-			bmodified(ip->i_bh);
+			lgfs2_set_di_num_formal_ino(bh->b_data, block);
+			bmodified(bh);
+			fixed = 1;
 		} else
 			log_err( _("Inode number in inode at block #%lld "
 				   "(0x%llx) not fixed\n"),
 				 (unsigned long long)block,
 				 (unsigned long long)block);
 	}
+	ip = fsck_inode_get(sdp, rgd, bh);
+	if (fixed) {
+		/* A system inode comes from its cached copy, which wasn't read
+		   from the fixed buffer */
+		ip->i_di.di_num.no_addr = lgfs2_get_di_num_addr(bh->b_data);
+		ip->i_di.di_num.no_formal_ino = lgfs2_get_di_num_formal_ino(bh->b_data);
+		if (ip->i_bh != NULL)
+			bmodified(ip->i_bh);
+	}
 	check_i_goal(sdp, ip);
 	error = handle_ip(sdp, ip);
 	fsck_inode_put(&ip);
@@ -2173,14 +2191,14 @@ int pass1(struct gfs2_sbd *sdp)
 	addl_mem_needed = link1_create(&nlink1map, last_fs_block+1);
 	if (addl_mem_needed) {
 		enomem(addl_mem_needed);
-		gfs2_bmap_destroy(sdp, bl);
+		bl = gfs2_bmap_destroy(sdp, bl);
 		return FSCK_ERROR;
 	}
 	addl_mem_needed = link1_create(&clink1map, last_fs_block+1);
 	if (addl_mem_needed) {
 		enomem(addl_mem_needed);
 		link1_destroy(&nlink1map);
-		gfs2_bmap_destroy(sdp, bl);
+		bl = gfs2_bmap_destroy(sdp, bl);
 		return FSCK_ERROR;
 	}
 	osi_list_init(&gfs1_rindex_blks.list);
@@ -2238,6 +2256,6 @@ int pass1(struct gfs2_sbd *sdp)
 out:
 	gfs2_special_free(&gfs1_rindex_blks);
 	if (bl)
-		gfs2_bmap_destroy(sdp, bl);
+		bl = gfs2_bmap_destroy(sdp, bl);
 	return ret;
 }
@@ -449,6 +449,7 @@ static int clone_data(struct gfs2_inode *ip, uint64_t metablock,
 				/* Now fix the reference: */
 				*ptr = cpu_to_be64(cloneblock);
 				bmodified(bh);
+				lgfs2_mpcache_drop(ip);
 				log_err(_("Duplicate reference to block %lld "
 					  "(0x%llx) was cloned to block %lld "
 					  "(0x%llx).\n"),
@@ -469,6 +470,7 @@ static int clone_data(struct gfs2_inode *ip, uint64_t metablock,
 		}
 		*ptr = 0;
 		bmodified(bh);
+		lgfs2_mpcache_drop(ip);
 		log_err(_("Duplicate reference to block %lld (0x%llx) was "
 			  "zeroed.\n"),
 			(unsigned long long)block,
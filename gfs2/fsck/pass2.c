@@ -18,6 +18,7 @@
 #include "lost_n_found.h"
 #include "inode_hash.h"
 #include "afterpass1_common.h"
+#include "dir_prefetch.h"
 
 #define MAX_FILENAME 256
 
@@ -1086,6 +1087,7 @@ static int write_new_leaf(struct gfs2_inode *dip, int start_lindex,
 		count = gfs2_writei(dip, padbuf, start_lindex *
 				    sizeof(uint64_t), pad_size);
 	free(padbuf);
+	lgfs2_dir_index_drop(dip);
 	if (count != pad_size) {
 		log_err( _("Error: bad write while fixing directory leaf "
 			   "pointers.\n"));
@@ -2208,8 +2210,9 @@ int pass2(struct gfs2_sbd *sdp)
 	struct osi_node *tmp, *next = NULL;
 	struct gfs2_inode *ip;
 	struct dir_info *dt;
+	struct dir_prefetch *dp;
 	uint64_t dirblk;
-	int error;
+	int error = FSCK_OK;
 
 	/* Check all the system directory inodes. */
 	if (!sdp->gfs1 &&
@@ -2240,6 +2243,8 @@ int pass2(struct gfs2_sbd *sdp)
 	if (skip_this_pass || fsck_abort) /* if asked to skip the rest */
 		return FSCK_OK;
 	log_info( _("Checking directory inodes.\n"));
+	/* Read the directories in the background while we check them */
+	dp = dir_prefetch_start(sdp, &dirtree);
 	/* Grab each directory inode, and run checks on it */
 	for (tmp = osi_first(&dirtree); tmp; tmp = next) {
 		next = osi_next(tmp);
@@ -2248,7 +2253,7 @@ int pass2(struct gfs2_sbd *sdp)
 		dirblk = dt->dinode.no_addr;
 		warm_fuzzy_stuff(dirblk);
 		if (skip_this_pass || fsck_abort) /* if asked to skip the rest */
-			return FSCK_OK;
+			break;
 
 		/* Skip the system inodes - they're checked above */
 		if (is_system_dir(sdp, dirblk))
@@ -2265,21 +2270,26 @@ int pass2(struct gfs2_sbd *sdp)
 		log_debug(_("Checking directory inode at block %llu (0x%llx)\n"),
 			  (unsigned long long)dirblk, (unsigned long long)dirblk);
 
+		dir_prefetch_advance(dp, dirblk);
 		ip = fsck_load_inode(sdp, dirblk);
 		if (ip == NULL) {
 			stack;
-			return FSCK_ERROR;
+			error = FSCK_ERROR;
+			break;
 		}
 		error = pass2_check_dir(sdp, ip);
 		fsck_inode_put(&ip);
 
-		if (skip_this_pass || fsck_abort)
-			return FSCK_OK;
+		if (skip_this_pass || fsck_abort) {
+			error = FSCK_OK;
+			break;
+		}
 
 		if (error != FSCK_OK) {
 			stack;
-			return error;
+			break;
 		}
 	}
-	return FSCK_OK;
+	dir_prefetch_stop(&dp);
+	return error;
 }
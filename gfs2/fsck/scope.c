@@ -0,0 +1,476 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <libintl.h>
+#define _(String) gettext(String)
+
+#include <logging.h>
+#include "libgfs2.h"
+#include "fsck.h"
+#include "util.h"
+#include "scope.h"
+
+/*
+ * Scoped checking, for when a full check would take too long, e.g. after a
+ * single node has crashed. Only the resource groups selected with --rgrps are
+ * checked: those containing the blocks listed, and/or those that the replayed
+ * journals wrote to. The bitmaps of each one are checked against its
+ * counters, each dinode in it is read and each block the dinode references,
+ * in whichever resource group, must be marked in use. The check stops when
+ * the --time-limit runs out and the selected regions that were not reached
+ * are listed at the end.
+ *
+ * Nothing outside the selected resource groups is looked at, so it can't be
+ * known whether blocks marked in use are referenced at all, or by more than
+ * one dinode. For the same reason nothing is repaired: any problem found
+ * means a full check is needed.
+ */
+
+struct blk_list {
+	uint64_t *blks;
+	size_t n;
+	size_t max;
+};
+
+struct scope {
+	struct gfs2_sbd *sdp;
+	time_t deadline;
+	uint64_t dinodes;
+	int errors;
+};
+
+static struct blk_list selected; /* Blocks given with --rgrps */
+static struct blk_list replayed; /* Blocks written by journal replay */
+static int by_journal = 0;
+
+static int list_add(struct blk_list *l, uint64_t blk)
+{
+	if (l->n == l->max) {
+		size_t max = l->max ? l->max * 2 : 64;
+		uint64_t *blks = realloc(l->blks, max * sizeof(*blks));
+
+		if (blks == NULL)
+			return -1;
+		l->blks = blks;
+		l->max = max;
+	}
+	l->blks[l->n++] = blk;
+	return 0;
+}
+
+static int u64cmp(const void *p1, const void *p2)
+{
+	uint64_t a = *(uint64_t *)p1;
+	uint64_t b = *(uint64_t *)p2;
+
+	if (a > b)
+		return 1;
+	if (a < b)
+		return -1;
+
+	return 0;
+}
+
+static void list_sort_unique(struct blk_list *l)
+{
+	size_t i, n = 0;
+
+	if (l->n == 0)
+		return;
+	qsort(l->blks, l->n, sizeof(uint64_t), u64cmp);
+	for (i = 1; i < l->n; i++)
+		if (l->blks[i] != l->blks[n])
+			l->blks[++n] = l->blks[i];
+	l->n = n + 1;
+}
+
+/**
+ * scope_parse - parse the argument to --rgrps
+ * @arg: a comma-separated list of block numbers, each selecting the resource
+ *       group that contains it, and/or "journal" to select the resource
+ *       groups written to by journal replay
+ *
+ * Returns: 0 on success or -1 if the list is not valid
+ */
+int scope_parse(const char *arg)
+{
+	char *str, *tok, *save = NULL;
+	int ret = 0;
+
+	str = strdup(arg);
+	if (str == NULL)
+		return -1;
+	for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		unsigned long long blk;
+		char *end;
+
+		if (strcmp(tok, "journal") == 0) {
+			by_journal = 1;
+			continue;
+		}
+		blk = strtoull(tok, &end, 0);
+		if (*end != '\0' || end == tok || list_add(&selected, blk)) {
+			fprintf(stderr, _("Invalid resource group '%s'\n"), tok);
+			ret = -1;
+			break;
+		}
+	}
+	free(str);
+	if (ret == 0 && !by_journal && selected.n == 0) {
+		fprintf(stderr, _("No resource groups specified\n"));
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Called by journal replay for each block it writes */
+void scope_note_block(uint64_t blk)
+{
+	if (by_journal)
+		list_add(&replayed, blk);
+}
+
+static int scope_error(struct scope *sc)
+{
+	sc->errors++;
+	errors_found++;
+	return -1;
+}
+
+/* A block referenced by a dinode must be in range and marked in use */
+static int check_ref(struct scope *sc, uint64_t owner, uint64_t blk,
+		     const char *what)
+{
+	int q;
+
+	if (!valid_block(sc->sdp, blk)) {
+		log_err(_("Dinode %"PRIu64" (0x%"PRIx64") references %s block "
+			  "%"PRIu64" (0x%"PRIx64") which is out of range.\n"),
+			owner, owner, what, blk, blk);
+		return scope_error(sc);
+	}
+	q = lgfs2_get_bitmap(sc->sdp, blk, NULL);
+	if (q != GFS2_BLKST_USED) {
+		log_err(_("Dinode %"PRIu64" (0x%"PRIx64") references %s block "
+			  "%"PRIu64" (0x%"PRIx64") which is marked %s in the "
+			  "bitmap.\n"), owner, owner, what, blk, blk,
+			block_type_string(q));
+		return scope_error(sc);
+	}
+	return 0;
+}
+
+static struct gfs2_buffer_head *read_meta(struct scope *sc, uint64_t owner,
+					  uint64_t blk, int mtype, const char *what)
+{
+	struct gfs2_buffer_head *bh = bread(sc->sdp, blk);
+
+	if (bh == NULL) {
+		scope_error(sc);
+		return NULL;
+	}
+	if (gfs2_check_meta(bh->b_data, mtype)) {
+		log_err(_("Dinode %"PRIu64" (0x%"PRIx64") references %s block "
+			  "%"PRIu64" (0x%"PRIx64") which is not a %s block.\n"),
+			owner, owner, what, blk, blk, what);
+		scope_error(sc);
+		brelse(bh);
+		return NULL;
+	}
+	return bh;
+}
+
+/* Check the non-zero pointers in a block and add them to l if they are to be
+   read in turn */
+static void check_ptrs(struct scope *sc, uint64_t owner, const char *start,
+		       const char *end, const char *what, struct blk_list *l)
+{
+	const __be64 *p;
+	uint64_t prev = 0;
+
+	for (p = (const __be64 *)start; p < (const __be64 *)end; p++) {
+		uint64_t blk = be64_to_cpu(*p);
+
+		/* Hash tables have runs of pointers to the same leaf */
+		if (blk == 0 || blk == prev)
+			continue;
+		prev = blk;
+		if (check_ref(sc, owner, blk, what) == 0 && l != NULL)
+			list_add(l, blk);
+	}
+}
+
+static void check_leaves(struct scope *sc, struct gfs2_dinode *di,
+			 struct blk_list *leaves)
+{
+	uint64_t owner = di->di_num.no_addr;
+	size_t i;
+
+	list_sort_unique(leaves);
+	for (i = 0; i < leaves->n; i++) {
+		uint64_t blk = leaves->blks[i];
+		uint64_t chain;
+
+		/* Leaf chains can't be longer than the directory */
+		for (chain = 0; blk && chain < di->di_blocks; chain++) {
+			struct gfs2_buffer_head *bh;
+			struct gfs2_leaf *lf;
+
+			bh = read_meta(sc, owner, blk, GFS2_METATYPE_LF, "leaf");
+			if (bh == NULL)
+				break;
+			lf = (struct gfs2_leaf *)bh->b_data;
+			blk = be64_to_cpu(lf->lf_next);
+			brelse(bh);
+			if (blk && check_ref(sc, owner, blk, "leaf"))
+				break;
+		}
+	}
+}
+
+/**
+ * check_tree - check the blocks referenced by a dinode
+ * The tree is read one height at a time. Data blocks are not read, except for
+ * the hash table of a directory, which points to its leaf blocks.
+ */
+static void check_tree(struct scope *sc, struct gfs2_buffer_head *dibh,
+		       struct gfs2_dinode *di)
+{
+	struct gfs2_sbd *sdp = sc->sdp;
+	int hashed = S_ISDIR(di->di_mode) && (di->di_flags & GFS2_DIF_EXHASH);
+	uint64_t owner = di->di_num.no_addr;
+	struct blk_list cur = {0}, next = {0}, tmp;
+	const char *ptrs = dibh->b_data + sizeof(struct gfs2_dinode);
+	const char *end = dibh->b_data + sdp->bsize;
+	unsigned h;
+	size_t i;
+
+	if (di->di_eattr)
+		check_ref(sc, owner, di->di_eattr, _("extended attribute"));
+
+	if (di->di_height == 0) {
+		/* Stuffed, or a hash table held in the dinode block */
+		if (hashed) {
+			check_ptrs(sc, owner, ptrs, end, _("leaf"), &next);
+			check_leaves(sc, di, &next);
+		}
+		free(next.blks);
+		return;
+	}
+	check_ptrs(sc, owner, ptrs, end,
+		   di->di_height == 1 ? _("data") : _("metadata"), &cur);
+	for (h = 1; h <= di->di_height; h++) {
+		int data = (h == di->di_height);
+		int last_indir = (h + 1 == di->di_height);
+
+		if (data && !hashed)
+			break;
+		next.n = 0;
+		for (i = 0; i < cur.n; i++) {
+			struct gfs2_buffer_head *bh;
+
+			bh = read_meta(sc, owner, cur.blks[i],
+				       data ? GFS2_METATYPE_JD : GFS2_METATYPE_IN,
+				       data ? _("hash table") : _("indirect"));
+			if (bh == NULL)
+				continue;
+			ptrs = bh->b_data + sizeof(struct gfs2_meta_header);
+			end = bh->b_data + sdp->bsize;
+			if (data)
+				check_ptrs(sc, owner, ptrs, end, _("leaf"), &next);
+			else if (last_indir)
+				check_ptrs(sc, owner, ptrs, end, _("data"),
+					   hashed ? &next : NULL);
+			else
+				check_ptrs(sc, owner, ptrs, end, _("metadata"), &next);
+			brelse(bh);
+		}
+		tmp = cur;
+		cur = next;
+		next = tmp;
+		if (data) {
+			check_leaves(sc, di, &cur);
+			break;
+		}
+	}
+	free(cur.blks);
+	free(next.blks);
+}
+
+static void check_dinode(struct scope *sc, uint64_t blk)
+{
+	struct gfs2_buffer_head *bh;
+	struct gfs2_dinode di;
+
+	sc->dinodes++;
+	bh = bread(sc->sdp, blk);
+	if (bh == NULL) {
+		scope_error(sc);
+		return;
+	}
+	if (gfs2_check_meta(bh->b_data, GFS2_METATYPE_DI)) {
+		log_err(_("Block %"PRIu64" (0x%"PRIx64") is marked as a dinode "
+			  "but is not one.\n"), blk, blk);
+		scope_error(sc);
+		goto out;
+	}
+	gfs2_dinode_in(&di, bh->b_data);
+	if (di.di_num.no_addr != blk) {
+		log_err(_("Dinode %"PRIu64" (0x%"PRIx64") has the wrong block "
+			  "number %"PRIu64" (0x%"PRIx64").\n"), blk, blk,
+			(uint64_t)di.di_num.no_addr, (uint64_t)di.di_num.no_addr);
+		scope_error(sc);
+		goto out;
+	}
+	if (di.di_height > sc->sdp->sd_max_height) {
+		log_err(_("Dinode %"PRIu64" (0x%"PRIx64") has an invalid "
+			  "height %u.\n"), blk, blk, di.di_height);
+		scope_error(sc);
+		goto out;
+	}
+	check_tree(sc, bh, &di);
+out:
+	brelse(bh);
+}
+
+/**
+ * check_rgrp - check one resource group
+ * @stopped: set to the first block not checked if time ran out
+ *
+ * Returns: 0 if the resource group was checked, 1 if time ran out
+ */
+static int check_rgrp(struct scope *sc, struct rgrp_tree *rgd, uint64_t *stopped)
+{
+	struct gfs2_sbd *sdp = sc->sdp;
+	uint64_t count[4] = {0};
+	uint64_t blk, end = rgd->ri.ri_data0 + rgd->ri.ri_data;
+	int q;
+
+	log_info(_("Checking resource group %"PRIu64" (0x%"PRIx64")\n"),
+		 (uint64_t)rgd->ri.ri_addr, (uint64_t)rgd->ri.ri_addr);
+	for (blk = rgd->ri.ri_data0; blk < end; blk++) {
+		q = lgfs2_get_bitmap(sdp, blk, rgd);
+		if (q >= GFS2_BLKST_FREE && q <= GFS2_BLKST_DINODE)
+			count[q]++;
+	}
+	if (count[GFS2_BLKST_FREE] != rgd->rg.rg_free) {
+		log_err(_("Resource group %"PRIu64" (0x%"PRIx64") free count "
+			  "is %u but the bitmap has %"PRIu64" free blocks.\n"),
+			(uint64_t)rgd->ri.ri_addr, (uint64_t)rgd->ri.ri_addr,
+			rgd->rg.rg_free, count[GFS2_BLKST_FREE]);
+		scope_error(sc);
+	}
+	if (count[GFS2_BLKST_DINODE] != rgd->rg.rg_dinodes) {
+		log_err(_("Resource group %"PRIu64" (0x%"PRIx64") dinode count "
+			  "is %u but the bitmap has %"PRIu64" dinodes.\n"),
+			(uint64_t)rgd->ri.ri_addr, (uint64_t)rgd->ri.ri_addr,
+			rgd->rg.rg_dinodes, count[GFS2_BLKST_DINODE]);
+		scope_error(sc);
+	}
+
+	for (blk = rgd->ri.ri_data0; blk < end; blk++) {
+		q = lgfs2_get_bitmap(sdp, blk, rgd);
+		if (q != GFS2_BLKST_DINODE && q != GFS2_BLKST_UNLINKED)
+			continue;
+		if ((sc->deadline && time(NULL) >= sc->deadline) || fsck_abort) {
+			*stopped = blk;
+			return 1;
+		}
+		check_dinode(sc, blk);
+	}
+	return 0;
+}
+
+static void select_rgrps(struct gfs2_sbd *sdp, struct blk_list *blks,
+			 struct blk_list *rgrps)
+{
+	size_t i;
+
+	for (i = 0; i < blks->n; i++) {
+		struct rgrp_tree *rgd = gfs2_blk2rgrpd(sdp, blks->blks[i]);
+
+		if (rgd == NULL) {
+			log_warn(_("Block %"PRIu64" (0x%"PRIx64") is not in a "
+				   "resource group.\n"), blks->blks[i], blks->blks[i]);
+			continue;
+		}
+		list_add(rgrps, rgd->ri.ri_addr);
+	}
+}
+
+static void report_unchecked(uint64_t start, uint64_t end, uint64_t rgaddr)
+{
+	log_notice(_("Unchecked: blocks %"PRIu64"-%"PRIu64" (0x%"PRIx64"-0x%"PRIx64
+		     ") in resource group %"PRIu64" (0x%"PRIx64")\n"),
+		   start, end - 1, start, end - 1, rgaddr, rgaddr);
+}
+
+/**
+ * scope_check - check the selected resource groups
+ * @time_limit: stop after this many seconds, or 0 for no limit
+ *
+ * Returns: FSCK_OK or FSCK_ERROR. Any problems found are counted in
+ * errors_found.
+ */
+int scope_check(struct gfs2_sbd *sdp, unsigned time_limit)
+{
+	struct scope sc = { .sdp = sdp, };
+	struct blk_list rgrps = {0};
+	struct osi_node *n;
+	uint64_t stopped = 0;
+	size_t i, checked = 0, total = 0;
+
+	if (sdp->gfs1) {
+		log_crit(_("Checking selected resource groups is not supported "
+			   "on GFS file systems\n"));
+		return FSCK_ERROR;
+	}
+	if (time_limit)
+		sc.deadline = time(NULL) + time_limit;
+
+	select_rgrps(sdp, &selected, &rgrps);
+	if (by_journal) {
+		log_notice(_("Journal replay wrote to %zu blocks\n"), replayed.n);
+		select_rgrps(sdp, &replayed, &rgrps);
+	}
+	list_sort_unique(&rgrps);
+	for (n = osi_first(&sdp->rgtree); n; n = osi_next(n))
+		total++;
+	log_notice(_("Checking %zu of %zu resource groups\n"), rgrps.n, total);
+
+	for (i = 0; i < rgrps.n; i++) {
+		struct rgrp_tree *rgd = gfs2_blk2rgrpd(sdp, rgrps.blks[i]);
+
+		if (check_rgrp(&sc, rgd, &stopped))
+			break;
+		checked++;
+	}
+
+	log_notice(_("Checked %zu resource groups and %"PRIu64" dinodes, found "
+		     "%d problems\n"), checked, sc.dinodes, sc.errors);
+	if (checked < rgrps.n) {
+		struct rgrp_tree *rgd = gfs2_blk2rgrpd(sdp, rgrps.blks[i]);
+
+		log_warn(_("%s before all selected resource groups were "
+			   "checked\n"), fsck_abort ? _("Interrupted") :
+			 _("Time limit reached"));
+		report_unchecked(stopped, rgd->ri.ri_data0 + rgd->ri.ri_data,
+				 rgd->ri.ri_addr);
+		for (i++; i < rgrps.n; i++) {
+			rgd = gfs2_blk2rgrpd(sdp, rgrps.blks[i]);
+			report_unchecked(rgd->ri.ri_addr,
+					 rgd->ri.ri_data0 + rgd->ri.ri_data,
+					 rgd->ri.ri_addr);
+		}
+	}
+	if (sc.errors)
+		log_err(_("Run fsck.gfs2 on the whole file system to repair the "
+			  "problems found\n"));
+	free(rgrps.blks);
+	return FSCK_OK;
+}
@@ -0,0 +1,10 @@
+#ifndef __SCOPE_H__
+#define __SCOPE_H__
+
+#include "libgfs2.h"
+
+extern int scope_parse(const char *arg);
+extern void scope_note_block(uint64_t blk);
+extern int scope_check(struct gfs2_sbd *sdp, unsigned time_limit);
+
+#endif /* __SCOPE_H__ */
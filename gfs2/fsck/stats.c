@@ -0,0 +1,448 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <libintl.h>
+#define _(String) gettext(String)
+
+#include <logging.h>
+#include "libgfs2.h"
+#include "fsck.h"
+#include "link.h"
+#include "util.h"
+#include "stats.h"
+
+/*
+ * The --stats report. libgfs2 counts the I/O requests made through it and
+ * calls back here after each one so that it can be charged to a resource
+ * group, and the passes are bracketed so that the counters can be split up by
+ * pass. The report is written to the --stats-file when fsck exits and, when
+ * that is a regular file, every STATS_INTERVAL seconds while fsck is doing I/O
+ * so that a long check can be followed from outside. It never goes to stdout,
+ * where it would be mixed up with fsck's messages.
+ */
+
+#define STATS_MAX_PASSES (16)
+#define STATS_INTERVAL   (5)
+/* Reads quicker than 2^5us are assumed to have been served by the cache */
+#define STATS_CACHED_BUCKETS (5)
+#define NSEC_PER_SEC (1000000000ULL)
+
+extern struct gfs2_bmap *bl; /* pass1.c */
+
+struct pass_stats {
+	const char *name;
+	uint64_t start;
+	uint64_t ns;
+	uint64_t inodes;
+	uint64_t dirs;
+	struct lgfs2_io_stats io;
+	int running;
+	int interrupted;
+};
+
+struct rg_stats {
+	uint64_t addr;
+	uint64_t end;
+	uint64_t reads;
+	uint64_t read_blocks;
+	uint64_t read_ns;
+	uint64_t writes;
+	uint64_t write_blocks;
+};
+
+struct mem_stats {
+	uint64_t blockmap;
+	uint64_t dirtree;
+	uint64_t inodetree;
+	uint64_t dup_blocks;
+};
+
+static struct lgfs2_io_stats io;
+static const char *stats_path;
+static FILE *stats_stream; /* A pipe or the like, only written at exit */
+static int enabled = 0;
+static unsigned bsize;
+static uint64_t start_time;
+static uint64_t next_write;
+static uint64_t inodes_seen;
+static uint64_t dirs_seen;
+static struct pass_stats passes[STATS_MAX_PASSES];
+static unsigned npasses = 0;
+static struct rg_stats *rgs = NULL;
+static unsigned nrgs = 0;
+static struct mem_stats peak;
+static int exit_status = -1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static double secs(uint64_t ns)
+{
+	return (double)ns / NSEC_PER_SEC;
+}
+
+static double rate(uint64_t n, uint64_t ns)
+{
+	return ns ? n / secs(ns) : 0.0;
+}
+
+static uint64_t tree_nodes(struct osi_root *root)
+{
+	struct osi_node *n;
+	uint64_t count = 0;
+
+	for (n = osi_first(root); n; n = osi_next(n))
+		count++;
+	return count;
+}
+
+static void max_u64(uint64_t *peak_val, uint64_t val)
+{
+	if (val > *peak_val)
+		*peak_val = val;
+}
+
+/* Cheap enough to do for every I/O request */
+static void sample_maps(void)
+{
+	uint64_t bm = nlink1map.mapsize + clink1map.mapsize;
+
+	if (bl)
+		bm += bl->mapsize;
+	max_u64(&peak.blockmap, bm);
+}
+
+static void sample_memory(void)
+{
+	sample_maps();
+	max_u64(&peak.dirtree, tree_nodes(&dirtree) * sizeof(struct dir_info));
+	max_u64(&peak.inodetree, tree_nodes(&inodetree) * sizeof(struct inode_info));
+	max_u64(&peak.dup_blocks, tree_nodes(&dup_blocks) * sizeof(struct duptree));
+}
+
+static void io_sub(struct lgfs2_io_stats *d, const struct lgfs2_io_stats *a,
+		   const struct lgfs2_io_stats *b)
+{
+	unsigned i;
+
+	memset(d, 0, sizeof(*d));
+	d->reads = a->reads - b->reads;
+	d->read_blocks = a->read_blocks - b->read_blocks;
+	d->read_ns = a->read_ns - b->read_ns;
+	d->writes = a->writes - b->writes;
+	d->write_blocks = a->write_blocks - b->write_blocks;
+	d->write_ns = a->write_ns - b->write_ns;
+	for (i = 0; i < LGFS2_IO_LAT_BUCKETS; i++)
+		d->read_lat[i] = a->read_lat[i] - b->read_lat[i];
+}
+
+static void print_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; s && *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void print_io(FILE *f, const struct lgfs2_io_stats *st)
+{
+	uint64_t cached = 0;
+	unsigned i;
+
+	for (i = 0; i < STATS_CACHED_BUCKETS; i++)
+		cached += st->read_lat[i];
+
+	fprintf(f, "{\"reads\": %"PRIu64", \"blocks_read\": %"PRIu64
+		", \"bytes_read\": %"PRIu64", \"read_seconds\": %.6f"
+		", \"writes\": %"PRIu64", \"blocks_written\": %"PRIu64
+		", \"bytes_written\": %"PRIu64", \"write_seconds\": %.6f"
+		", \"cache_hit_rate\": %.4f, \"read_latency_us\": {",
+		st->reads, st->read_blocks, st->read_blocks * bsize,
+		secs(st->read_ns), st->writes, st->write_blocks,
+		st->write_blocks * bsize, secs(st->write_ns),
+		st->reads ? (double)cached / st->reads : 0.0);
+	for (i = 0; i < LGFS2_IO_LAT_BUCKETS - 1; i++)
+		fprintf(f, "\"%llu\": %"PRIu64", ", 1ULL << i, st->read_lat[i]);
+	fprintf(f, "\"inf\": %"PRIu64"}}", st->read_lat[i]);
+}
+
+static void print_pass(FILE *f, const struct pass_stats *p, uint64_t now)
+{
+	struct lgfs2_io_stats d;
+	uint64_t ns = p->ns;
+	uint64_t inodes = p->inodes;
+	uint64_t dirs = p->dirs;
+
+	if (p->running) {
+		io_sub(&d, &io, &p->io);
+		ns = now - p->start;
+		inodes = inodes_seen - p->inodes;
+		dirs = dirs_seen - p->dirs;
+	} else {
+		d = p->io;
+	}
+	fprintf(f, "    {\"name\": ");
+	print_str(f, p->name);
+	fprintf(f, ", \"seconds\": %.6f, \"running\": %s, \"interrupted\": %s"
+		", \"inodes\": %"PRIu64", \"dirs\": %"PRIu64
+		", \"inodes_per_second\": %.1f, \"dirs_per_second\": %.1f"
+		",\n     \"io\": ",
+		secs(ns), p->running ? "true" : "false",
+		p->interrupted ? "true" : "false", inodes, dirs,
+		rate(inodes, ns), rate(dirs, ns));
+	print_io(f, &d);
+	fprintf(f, "}");
+}
+
+static void print_report(FILE *f, int complete)
+{
+	uint64_t now = now_ns();
+	struct rusage ru;
+	unsigned i;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		ru.ru_maxrss = 0;
+
+	fprintf(f, "{\n  \"device\": ");
+	print_str(f, opts.device);
+	fprintf(f, ",\n  \"block_size\": %u,\n  \"complete\": %s",
+		bsize, complete ? "true" : "false");
+	if (complete)
+		fprintf(f, ",\n  \"exit_status\": %d", exit_status);
+	fprintf(f, ",\n  \"seconds\": %.6f,\n  \"inodes\": %"PRIu64
+		",\n  \"dirs\": %"PRIu64",\n  \"io\": ",
+		secs(now - start_time), inodes_seen, dirs_seen);
+	print_io(f, &io);
+	fprintf(f, ",\n  \"memory\": {\"peak_rss_bytes\": %llu"
+		", \"blockmap_bytes\": %"PRIu64", \"dirtree_bytes\": %"PRIu64
+		", \"inodetree_bytes\": %"PRIu64", \"dup_blocks_bytes\": %"PRIu64"}",
+		(unsigned long long)ru.ru_maxrss * 1024, peak.blockmap,
+		peak.dirtree, peak.inodetree, peak.dup_blocks);
+
+	fprintf(f, ",\n  \"passes\": [");
+	for (i = 0; i < npasses; i++) {
+		fprintf(f, "%s\n", i ? "," : "");
+		print_pass(f, &passes[i], now);
+	}
+	fprintf(f, "\n  ],\n  \"rgrps\": [");
+	for (i = 0; i < nrgs; i++) {
+		struct rg_stats *rg = &rgs[i];
+
+		fprintf(f, "%s\n    {\"addr\": %"PRIu64", \"reads\": %"PRIu64
+			", \"blocks_read\": %"PRIu64", \"read_seconds\": %.6f"
+			", \"writes\": %"PRIu64", \"blocks_written\": %"PRIu64"}",
+			i ? "," : "", rg->addr, rg->reads, rg->read_blocks,
+			secs(rg->read_ns), rg->writes, rg->write_blocks);
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+static void write_report(int complete)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	next_write = now_ns() + STATS_INTERVAL * NSEC_PER_SEC;
+	if (stats_stream != NULL) {
+		if (!complete)
+			return;
+		print_report(stats_stream, complete);
+		if (fclose(stats_stream))
+			log_err(_("Could not write statistics to '%s': %s\n"),
+				stats_path, strerror(errno));
+		stats_stream = NULL;
+		return;
+	}
+	/* Write to a temporary file and rename it so that readers never see
+	   a partial report */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		log_err(_("Could not write statistics to '%s': %s\n"), tmp,
+			strerror(errno));
+		return;
+	}
+	print_report(f, complete);
+	if (fclose(f) || rename(tmp, stats_path))
+		log_err(_("Could not write statistics to '%s': %s\n"),
+			stats_path, strerror(errno));
+}
+
+static struct rg_stats *find_rg(uint64_t blk)
+{
+	unsigned lo = 0, hi = nrgs;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (blk < rgs[mid].addr)
+			hi = mid;
+		else if (blk >= rgs[mid].end)
+			lo = mid + 1;
+		else
+			return &rgs[mid];
+	}
+	return NULL;
+}
+
+static void account(struct lgfs2_io_stats *st, uint64_t blk, uint64_t count,
+		    int write, uint64_t ns)
+{
+	struct rg_stats *rg = find_rg(blk);
+
+	sample_maps();
+	if (rg != NULL) {
+		if (write) {
+			rg->writes++;
+			rg->write_blocks += count;
+		} else {
+			rg->reads++;
+			rg->read_blocks += count;
+			rg->read_ns += ns;
+		}
+	}
+	if (stats_stream == NULL && st->now >= next_write) {
+		sample_memory();
+		write_report(0);
+	}
+}
+
+static void stats_exit(int status, void *unused)
+{
+	exit_status = status;
+	if (npasses && passes[npasses - 1].running)
+		fsck_stats_pass_end(1);
+	write_report(1);
+	free(rgs);
+}
+
+/**
+ * fsck_stats_init - start collecting statistics
+ * @sdp: the superblock, before the file system is opened
+ * @path: the file to write the report to. Anything but a regular file, such
+ *        as a pipe or /dev/fd/3, only gets the final report.
+ *
+ * Returns: 0 on success or -1 if the report file could not be written
+ */
+int fsck_stats_init(struct gfs2_sbd *sdp, const char *path)
+{
+	struct stat st;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, _("Could not open '%s': %s\n"), path,
+			strerror(errno));
+		return -1;
+	}
+	/* Only a file that can be replaced under its own name is rewritten as
+	   fsck goes; /dev/fd/N is a link even when the fd is a regular file */
+	if (lstat(path, &st) == 0 && S_ISREG(st.st_mode))
+		fclose(f);
+	else
+		stats_stream = f;
+	memset(&io, 0, sizeof(io));
+	io.account = account;
+	sdp->io_stats = &io;
+	stats_path = path;
+	start_time = now_ns();
+	next_write = start_time + STATS_INTERVAL * NSEC_PER_SEC;
+	enabled = 1;
+	on_exit(stats_exit, NULL);
+	return 0;
+}
+
+/**
+ * fsck_stats_rgrps - set up the per-resource group counters
+ * Call this again whenever the resource group list has been rebuilt.
+ */
+void fsck_stats_rgrps(struct gfs2_sbd *sdp)
+{
+	struct osi_node *n;
+	struct rg_stats *new;
+	unsigned count = 0;
+
+	if (!enabled)
+		return;
+	bsize = sdp->bsize;
+	for (n = osi_first(&sdp->rgtree); n; n = osi_next(n))
+		count++;
+	new = calloc(count, sizeof(*new));
+	if (new == NULL)
+		return;
+	free(rgs);
+	rgs = new;
+	nrgs = 0;
+	/* The tree is in address order so the array is too */
+	for (n = osi_first(&sdp->rgtree); n; n = osi_next(n)) {
+		struct rgrp_tree *rgd = (struct rgrp_tree *)n;
+
+		rgs[nrgs].addr = rgd->ri.ri_addr;
+		rgs[nrgs].end = rgd->ri.ri_data0 + rgd->ri.ri_data;
+		nrgs++;
+	}
+}
+
+void fsck_stats_pass_start(const char *name)
+{
+	struct pass_stats *p;
+
+	if (!enabled || npasses == STATS_MAX_PASSES)
+		return;
+	p = &passes[npasses++];
+	p->name = name;
+	p->start = now_ns();
+	p->io = io;
+	p->inodes = inodes_seen;
+	p->dirs = dirs_seen;
+	p->running = 1;
+}
+
+void fsck_stats_pass_end(int interrupted)
+{
+	struct pass_stats *p;
+	struct lgfs2_io_stats start;
+
+	if (!enabled || npasses == 0 || !passes[npasses - 1].running)
+		return;
+	p = &passes[npasses - 1];
+	start = p->io;
+	io_sub(&p->io, &io, &start);
+	p->ns = now_ns() - p->start;
+	p->inodes = inodes_seen - p->inodes;
+	p->dirs = dirs_seen - p->dirs;
+	p->running = 0;
+	p->interrupted = interrupted;
+	sample_memory();
+	write_report(0);
+}
+
+/* Count an inode that has been read in for checking */
+void fsck_stats_inode(struct gfs2_inode *ip)
+{
+	if (!enabled)
+		return;
+	inodes_seen++;
+	if (is_dir(&ip->i_di, ip->i_sbd->gfs1))
+		dirs_seen++;
+}
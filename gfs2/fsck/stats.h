@@ -0,0 +1,12 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "libgfs2.h"
+
+extern int fsck_stats_init(struct gfs2_sbd *sdp, const char *path);
+extern void fsck_stats_rgrps(struct gfs2_sbd *sdp);
+extern void fsck_stats_pass_start(const char *name);
+extern void fsck_stats_pass_end(int interrupted);
+extern void fsck_stats_inode(struct gfs2_inode *ip);
+
+#endif /* __STATS_H__ */
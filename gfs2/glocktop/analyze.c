@@ -0,0 +1,428 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include "analyze.h"
+#include "capture.h"
+
+/*
+ * Offline analysis of a capture file. The glocks of every snapshot are
+ * parsed as in a live report, and each glock that has waiters or a pending
+ * demote in any snapshot is followed from then on: how often it was
+ * contended, by how many waiters, which pids held it while it was, and how
+ * long each waiting pid was seen to wait for it. A wait is timed from the
+ * first snapshot the pid was seen waiting in to the last, so waits shorter
+ * than the interval between snapshots count as zero. Graphs span the whole
+ * capture, their columns widening as it goes on.
+ */
+
+extern const char *ltype[];
+
+static const char *type_name(unsigned type)
+{
+	return type < GLOCK_TYPES - 1 ? ltype[type] : ltype[0];
+}
+
+static void graph_rescale(struct time_graph *g, unsigned shift)
+{
+	unsigned i;
+
+	for (; g->shift < shift; g->shift++) {
+		/* Each column takes the peak of the two it replaces */
+		for (i = 0; i < SPARK_COLS / 2; i++)
+			g->v[i] = g->v[2 * i] > g->v[2 * i + 1] ?
+				  g->v[2 * i] : g->v[2 * i + 1];
+		memset(&g->v[SPARK_COLS / 2], 0,
+		       (SPARK_COLS - SPARK_COLS / 2) * sizeof(g->v[0]));
+	}
+}
+
+static void graph_add(const struct analysis *a, struct time_graph *g,
+		      uint64_t time, unsigned v)
+{
+	uint64_t col;
+
+	graph_rescale(g, a->shift);
+	col = (time - a->start) / ((uint64_t)ANALYZE_COL_US << a->shift);
+	if (v > g->v[col])
+		g->v[col] = v;
+}
+
+static struct fs_stats *fs_get(struct analysis *a, const char *name)
+{
+	struct fs_stats *fs, **fsp;
+
+	for (fsp = &a->fs; *fsp != NULL; fsp = &(*fsp)->next)
+		if (strcmp((*fsp)->name, name) == 0)
+			return *fsp;
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL)
+		return NULL;
+	fs->name = strdup(name);
+	fs->nbuckets = 1024;
+	fs->hash = calloc(fs->nbuckets, sizeof(*fs->hash));
+	if (fs->name == NULL || fs->hash == NULL) {
+		free(fs->name);
+		free(fs->hash);
+		free(fs);
+		return NULL;
+	}
+	/* Kept in the order they first appear */
+	*fsp = fs;
+	return fs;
+}
+
+static unsigned hash_glock(const struct fs_stats *fs, unsigned type,
+			   uint64_t number)
+{
+	uint64_t h = (number ^ ((uint64_t)type << 56)) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (fs->nbuckets - 1);
+}
+
+static void grow_hash(struct fs_stats *fs)
+{
+	unsigned nbuckets = fs->nbuckets * 2;
+	struct glock_stats **hash = calloc(nbuckets, sizeof(*hash));
+	struct glock_stats **old = fs->hash;
+	unsigned i;
+
+	if (hash == NULL)
+		return;
+	fs->hash = hash;
+	fs->nbuckets = nbuckets;
+	for (i = 0; i < nbuckets / 2; i++) {
+		while (old[i] != NULL) {
+			struct glock_stats *gs = old[i];
+			unsigned b = hash_glock(fs, gs->type, gs->number);
+
+			old[i] = gs->next;
+			gs->next = hash[b];
+			hash[b] = gs;
+		}
+	}
+	free(old);
+}
+
+static struct glock_stats *find_glock(struct fs_stats *fs, unsigned type,
+				      uint64_t number, int create)
+{
+	struct glock_stats *gs;
+	unsigned b = hash_glock(fs, type, number);
+
+	for (gs = fs->hash[b]; gs != NULL; gs = gs->next)
+		if (gs->number == number && gs->type == type)
+			return gs;
+	if (!create)
+		return NULL;
+	if (fs->count >= fs->nbuckets) {
+		grow_hash(fs);
+		b = hash_glock(fs, type, number);
+	}
+	gs = calloc(1, sizeof(*gs));
+	if (gs == NULL)
+		return NULL;
+	gs->type = type;
+	gs->number = number;
+	gs->next = fs->hash[b];
+	fs->hash[b] = gs;
+	fs->count++;
+	return gs;
+}
+
+static void end_wait(struct glock_stats *gs, const struct waiter *w)
+{
+	uint64_t us = w->last - w->since;
+
+	gs->waits++;
+	gs->wait_us += us;
+	if (us > gs->wait_max_us)
+		gs->wait_max_us = us;
+}
+
+/* Count the pids that hold contended glocks most often, keeping the few
+   counted so far and replacing the least counted */
+static void count_holder(struct glock_stats *gs, const struct holder_info *h)
+{
+	struct pid_count *pc = NULL;
+	unsigned i;
+
+	for (i = 0; i < gs->nholders; i++) {
+		if (gs->holders[i].pid == h->pid) {
+			gs->holders[i].count++;
+			return;
+		}
+		if (pc == NULL || gs->holders[i].count < pc->count)
+			pc = &gs->holders[i];
+	}
+	if (gs->nholders < ANALYZE_PIDS) {
+		pc = &gs->holders[gs->nholders++];
+		pc->count = 0;
+	}
+	pc->pid = h->pid;
+	holder_comm(h, pc->comm, sizeof(pc->comm));
+	pc->count++;
+}
+
+/* Returns the number of waiters */
+static unsigned analyze_glock(struct analysis *a, struct fs_stats *fs,
+			      uint64_t time, uint64_t prev,
+			      const struct glock_info *gi)
+{
+	unsigned waiters = 0, i, j, n;
+	struct glock_stats *gs;
+	int contended;
+
+	for (i = 0; i < gi->nholders; i++)
+		if (holder_is_waiter(&gi->holders[i]))
+			waiters++;
+	contended = waiters || gi->demote_time;
+	gs = find_glock(fs, gi->type, gi->number, contended);
+	if (gs == NULL)
+		return waiters;
+
+	/* Carry on the waits that were going at the previous snapshot and
+	   start the new ones */
+	for (i = 0; i < gi->nholders; i++) {
+		const struct holder_info *h = &gi->holders[i];
+
+		if (!holder_is_waiter(h))
+			continue;
+		for (j = 0; j < gs->nw; j++)
+			if (gs->w[j].pid == h->pid && gs->w[j].last == prev)
+				break;
+		if (j < gs->nw) {
+			gs->w[j].last = time;
+		} else if (gs->nw < ANALYZE_WAITERS) {
+			gs->w[gs->nw].pid = h->pid;
+			gs->w[gs->nw].since = time;
+			gs->w[gs->nw++].last = time;
+		}
+	}
+	/* and end the rest */
+	for (i = n = 0; i < gs->nw; i++) {
+		if (gs->w[i].last == time)
+			gs->w[n++] = gs->w[i];
+		else
+			end_wait(gs, &gs->w[i]);
+	}
+	gs->nw = n;
+
+	if (!contended)
+		return 0;
+	if (waiters) {
+		gs->contended++;
+		gs->waiters += waiters;
+		if (waiters > gs->peak)
+			gs->peak = waiters;
+		graph_add(a, &gs->graph, time, waiters);
+	}
+	if (gi->demote_time)
+		gs->demoting++;
+	for (i = 0; i < gi->nholders; i++)
+		if (holder_is_holder(&gi->holders[i]))
+			count_holder(gs, &gi->holders[i]);
+	return waiters;
+}
+
+static void analyze_snapshot(struct analysis *a, struct fs_stats *fs,
+			     uint64_t time, struct gt_reader *rd)
+{
+	uint64_t prev = fs->snapshots ? fs->last : 0;
+	unsigned waiters = 0;
+
+	if (a->snapshots++ == 0)
+		a->start = time;
+	if (time < a->start) /* The clock went back */
+		time = a->start;
+	/* Widen the graph columns until the capture fits */
+	while ((time - a->start) / ((uint64_t)ANALYZE_COL_US << a->shift) >=
+	       SPARK_COLS)
+		a->shift++;
+
+	if (time > a->end)
+		a->end = time;
+	if (fs->snapshots++ == 0)
+		fs->first = time;
+	while (glock_next(rd, &a->gi)) {
+		fs->glocks++;
+		waiters += analyze_glock(a, fs, time, prev, &a->gi);
+	}
+	graph_add(a, &fs->graph, time, waiters);
+	fs->last = time;
+}
+
+static unsigned count_lines(struct gt_reader *rd)
+{
+	unsigned n = 0;
+
+	while (reader_line(rd) != NULL)
+		n++;
+	return n;
+}
+
+static int cmp_glocks(const void *p1, const void *p2)
+{
+	const struct glock_stats *a = *(const struct glock_stats **)p1;
+	const struct glock_stats *b = *(const struct glock_stats **)p2;
+
+	if (a->waiters != b->waiters)
+		return a->waiters < b->waiters ? 1 : -1;
+	if (a->demoting != b->demoting)
+		return a->demoting < b->demoting ? 1 : -1;
+	return 0;
+}
+
+static const char *time_str(uint64_t us, char *buf, size_t size)
+{
+	time_t t = us / 1000000;
+
+	strftime(buf, size, "%a %b %d %T %Y", localtime(&t));
+	return buf;
+}
+
+static void print_glock(const struct analysis *a, struct glock_stats *gs,
+			unsigned snapshots)
+{
+	char spark[SPARK_COLS + 1], id[48];
+	unsigned i;
+
+	graph_rescale(&gs->graph, a->shift);
+	sparkline(spark, gs->graph.v, SPARK_COLS);
+	snprintf(id, sizeof(id), "%s %"PRIx64, type_name(gs->type), gs->number);
+	printf("  %-24s %5u/%-5u %5u %6u %8.1f %8.1f [%s] ", id, gs->contended,
+	       snapshots, gs->peak, gs->waits,
+	       gs->waits ? gs->wait_us / 1000.0 / gs->waits : 0.0,
+	       gs->wait_max_us / 1000.0, spark);
+	for (i = 0; i < gs->nholders; i++)
+		printf("%s%ld (%s) x%u", i ? ", " : "", gs->holders[i].pid,
+		       gs->holders[i].comm, gs->holders[i].count);
+	printf("\n");
+}
+
+static void print_fs(const struct analysis *a, struct fs_stats *fs)
+{
+	struct glock_stats **sorted;
+	char spark[SPARK_COLS + 1];
+	unsigned i, n = 0;
+
+	printf("\n@ %s: %u snapshots over %.1f seconds, %"PRIu64" glocks on "
+	       "average, %u contended\n", fs->name, fs->snapshots,
+	       (fs->last - fs->first) / 1000000.0, fs->glocks / fs->snapshots,
+	       fs->count);
+	graph_rescale(&fs->graph, a->shift);
+	sparkline(spark, fs->graph.v, SPARK_COLS);
+	printf("  All glocks: peak waiters [%s], most dlm waiters %u\n", spark,
+	       fs->dlm_peak);
+	if (fs->count == 0)
+		return;
+
+	sorted = malloc(fs->count * sizeof(*sorted));
+	if (sorted == NULL)
+		return;
+	for (i = 0; i < fs->nbuckets; i++) {
+		struct glock_stats *gs;
+
+		for (gs = fs->hash[i]; gs != NULL; gs = gs->next) {
+			/* Waits still going at the end of the capture */
+			while (gs->nw > 0)
+				end_wait(gs, &gs->w[--gs->nw]);
+			sorted[n++] = gs;
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp_glocks);
+	printf("  %-24s %11s %5s %6s %8s %8s  %-*s  %s\n", "Glock", "Contended",
+	       "Peak", "Waits", "Avg ms", "Max ms", SPARK_COLS, "Waiters",
+	       "Holders while contended");
+	for (i = 0; i < n && i < ANALYZE_TOP; i++)
+		print_glock(a, sorted[i], fs->snapshots);
+	free(sorted);
+}
+
+static void analysis_free(struct analysis *a)
+{
+	while (a->fs != NULL) {
+		struct fs_stats *fs = a->fs;
+		unsigned i;
+
+		for (i = 0; i < fs->nbuckets; i++) {
+			while (fs->hash[i] != NULL) {
+				struct glock_stats *gs = fs->hash[i];
+
+				fs->hash[i] = gs->next;
+				free(gs);
+			}
+		}
+		a->fs = fs->next;
+		free(fs->hash);
+		free(fs->name);
+		free(fs);
+	}
+	glock_info_free(&a->gi);
+	free(a);
+}
+
+/**
+ * analyze_capture - analyze a capture file and print the results
+ *
+ * Returns: 0 on success or -1 if the capture couldn't be read
+ */
+int analyze_capture(const char *path)
+{
+	struct analysis *a;
+	struct capture *cap;
+	struct fs_stats *fs;
+	char t1[64], t2[64];
+	int ret;
+
+	cap = capture_open(path);
+	if (cap == NULL) {
+		fprintf(stderr, "%s: %s\n", path, errno == EINVAL ?
+			"not a glocktop capture file" : strerror(errno));
+		return -1;
+	}
+	a = calloc(1, sizeof(*a));
+	if (a == NULL) {
+		perror("Failed to allocate analysis");
+		capture_close(cap);
+		return -1;
+	}
+	strcpy(a->host, cap->host);
+	while ((ret = capture_read(cap)) == 1) {
+		fs = fs_get(a, cap->name);
+		if (fs == NULL) {
+			perror("Failed to allocate analysis");
+			break;
+		}
+		if (cap->kind == CAPTURE_GLOCKS) {
+			analyze_snapshot(a, fs, cap->time, &cap->data);
+		} else if (cap->kind == CAPTURE_DLM_WAITERS) {
+			unsigned n = count_lines(&cap->data);
+
+			if (n > fs->dlm_peak)
+				fs->dlm_peak = n;
+		}
+	}
+	if (ret < 0)
+		fprintf(stderr, "%s: capture is truncated or corrupt; "
+			"analyzing what could be read\n", path);
+	capture_close(cap);
+
+	if (a->snapshots == 0) {
+		printf("%s: no glock snapshots\n", path);
+	} else {
+		printf("Capture of %s from %s to %s\n", a->host,
+		       time_str(a->start, t1, sizeof(t1)),
+		       time_str(a->end, t2, sizeof(t2)));
+		for (fs = a->fs; fs != NULL; fs = fs->next)
+			if (fs->snapshots)
+				print_fs(a, fs);
+	}
+	analysis_free(a);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef __ANALYZE_DOT_H__
+#define __ANALYZE_DOT_H__
+
+#include <stdint.h>
+#include "glocks.h"
+#include "sample.h"
+
+#define ANALYZE_TOP     20 /* Glocks listed for each file system */
+#define ANALYZE_WAITERS 16 /* Waiting pids followed for each glock */
+#define ANALYZE_PIDS    4  /* Holder pids counted for each glock */
+#define ANALYZE_COL_US  100000 /* Narrowest graph column, in microseconds */
+
+/* Values over the whole capture, SPARK_COLS columns of equal time */
+struct time_graph {
+	unsigned shift;    /* Column width is ANALYZE_COL_US << shift */
+	unsigned v[SPARK_COLS];
+};
+
+struct waiter {
+	long pid;
+	uint64_t since;    /* First snapshot it was seen waiting in */
+	uint64_t last;     /* Last snapshot it was seen waiting in */
+};
+
+struct pid_count {
+	long pid;
+	char comm[16];
+	unsigned count;
+};
+
+/* A glock that had waiters or a pending demote in at least one snapshot */
+struct glock_stats {
+	struct glock_stats *next; /* Hash chain */
+	uint64_t number;
+	unsigned type;
+	unsigned contended;       /* Snapshots it had waiters in */
+	unsigned demoting;        /* Snapshots it had a demote pending in */
+	unsigned peak;            /* Most waiters in any one snapshot */
+	uint64_t waiters;         /* Sum of the waiters over all snapshots */
+	unsigned waits;           /* Waits seen to end */
+	uint64_t wait_us;         /* Their total and longest time */
+	uint64_t wait_max_us;
+	struct waiter w[ANALYZE_WAITERS];
+	unsigned nw;
+	struct pid_count holders[ANALYZE_PIDS];
+	unsigned nholders;
+	struct time_graph graph;  /* Peak waiters */
+};
+
+struct fs_stats {
+	struct fs_stats *next;
+	char *name;               /* The lock table name */
+	unsigned snapshots;
+	uint64_t first;           /* Time of the first and last snapshots */
+	uint64_t last;
+	uint64_t glocks;          /* Sum over all snapshots */
+	unsigned dlm_peak;        /* Most dlm waiters in any one snapshot */
+	struct glock_stats **hash;
+	unsigned nbuckets;
+	unsigned count;
+	struct time_graph graph;  /* Peak waiters on all glocks */
+};
+
+struct analysis {
+	char host[256];
+	uint64_t start;           /* Time of the first and last snapshots */
+	uint64_t end;
+	unsigned shift;           /* Current column width of the graphs */
+	unsigned snapshots;
+	struct fs_stats *fs;
+	struct glock_info gi;
+};
+
+extern int analyze_capture(const char *path);
+
+#endif /* __ANALYZE_DOT_H__ */
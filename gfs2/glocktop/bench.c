@@ -0,0 +1,273 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include "bench.h"
+
+/*
+ * Benchmark of glocktop's own overhead. A debugfs tree is generated with
+ * glocks and dlm files of a given size and contention shape, in the same
+ * format as the kernel's, and glocktop reports on it headless over and over
+ * while the time taken and the memory used are measured. The holder pids
+ * don't exist, so the /proc lookups made for them fail quickly, but they are
+ * still made, as they would be on a real node.
+ */
+
+/* Lock types in rough proportion to a busy file system's */
+static const unsigned bench_types[] = {2, 2, 2, 2, 5, 5, 5, 3, 1, 4, 8, 9};
+
+static uint64_t bench_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static size_t heap_in_use(void)
+{
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+void bench_shape_default(struct bench_shape *shape)
+{
+	shape->filesystems = 2;
+	shape->glocks = 100000;
+	shape->held = 40;
+	shape->contended = 2;
+	shape->waiters = 4;
+	shape->seed = 1;
+}
+
+/**
+ * bench_parse_shape - parse a shape given as fs=N,glocks=N,held=P,...
+ *
+ * Returns: 0 on success or -1 if an option is unknown or out of range
+ */
+int bench_parse_shape(struct bench_shape *shape, char *opts)
+{
+	const struct {
+		const char *name;
+		unsigned *field;
+	} names[] = {
+		{"fs", &shape->filesystems}, {"glocks", &shape->glocks},
+		{"held", &shape->held}, {"contended", &shape->contended},
+		{"waiters", &shape->waiters}, {"seed", &shape->seed},
+	};
+	char *opt, *value, *end, *save = NULL;
+	unsigned i;
+
+	for (opt = strtok_r(opts, ",", &save); opt != NULL;
+	     opt = strtok_r(NULL, ",", &save)) {
+		value = strchr(opt, '=');
+		if (value == NULL)
+			return -1;
+		*value++ = '\0';
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+			if (strcmp(opt, names[i].name) == 0)
+				break;
+		if (i == sizeof(names) / sizeof(names[0]))
+			return -1;
+		*names[i].field = strtoul(value, &end, 10);
+		if (end == value || *end != '\0')
+			return -1;
+	}
+	if (shape->filesystems == 0 || shape->filesystems > BENCH_FS_MAX ||
+	    shape->held > 100 || shape->contended > 100 ||
+	    shape->waiters > 1000)
+		return -1;
+	return 0;
+}
+
+static int generate_fs(const char *dir, unsigned fs,
+		       const struct bench_shape *shape, uint64_t *rnd)
+{
+	FILE *glocks = NULL, *locks = NULL, *waiters = NULL;
+	char path[PATH_MAX];
+	unsigned g, w, lkb = 1;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "%s/gfs2/bench:fs%u", dir, fs);
+	if (mkdir(path, 0755))
+		return -1;
+	snprintf(path, sizeof(path), "%s/gfs2/bench:fs%u/glocks", dir, fs);
+	glocks = fopen(path, "w");
+	snprintf(path, sizeof(path), "%s/dlm/fs%u_locks", dir, fs);
+	locks = fopen(path, "w");
+	snprintf(path, sizeof(path), "%s/dlm/fs%u_waiters", dir, fs);
+	waiters = fopen(path, "w");
+	if (glocks == NULL || locks == NULL || waiters == NULL)
+		goto out;
+
+	fprintf(locks, "lkb_id n remid pid x e f s g rq u n ln res_name\n");
+	for (g = 0; g < shape->glocks; g++) {
+		uint64_t r = bench_rand(rnd);
+		unsigned type = bench_types[r % (sizeof(bench_types) /
+						 sizeof(bench_types[0]))];
+		uint64_t number = bench_rand(rnd) & 0xfffffffffULL;
+		int contended = (r >> 8) % 100 < shape->contended;
+		int held = contended || (r >> 16) % 100 < shape->held;
+		int ex = (r >> 24) & 1;
+		unsigned pid = 4000000 + (r >> 32) % 100000;
+
+		fprintf(glocks, "G:  s:%s n:%u/%"PRIx64" f:%s t:%s d:EX/0 a:0 "
+			"v:0 r:%u m:200 p:%u\n", held ? (ex ? "EX" : "SH") : "UN",
+			type, number, held ? "q" : "", held ? (ex ? "EX" : "SH") :
+			"UN", 3 + (contended ? shape->waiters : 0), held);
+		if (type == 2)
+			fprintf(glocks, " I: n:1/%"PRIu64" t:8 f:0x00 "
+				"d:0x00000000 s:0\n", number);
+		if (!held)
+			continue;
+		fprintf(glocks, " H: s:%s f:H e:0 p:%u [bench] "
+			"gfs2_write_begin+0x40/0x500 [gfs2]\n",
+			ex ? "EX" : "SH", pid);
+		fprintf(locks, "%x 0 %x %u 0 0 10000 2 %d -1 0 0 24 "
+			"\"%8u%16"PRIx64"\"\n", lkb, lkb + 0x100000, pid,
+			ex ? 5 : 3, type, number);
+		lkb++;
+		if (!contended)
+			continue;
+		for (w = 0; w < shape->waiters; w++) {
+			fprintf(glocks, " H: s:EX f:W e:0 p:%u [bench] "
+				"gfs2_inode_lookup+0x1a3/0x420 [gfs2]\n",
+				pid + w + 1);
+			fprintf(locks, "%x 2 %x %u 0 0 10000 1 -1 5 0 0 24 "
+				"\"%8u%16"PRIx64"\"\n", lkb, lkb + 0x100000,
+				pid + w + 1, type, number);
+			lkb++;
+		}
+		fprintf(waiters, "%x 3 1 %8u %17"PRIx64"\n", lkb, type, number);
+	}
+	ret = 0;
+out:
+	if (glocks != NULL && fclose(glocks))
+		ret = -1;
+	if (locks != NULL && fclose(locks))
+		ret = -1;
+	if (waiters != NULL && fclose(waiters))
+		ret = -1;
+	return ret;
+}
+
+/**
+ * bench_generate - generate a debugfs tree of the given shape
+ * @dir: a template for mkdtemp(), replaced by the name of the tree
+ *
+ * Returns: 0 on success or -1 with errno set
+ */
+int bench_generate(char *dir, const struct bench_shape *shape)
+{
+	uint64_t rnd = 0x9e3779b97f4a7c15ULL * (shape->seed + 1);
+	char path[PATH_MAX];
+	unsigned fs;
+
+	if (mkdtemp(dir) == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "%s/gfs2", dir);
+	if (mkdir(path, 0755))
+		goto fail;
+	snprintf(path, sizeof(path), "%s/dlm", dir);
+	if (mkdir(path, 0755))
+		goto fail;
+	for (fs = 0; fs < shape->filesystems; fs++)
+		if (generate_fs(dir, fs, shape, &rnd))
+			goto fail;
+	return 0;
+fail:
+	bench_remove(dir, shape);
+	return -1;
+}
+
+/**
+ * bench_remove - remove a tree made by bench_generate()
+ */
+void bench_remove(const char *dir, const struct bench_shape *shape)
+{
+	int saved = errno;
+	char path[PATH_MAX];
+	unsigned fs;
+
+	for (fs = 0; fs < shape->filesystems; fs++) {
+		snprintf(path, sizeof(path), "%s/gfs2/bench:fs%u/glocks", dir, fs);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/gfs2/bench:fs%u", dir, fs);
+		rmdir(path);
+		snprintf(path, sizeof(path), "%s/dlm/fs%u_locks", dir, fs);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/dlm/fs%u_waiters", dir, fs);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/gfs2", dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/dlm", dir);
+	rmdir(path);
+	rmdir(dir);
+	errno = saved;
+}
+
+void bench_start(struct bench_result *res)
+{
+	memset(res, 0, sizeof(*res));
+	res->start_us = now_us();
+}
+
+/* Account for an iteration just done */
+void bench_iteration(struct bench_result *res)
+{
+	size_t heap = heap_in_use();
+	struct rusage ru;
+
+	res->secs = (now_us() - res->start_us) / 1000000.0;
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		res->peak_rss_kb = ru.ru_maxrss;
+	if (res->iterations++ == 0)
+		res->heap_first = heap;
+	res->heap_last = heap;
+	if (heap > res->heap_peak)
+		res->heap_peak = heap;
+}
+
+void bench_print(FILE *f, const struct bench_shape *shape,
+		 const struct bench_result *res)
+{
+	fprintf(f, "Benchmark: %u file systems of %u glocks, %u%% held, "
+		"%u%% contended with %u waiters\n", shape->filesystems,
+		shape->glocks, shape->held, shape->contended, shape->waiters);
+	fprintf(f, "Reported %"PRIu64" glocks and %"PRIu64" dlm locks in "
+		"%u iterations, %.3fs: %.0f glocks/s\n", res->glocks,
+		res->dlm_locks, res->iterations, res->secs,
+		res->secs > 0 ? res->glocks / res->secs : 0.0);
+	fprintf(f, "Peak RSS: %ld KiB\n", res->peak_rss_kb);
+#ifdef HAVE_MALLINFO2
+	fprintf(f, "Heap: %zu KiB after the first iteration, %zu KiB after "
+		"the last, %zu KiB at most\n", res->heap_first / 1024,
+		res->heap_last / 1024, res->heap_peak / 1024);
+#endif
+}
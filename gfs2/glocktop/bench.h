@@ -0,0 +1,50 @@
+#ifndef __BENCH_DOT_H__
+#define __BENCH_DOT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define BENCH_FS_MAX 64 /* Most file systems in a generated tree */
+
+/* What a generated debugfs tree looks like */
+struct bench_shape {
+	unsigned filesystems;  /* File systems, each with its own files */
+	unsigned glocks;       /* Glocks in each glocks file */
+	unsigned held;         /* Percent of the glocks with a holder */
+	unsigned contended;    /* Percent of the glocks with waiters */
+	unsigned waiters;      /* Waiters on each contended glock */
+	unsigned seed;
+};
+
+/* Cost of reporting on a generated tree */
+struct bench_result {
+	uint64_t start_us;
+	unsigned iterations;
+	uint64_t glocks;       /* Glocks reported on over all the iterations */
+	uint64_t dlm_locks;    /* ...and dlm locks indexed */
+	double secs;           /* Time taken by the iterations so far */
+	long peak_rss_kb;
+	size_t heap_first;     /* Heap in use after the first and last iteration */
+	size_t heap_last;
+	size_t heap_peak;
+};
+
+extern void bench_shape_default(struct bench_shape *shape);
+extern int bench_parse_shape(struct bench_shape *shape, char *opts);
+extern int bench_generate(char *dir, const struct bench_shape *shape);
+extern void bench_remove(const char *dir, const struct bench_shape *shape);
+extern void bench_start(struct bench_result *res);
+extern void bench_iteration(struct bench_result *res);
+extern void bench_print(FILE *f, const struct bench_shape *shape,
+			const struct bench_result *res);
+
+struct fs_snapshot;
+
+/* In glocktop.c */
+extern void report_fs(struct fs_snapshot *snap, int trace_dir_path,
+		      int show_held, int help, int summary,
+		      struct bench_result *res);
+extern int run_benchmark(const struct bench_shape *shape, unsigned count,
+			 struct bench_result *res);
+
+#endif /* __BENCH_DOT_H__ */
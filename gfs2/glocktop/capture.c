@@ -0,0 +1,200 @@
+#include "clusterautoconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+#include "capture.h"
+
+/*
+ * Capture files hold the raw debugfs files that glocktop reads, so that
+ * they can be analyzed later, elsewhere, at full speed. The files are
+ * stored as read, with no parsing, and compressed at the fastest level to
+ * keep the cost on the node being watched low.
+ */
+
+#define CAPTURE_CHUNK (1U << 30) /* Most passed to zlib at once */
+
+static int cap_write(struct capture *cap, const void *buf, uint64_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		unsigned n = len > CAPTURE_CHUNK ? CAPTURE_CHUNK : len;
+
+		if (gzwrite(cap->gz, p, n) != (int)n)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Returns 1 if all of @len was read, 0 at the end of the file, -1 if the
+   file is truncated or can't be read */
+static int cap_read(struct capture *cap, void *buf, uint64_t len)
+{
+	char *p = buf;
+	uint64_t done = 0;
+
+	while (done < len) {
+		uint64_t left = len - done;
+		unsigned n = left > CAPTURE_CHUNK ? CAPTURE_CHUNK : left;
+		int ret = gzread(cap->gz, p + done, n);
+
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			return done == 0 ? 0 : -1;
+		done += ret;
+	}
+	return 1;
+}
+
+static int read_u16(struct capture *cap, uint16_t *v)
+{
+	int ret = cap_read(cap, v, sizeof(*v));
+
+	*v = le16toh(*v);
+	return ret;
+}
+
+static int read_u64(struct capture *cap, uint64_t *v)
+{
+	int ret = cap_read(cap, v, sizeof(*v));
+
+	*v = le64toh(*v);
+	return ret;
+}
+
+/**
+ * capture_create - create a capture file
+ * @host: the name of the node being captured
+ *
+ * Returns: the capture, or NULL with errno set
+ */
+struct capture *capture_create(const char *path, const char *host)
+{
+	struct capture *cap = calloc(1, sizeof(*cap));
+	uint16_t len = strnlen(host, sizeof(cap->host) - 1);
+	uint16_t le_len = htole16(len);
+
+	if (cap == NULL)
+		return NULL;
+	cap->path = path;
+	memcpy(cap->host, host, len);
+	cap->gz = gzopen(path, "wb1");
+	if (cap->gz == NULL) {
+		free(cap);
+		return NULL;
+	}
+	gzbuffer(cap->gz, (1<<20));
+	if (cap_write(cap, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) ||
+	    cap_write(cap, &le_len, sizeof(le_len)) ||
+	    cap_write(cap, host, len)) {
+		capture_close(cap);
+		errno = EIO;
+		return NULL;
+	}
+	return cap;
+}
+
+/**
+ * capture_write - add a debugfs file to a capture
+ * @kind: which of a file system's files it is
+ * @time: when it was read, in microseconds since the epoch
+ * @name: the file system's gfs2 debugfs directory name
+ * @rd: a reader holding the whole file, before it has been parsed
+ *
+ * Returns: 0 on success or -1 on error
+ */
+int capture_write(struct capture *cap, unsigned kind, uint64_t time,
+		  const char *name, const struct gt_reader *rd)
+{
+	uint8_t k = kind;
+	uint16_t len = strnlen(name, sizeof(cap->name) - 1);
+	uint16_t le_len = htole16(len);
+	uint64_t le_time = htole64(time);
+	uint64_t le_size = htole64(rd->end);
+
+	if (cap_write(cap, &k, sizeof(k)) ||
+	    cap_write(cap, &le_time, sizeof(le_time)) ||
+	    cap_write(cap, &le_len, sizeof(le_len)) ||
+	    cap_write(cap, name, len) ||
+	    cap_write(cap, &le_size, sizeof(le_size)) ||
+	    cap_write(cap, rd->buf, rd->end))
+		return -1;
+	return 0;
+}
+
+/**
+ * capture_open - open a capture file to read its records
+ *
+ * Returns: the capture, or NULL with errno set
+ */
+struct capture *capture_open(const char *path)
+{
+	struct capture *cap = calloc(1, sizeof(*cap));
+	char magic[sizeof(CAPTURE_MAGIC) - 1];
+	uint16_t len;
+
+	if (cap == NULL)
+		return NULL;
+	cap->path = path;
+	cap->gz = gzopen(path, "rb");
+	if (cap->gz == NULL) {
+		free(cap);
+		return NULL;
+	}
+	gzbuffer(cap->gz, (1<<20));
+	if (reader_init(&cap->data, 64 * 1024) ||
+	    cap_read(cap, magic, sizeof(magic)) != 1 ||
+	    memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+	    read_u16(cap, &len) != 1 || len >= sizeof(cap->host) ||
+	    cap_read(cap, cap->host, len) != 1) {
+		capture_close(cap);
+		errno = EINVAL;
+		return NULL;
+	}
+	cap->host[len] = '\0';
+	return cap;
+}
+
+/**
+ * capture_read - read the next record of a capture
+ * The record's file is left in cap->data, ready to be parsed.
+ *
+ * Returns: 1 if a record was read, 0 at the end of the capture or -1 if the
+ * capture is truncated or corrupt
+ */
+int capture_read(struct capture *cap)
+{
+	uint8_t kind;
+	uint16_t len;
+	uint64_t size;
+	int ret;
+
+	ret = cap_read(cap, &kind, sizeof(kind));
+	if (ret != 1)
+		return ret;
+	if (read_u64(cap, &cap->time) != 1 || read_u16(cap, &len) != 1 ||
+	    len >= sizeof(cap->name) || cap_read(cap, cap->name, len) != 1 ||
+	    read_u64(cap, &size) != 1 || size >= SIZE_MAX)
+		return -1;
+	cap->name[len] = '\0';
+	cap->kind = kind;
+	if (reader_preload(&cap->data, size) ||
+	    (size > 0 && cap_read(cap, cap->data.buf, size) != 1))
+		return -1;
+	return 1;
+}
+
+int capture_close(struct capture *cap)
+{
+	int ret = gzclose(cap->gz);
+
+	reader_free(&cap->data);
+	free(cap);
+	return ret == Z_OK ? 0 : -1;
+}
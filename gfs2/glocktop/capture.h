@@ -0,0 +1,46 @@
+#ifndef __CAPTURE_DOT_H__
+#define __CAPTURE_DOT_H__
+
+#include <stdint.h>
+#include <zlib.h>
+#include "glocks.h"
+
+/*
+ * A capture file is a gzip stream of a header followed by records, all
+ * little-endian:
+ *
+ *   header: "GLTCAP1\n", u16 host name length, host name
+ *   record: u8 CAPTURE_* kind, u64 time in microseconds since the epoch,
+ *           u16 name length, the file system's gfs2 debugfs directory name
+ *           (its lock table name), u64 data length, the file's contents
+ *
+ * Each refresh writes a record for each file that could be read, for each
+ * file system, with the same time.
+ */
+#define CAPTURE_MAGIC "GLTCAP1\n"
+
+enum capture_kind {
+	CAPTURE_GLOCKS = 1,
+	CAPTURE_DLM_WAITERS = 2,
+	CAPTURE_DLM_LOCKS = 3,
+};
+
+struct capture {
+	gzFile gz;
+	const char *path;
+	char host[256];
+	/* The record last read */
+	unsigned kind;
+	uint64_t time;
+	char name[256];
+	struct gt_reader data;
+};
+
+extern struct capture *capture_create(const char *path, const char *host);
+extern int capture_write(struct capture *cap, unsigned kind, uint64_t time,
+			 const char *name, const struct gt_reader *rd);
+extern struct capture *capture_open(const char *path);
+extern int capture_read(struct capture *cap);
+extern int capture_close(struct capture *cap);
+
+#endif /* __CAPTURE_DOT_H__ */
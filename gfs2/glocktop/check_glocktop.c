@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <check.h>
+#include "dlm.h"
+#include "bench.h"
+#include "collect.h"
+#include "stacks.h"
+#include "glocks.h"
+#include "export.h"
+
+extern int termlines, line;
+
+START_TEST(test_dlm_index)
+{
+	struct dlm_index di = {0};
+	const struct dlm_res *r;
+	const struct dlm_lock *l;
+	char line[128];
+	unsigned i;
+
+	ck_assert(dlm_add_lock(&di, "lkb_id n remid pid x e f s g rq u n ln "
+			       "res_name") == 0);
+	ck_assert(dlm_add_lock(&di, "64c64 1 76dfca 953012 0 0 10000 2 5 5 0 0 "
+			       "24 \"       9       52c4a3699\"") == 1);
+	ck_assert(dlm_add_lock(&di, "5aeb84 2 e06b14 989982 0 0 10000 1 -1 5 0 "
+			       "0 24 \"       9       52c4a3699\"") == 1);
+	ck_assert(dlm_add_waiter(&di, "c32d33 3 1        9         "
+				 "52c4a3699") == 1);
+	ck_assert(dlm_find(&di, 2, 0x52c4a3699) == NULL);
+
+	r = dlm_find(&di, 9, 0x52c4a3699);
+	ck_assert(r != NULL);
+	ck_assert(r->waiting == 1);
+	l = dlm_lock_at(&di, r->first);
+	ck_assert(l != NULL && l->ownpid == 953012 && l->grmode == 5);
+	l = dlm_lock_at(&di, l->next);
+	ck_assert(l != NULL && l->status == 1 && l->grmode == -1);
+	ck_assert(dlm_lock_at(&di, l->next) == NULL);
+
+	/* Enough resources to grow the hash table a few times */
+	for (i = 0; i < 10000; i++) {
+		sprintf(line, "%x 0 0 1 0 0 0 2 3 -1 0 0 24 \"%8u%16x\"", i, 2, i);
+		ck_assert(dlm_add_lock(&di, line) == 1);
+	}
+	for (i = 0; i < 10000; i++) {
+		r = dlm_find(&di, 2, i);
+		ck_assert(r != NULL && di.locks[r->first].lkb_id == i);
+	}
+
+	dlm_index_reset(&di);
+	ck_assert(dlm_find(&di, 9, 0x52c4a3699) == NULL);
+	dlm_index_free(&di);
+}
+END_TEST
+
+START_TEST(test_benchmark)
+{
+	struct bench_shape shape;
+	struct bench_result res;
+	char opts[] = "fs=2,glocks=5000,contended=5,waiters=3";
+
+	bench_shape_default(&shape);
+	ck_assert(bench_parse_shape(&shape, opts) == 0);
+	ck_assert(shape.filesystems == 2 && shape.glocks == 5000 &&
+		  shape.held == 40);
+
+	ck_assert(freopen("/dev/null", "w", stdout) != NULL);
+	ck_assert(run_benchmark(&shape, 3, &res) == 0);
+	ck_assert(res.iterations == 3);
+	ck_assert(res.glocks == 3 * 2 * 5000);
+	ck_assert(res.dlm_locks > 0 && res.dlm_locks % 3 == 0);
+	/* Memory kept from one report to the next is reused, not added to */
+	ck_assert(res.heap_last <= res.heap_first + 64 * 1024);
+}
+END_TEST
+
+START_TEST(test_bench_shape_invalid)
+{
+	struct bench_shape shape;
+	char unknown[] = "fs=2,bogus=1";
+	char range[] = "contended=101";
+	char number[] = "glocks=lots";
+
+	bench_shape_default(&shape);
+	ck_assert(bench_parse_shape(&shape, unknown) != 0);
+	ck_assert(bench_parse_shape(&shape, range) != 0);
+	ck_assert(bench_parse_shape(&shape, number) != 0);
+}
+END_TEST
+
+/* Report on each file system of a tree as if on a screen of @lines lines */
+static void report_tree(const char *dir, int lines)
+{
+	struct collection coll;
+	struct fs_snapshot *snap;
+
+	termlines = lines;
+	line = 0;
+	ck_assert(collect_start(&coll, dir, 1) == 0);
+	while ((snap = collect_next(&coll)))
+		report_fs(snap, 0, 0, 0, 0, NULL);
+	collect_finish(&coll);
+	termlines = 0;
+}
+
+START_TEST(test_stacks_full_screen)
+{
+	struct bench_shape shape;
+	char opts[] = "fs=1,glocks=1000,contended=5,waiters=1";
+	char dir[] = "/tmp/glocktop-check-XXXXXX";
+	uint64_t all;
+
+	bench_shape_default(&shape);
+	ck_assert(bench_parse_shape(&shape, opts) == 0);
+	ck_assert(bench_generate(dir, &shape) == 0);
+	ck_assert(freopen("/dev/null", "w", stdout) != NULL);
+	ck_assert(stacks_open("/dev/null") == 0);
+
+	report_tree(dir, 0);
+	all = stacks_tried();
+	/* Far more contended glocks than fit on the screen below */
+	ck_assert(all > 20);
+	report_tree(dir, 5);
+	ck_assert(stacks_tried() == 2 * all);
+
+	stacks_close();
+	bench_remove(dir, &shape);
+}
+END_TEST
+
+/* Export a glock with @waiters holders waiting for it */
+static void export_waited(struct export_rec *r, uint64_t number, unsigned waiters)
+{
+	static struct holder_info h[100];
+	struct glock_info gi = {
+		.type = 2,
+		.number = number,
+		.state = 'E',
+		.target = 'E',
+		.holders = h,
+		.nholders = waiters,
+	};
+	unsigned i;
+
+	for (i = 0; i < waiters; i++) {
+		h[i].fmask = FLAG_BIT('W');
+		h[i].state = 'E';
+		h[i].pid = 1000 + i;
+		h[i].pidstr = "1000 [worker]";
+		h[i].pidlen = 13;
+		h[i].caller = "gfs2_inode_lookup";
+	}
+	export_glock(r, &gi);
+}
+
+START_TEST(test_export_top)
+{
+	struct export_rec r;
+	uint64_t seen = 0;
+	unsigned i;
+
+	/* The two most contended first, then many barely contended ones */
+	export_start(&r, "fs", "host");
+	export_waited(&r, 1, 100);
+	export_waited(&r, 2, 50);
+	for (i = 0; i < 30; i++)
+		export_waited(&r, 10 + i, 1);
+	ck_assert_int_eq(r.ntop, EXPORT_TOP);
+	for (i = 0; i < r.ntop; i++)
+		if (r.top[i].number <= 2)
+			seen |= r.top[i].number;
+	ck_assert(seen == 3);
+
+	/* 1 to 40 waiters in no particular order keep 25 to 40 */
+	export_start(&r, "fs", "host");
+	for (i = 0; i < 40; i++)
+		export_waited(&r, i, (i * 17) % 40 + 1);
+	ck_assert_int_eq(r.glocks, 40);
+	ck_assert_int_eq(r.ntop, EXPORT_TOP);
+	for (i = 0, seen = 0; i < r.ntop; i++) {
+		ck_assert(r.top[i].waiters > 40 - EXPORT_TOP);
+		seen |= 1ULL << (r.top[i].waiters - 1);
+	}
+	ck_assert(seen == 0xffffULL << (40 - EXPORT_TOP));
+}
+END_TEST
+
+static Suite *suite_glocktop(void)
+{
+	Suite *s = suite_create("glocktop");
+	TCase *tc_dlm = tcase_create("dlm");
+	TCase *tc_bench = tcase_create("bench");
+	TCase *tc_stacks = tcase_create("stacks");
+	TCase *tc_export = tcase_create("export");
+
+	tcase_add_test(tc_dlm, test_dlm_index);
+	suite_add_tcase(s, tc_dlm);
+	tcase_add_test(tc_stacks, test_stacks_full_screen);
+	suite_add_tcase(s, tc_stacks);
+	tcase_add_test(tc_export, test_export_top);
+	suite_add_tcase(s, tc_export);
+	tcase_add_test(tc_bench, test_benchmark);
+	tcase_add_test(tc_bench, test_bench_shape_invalid);
+	tcase_set_timeout(tc_bench, 60);
+	suite_add_tcase(s, tc_bench);
+	return s;
+}
+
+int main(void)
+{
+	int failures;
+
+	SRunner *runner = srunner_create(suite_glocktop());
+	srunner_run_all(runner, CK_ENV);
+	failures = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "collect.h"
+
+/*
+ * Collection of each file system's debugfs files. Reading a glocks file
+ * with hundreds of thousands of glocks keeps the kernel busy formatting them
+ * for a good while, and with many file systems mounted, reading them one
+ * after the other can take longer than the refresh interval. So the files of
+ * each file system are read in full into a snapshot by a pool of collector
+ * threads, while the report is made from the snapshots in the order the
+ * file systems are listed in debugfs, each as soon as it has been read. A
+ * collector only starts on a file system other than the next one the report
+ * needs while the snapshots it hasn't taken yet hold less than COLLECT_AHEAD
+ * bytes, so the memory used is bounded by that and the files being read,
+ * rather than by how many glocks each file system has.
+ */
+
+#define READ_SIZE (256 * 1024) /* Starting size of each snapshot buffer */
+
+/* Read a whole file into @rd. Returns 0 on success or an errno. */
+static int read_file(struct gt_reader *rd, const char *path)
+{
+	int fd, ret = 0;
+
+	if (rd->buf == NULL && reader_init(rd, READ_SIZE))
+		return ENOMEM;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+	if (reader_slurp(rd, fd))
+		ret = ENOMEM;
+	close(fd);
+	return ret;
+}
+
+static void collect_fs(const struct collection *c, struct fs_snapshot *snap)
+{
+	struct timeval tv;
+	char *fn;
+
+	if (asprintf(&fn, "%s/dlm/%s_waiters", c->debugfs, snap->fsname) != -1) {
+		snap->have_waiters = read_file(&snap->dlm_waiters, fn) == 0;
+		free(fn);
+	}
+	if (c->dlm_locks &&
+	    asprintf(&fn, "%s/dlm/%s_locks", c->debugfs, snap->fsname) != -1) {
+		snap->have_locks = read_file(&snap->dlm_locks, fn) == 0;
+		free(fn);
+	}
+	snap->error = read_file(&snap->glocks, snap->glocks_path);
+	snap->bytes = snap->glocks.size + snap->dlm_waiters.size +
+		      snap->dlm_locks.size;
+	gettimeofday(&tv, NULL);
+	snap->time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void *collector(void *arg)
+{
+	struct collection *c = arg;
+
+	pthread_mutex_lock(&c->lock);
+	while (c->next_job < c->count) {
+		unsigned i = c->next_job;
+
+		if (i > c->next_out && c->ahead >= COLLECT_AHEAD) {
+			pthread_cond_wait(&c->cond, &c->lock);
+			continue;
+		}
+		c->next_job++;
+		pthread_mutex_unlock(&c->lock);
+		collect_fs(c, &c->snaps[i]);
+		pthread_mutex_lock(&c->lock);
+		c->ahead += c->snaps[i].bytes;
+		c->snaps[i].done = 1;
+		pthread_cond_broadcast(&c->cond);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+static int add_snapshot(struct collection *c, const char *debugfs,
+			const char *dirname)
+{
+	struct fs_snapshot *snap;
+
+	if ((c->count & (c->count - 1)) == 0) {
+		/* Doubles at each power of two */
+		struct fs_snapshot *s;
+
+		s = realloc(c->snaps, (c->count ? c->count * 2 : 4) * sizeof(*s));
+		if (s == NULL)
+			return -1;
+		c->snaps = s;
+	}
+	snap = &c->snaps[c->count];
+	memset(snap, 0, sizeof(*snap));
+	snap->dirname = strdup(dirname);
+	if (snap->dirname == NULL)
+		return -1;
+	snap->fsname = fs_name(snap->dirname);
+	if (asprintf(&snap->glocks_path, "%s/gfs2/%s/glocks", debugfs,
+		     dirname) == -1) {
+		free(snap->dirname);
+		return -1;
+	}
+	c->count++;
+	return 0;
+}
+
+/**
+ * collect_start - start reading the debugfs files of every file system
+ * @debugfs: where debugfs is mounted
+ * @dlm_locks: whether to read the dlm locks files as well as the waiters
+ *
+ * Returns: 0 on success, or -1 with errno set if the gfs2 debugfs directory
+ * couldn't be read or the collectors couldn't be started
+ */
+int collect_start(struct collection *c, const char *debugfs, int dlm_locks)
+{
+	struct dirent *dent;
+	sigset_t mask, old;
+	char *fn;
+	DIR *dir;
+
+	memset(c, 0, sizeof(*c));
+	c->debugfs = debugfs;
+	c->dlm_locks = dlm_locks;
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond, NULL);
+
+	if (asprintf(&fn, "%s/gfs2/", debugfs) == -1)
+		return -1;
+	dir = opendir(fn);
+	free(fn);
+	if (dir == NULL) {
+		int err = errno;
+
+		collect_finish(c);
+		errno = err;
+		return -1;
+	}
+	while ((dent = readdir(dir))) {
+		if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+			continue;
+		if (add_snapshot(c, debugfs, dent->d_name)) {
+			closedir(dir);
+			collect_finish(c);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	closedir(dir);
+
+	/* Signals, SIGINT in particular, must go to the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+	while (c->nthreads < COLLECT_THREADS && c->nthreads < c->count) {
+		if (pthread_create(&c->threads[c->nthreads], NULL, collector, c))
+			break;
+		c->nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (c->nthreads == 0 && c->count > 0) {
+		collect_finish(c);
+		errno = EAGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+static void snapshot_free(struct fs_snapshot *snap)
+{
+	free(snap->dirname);
+	snap->dirname = NULL;
+	free(snap->glocks_path);
+	snap->glocks_path = NULL;
+	reader_free(&snap->glocks);
+	reader_free(&snap->dlm_waiters);
+	reader_free(&snap->dlm_locks);
+}
+
+/**
+ * collect_next - wait for the next file system's snapshot
+ * The previous snapshot handed out is freed.
+ *
+ * Returns: the snapshot, or NULL when there are no more
+ */
+struct fs_snapshot *collect_next(struct collection *c)
+{
+	struct fs_snapshot *snap;
+
+	pthread_mutex_lock(&c->lock);
+	if (c->next_out > 0)
+		snapshot_free(&c->snaps[c->next_out - 1]);
+	if (c->next_out == c->count) {
+		pthread_mutex_unlock(&c->lock);
+		return NULL;
+	}
+	snap = &c->snaps[c->next_out++];
+	/* Let the collectors move on */
+	pthread_cond_broadcast(&c->cond);
+	while (!snap->done)
+		pthread_cond_wait(&c->cond, &c->lock);
+	c->ahead -= snap->bytes;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	return snap;
+}
+
+/**
+ * collect_finish - wait for the collectors and free the snapshots
+ * The collectors finish the snapshots they are reading but start no more.
+ */
+void collect_finish(struct collection *c)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&c->lock);
+	c->next_job = c->count;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	for (i = 0; i < c->nthreads; i++)
+		pthread_join(c->threads[i], NULL);
+	for (i = 0; i < c->count; i++)
+		snapshot_free(&c->snaps[i]);
+	free(c->snaps);
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->cond);
+	memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,45 @@
+#ifndef __COLLECT_DOT_H__
+#define __COLLECT_DOT_H__
+
+#include <pthread.h>
+#include "glocks.h"
+
+#define COLLECT_THREADS 8  /* Most file systems read at the same time */
+#define COLLECT_AHEAD   (64 << 20) /* Most bytes read but not handed out yet */
+
+/* The debugfs files of one file system, as read by a collector thread */
+struct fs_snapshot {
+	char *dirname;           /* Its directory in <debugfs>/gfs2/ */
+	const char *fsname;      /* The lock table's file system name */
+	char *glocks_path;
+	int error;               /* errno if the glocks file couldn't be read */
+	uint64_t time;           /* When it was read, in us since the epoch */
+	int have_waiters;        /* Whether each dlm file could be read */
+	int have_locks;
+	struct gt_reader glocks; /* Each file, read in full */
+	struct gt_reader dlm_waiters;
+	struct gt_reader dlm_locks;
+	size_t bytes;            /* Memory the files take up */
+	int done;
+};
+
+struct collection {
+	const char *debugfs;
+	int dlm_locks;           /* Whether to read the dlm locks files */
+	struct fs_snapshot *snaps;
+	unsigned count;
+	unsigned next_job;       /* Next snapshot for a collector to take */
+	unsigned next_out;       /* Next snapshot to hand out */
+	size_t ahead;            /* Bytes of the snapshots read but not out */
+	pthread_t threads[COLLECT_THREADS];
+	unsigned nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+extern int collect_start(struct collection *c, const char *debugfs,
+			 int dlm_locks);
+extern struct fs_snapshot *collect_next(struct collection *c);
+extern void collect_finish(struct collection *c);
+
+#endif /* __COLLECT_DOT_H__ */
@@ -0,0 +1,338 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include "correlate.h"
+
+/*
+ * Correlation of captures made on several nodes of a cluster. The glocks
+ * snapshots of all the captures are merged in time order, so the clocks of
+ * the nodes should be in step, and each file system is matched across the
+ * nodes by its lock table name. Each glock that any node holds exclusively
+ * or has waiters for gets one entry, in a hash table per file system, that
+ * the snapshots of every node update in turn: which node last held it
+ * exclusively, how many times that changed from one node to another, and
+ * once it is contended, how often each node held it or waited for it. A
+ * glock that keeps moving between nodes is what makes them take turns
+ * flushing and invalidating their caches, which no single node can see.
+ */
+
+extern const char *ltype[];
+
+static struct xfs *xfs_get(struct correlation *c, const char *name)
+{
+	struct xfs *fs, **fsp;
+
+	for (fsp = &c->fs; *fsp != NULL; fsp = &(*fsp)->next)
+		if (strcmp((*fsp)->name, name) == 0)
+			return *fsp;
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL)
+		return NULL;
+	fs->name = strdup(name);
+	fs->nbuckets = 4096;
+	fs->hash = calloc(fs->nbuckets, sizeof(*fs->hash));
+	if (fs->name == NULL || fs->hash == NULL) {
+		free(fs->name);
+		free(fs->hash);
+		free(fs);
+		return NULL;
+	}
+	*fsp = fs;
+	return fs;
+}
+
+static unsigned hash_xglock(const struct xfs *fs, unsigned type,
+			    uint64_t number)
+{
+	uint64_t h = (number ^ ((uint64_t)type << 56)) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (fs->nbuckets - 1);
+}
+
+static void grow_hash(struct xfs *fs)
+{
+	unsigned nbuckets = fs->nbuckets * 2;
+	struct xglock **hash = calloc(nbuckets, sizeof(*hash));
+	struct xglock **old = fs->hash;
+	unsigned i;
+
+	if (hash == NULL)
+		return;
+	fs->hash = hash;
+	fs->nbuckets = nbuckets;
+	for (i = 0; i < nbuckets / 2; i++) {
+		while (old[i] != NULL) {
+			struct xglock *xg = old[i];
+			unsigned b = hash_xglock(fs, xg->type, xg->number);
+
+			old[i] = xg->next;
+			xg->next = hash[b];
+			hash[b] = xg;
+		}
+	}
+	free(old);
+}
+
+static struct xglock *find_xglock(struct xfs *fs, unsigned type,
+				  uint64_t number, int create)
+{
+	unsigned b = hash_xglock(fs, type, number);
+	struct xglock *xg;
+
+	for (xg = fs->hash[b]; xg != NULL; xg = xg->next)
+		if (xg->number == number && xg->type == type)
+			return xg;
+	if (!create)
+		return NULL;
+	if (fs->count >= fs->nbuckets) {
+		grow_hash(fs);
+		b = hash_xglock(fs, type, number);
+	}
+	xg = calloc(1, sizeof(*xg));
+	if (xg == NULL)
+		return NULL;
+	xg->type = type;
+	xg->number = number;
+	xg->ex_node = -1;
+	xg->next = fs->hash[b];
+	fs->hash[b] = xg;
+	fs->count++;
+	return xg;
+}
+
+/* Merge one node's snapshot of a file system's glocks */
+static void correlate_snapshot(struct correlation *c, struct xfs *fs,
+			       unsigned node, struct gt_reader *rd)
+{
+	struct glock_info *gi = &c->gi;
+
+	while (glock_next(rd, gi)) {
+		unsigned waiters = 0, i;
+		struct xglock *xg;
+		int ex;
+
+		for (i = 0; i < gi->nholders; i++)
+			if (holder_is_waiter(&gi->holders[i]))
+				waiters++;
+		ex = gi->state == 'E';
+		if (!ex && !waiters && gi->state != 'S' && gi->state != 'D')
+			continue;
+		xg = find_xglock(fs, gi->type, gi->number, ex || waiters);
+		if (xg == NULL)
+			continue;
+		if (ex && xg->ex_node != (int)node) {
+			if (xg->ex_node >= 0)
+				xg->bounces++;
+			xg->ex_node = node;
+		}
+		xg->waiters += waiters;
+		if (xg->nodes == NULL && (waiters || xg->bounces))
+			xg->nodes = calloc(c->nnodes, sizeof(*xg->nodes));
+		if (xg->nodes != NULL) {
+			struct node_stats *ns = &xg->nodes[node];
+
+			if (ex)
+				ns->ex++;
+			else if (gi->state == 'S' || gi->state == 'D')
+				ns->shared++;
+			if (waiters) {
+				ns->waited++;
+				if (waiters > ns->peak)
+					ns->peak = waiters;
+			}
+		}
+	}
+}
+
+/* Move a node on to its next glocks snapshot */
+static void advance(struct correlation *c, unsigned node)
+{
+	struct capture *cap = c->caps[node];
+	int ret;
+
+	while ((ret = capture_read(cap)) == 1)
+		if (cap->kind == CAPTURE_GLOCKS) {
+			c->pending[node] = 1;
+			return;
+		}
+	if (ret < 0)
+		fprintf(stderr, "%s: capture is truncated or corrupt; "
+			"correlating what could be read\n", cap->path);
+	c->pending[node] = 0;
+}
+
+static int cmp_xglocks(const void *p1, const void *p2)
+{
+	const struct xglock *a = *(const struct xglock **)p1;
+	const struct xglock *b = *(const struct xglock **)p2;
+
+	if (a->bounces != b->bounces)
+		return a->bounces < b->bounces ? 1 : -1;
+	if (a->waiters != b->waiters)
+		return a->waiters < b->waiters ? 1 : -1;
+	return 0;
+}
+
+static void print_xglock(const struct correlation *c, const struct xglock *xg)
+{
+	double secs = (c->end - c->start) / 1000000.0;
+	char id[48];
+	unsigned n;
+
+	snprintf(id, sizeof(id), "%s %"PRIx64,
+		 xg->type < GLOCK_TYPES - 1 ? ltype[xg->type] : ltype[0],
+		 xg->number);
+	printf("  %-24s %6u %8.1f %8"PRIu64" ", id, xg->bounces,
+	       secs > 0 ? xg->bounces * 60 / secs : 0.0, xg->waiters);
+	for (n = 0; xg->nodes != NULL && n < c->nnodes; n++) {
+		const struct node_stats *ns = &xg->nodes[n];
+
+		if (!ns->ex && !ns->shared && !ns->waited)
+			continue;
+		printf(" %s %u/%u/%u", c->caps[n]->host, ns->ex, ns->shared,
+		       ns->waited);
+		if (ns->peak > 1)
+			printf("(%u)", ns->peak);
+	}
+	printf("\n");
+}
+
+static void print_xfs(const struct correlation *c, const struct xfs *fs)
+{
+	struct xglock **sorted;
+	unsigned i, n = 0, moved = 0;
+
+	sorted = malloc((fs->count ? fs->count : 1) * sizeof(*sorted));
+	if (sorted == NULL)
+		return;
+	for (i = 0; i < fs->nbuckets; i++) {
+		struct xglock *xg;
+
+		for (xg = fs->hash[i]; xg != NULL; xg = xg->next) {
+			if (xg->bounces)
+				moved++;
+			if (xg->nodes != NULL)
+				sorted[n++] = xg;
+		}
+	}
+	printf("\n@ %s: %u glocks held exclusively or waited for, %u moved "
+	       "between nodes\n", fs->name, fs->count, moved);
+	if (n > 0) {
+		qsort(sorted, n, sizeof(*sorted), cmp_xglocks);
+		printf("  %-24s %6s %8s %8s  %s\n", "Glock", "Moves", "Per min",
+		       "Waiters", "Node EX/SH/waited(peak waiters)");
+		for (i = 0; i < n && i < CORRELATE_TOP; i++)
+			print_xglock(c, sorted[i]);
+	}
+	free(sorted);
+}
+
+static void correlation_free(struct correlation *c)
+{
+	unsigned i;
+
+	while (c->fs != NULL) {
+		struct xfs *fs = c->fs;
+
+		for (i = 0; i < fs->nbuckets; i++) {
+			while (fs->hash[i] != NULL) {
+				struct xglock *xg = fs->hash[i];
+
+				fs->hash[i] = xg->next;
+				free(xg->nodes);
+				free(xg);
+			}
+		}
+		c->fs = fs->next;
+		free(fs->hash);
+		free(fs->name);
+		free(fs);
+	}
+	for (i = 0; i < c->nnodes; i++)
+		capture_close(c->caps[i]);
+	glock_info_free(&c->gi);
+	free(c);
+}
+
+/**
+ * correlate_captures - correlate the captures of several nodes and print
+ * which glocks moved between them
+ *
+ * Returns: 0 on success or -1 if a capture couldn't be read
+ */
+int correlate_captures(char **paths, unsigned npaths)
+{
+	struct correlation *c;
+	char t1[64], t2[64];
+	struct xfs *fs;
+	time_t t;
+	unsigned i;
+
+	if (npaths > CORRELATE_NODES) {
+		fprintf(stderr, "Error: at most %d captures can be correlated\n",
+			CORRELATE_NODES);
+		return -1;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		perror("Failed to allocate correlation");
+		return -1;
+	}
+	for (i = 0; i < npaths; i++) {
+		c->caps[i] = capture_open(paths[i]);
+		if (c->caps[i] == NULL) {
+			fprintf(stderr, "%s: %s\n", paths[i], errno == EINVAL ?
+				"not a glocktop capture file" : strerror(errno));
+			correlation_free(c);
+			return -1;
+		}
+		c->nnodes++;
+	}
+	for (i = 0; i < c->nnodes; i++)
+		advance(c, i);
+
+	while (1) {
+		int node = -1;
+
+		/* The earliest snapshot not merged yet */
+		for (i = 0; i < c->nnodes; i++)
+			if (c->pending[i] && (node < 0 ||
+			    c->caps[i]->time < c->caps[node]->time))
+				node = i;
+		if (node < 0)
+			break;
+		if (c->snapshots++ == 0)
+			c->start = c->caps[node]->time;
+		c->end = c->caps[node]->time;
+		fs = xfs_get(c, c->caps[node]->name);
+		if (fs == NULL) {
+			perror("Failed to allocate correlation");
+			break;
+		}
+		correlate_snapshot(c, fs, node, &c->caps[node]->data);
+		advance(c, node);
+	}
+
+	if (c->snapshots == 0) {
+		printf("No glock snapshots\n");
+	} else {
+		t = c->start / 1000000;
+		strftime(t1, sizeof(t1), "%a %b %d %T %Y", localtime(&t));
+		t = c->end / 1000000;
+		strftime(t2, sizeof(t2), "%a %b %d %T %Y", localtime(&t));
+		printf("Glocks across %u nodes from %s to %s:", c->nnodes, t1, t2);
+		for (i = 0; i < c->nnodes; i++)
+			printf(" %s", c->caps[i]->host);
+		printf("\n");
+		for (fs = c->fs; fs != NULL; fs = fs->next)
+			print_xfs(c, fs);
+	}
+	correlation_free(c);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __CORRELATE_DOT_H__
+#define __CORRELATE_DOT_H__
+
+#include <stdint.h>
+#include "glocks.h"
+#include "capture.h"
+
+#define CORRELATE_NODES 64 /* Most captures correlated at once */
+#define CORRELATE_TOP   20 /* Glocks listed for each file system */
+
+/* What one node did with a glock over the captures */
+struct node_stats {
+	uint32_t ex;      /* Snapshots it held the glock exclusively in */
+	uint32_t shared;  /* ...or in a shared or deferred state */
+	uint32_t waited;  /* Snapshots it had waiters in */
+	uint32_t peak;    /* Most waiters in any one snapshot */
+};
+
+/* A glock held exclusively or waited for on some node */
+struct xglock {
+	struct xglock *next;      /* Hash chain */
+	uint64_t number;
+	unsigned type;
+	int ex_node;              /* Node last seen holding it exclusively */
+	unsigned bounces;         /* Times that moved to another node */
+	uint64_t waiters;         /* Sum of the waiters in all snapshots */
+	struct node_stats *nodes; /* For each node, once it is contended */
+};
+
+/* A file system, known by its lock table name on every node */
+struct xfs {
+	struct xfs *next;
+	char *name;
+	struct xglock **hash;
+	unsigned nbuckets;
+	unsigned count;
+};
+
+struct correlation {
+	unsigned nnodes;
+	struct capture *caps[CORRELATE_NODES];
+	int pending[CORRELATE_NODES]; /* Node has a glocks record to merge */
+	unsigned snapshots;
+	uint64_t start;               /* Time of the first and last snapshots */
+	uint64_t end;
+	struct xfs *fs;
+	struct glock_info gi;
+};
+
+extern int correlate_captures(char **paths, unsigned npaths);
+
+#endif /* __CORRELATE_DOT_H__ */
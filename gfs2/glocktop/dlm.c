@@ -0,0 +1,225 @@
+#include "clusterautoconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dlm.h"
+
+/*
+ * Index of the dlm locks and waiters files of a file system. Each line is
+ * parsed once as the file is read and its lock is chained onto the resource
+ * it names, so showing the dlm state of a glock is a hash lookup by the
+ * glock's type and number rather than a scan of every line, and there is no
+ * limit on how many lines are kept. Records refer to each other by index
+ * into arrays that only grow, so resetting the index for the next refresh
+ * keeps its memory for reuse.
+ */
+
+static uint32_t hash_res(const struct dlm_index *di, unsigned type,
+			 uint64_t number)
+{
+	uint64_t h = (number ^ ((uint64_t)type << 56)) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (di->nbuckets - 1);
+}
+
+static int grow_hash(struct dlm_index *di)
+{
+	uint32_t nbuckets = di->nbuckets ? di->nbuckets * 2 : 1024;
+	uint32_t *hash = malloc(nbuckets * sizeof(*hash));
+	uint32_t i;
+
+	if (hash == NULL)
+		return -1;
+	memset(hash, 0xff, nbuckets * sizeof(*hash));
+	free(di->hash);
+	di->hash = hash;
+	di->nbuckets = nbuckets;
+	for (i = 0; i < di->nres; i++) {
+		uint32_t b = hash_res(di, di->res[i].type, di->res[i].number);
+
+		di->res[i].next = hash[b];
+		hash[b] = i;
+	}
+	return 0;
+}
+
+static struct dlm_res *get_res(struct dlm_index *di, unsigned type,
+			       uint64_t number)
+{
+	struct dlm_res *r;
+	uint32_t b, i;
+
+	if (di->nbuckets) {
+		b = hash_res(di, type, number);
+		for (i = di->hash[b]; i != DLM_NONE; i = di->res[i].next)
+			if (di->res[i].number == number && di->res[i].type == type)
+				return &di->res[i];
+	}
+	if (di->nres == di->maxres) {
+		uint32_t max = di->maxres ? di->maxres * 2 : 1024;
+
+		r = realloc(di->res, max * sizeof(*r));
+		if (r == NULL)
+			return NULL;
+		di->res = r;
+		di->maxres = max;
+	}
+	if (di->nres >= di->nbuckets && grow_hash(di))
+		return NULL;
+	b = hash_res(di, type, number);
+	r = &di->res[di->nres];
+	r->type = type;
+	r->number = number;
+	r->first = r->last = DLM_NONE;
+	r->waiting = 0;
+	r->next = di->hash[b];
+	di->hash[b] = di->nres++;
+	return r;
+}
+
+/* Parse the next number of a line, which must be followed by a space */
+static int field(const char **p, int base, long long *val)
+{
+	char *end;
+
+	*val = strtoll(*p, &end, base);
+	if (end == *p || *end != ' ')
+		return -1;
+	*p = end;
+	return 0;
+}
+
+/* Parse a gfs2 resource name, the glock's type and number in hex */
+static int res_name(const char *p, unsigned *type, uint64_t *number)
+{
+	char *end;
+
+	*type = strtoul(p, &end, 10);
+	if (end == p)
+		return -1;
+	p = end;
+	*number = strtoull(p, &end, 16);
+	if (end == p)
+		return -1;
+	return 0;
+}
+
+/**
+ * dlm_index_reset - empty an index, keeping its memory for the next files
+ */
+void dlm_index_reset(struct dlm_index *di)
+{
+	di->nres = 0;
+	di->nlocks = 0;
+	if (di->hash != NULL)
+		memset(di->hash, 0xff, di->nbuckets * sizeof(*di->hash));
+}
+
+void dlm_index_free(struct dlm_index *di)
+{
+	free(di->res);
+	free(di->locks);
+	free(di->hash);
+	memset(di, 0, sizeof(*di));
+}
+
+/**
+ * dlm_add_lock - index a line of the dlm locks file
+ *
+ * The columns are: lkb_id n remid pid x e f s g rq u n ln res_name
+ *
+ * Returns: 1 if the line was a lock, 0 if it wasn't (the heading), or -1 if
+ * memory ran out
+ */
+int dlm_add_lock(struct dlm_index *di, const char *line)
+{
+	long long v[13];
+	struct dlm_lock *l;
+	struct dlm_res *r;
+	const int base[13] = {16, 10, 16, 10, 10, 16, 16, 10, 10, 10, 10, 10, 10};
+	const char *p = line;
+	uint64_t number;
+	unsigned type;
+	int i;
+
+	for (i = 0; i < 13; i++)
+		if (field(&p, base[i], &v[i]))
+			return 0;
+	p = strchr(p, '"');
+	if (p == NULL || res_name(p + 1, &type, &number))
+		return 0;
+
+	if (di->nlocks == di->maxlocks) {
+		uint32_t max = di->maxlocks ? di->maxlocks * 2 : 1024;
+
+		l = realloc(di->locks, max * sizeof(*l));
+		if (l == NULL)
+			return -1;
+		di->locks = l;
+		di->maxlocks = max;
+	}
+	r = get_res(di, type, number);
+	if (r == NULL)
+		return -1;
+	l = &di->locks[di->nlocks];
+	l->next = DLM_NONE;
+	l->lkb_id = v[0];
+	l->nodeid = v[1];
+	l->ownpid = v[3];
+	l->status = v[7];
+	l->grmode = v[8];
+	if (r->last == DLM_NONE)
+		r->first = di->nlocks;
+	else
+		di->locks[r->last].next = di->nlocks;
+	r->last = di->nlocks++;
+	return 1;
+}
+
+/**
+ * dlm_add_waiter - index a line of the dlm waiters file
+ *
+ * The columns are: lkb_id wait_type nodeid and the resource name, unquoted
+ *
+ * Returns: 1 if the line was a waiter, 0 if it wasn't, or -1 if memory ran out
+ */
+int dlm_add_waiter(struct dlm_index *di, const char *line)
+{
+	const char *p = line;
+	struct dlm_res *r;
+	uint64_t number;
+	unsigned type;
+	long long v;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (field(&p, i ? 10 : 16, &v))
+			return 0;
+	if (res_name(p, &type, &number))
+		return 0;
+	r = get_res(di, type, number);
+	if (r == NULL)
+		return -1;
+	r->waiting++;
+	return 1;
+}
+
+/**
+ * dlm_find - look up the dlm resource of a glock
+ *
+ * Returns: the resource, or NULL if neither file named it
+ */
+const struct dlm_res *dlm_find(const struct dlm_index *di, unsigned type,
+			       uint64_t number)
+{
+	uint32_t i;
+
+	if (di->nbuckets == 0)
+		return NULL;
+	for (i = di->hash[hash_res(di, type, number)]; i != DLM_NONE;
+	     i = di->res[i].next)
+		if (di->res[i].number == number && di->res[i].type == type)
+			return &di->res[i];
+	return NULL;
+}
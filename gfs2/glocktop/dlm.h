@@ -0,0 +1,53 @@
+#ifndef __DLM_DOT_H__
+#define __DLM_DOT_H__
+
+#include <stdint.h>
+
+#define DLM_NONE UINT32_MAX /* End of a chain of records */
+
+/* One lock of a dlm resource, from a line of the dlm locks file */
+struct dlm_lock {
+	uint32_t next;     /* Next lock of the same resource */
+	uint32_t lkb_id;
+	uint32_t nodeid;   /* The lkb's node, 0 if it is local */
+	uint32_t ownpid;
+	int status;
+	int grmode;
+};
+
+/* A dlm resource, named for the glock it belongs to */
+struct dlm_res {
+	uint32_t next;     /* Hash chain */
+	uint32_t first;    /* Its locks, in the order they were listed */
+	uint32_t last;
+	uint32_t waiting;  /* Lines of the dlm waiters file naming it */
+	uint64_t number;
+	unsigned type;
+};
+
+/* Both dlm files of one file system, indexed by resource */
+struct dlm_index {
+	struct dlm_res *res;
+	uint32_t nres;
+	uint32_t maxres;
+	struct dlm_lock *locks;
+	uint32_t nlocks;
+	uint32_t maxlocks;
+	uint32_t *hash;
+	uint32_t nbuckets;
+};
+
+extern void dlm_index_reset(struct dlm_index *di);
+extern void dlm_index_free(struct dlm_index *di);
+extern int dlm_add_lock(struct dlm_index *di, const char *line);
+extern int dlm_add_waiter(struct dlm_index *di, const char *line);
+extern const struct dlm_res *dlm_find(const struct dlm_index *di,
+				      unsigned type, uint64_t number);
+
+static inline const struct dlm_lock *dlm_lock_at(const struct dlm_index *di,
+						 uint32_t i)
+{
+	return i == DLM_NONE ? NULL : &di->locks[i];
+}
+
+#endif /* __DLM_DOT_H__ */
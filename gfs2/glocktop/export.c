@@ -0,0 +1,293 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <endian.h>
+
+#include "export.h"
+
+/*
+ * Export of each report as a record that a collector can read, instead of
+ * text meant for people: newline-delimited JSON or a stream of binary
+ * records laid out as described in export.h. A record holds the totals that
+ * print_summary() shows, the dlm counts and the most contended glocks of one
+ * file system, with their holders and waiters.
+ */
+
+static const char *type_names[GLOCK_TYPES - 1] = {
+	"unknown", "nondisk", "inode", "rgrp", "meta", "iopen", "flock",
+	"plock", "quota", "journal"
+};
+
+static const char *stype_names[stypes] = {
+	"all", "locked", "held_ex", "held_sh", "held_df", "has_waiter",
+	"waiters"
+};
+
+int export_parse_format(const char *str)
+{
+	if (strcmp(str, "json") == 0)
+		return EXPORT_JSON;
+	if (strcmp(str, "binary") == 0)
+		return EXPORT_BINARY;
+	return -1;
+}
+
+void export_start(struct export_rec *r, const char *fsname,
+		  const char *hostname)
+{
+	memset(r, 0, sizeof(*r));
+	r->fsname = fsname;
+	r->hostname = hostname;
+	gettimeofday(&r->tv, NULL);
+}
+
+static int more_contended(const struct export_glock *a, unsigned waiters,
+			  long long demote_time)
+{
+	if (waiters != a->waiters)
+		return waiters > a->waiters;
+	return demote_time > a->demote_time;
+}
+
+static void copy_str(char *dst, size_t size, const char *src, size_t len)
+{
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+/**
+ * export_glock - count a glock and keep it if it is one of the most contended
+ */
+void export_glock(struct export_rec *r, const struct glock_info *gi)
+{
+	struct export_glock *eg;
+	unsigned waiters = 0, holders = 0, i;
+
+	r->glocks++;
+	glock_count(gi, r->totals);
+
+	for (i = 0; i < gi->nholders; i++) {
+		if (holder_is_waiter(&gi->holders[i]))
+			waiters++;
+		else if (holder_is_holder(&gi->holders[i]))
+			holders++;
+	}
+	if (waiters == 0 && gi->demote_time == 0)
+		return;
+
+	/* The glocks kept aren't sorted; replace the least contended */
+	if (r->ntop < EXPORT_TOP) {
+		eg = &r->top[r->ntop++];
+	} else {
+		eg = &r->top[0];
+		for (i = 1; i < EXPORT_TOP; i++)
+			if (more_contended(&r->top[i], eg->waiters,
+					   eg->demote_time))
+				eg = &r->top[i];
+		if (!more_contended(eg, waiters, gi->demote_time))
+			return;
+	}
+	eg->type = gi->type;
+	eg->number = gi->number;
+	eg->state = gi->state;
+	eg->target = gi->target;
+	eg->demote_time = gi->demote_time;
+	eg->waiters = waiters;
+	eg->holders = holders;
+	eg->nholders = 0;
+	for (i = 0; i < gi->nholders && eg->nholders < EXPORT_HOLDERS; i++) {
+		const struct holder_info *h = &gi->holders[i];
+		struct export_holder *eh = &eg->h[eg->nholders++];
+
+		eh->pid = h->pid;
+		eh->state = h->state;
+		eh->flags = (holder_is_holder(h) ? EXPORT_H_HELD : 0) |
+			    (holder_is_waiter(h) ? EXPORT_H_WAITING : 0);
+		holder_comm(h, eh->comm, sizeof(eh->comm));
+		copy_str(eh->caller, sizeof(eh->caller), h->caller,
+			 strlen(h->caller));
+	}
+}
+
+static int cmp_top(const void *p1, const void *p2)
+{
+	const struct export_glock *a = p1;
+	const struct export_glock *b = p2;
+
+	if (more_contended(a, b->waiters, b->demote_time))
+		return 1;
+	if (more_contended(b, a->waiters, a->demote_time))
+		return -1;
+	return 0;
+}
+
+static void json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static const char *state_str(char state)
+{
+	switch (state) {
+	case 'E': return "EX";
+	case 'S': return "SH";
+	case 'D': return "DF";
+	case 'U': return "UN";
+	}
+	return "";
+}
+
+static void write_json(FILE *f, const struct export_rec *r)
+{
+	unsigned i, j;
+
+	fprintf(f, "{\"time\": %lld.%06ld, \"host\": ",
+		(long long)r->tv.tv_sec, (long)r->tv.tv_usec);
+	json_str(f, r->hostname);
+	fprintf(f, ", \"fs\": ");
+	json_str(f, r->fsname);
+	fprintf(f, ", \"glocks\": %u, \"dlm\": {\"waiters\": %u, "
+		"\"grants\": %u}, \"types\": {", r->glocks, r->dlm_waiters,
+		r->dlm_grants);
+	for (i = 1; i < GLOCK_TYPES - 1; i++) {
+		fprintf(f, "%s\"%s\": {", i > 1 ? ", " : "", type_names[i]);
+		for (j = 0; j < stypes; j++)
+			fprintf(f, "%s\"%s\": %d", j ? ", " : "", stype_names[j],
+				r->totals[i][j]);
+		fputc('}', f);
+	}
+	fprintf(f, "}, \"top\": [");
+	for (i = 0; i < r->ntop; i++) {
+		const struct export_glock *eg = &r->top[i];
+
+		fprintf(f, "%s{\"type\": \"%s\", \"number\": \"%"PRIx64"\", "
+			"\"state\": \"%s\", \"target\": \"%s\", "
+			"\"demote_us\": %lld, \"waiters\": %u, \"holders\": %u, "
+			"\"queue\": [", i ? ", " : "", type_names[eg->type],
+			eg->number, state_str(eg->state),
+			state_str(eg->target), eg->demote_time, eg->waiters,
+			eg->holders);
+		for (j = 0; j < eg->nholders; j++) {
+			const struct export_holder *eh = &eg->h[j];
+
+			fprintf(f, "%s{\"pid\": %ld, \"state\": \"%s\", "
+				"\"held\": %s, \"waiting\": %s, \"comm\": ",
+				j ? ", " : "", eh->pid, state_str(eh->state),
+				eh->flags & EXPORT_H_HELD ? "true" : "false",
+				eh->flags & EXPORT_H_WAITING ? "true" : "false");
+			json_str(f, eh->comm);
+			fprintf(f, ", \"caller\": ");
+			json_str(f, eh->caller);
+			fputc('}', f);
+		}
+		fprintf(f, "]}");
+	}
+	fprintf(f, "]}\n");
+}
+
+static char *put8(char *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static char *put16(char *p, uint16_t v)
+{
+	v = htole16(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static char *put32(char *p, uint32_t v)
+{
+	v = htole32(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static char *put64(char *p, uint64_t v)
+{
+	v = htole64(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static int write_binary(FILE *f, const struct export_rec *r)
+{
+	/* Big enough for the largest possible record */
+	static char buf[64 + 255 + sizeof(r->totals) +
+			EXPORT_TOP * (24 + EXPORT_HOLDERS * 6)];
+	size_t namelen = strlen(r->fsname);
+	char *p = buf + 8;
+	unsigned i, j;
+
+	if (namelen > 255)
+		namelen = 255;
+	p = put64(p, (uint64_t)r->tv.tv_sec * 1000000 + r->tv.tv_usec);
+	p = put32(p, r->glocks);
+	p = put32(p, r->dlm_waiters);
+	p = put32(p, r->dlm_grants);
+	p = put8(p, namelen);
+	memcpy(p, r->fsname, namelen);
+	p += namelen;
+	for (i = 0; i < GLOCK_TYPES - 1; i++)
+		for (j = 0; j < stypes; j++)
+			p = put32(p, r->totals[i][j]);
+	p = put8(p, r->ntop);
+	for (i = 0; i < r->ntop; i++) {
+		const struct export_glock *eg = &r->top[i];
+
+		p = put8(p, eg->type);
+		p = put8(p, eg->state);
+		p = put8(p, eg->target);
+		p = put8(p, eg->nholders);
+		p = put64(p, eg->number);
+		p = put64(p, eg->demote_time);
+		p = put16(p, eg->waiters > UINT16_MAX ? UINT16_MAX : eg->waiters);
+		p = put16(p, eg->holders > UINT16_MAX ? UINT16_MAX : eg->holders);
+		for (j = 0; j < eg->nholders; j++) {
+			p = put32(p, eg->h[j].pid);
+			p = put8(p, eg->h[j].state);
+			p = put8(p, eg->h[j].flags);
+		}
+	}
+	put32(buf, EXPORT_MAGIC);
+	put32(buf + 4, p - buf - 8);
+	if (fwrite(buf, p - buf, 1, f) != 1)
+		return -1;
+	return 0;
+}
+
+/**
+ * export_write - write a record and flush it to the collector
+ * The most contended glocks are written first, so @r's glocks are sorted.
+ *
+ * Returns: 0 on success or -1 if the record could not be written
+ */
+int export_write(FILE *f, int format, struct export_rec *r)
+{
+	qsort(r->top, r->ntop, sizeof(r->top[0]), cmp_top);
+	if (format == EXPORT_JSON)
+		write_json(f, r);
+	else if (write_binary(f, r))
+		return -1;
+	if (fflush(f) != 0 || ferror(f))
+		return -1;
+	return 0;
+}
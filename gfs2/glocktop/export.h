@@ -0,0 +1,73 @@
+#ifndef __EXPORT_DOT_H__
+#define __EXPORT_DOT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "glocks.h"
+
+#define EXPORT_TOP     16 /* Most contended glocks in each record */
+#define EXPORT_HOLDERS 16 /* Holders and waiters kept for each of them */
+
+enum export_format {
+	EXPORT_NONE = 0,
+	EXPORT_JSON = 1,
+	EXPORT_BINARY = 2,
+};
+
+/*
+ * Binary records are a stream of little-endian fields:
+ *
+ *   u32 EXPORT_MAGIC, u32 length of the rest of the record,
+ *   u64 time in microseconds since the epoch,
+ *   u32 glocks, u32 dlm waiters, u32 dlm grants,
+ *   u8 length of the file system name, then the name,
+ *   u32 totals[GLOCK_TYPES - 1][stypes], indexed as in print_summary,
+ *   u8 number of glocks that follow, then for each glock:
+ *     u8 type, char state, char target, u8 holders that follow,
+ *     u64 number, u64 demote time (us), u16 waiters, u16 holders,
+ *     then for each holder: u32 pid, char state, u8 EXPORT_H_* flags.
+ */
+#define EXPORT_MAGIC 0x58544c47 /* "GLTX" */
+#define EXPORT_H_HELD    0x01
+#define EXPORT_H_WAITING 0x02
+
+struct export_holder {
+	long pid;
+	char state;
+	uint8_t flags;
+	char comm[16];
+	char caller[64];
+};
+
+struct export_glock {
+	unsigned type;
+	uint64_t number;
+	char state;
+	char target;
+	long long demote_time;
+	unsigned waiters;
+	unsigned holders;
+	unsigned nholders; /* In h[] */
+	struct export_holder h[EXPORT_HOLDERS];
+};
+
+struct export_rec {
+	const char *fsname;
+	const char *hostname;
+	struct timeval tv;
+	unsigned glocks;
+	unsigned dlm_waiters;
+	unsigned dlm_grants;
+	int totals[GLOCK_TYPES][stypes];
+	unsigned ntop;
+	struct export_glock top[EXPORT_TOP];
+};
+
+extern int export_parse_format(const char *str);
+extern void export_start(struct export_rec *r, const char *fsname,
+			 const char *hostname);
+extern void export_glock(struct export_rec *r, const struct glock_info *gi);
+extern int export_write(FILE *f, int format, struct export_rec *r);
+
+#endif /* __EXPORT_DOT_H__ */
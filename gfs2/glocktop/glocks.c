@@ -0,0 +1,456 @@
+#include "clusterautoconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "glocks.h"
+
+/*
+ * Parsing of the debugfs glocks file. The file is read a large chunk at a
+ * time and each glock is parsed once, in place, into a glock_info whose
+ * lines and fields point into the read buffer. Only the unparsed part of a
+ * glock left at the end of a chunk is moved before the next read, and the
+ * buffer grows in the unlikely case that one glock doesn't fit in it.
+ */
+
+int reader_init(struct gt_reader *rd, size_t size)
+{
+	memset(rd, 0, sizeof(*rd));
+	rd->buf = malloc(size);
+	if (rd->buf == NULL)
+		return -1;
+	rd->size = size;
+	rd->fd = -1;
+	return 0;
+}
+
+void reader_free(struct gt_reader *rd)
+{
+	free(rd->buf);
+	rd->buf = NULL;
+	rd->size = 0;
+}
+
+void reader_start(struct gt_reader *rd, int fd)
+{
+	rd->fd = fd;
+	rd->start = rd->scan = rd->end = 0;
+	rd->eof = 0;
+	rd->buf[0] = '\0';
+}
+
+/* Keep the data not handed out yet and read some more after it. There is
+   always room to terminate the data, so that the last line needs no '\n'. */
+static void reader_fill(struct gt_reader *rd)
+{
+	ssize_t n;
+
+	if (rd->start > 0) {
+		memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+		rd->end -= rd->start;
+		rd->scan -= rd->start;
+		rd->start = 0;
+	}
+	if (rd->end + 1 >= rd->size) {
+		char *buf = realloc(rd->buf, rd->size * 2);
+
+		if (buf == NULL) {
+			rd->eof = 1;
+			return;
+		}
+		rd->buf = buf;
+		rd->size *= 2;
+	}
+	do {
+		n = read(rd->fd, rd->buf + rd->end, rd->size - rd->end - 1);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		rd->eof = 1;
+	else
+		rd->end += n;
+	rd->buf[rd->end] = '\0';
+}
+
+/**
+ * reader_slurp - read a whole file into the buffer
+ * The file can then be parsed with reader_line() or glock_next() as usual.
+ *
+ * Returns: 0 on success or -1 if the buffer couldn't be made big enough
+ */
+int reader_slurp(struct gt_reader *rd, int fd)
+{
+	reader_start(rd, fd);
+	while (!rd->eof) {
+		if (rd->end + 1 >= rd->size) {
+			char *buf = realloc(rd->buf, rd->size * 2);
+
+			if (buf == NULL)
+				return -1;
+			rd->buf = buf;
+			rd->size *= 2;
+		}
+		reader_fill(rd);
+	}
+	rd->fd = -1;
+	return 0;
+}
+
+/**
+ * reader_preload - make room for @len bytes of a file held elsewhere
+ * The caller copies the file to rd->buf, after which it can be parsed with
+ * reader_line() or glock_next() as usual.
+ *
+ * Returns: 0 on success or -1 if the buffer couldn't be made big enough
+ */
+int reader_preload(struct gt_reader *rd, size_t len)
+{
+	if (len + 1 > rd->size) {
+		char *buf = realloc(rd->buf, len + 1);
+
+		if (buf == NULL)
+			return -1;
+		rd->buf = buf;
+		rd->size = len + 1;
+	}
+	rd->fd = -1;
+	rd->start = rd->scan = 0;
+	rd->end = len;
+	rd->eof = 1;
+	rd->buf[len] = '\0';
+	return 0;
+}
+
+/**
+ * reader_line - return the next line of the file, without its line ending
+ * Blank lines are skipped. The line is only valid until the next call.
+ *
+ * Returns: the line, or NULL at the end of the file
+ */
+char *reader_line(struct gt_reader *rd)
+{
+	while (1) {
+		char *ln = rd->buf + rd->start;
+		char *nl = memchr(rd->buf + rd->scan, '\n', rd->end - rd->scan);
+
+		if (nl != NULL) {
+			rd->start = rd->scan = nl + 1 - rd->buf;
+			*nl = '\0';
+			if (nl > ln && nl[-1] == '\r')
+				nl[-1] = '\0';
+			if (*ln == '\0')
+				continue;
+			return ln;
+		}
+		if (rd->eof) {
+			if (rd->start == rd->end)
+				return NULL;
+			rd->start = rd->scan = rd->end;
+			return ln;
+		}
+		rd->scan = rd->end;
+		reader_fill(rd);
+	}
+}
+
+/* strtoull() is slow enough to show up here, and needs no locale support */
+static uint64_t parse_num(const char *p, const char **end, int hex)
+{
+	uint64_t n = 0;
+
+	for (;; p++) {
+		unsigned d;
+
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if (hex && *p >= 'a' && *p <= 'f')
+			d = *p - 'a' + 10;
+		else
+			break;
+		n = n * (hex ? 16 : 10) + d;
+	}
+	if (end != NULL)
+		*end = p;
+	return n;
+}
+
+static uint64_t flag_mask(const char *flags, int n)
+{
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		mask |= FLAG_BIT(flags[i]);
+	return mask;
+}
+
+/* G:  s:SH n:2/805b f:lDpiIqob t:SH d:EX/0 a:0 v:0 r:3 m:200 p:1 */
+static void parse_glock_line(struct glock_info *gi, const char *ln)
+{
+	const char *p = ln + 2;
+
+	gi->line = ln;
+	gi->type = 0;
+	gi->number = 0;
+	gi->state = gi->target = '\0';
+	gi->flags = NULL;
+	gi->nflags = 0;
+	gi->fmask = 0;
+	gi->demote_time = 0;
+
+	while (*p != '\0') {
+		const char *tok, *val, *slash, *end;
+
+		while (*p == ' ')
+			p++;
+		tok = p;
+		while (*p != '\0' && *p != ' ')
+			p++;
+		if (p - tok < 2 || tok[1] != ':')
+			continue;
+		val = tok + 2;
+		switch (tok[0]) {
+		case 's':
+			gi->state = *val;
+			break;
+		case 't':
+			gi->target = *val;
+			break;
+		case 'n':
+			gi->type = parse_num(val, &end, 0);
+			if (*end == '/')
+				gi->number = parse_num(end + 1, NULL, 1);
+			if (gi->type >= GLOCK_TYPES - 1)
+				gi->type = 0;
+			break;
+		case 'f':
+			gi->flags = val;
+			gi->nflags = p - val;
+			gi->fmask = flag_mask(val, gi->nflags);
+			break;
+		case 'd':
+			slash = memchr(val, '/', p - val);
+			if (slash != NULL)
+				gi->demote_time = parse_num(slash + 1, NULL, 0);
+			/* Nothing after the demote time is needed */
+			return;
+		}
+	}
+}
+
+/*  H: s:EX f:H e:0 p:1234 [gfs2_quotad] gfs2_statfs_sync+0x4f/0x1a0 [gfs2] */
+static void parse_holder_line(struct holder_info *h, const char *ln)
+{
+	const char *p = ln + 3;
+
+	h->line = ln;
+	h->state = '\0';
+	h->fmask = 0;
+	h->pid = 0;
+	h->pidstr = "";
+	h->pidlen = 0;
+	h->caller = "";
+
+	while (*p != '\0') {
+		const char *tok, *val, *bracket;
+
+		while (*p == ' ')
+			p++;
+		tok = p;
+		while (*p != '\0' && *p != ' ')
+			p++;
+		if (p - tok < 2 || tok[1] != ':')
+			continue;
+		val = tok + 2;
+		switch (tok[0]) {
+		case 's':
+			h->state = *val;
+			break;
+		case 'f':
+			h->fmask = flag_mask(val, p - val);
+			break;
+		case 'p':
+			/* The pid is followed by the command, which may contain
+			   spaces, and then the caller */
+			h->pid = parse_num(val, NULL, 0);
+			h->pidstr = val;
+			bracket = strchr(val, ']');
+			if (bracket == NULL) {
+				h->pidlen = strlen(val);
+				return;
+			}
+			h->pidlen = bracket + 1 - val;
+			h->caller = bracket + 1;
+			while (*h->caller == ' ')
+				h->caller++;
+			return;
+		}
+	}
+}
+
+static int add_line(struct glock_info *gi, const char *ln)
+{
+	if (gi->nsublines == gi->maxsublines) {
+		unsigned max = gi->maxsublines ? gi->maxsublines * 2 : 16;
+		const char **l = realloc(gi->sublines, max * sizeof(*l));
+
+		if (l == NULL)
+			return -1;
+		gi->sublines = l;
+		gi->maxsublines = max;
+	}
+	gi->sublines[gi->nsublines++] = ln;
+	if (!line_is_holder(ln))
+		return 0;
+
+	if (gi->nholders == gi->maxholders) {
+		unsigned max = gi->maxholders ? gi->maxholders * 2 : 16;
+		struct holder_info *h = realloc(gi->holders, max * sizeof(*h));
+
+		if (h == NULL)
+			return -1;
+		gi->holders = h;
+		gi->maxholders = max;
+	}
+	parse_holder_line(&gi->holders[gi->nholders++], ln);
+	return 0;
+}
+
+/* Split a glock's lines in place and parse them */
+static int parse_glock(struct glock_info *gi, char *buf, size_t len)
+{
+	char *end = buf + len;
+	char *ln, *nl;
+
+	if (len < 2 || buf[0] != 'G' || buf[1] != ':')
+		return -1;
+
+	gi->nsublines = gi->nholders = 0;
+	for (ln = buf; ln < end; ln = nl + 1) {
+		nl = memchr(ln, '\n', end - ln);
+		if (nl == NULL)
+			nl = end; /* Last line of the file */
+		*nl = '\0';
+		if (nl > ln && nl[-1] == '\r')
+			nl[-1] = '\0';
+
+		if (ln == buf)
+			parse_glock_line(gi, ln);
+		else if (*ln == '\0' ||
+			 (ln[0] == ' ' && ln[1] == ' ' && ln[2] == ' '))
+			continue;
+		else if (add_line(gi, ln))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * glock_next - parse the next glock in the file
+ * @rd: the reader, started on the glocks file
+ * @gi: filled in with the glock and its holders, which point into the read
+ *      buffer and are only valid until the next call
+ *
+ * Returns: 1 if a glock was parsed or 0 at the end of the file
+ */
+int glock_next(struct gt_reader *rd, struct glock_info *gi)
+{
+	while (1) {
+		char *gl = rd->buf + rd->start;
+		char *next;
+		size_t len;
+
+		/* A glock ends where the next one starts */
+		next = memmem(rd->buf + rd->scan, rd->end - rd->scan, "\nG:", 3);
+		if (next != NULL) {
+			len = next + 1 - gl;
+		} else if (rd->eof) {
+			len = rd->end - rd->start;
+			if (len == 0)
+				return 0;
+		} else {
+			/* Look again at the last bytes, which may be the
+			   start of the next glock */
+			rd->scan = rd->end - rd->start > 2 ? rd->end - 2 : rd->start;
+			reader_fill(rd);
+			continue;
+		}
+		rd->start += len;
+		rd->scan = rd->start;
+		if (parse_glock(gi, gl, len) == 0)
+			return 1;
+	}
+}
+
+/* The command of a holder, from between the brackets after its pid */
+void holder_comm(const struct holder_info *h, char *comm, size_t size)
+{
+	const char *start = memchr(h->pidstr, '[', h->pidlen);
+	const char *end = h->pidstr + h->pidlen;
+	size_t len;
+
+	comm[0] = '\0';
+	if (start == NULL)
+		return;
+	start++;
+	if (end > start && end[-1] == ']')
+		end--;
+	len = end - start;
+	if (len >= size)
+		len = size - 1;
+	memcpy(comm, start, len);
+	comm[len] = '\0';
+}
+
+/* The file system name from a gfs2 debugfs directory name, cluster:fsname */
+const char *fs_name(const char *dirname)
+{
+	const char *fsname = strchr(dirname, ':');
+
+	if (fsname)
+		return fsname + 1;
+	return dirname;
+}
+
+void glock_info_free(struct glock_info *gi)
+{
+	free(gi->sublines);
+	free(gi->holders);
+	memset(gi, 0, sizeof(*gi));
+}
+
+/**
+ * glock_count - add a glock to the summary totals
+ */
+void glock_count(const struct glock_info *gi, int totals[GLOCK_TYPES][stypes])
+{
+	int waiters = 0, ex = 0, sh = 0, df = 0;
+	unsigned i;
+
+	totals[gi->type][all]++;
+	if (gi->state != 'U')
+		totals[gi->type][locked]++;
+
+	for (i = 0; i < gi->nholders; i++) {
+		const struct holder_info *h = &gi->holders[i];
+
+		if (holder_is_waiter(h))
+			waiters++;
+		else if (!holder_is_holder(h))
+			continue;
+		else if (h->state == 'E')
+			ex = 1;
+		else if (h->state == 'S')
+			sh = 1;
+		else
+			df = 1;
+	}
+	if (waiters) {
+		totals[gi->type][tot_waiters] += waiters;
+		totals[gi->type][has_waiter]++;
+	}
+	totals[gi->type][held_ex] += ex;
+	totals[gi->type][held_sh] += sh;
+	totals[gi->type][held_df] += df;
+}
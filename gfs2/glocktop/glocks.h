@@ -0,0 +1,103 @@
+#ifndef __GLOCKS_DOT_H__
+#define __GLOCKS_DOT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Bit for a flag letter in the f: field of a glock or holder line */
+#define FLAG_BIT(c) ((c) >= 'a' && (c) <= 'z' ? 1ULL << ((c) - 'a') : \
+		     (c) >= 'A' && (c) <= 'Z' ? 1ULL << ((c) - 'A' + 26) : 0)
+
+enum summary_types {
+	all = 0,
+	locked = 1,
+	held_ex = 2,
+	held_sh = 3,
+	held_df = 4,
+	has_waiter = 5,
+	tot_waiters = 6,
+	stypes = 7,
+};
+
+#define GLOCK_TYPES 11 /* Lock types 0 to 9 and a total */
+
+/*
+ * A buffer that a debugfs file is read into a chunk at a time. Lines and
+ * glocks are handed out in place, so they are only valid until the next one
+ * is asked for.
+ */
+struct gt_reader {
+	char *buf;
+	size_t size;  /* Size of buf */
+	size_t start; /* Start of the data not handed out yet */
+	size_t scan;  /* Where to carry on looking for the end of a glock */
+	size_t end;   /* End of the data read so far */
+	int fd;
+	int eof;
+};
+
+struct holder_info {
+	const char *line;   /* The whole line */
+	char state;         /* First letter of the state requested: E, S, D, U */
+	uint64_t fmask;     /* FLAG_BIT()s of the holder flags */
+	long pid;
+	const char *pidstr; /* "<pid> [<command>]", not terminated */
+	int pidlen;
+	const char *caller; /* The function that queued the holder */
+};
+
+struct glock_info {
+	const char *line;   /* The G: line */
+	unsigned type;
+	uint64_t number;
+	char state;         /* First letters of the s: and t: states */
+	char target;
+	const char *flags;  /* The glock flag letters, not terminated */
+	int nflags;
+	uint64_t fmask;     /* FLAG_BIT()s of the glock flags */
+	long long demote_time;
+	/* Every line after the G: line, holders included */
+	const char **sublines;
+	unsigned nsublines;
+	unsigned maxsublines;
+	struct holder_info *holders;
+	unsigned nholders;
+	unsigned maxholders;
+};
+
+extern int reader_init(struct gt_reader *rd, size_t size);
+extern void reader_free(struct gt_reader *rd);
+extern void reader_start(struct gt_reader *rd, int fd);
+extern int reader_slurp(struct gt_reader *rd, int fd);
+extern int reader_preload(struct gt_reader *rd, size_t len);
+extern char *reader_line(struct gt_reader *rd);
+
+extern int glock_next(struct gt_reader *rd, struct glock_info *gi);
+extern void glock_info_free(struct glock_info *gi);
+extern const char *fs_name(const char *dirname);
+extern void holder_comm(const struct holder_info *h, char *comm, size_t size);
+extern void glock_count(const struct glock_info *gi,
+			int totals[GLOCK_TYPES][stypes]);
+
+static inline int holder_is_holder(const struct holder_info *h)
+{
+	return (h->fmask & FLAG_BIT('H')) != 0;
+}
+
+static inline int holder_is_waiter(const struct holder_info *h)
+{
+	return (h->fmask & FLAG_BIT('W')) != 0;
+}
+
+/* Lines in a glock dump that are reservations and holders */
+static inline int line_is_holder(const char *ln)
+{
+	return ln[0] == ' ' && ln[1] == 'H';
+}
+
+static inline int line_is_resv(const char *ln)
+{
+	return ln[0] == ' ' && ln[2] == 'B' && ln[3] == ':';
+}
+
+#endif /* __GLOCKS_DOT_H__ */
@@ -24,10 +24,21 @@
 #include <errno.h>
 #include <libgfs2.h>
 
+#include "glocks.h"
+#include "sample.h"
+#include "export.h"
+#include "pathcache.h"
+#include "collect.h"
+#include "capture.h"
+#include "analyze.h"
+#include "correlate.h"
+#include "dlm.h"
+#include "bench.h"
+#include "stacks.h"
+
 #define MAX_GLOCKS 20
-#define MAX_LINES 6000
-#define MAX_FILES 512
 #define MAX_CALLTRACE_LINES 4
+#define TOP_GLOCKS 10
 #define TITLE1 "glocktop - GFS2 glock monitor"
 #define TITLE2 "Press <ctrl-c> or <escape> to exit"
 
@@ -132,17 +143,6 @@
 #define DETAILS  0x00000001
 #define FRIENDLY 0x00000002
 
-enum summary_types {
-	all = 0,
-	locked = 1,
-	held_ex = 2,
-	held_sh = 3,
-	held_df = 4,
-	has_waiter = 5,
-	tot_waiters = 6,
-	stypes = 7,
-};
-
 char *debugfs;
 int termcols = 80, termlines = 30, done = 0;
 unsigned glocks = 0;
@@ -159,25 +159,19 @@ struct mount_point {
 	struct gfs2_sb sb;
 };
 struct mount_point *mounts;
-char dlmwlines[MAX_LINES][96]; /* waiters lines */
-char dlmglines[MAX_LINES][97]; /* granted lines */
-char contended_filenames[MAX_FILES][PATH_MAX];
-unsigned long long contended_blocks[MAX_FILES];
-int contended_count = 0;
+struct dlm_index dlm; /* The dlm files of the file system being shown */
 int line = 0;
 const char *prog_name;
 char dlm_dirtbl_size[32], dlm_rsbtbl_size[32], dlm_lkbtbl_size[32];
 int bsize = 0;
 char print_dlm_grants = 1;
-char *gbuf = NULL; /* glocks buffer */
-char *gpos = NULL;
-char *gnextpos = NULL;
-int gmaxpos = 0;
-
-char *dbuf = NULL; /* dlm locks buffer */
-char *dpos = NULL;
-char *dnextpos = NULL;
-int dmaxpos = 0;
+struct gt_reader rd; /* For the glocks and dlm locks files */
+struct glock_info ginfo; /* Each glock as it is parsed */
+int sample_ms = 0; /* Interval between contention samples */
+int export_format = EXPORT_NONE; /* Records on stdout instead of a report */
+struct export_rec export;
+const char *ltype[] = {"N/A", "non-disk", "inode", "rgrp", "meta", "i_open",
+		       "flock", "posix lock", "quota", "journal"};
 char hostname[256];
 
 /*
@@ -454,77 +448,21 @@ static int bobgets(char string[], int x, int y, int sz, int *ch)
 	return rc;
 }/* bobgets */
 
-static char *bufgets(int fd, char *bigbuf, char **nextpos, char **pos,
-		     int *maxpos)
-{
-	if (*nextpos == NULL) {
-		*maxpos = read(fd, bigbuf, bufsize - 1);
-		bigbuf[bufsize - 1] = '\0';
-		if (*maxpos == 0)
-			return NULL;
-		*pos = bigbuf;
-	} else
-		*pos = *nextpos;
-
-	*nextpos = memchr(*pos, '\n', (bigbuf + *maxpos) - *pos);
-	while (*nextpos && (**nextpos == '\n' || **nextpos == '\r') &&
-	       *nextpos < bigbuf + (bufsize - 1)) {
-		**nextpos = '\0';
-		(*nextpos)++;
-	}
-	if (*nextpos >= bigbuf + *maxpos)
-		*nextpos = NULL;
-	return *pos;
-}
-
-static char *glock_number(const char *str)
+static int this_glock_requested(const struct glock_info *gi)
 {
-	const char *glockid;
-	char *p;
-	static char id[32];
-
-	glockid = strchr(str, '/');
-	if (glockid == NULL)
-		return NULL;
-	glockid++;
-	strncpy(id, glockid, sizeof(id));
-	id[31] = '\0';
-	p = strchr(id, ' ');
-	if (p)
-		*p = '\0';
-	return id;
-}
-
-static int this_glock_requested(const char *str)
-{
-	const char *glockid;
+	char id[32];
 	int i;
 
 	if (!glocks)
 		return 0;
 
-	glockid = glock_number(str);
-	if (glockid == NULL)
-		return 0;
+	sprintf(id, "%"PRIx64, gi->number);
 	for (i = 0; i < glocks; i++)
-		if (!strcmp(glockid, glock[i]))
+		if (!strcmp(id, glock[i]))
 			return 1;
 	return 0;
 }
 
-static int is_iopen(const char *str)
-{
-	char *p;
-
-	p = strchr(str, '/');
-	if (p == NULL)
-		return 0;
-	p--;
-	if (*p == '5')
-		return 1;
-	return 0;
-}
-
 static int this_lkb_requested(const char *str)
 {
 	int i;
@@ -572,14 +510,14 @@ void print_it(const char *label, const char *fmt, const char *fmt2, ...)
 	va_end(args);
 }
 
+/* Print the path of a directory if it is known yet. It is looked up in the
+   background, so that a big directory doesn't hold up the display. */
 static void display_filename(int fd, unsigned long long block,
-			     unsigned long long dirarray[256], int subdepth)
+			     uint64_t generation)
 {
 	struct mount_point *mp;
-	int i, subs;
-	char blk[32];
-	DIR *dir = NULL;
-	struct dirent *dent;
+	struct path_mount pm;
+	char path[PATH_MAX];
 
 	for (mp = mounts; mp != NULL; mp = mp->next) {
 		if (fd == mp->fd)
@@ -587,30 +525,20 @@ static void display_filename(int fd, unsigned long long block,
 	}
 	if (mp == NULL)
 		return;
-	for (i = 0; i < contended_count; i++) {
-		if (contended_blocks[i] == block) {
-			break;
-		}
-	}
-	sprintf(blk, "%lld", block);
-	if (i >= contended_count) {
-		memset(contended_filenames[i], 0, PATH_MAX);
-		strcat(contended_filenames[i], mp->dir);
-		for (subs = subdepth - 2; subs >= 0; subs--) {
-			dir = opendir(contended_filenames[i]);
-			while ((dent = readdir(dir))) {
-				if (dent->d_ino == dirarray[subs]) {
-					strcat(contended_filenames[i], "/");
-					strcat(contended_filenames[i],
-					       dent->d_name);
-					break;
-				}
-			}
-			closedir(dir);
-		}
+	pm.fd = fd;
+	pm.dir = mp->dir;
+	pm.bsize = bsize;
+	switch (pathcache_get(&pm, block, generation, path, sizeof(path))) {
+	case PATH_FOUND:
+		print_it(NULL, "%s", NULL, path);
+		break;
+	case PATH_PENDING:
+		print_it(NULL, "%s/(looking up path)", NULL, mp->dir);
+		break;
+	default:
+		print_it(NULL, "%s/(path not found)", NULL, mp->dir);
+		break;
 	}
-
-	print_it(NULL, "%s", NULL, contended_filenames[i]);
 	eol(0);
 }
 
@@ -621,30 +549,11 @@ static const char *show_inode(const char *id, int fd, unsigned long long block)
 	struct gfs2_sbd sbd = { .device_fd = fd, .bsize = bsize };
 
 	ip = lgfs2_inode_read(&sbd, block);
+	if (ip == NULL)
+		return "";
 	if (S_ISDIR(ip->i_di.di_mode)) {
-		struct gfs2_inode *parent;
-		unsigned long long dirarray[256];
-		int subdepth = 0, error;
-
 		inode_type = "directory ";
-		dirarray[0] = block;
-		subdepth++;
-		/* Backtrack the directory to its source */
-		while (1) {
-			error = gfs2_lookupi(ip, "..", 2, &parent);
-			if (error)
-				break;
-			/* Stop at the root inode */
-			if (ip->i_di.di_num.no_addr ==
-			    parent->i_di.di_num.no_addr) {
-				inode_put(&parent);
-				break;
-			}
-			inode_put(&ip);
-			ip = parent;
-			dirarray[subdepth++] = parent->i_di.di_num.no_addr;
-		}
-		display_filename(fd, block, dirarray, subdepth);
+		display_filename(fd, block, ip->i_di.di_generation);
 	} else if (S_ISREG(ip->i_di.di_mode)) {
 		inode_type = "file ";
 	} else if (S_ISLNK(ip->i_di.di_mode)) {
@@ -750,57 +659,43 @@ out_err:
 	return "error";
 }
 
-static int is_dlm_waiting(int dlmwaiters, int locktype, char *id)
+static int is_dlm_waiting(unsigned locktype, uint64_t number)
 {
-	int i;
-	int dlmid, wait_type, nodeid, type;
-	char locknum[32];
+	const struct dlm_res *r = dlm_find(&dlm, locktype, number);
 
-	for (i = 0; i < dlmwaiters && i < 100; i++) {
-		sscanf(dlmwlines[i], "%x %d %d        %d         %s",
-		       &dlmid, &wait_type, &nodeid, &type, locknum);
-		if ((type == locktype) && (!strcmp(locknum, id)))
-			return 1;
-	}
-	return 0;
+	return r != NULL && r->waiting;
 }
 
-static const char *friendly_state(const char *glock_line, const char *search)
+static const char *friendly_state(char state)
 {
-	const char *p;
-
-	p = strstr(glock_line, search);
-
-	if (p == NULL)
+	if (state == '\0')
 		return "Dazed";
-
-	p += 2;
-	if (*p == 'E')
+	else if (state == 'E')
 		return "Exclusive";
-	else if (*p == 'S')
+	else if (state == 'S')
 		return "Shared";
-	else if (*p == 'U')
+	else if (state == 'U')
 		return "Unlocked";
-	else if (*p == 'D')
+	else if (state == 'D')
 		return "Deferred";
 	else
 		return "Confused";
 }
 
-static const char *friendly_gflags(const char *glock_line)
+static const char *friendly_gflags(const struct glock_info *gi)
 {
 	static char flagout[PATH_MAX];
-	const char *p;
+	int i;
 
 	memset(flagout, 0, sizeof(flagout));
 
-	p = strstr(glock_line, "f:");
-	if (!p)
+	if (gi->flags == NULL)
 		return " ";
-	p += 2;
 	strcpy(flagout, "[");
-	while (*p != ' ') {
-		switch (*p) {
+	for (i = 0; i < gi->nflags; i++) {
+		char next = (i + 1 < gi->nflags) ? gi->flags[i + 1] : ' ';
+
+		switch (gi->flags[i]) {
 		case 'l':
 			/*strcat(flagout, "Locked");*/
 			break;
@@ -847,27 +742,26 @@ static const char *friendly_gflags(const char *glock_line)
 			strcat(flagout, "Unknown");
 			break;
 		}
-		if ((strlen(flagout)) > 1 && (!strchr(" lIo", *(p + 1))))
+		if ((strlen(flagout)) > 1 && (!strchr(" lIo", next)))
 			strcat(flagout, ", ");
-		p++;
 	}
 	strcat(flagout, "]");
 	return flagout;
 }
 
-static const char *friendly_glock(const char *glock_line, char prefix)
+static const char *friendly_glock(const struct glock_info *gi, char prefix)
 {
 	static char gline[PATH_MAX];
 
 	if (prefix == 'W')
 		sprintf(gline, "Is:%s, Want:%s   %s",
-			friendly_state(glock_line, "s:"),
-			friendly_state(glock_line, "t:"),
-			friendly_gflags(glock_line));
+			friendly_state(gi->state),
+			friendly_state(gi->target),
+			friendly_gflags(gi));
 	else
 		sprintf(gline, "Held:%s   %s",
-			friendly_state(glock_line, "s:"),
-			friendly_gflags(glock_line));
+			friendly_state(gi->state),
+			friendly_gflags(gi));
 	return gline;
 }
 
@@ -926,72 +820,41 @@ static const char *getprocname(int ownpid)
 	return procname;
 }
 
-static void show_dlm_grants(int locktype, const char *g_line, int dlmgrants,
-			    int summary)
+static void show_dlm_grants(unsigned locktype, uint64_t number, int summary)
 {
-	int i;
-	char dlm_resid[75];
-	unsigned int lkb_id, lkbnodeid, remid, ownpid, exflags, flags, status;
-	unsigned int grmode, rqmode, nodeid, length;
-	unsigned long long xid, us;
-	char trgt_res_name[64], res_name[64], *p1, *p2;
+	const struct dlm_res *r = dlm_find(&dlm, locktype, number);
+	const struct dlm_lock *l;
 	const char *procname;
 
-	p1 = strchr(g_line, '/');
-	if (!p1)
+	if (r == NULL)
 		return;
-	p1++;
-	p2 = strchr(p1, ' ');
-	if (!p2)
-		return;
-	memset(trgt_res_name, 0, sizeof(trgt_res_name));
-	memcpy(trgt_res_name, p1, p2 - p1);
-	sprintf(dlm_resid, "%8d%16s", locktype, trgt_res_name);
-	for (i = 0; i < dlmgrants; i++) {
-/*
-lkb_id  n   remid  pid x e f s g rq u n ln res_name 1234567890123456
-1100003 1 2ae0006 8954 0 0 0 2 5 -1 0 1 24 "       2           102ab"
-2a20001 1 30d0001 8934 0 0 0 2 3 -1 0 1 24 "       5           102ab"
-  b0001 2  860001 8868 0 0 10000 2 3 -1 0 0 24 "       1               2"
-2450001 2 1be0002 8962 0 0 10000 1 -1 5 12214 0 24 "       2           102ab"
-*/
-		p1 = strchr(dlmglines[i], '\"');
-		if (!p1)
-			continue;
-		p1++;
-		if (strncmp(dlm_resid, p1, 24))
-			continue;
-
-		sscanf(dlmglines[i], "%x %d %x %u %llu %x %x %d %d %d %llu "
-		       "%u %d \"%24s\"\n",
-		       &lkb_id, &lkbnodeid, &remid, &ownpid, &xid, &exflags,
-		       &flags, &status, &grmode, &rqmode, &us, &nodeid,
-		       &length, res_name);
-		if (status == 1) { /* Waiting */
-			if (!lkbnodeid)
-				procname = getprocname(ownpid);
+	for (l = dlm_lock_at(&dlm, r->first); l != NULL;
+	     l = dlm_lock_at(&dlm, l->next)) {
+		if (l->status == 1) { /* Waiting */
+			if (!l->nodeid)
+				procname = getprocname(l->ownpid);
 			else
 				procname = "";
 			if (summary)
 				print_it(NULL, " (", NULL);
 			else
 				print_it(NULL, "  D: ", NULL);
-			print_it(NULL, "%s for %s, pid %d %s", NULL,
-				 dlm_status(status), dlm_nodeid(lkbnodeid),
-				 ownpid, procname);
+			print_it(NULL, "%s for %s, pid %u %s", NULL,
+				 dlm_status(l->status), dlm_nodeid(l->nodeid),
+				 l->ownpid, procname);
 			if (summary)
 				print_it(NULL, ")", NULL);
-		} else if (grmode == 0) {
+		} else if (l->grmode == 0) {
 			continue; /* ignore "D: Granted NL on node X" */
 		} else {
-			procname = getprocname(ownpid);
+			procname = getprocname(l->ownpid);
 			if (summary)
 				print_it(NULL, " (", NULL);
 			else
 				print_it(NULL, "  D: ", NULL);
-			print_it(NULL, "%s %s on %s to pid %d %s", NULL,
-				 dlm_status(status), dlm_grtype(grmode),
-				 dlm_nodeid(lkbnodeid), ownpid, procname);
+			print_it(NULL, "%s %s on %s to pid %u %s", NULL,
+				 dlm_status(l->status), dlm_grtype(l->grmode),
+				 dlm_nodeid(l->nodeid), l->ownpid, procname);
 			if (summary)
 				print_it(NULL, ")", NULL);
 		}
@@ -1000,22 +863,13 @@ lkb_id  n   remid  pid x e f s g rq u n ln res_name 1234567890123456
 	}
 }
 
-static void print_call_trace(const char *hline)
+static void print_call_trace(const struct holder_info *h)
 {
-	char *p, *pid, tmp[32], stackfn[64], str[96];
+	char *p, stackfn[64], str[96];
 	FILE *fp;
 	int i;
 
-	p = strchr(hline, 'p');
-	if (!p)
-		return;
-	pid = p + 2;
-	p = strchr(pid, ' ');
-	if (!p)
-		return;
-	memset(tmp, 0, sizeof(tmp));
-	memcpy(tmp, pid, p - pid);
-	sprintf(stackfn, "/proc/%s/stack", tmp);
+	sprintf(stackfn, "/proc/%ld/stack", h->pid);
 	fp = fopen(stackfn, "rt");
 	if (fp == NULL)
 		return;
@@ -1041,115 +895,34 @@ static void print_call_trace(const char *hline)
 	fclose(fp);
 }
 
-static int is_ex(const char *hline)
-{
-	if (strncmp(hline, " H: s:EX ", 9) == 0)
-		return 1;
-	return 0;
-}
-
-static int has_holder_flag(const char *hline, char flag)
-{
-	const char *p;
-
-	p = strchr(hline, 'f');
-	if (p == NULL)
-		return 0;
-	p++;
-	if (*p != ':')
-		return 0;
-	p++;
-	while (*p != '\0') {
-		if (*p == ' ')
-			return 0;
-		if (*p == flag)
-			return 1;
-		p++;
-	}
-	return 0;
-}
-
-static int is_holder(const char *hline)
-{
-	return has_holder_flag(hline, 'H');
-}
-
-static int is_waiter(const char *hline)
-{
-	return has_holder_flag(hline, 'W');
-}
-
-static int get_lock_type(const char *str)
-{
-	const char *p;
-
-	p = strchr(str, '/');
-	return (p ? (*(p - 1)) - '0' : 0);
-}
-
-static long long get_demote_time(const char *str)
-{
-	char *p;
-	char tmp[80];
-
-	p = strchr(str, '/');
-	if (p == NULL)
-		return 0;
-	p++;
-	p = strchr(p, '/');
-	if (p == NULL)
-		return 0;
-	p++;
-	strncpy(tmp, p, 79);
-	tmp[79] = '\0';
-	p = strchr(tmp, ' ');
-	if (p == NULL)
-		return 0;
-	*p = '\0';
-	return atoll(tmp);
-}
-
-static const char *pid_string(const char *str)
-{
-	char *p;
-	static char pidstr[80];
-
-	memset(pidstr, 0, sizeof(pidstr));
-	p = strchr(str, 'p');
-	if (p) {
-		strncpy(pidstr, p + 2, sizeof(pidstr));
-		pidstr[79] = '\0';
-		p = strchr(pidstr, ']');
-		if (p) {
-			p++;
-			*p = '\0';
-		}
-	}
-	return pidstr;
-}
-
 /* If this glock is relevant, return 0, else the reason it's irrelevant */
-static int irrelevant(const char *holder, const char *glockstr)
+static int irrelevant(const struct holder_info *h, const struct glock_info *gi)
 {
-	int lock_type = get_lock_type(glockstr);
-
 	/* Exclude shared and locks */
-	if (!is_ex(holder))
+	if (h == NULL || h->state != 'E')
 		return 1;
 	/* Exclude locks held at mount time: statfs*/
-	if (strstr(holder, "init_per_node"))
+	if (strstr(h->caller, "init_per_node"))
 		return 2;
-	if (strstr(holder, "init_journal"))
+	if (strstr(h->caller, "init_journal"))
 		return 3;
-	if (strstr(holder, "init_inodes"))
+	if (strstr(h->caller, "init_inodes"))
 		return 4;
-	if (strstr(holder, "fill_super"))
+	if (strstr(h->caller, "fill_super"))
 		return 5;
-	if (lock_type == 9) /* Exclude journal locks */
+	if (gi->type == 9) /* Exclude journal locks */
 		return 6;
 	return 0;
 }
 
+/* Holders are dumped first, so the first holder is the glock's first line */
+static const struct holder_info *first_holder(const struct glock_info *gi)
+{
+	if (gi->nholders && gi->sublines[0] == gi->holders[0].line)
+		return &gi->holders[0];
+	return NULL;
+}
+
 static const char *reason(int why)
 {
 	const char *reasons[] = {"(N/A:------)",  /* 0 */
@@ -1163,9 +936,9 @@ static const char *reason(int why)
 	return reasons[why];
 }
 
-static void print_friendly_prefix(char one_glocks_lines[MAX_LINES][97])
+static void print_friendly_prefix(const struct glock_info *gi)
 {
-	int why = irrelevant(one_glocks_lines[1], one_glocks_lines[0]);
+	int why = irrelevant(first_holder(gi), gi);
 
 	if (why)
 		print_it(NULL, "  U: %s ", NULL, reason(why));
@@ -1173,145 +946,118 @@ static void print_friendly_prefix(char one_glocks_lines[MAX_LINES][97])
 		print_it(NULL, "  U: ", NULL);
 }
 
-static void show_glock(char one_glocks_lines[MAX_LINES][97], int gline,
-		       const char *fsname, int dlmwaiters, int dlmgrants,
-		       int trace_dir_path, int prev_had_waiter, int flags,
-		       int summary)
+static void show_glock(const struct glock_info *gi, const char *fsname,
+		       int dlmwaiters, int dlmgrants, int trace_dir_path,
+		       int prev_had_waiter, int flags, int summary)
 {
-	int i, locktype = 0;
-	char id[33], *p;
+	unsigned i, hi;
+	char id[33];
 	char extras[80], prefix = '\0';
-	long long demote_time = 0;
-	const char *ltype[] = {"N/A", "non-disk", "inode", "rgrp", "meta",
-			       "i_open", "flock", "posix lock", "quota",
-			       "journal"};
 
 	if (termlines) {
-		if (irrelevant(one_glocks_lines[1], one_glocks_lines[0]))
+		if (irrelevant(first_holder(gi), gi))
 			COLORS_HELD;
 		else
 			COLORS_NORMAL;
 	}
-	if (!gline)
-		return;
 
 	memset(extras, 0, sizeof(extras));
-	p = strchr(one_glocks_lines[0], '/');
-	memset(id, 0, sizeof(id));
-
-	if (p) {
-		locktype = get_lock_type(one_glocks_lines[0]);
-		demote_time = get_demote_time(one_glocks_lines[0]);
-		p++;
-		strncpy(id, p, sizeof(id) - 1);
-		id[sizeof(id) - 1] = '\0';
-		p = strchr(id, ' ');
-		if (p)
-			*p = '\0';
-
-		if (locktype != 2) {
-			strncpy(extras, ltype[locktype], 79);
-			extras[79] = '\0';
-		} else {
-			const char *i_type = show_details(id, fsname, 2,
-							  trace_dir_path);
-			sprintf(extras, "%sinode", i_type);
-		}
+	sprintf(id, "%"PRIx64, gi->number);
+	if (gi->type != 2) {
+		strncpy(extras, ltype[gi->type], 79);
+		extras[79] = '\0';
+	} else {
+		const char *i_type = show_details(id, fsname, 2,
+						  trace_dir_path);
+		sprintf(extras, "%sinode", i_type);
 	}
 	if (flags & DETAILS) {
-		print_it(NULL, " %s ", NULL, one_glocks_lines[0]);
+		print_it(NULL, " %.96s ", NULL, gi->line);
 		print_it(NULL, "(%s)", NULL, extras);
-		if (demote_time)
+		if (gi->demote_time)
 			print_it(NULL, " ** demote time is greater than 0 **",
 				 NULL);
 		eol(0);
 		if (dlmgrants)
-			show_dlm_grants(locktype, one_glocks_lines[0],
-					dlmgrants, 0);
+			show_dlm_grants(gi->type, gi->number, 0);
 	}
 	if (flags & FRIENDLY) {
-		print_friendly_prefix(one_glocks_lines);
-		for (i = 1; i < gline; i++) {
-			if (one_glocks_lines[i][0] == ' ' &&
-			    one_glocks_lines[i][1] == 'H' &&
-			    prefix != 'W')
-				prefix = (is_holder(one_glocks_lines[i]) ?
-					  'H' : 'W');
-		}
+		print_friendly_prefix(gi);
+		for (i = 0; i < gi->nholders && prefix != 'W'; i++)
+			prefix = (holder_is_holder(&gi->holders[i]) ? 'H' : 'W');
 		print_it(NULL, " %c %-10.10s %-9.9s %s", NULL, prefix,
-			 extras, id, friendly_glock(one_glocks_lines[0],
-						    prefix));
+			 extras, id, friendly_glock(gi, prefix));
 		eol(0);
 	}
-	for (i = 1; i < gline; i++) {
-		if (!show_reservations &&
-		    one_glocks_lines[i][0] == ' ' &&
-		    one_glocks_lines[i][2] == 'B' &&
-		    one_glocks_lines[i][3] == ':')
+	for (i = 0, hi = 0; i < gi->nsublines; i++) {
+		const char *ln = gi->sublines[i];
+		const struct holder_info *h;
+
+		if (!show_reservations && line_is_resv(ln))
 			continue;
 
 		if (flags & DETAILS) {
-			print_it(NULL, " %-80.80s", NULL, one_glocks_lines[i]);
+			print_it(NULL, " %-80.80s", NULL, ln);
 			eol(0);
 			continue;
 		}
-		if ((flags & FRIENDLY) &&
-		    one_glocks_lines[i][1] == 'H')
-			print_friendly_prefix(one_glocks_lines);
-
-		if (one_glocks_lines[i][0] == ' ' &&
-		    one_glocks_lines[i][1] == 'H') {
-			print_it(NULL, " %c ---> %s pid %s ", NULL,
-				 prefix, (is_holder(one_glocks_lines[i]) ?
-					  "held by" : "waiting"),
-				 pid_string(one_glocks_lines[i]));
-			if (demote_time)
-				print_it(NULL, "** demote time is non-"
-					 "zero ** ", NULL);
-			if (is_dlm_waiting(dlmwaiters, locktype, id)) {
-				print_it(NULL, "***** DLM is in a "
-					 "comm wait for this lock "
-					 "***** ", NULL);
-			}
-			show_dlm_grants(locktype, one_glocks_lines[0],
-					dlmgrants, 1);
-			eol(0);
-			print_call_trace(one_glocks_lines[i]);
+		if (!line_is_holder(ln))
+			continue;
+		h = &gi->holders[hi++];
+		if (flags & FRIENDLY)
+			print_friendly_prefix(gi);
+
+		print_it(NULL, " %c ---> %s pid %.*s ", NULL,
+			 prefix, (holder_is_holder(h) ? "held by" : "waiting"),
+			 h->pidlen, h->pidstr);
+		if (gi->demote_time)
+			print_it(NULL, "** demote time is non-"
+				 "zero ** ", NULL);
+		if (is_dlm_waiting(gi->type, gi->number)) {
+			print_it(NULL, "***** DLM is in a "
+				 "comm wait for this lock "
+				 "***** ", NULL);
 		}
+		show_dlm_grants(gi->type, gi->number, 1);
+		eol(0);
+		print_call_trace(h);
 	}
 }
 
-static int parse_dlm_waiters(FILE *dlm, const char *fsname)
+static int parse_dlm_waiters(struct gt_reader *dlm_rd, const char *fsname)
 {
 	int dlml = 0;
+	char *dlmline;
 
-	memset(dlmwlines, 0, sizeof(dlmwlines));
-	while (fgets(dlmwlines[dlml], 80, dlm))
+	while ((dlmline = reader_line(dlm_rd))) {
+		if (dlm_add_waiter(&dlm, dlmline) < 0) {
+			perror("Failed to index dlm waiters");
+			exit(-1);
+		}
 		dlml++;
-
+	}
 	return dlml;
 }
 
-static int parse_dlm_grants(int dlmfd, const char *fsname)
+static int parse_dlm_grants(struct gt_reader *dlm_rd, const char *fsname)
 {
-	int dlml = 0;
+	int dlml = 0, ret;
 	char *dlmline;
 
-	memset(dlmglines, 0, sizeof(dlmglines));
-	dnextpos = NULL;
-	while ((dlmline = bufgets(dlmfd, dbuf, &dnextpos, &dpos, &dmaxpos))) {
+	while ((dlmline = reader_line(dlm_rd))) {
 		if (!this_lkb_requested(dlmline))
 			continue;
-		strncpy(dlmglines[dlml], dlmline, 96);
-		dlmglines[dlml][96] = '\0';
-		dlml++;
-		if (dlml >= MAX_LINES)
-			break;
+		ret = dlm_add_lock(&dlm, dlmline);
+		if (ret < 0) {
+			perror("Failed to index dlm locks");
+			exit(-1);
+		}
+		dlml += ret;
 	}
 	return dlml;
 }
 
-static void print_summary(int total_glocks[11][stypes], int dlmwaiters)
+static void print_summary(int total_glocks[GLOCK_TYPES][stypes], int dlmwaiters)
 {
 	int i;
 	int total_unlocked = 0;
@@ -1411,140 +1157,121 @@ static void print_summary(int total_glocks[11][stypes], int dlmwaiters)
 	eol(0);
 }
 
-/* flags = DETAILS || FRIENDLY or both */
-static void glock_details(int fd, const char *fsname, int dlmwaiters,
+static void print_contention(const struct sampler *smp)
+{
+	struct glock_rank top[TOP_GLOCKS];
+	unsigned vals[SAMPLE_HISTORY];
+	char spark[SPARK_COLS + 1];
+	unsigned win = sampler_window(smp);
+	unsigned n, i, type, ago;
+
+	n = sampler_top(smp, top, TOP_GLOCKS);
+	print_it(NULL, "T  Most contended glocks over the last %u samples:",
+		 NULL, win);
+	eol(0);
+	print_it(NULL, "T  type      glock       waits  peak   new  kept   "
+		 "demote  waiters", NULL);
+	eol(0);
+	for (i = 0; i < n; i++) {
+		const struct glock_hist *gh = top[i].gh;
+
+		for (ago = 0; ago < win; ago++)
+			vals[win - 1 - ago] = hist_sample(smp, gh, ago)->waiters;
+		sparkline(spark, vals, win);
+		print_it(NULL, "T  %-9.9s %-10"PRIx64" %6u %5u %5u %5u %6ums [%s]",
+			 NULL, ltype[gh->type], gh->number, top[i].score,
+			 top[i].peak, top[i].new_waiters, top[i].held_over,
+			 top[i].demote_ms, spark);
+		eol(0);
+	}
+	/* Waiters over time for each lock type that had any */
+	for (type = 1; type < GLOCK_TYPES - 1; type++) {
+		unsigned total = 0, peak = 0, newer = 0;
+
+		for (ago = 0; ago < win; ago++) {
+			const struct type_sample *ts = type_sample(smp, type, ago);
+
+			vals[win - 1 - ago] = ts->waiters;
+			total += ts->waiters;
+			newer += ts->new_waiters;
+			if (ts->waiters > peak)
+				peak = ts->waiters;
+		}
+		if (total == 0)
+			continue;
+		sparkline(spark, vals, win);
+		print_it(NULL, "T  %-9.9s all        %6u %5u %5u               "
+			 "[%s]", NULL, ltype[type], total, peak, newer, spark);
+		eol(0);
+	}
+	eol(0);
+}
+
+/* flags = DETAILS || FRIENDLY or both. Returns the number of glocks read. */
+static unsigned glock_details(struct gt_reader *glocks_rd, const char *fsname,
+			  int dlmwaiters,
 			  int dlmgrants, int trace_dir_path, int show_held,
 			  int summary)
 {
-	char *ln, *p;
-	char one_glocks_lines[MAX_LINES][97];
-	int gline = 0;
-	int show_prev_glock = 0, prev_had_waiter = 0;
-	int total_glocks[11][stypes], locktype = 0;
-	int holders_this_glock_ex = 0;
-	int holders_this_glock_sh = 0;
-	int holders_this_glock_df = 0;
-	int waiters_this_glock = 0;
+	struct glock_info *gi = &ginfo;
+	int total_glocks[GLOCK_TYPES][stypes];
+	int show_summary = summary && (iters_done % summary) == 0;
+	struct sampler *smp = NULL;
+	unsigned i, nglocks = 0;
 
 	memset(total_glocks, 0, sizeof(total_glocks));
-	gnextpos = NULL;
-	while ((ln = bufgets(fd, gbuf, &gnextpos, &gpos, &gmaxpos))) {
-		if (ln[0] == ' ' && ln[1] == ' ' && ln[2] == ' ')
+	if (sample_ms) {
+		smp = sampler_get(fsname);
+		if (smp)
+			sampler_begin(smp);
+	}
+	stacks_begin();
+	while (glock_next(glocks_rd, gi)) {
+		int show = 0, had_waiter = 0;
+
+		glock_count(gi, total_glocks);
+		nglocks++;
+		if (smp)
+			sampler_add(smp, gi);
+		stacks_add(gi);
+		/* Once the screen is full only the totals, the contention
+		   sample and the stacks are left to do */
+		if (termlines && line >= termlines) {
+			if (!show_summary && !smp && !stacks_enabled())
+				break;
 			continue;
-		if (ln[0] == 'G') {
-			/* Summary stuff------------------------------------ */
-			if (waiters_this_glock) {
-				total_glocks[locktype][tot_waiters] +=
-					waiters_this_glock;
-				total_glocks[locktype][has_waiter]++;
-			}
-			if (holders_this_glock_ex)
-				total_glocks[locktype][held_ex]++;
-			if (holders_this_glock_sh)
-				total_glocks[locktype][held_sh]++;
-			if (holders_this_glock_df)
-				total_glocks[locktype][held_df]++;
-			locktype = get_lock_type(ln);
-			p = ln + 6;
-			if (*p != 'U' || *(p + 1) != 'N')
-				total_glocks[locktype][locked]++;
-			total_glocks[locktype][all]++;
-			holders_this_glock_ex = 0;
-			holders_this_glock_sh = 0;
-			holders_this_glock_df = 0;
-			waiters_this_glock = 0;
-			/* Detail stuff------------------------------------- */
-			if (show_prev_glock) {
-				show_glock(one_glocks_lines, gline, fsname,
-					   dlmwaiters, dlmgrants,
-					   trace_dir_path, prev_had_waiter,
-					   DETAILS, summary);
-				show_glock(one_glocks_lines, gline, fsname,
-					   dlmwaiters, dlmgrants,
-					   trace_dir_path, prev_had_waiter,
-					   FRIENDLY, summary);
-				memset(one_glocks_lines, 0,
-				       sizeof(one_glocks_lines));
-				show_prev_glock = 0;
-			}
-			prev_had_waiter = 0;
-			gline = 0;
-			if (this_glock_requested(ln))
-				show_prev_glock = 1;
-		} else if (ln[0] == ' ' && ln[1] == 'H') {
-			char *flag = strchr(ln, 'f');
-			char *mode = strchr(ln, 's');
-
-			/* Summary stuff------------------------------------ */
-			while (flag) {
-				flag++;
-				switch (*flag) {
-				case ':':
-					break;
-				case 'W':
-					waiters_this_glock++;
-					flag = NULL;
-					break;
-				case 'H':
-					flag = NULL;
-					if (mode == NULL)
-						holders_this_glock_df++;
-					else if (*(mode + 1) == ':' &&
-						 *(mode + 2) == 'E' &&
-						 *(mode + 3) == 'X')
-						holders_this_glock_ex++;
-					else if (*(mode + 1) == ':' &&
-						 *(mode + 2) == 'S' &&
-						 *(mode + 3) == 'H')
-						holders_this_glock_sh++;
-					else
-						holders_this_glock_df++;
-					break;
-				case ' ':
-					flag = NULL;
-					break;
-				default:
-					break;
-				};
-			}
-			/* Detail stuff------------------------------------- */
-			if (!glocks) {
-				int haswaiter = is_waiter(ln);
-
-				if (haswaiter) {
-					show_prev_glock = 1;
-					prev_had_waiter = 1;
-				} else if (show_held && is_holder(ln) &&
-					   !is_iopen(one_glocks_lines[0])) {
-					show_prev_glock = 1;
-				} else if (!irrelevant(ln, one_glocks_lines[0])) {
-					show_prev_glock = 1;
+		}
+		if (glocks) {
+			show = this_glock_requested(gi);
+		} else {
+			for (i = 0; i < gi->nholders; i++) {
+				const struct holder_info *h = &gi->holders[i];
+
+				if (holder_is_waiter(h)) {
+					show = 1;
+					had_waiter = 1;
+				} else if (show_held && holder_is_holder(h) &&
+					   gi->type != 5) { /* not iopen */
+					show = 1;
+				} else if (!irrelevant(h, gi)) {
+					show = 1;
 				}
 			}
 		}
-		/* Detail stuff--------------------------------------------- */
-		strncpy(one_glocks_lines[gline], ln, 96);
-		one_glocks_lines[gline][96] = '\0';
-		gline++;
-		if (gline >= MAX_LINES)
-			break;
-		if (termlines && line >= termlines)
-			break;
+		if (!show)
+			continue;
+		show_glock(gi, fsname, dlmwaiters, dlmgrants, trace_dir_path,
+			   had_waiter, DETAILS, summary);
+		show_glock(gi, fsname, dlmwaiters, dlmgrants, trace_dir_path,
+			   had_waiter, FRIENDLY, summary);
 	}
-	/* Detail stuff----------------------------------------------------- */
-	if (show_prev_glock && gline < MAX_LINES &&
-	    (!termlines || line < termlines)) {
-		show_glock(one_glocks_lines, gline, fsname, dlmwaiters,
-			   dlmgrants, trace_dir_path, prev_had_waiter,
-			   DETAILS, summary);
-		show_glock(one_glocks_lines, gline, fsname, dlmwaiters,
-			   dlmgrants, trace_dir_path, prev_had_waiter,
-			   FRIENDLY, summary);
-	}
-	if (!summary || ((iters_done % summary) != 0))
-		return;
-
-	print_summary(total_glocks, dlmwaiters);
+	if (smp)
+		sampler_end(smp);
+	if (show_summary)
+		print_summary(total_glocks, dlmwaiters);
+	if (smp)
+		print_contention(smp);
+	return nglocks;
 }
 
 static void show_help(int help)
@@ -1600,13 +1327,15 @@ static void show_help(int help)
 	}
 }
 
-/* flags = DETAILS || FRIENDLY or both */
-static void parse_glocks_file(int fd, const char *fsname, int dlmwaiters,
-			      int dlmgrants, int trace_dir_path,
-			      int show_held, int help, int summary)
+/* flags = DETAILS || FRIENDLY or both. Returns the number of glocks read. */
+static unsigned parse_glocks_file(struct gt_reader *glocks_rd, const char *fsname,
+				  int dlmwaiters,
+				  int dlmgrants, int trace_dir_path,
+				  int show_held, int help, int summary)
 {
 	char fstitle[96], *fsdlm;
 	char ctimestr[64];
+	unsigned nglocks;
 	time_t t;
 	int i;
 
@@ -1636,68 +1365,311 @@ static void parse_glocks_file(int fd, const char *fsname, int dlmwaiters,
 	free(fsdlm);
 	eol(0);
 	attroff(A_BOLD);
-	glock_details(fd, fsname, dlmwaiters, dlmgrants, trace_dir_path,
-		      show_held, summary);
+	nglocks = glock_details(glocks_rd, fsname, dlmwaiters, dlmgrants,
+				trace_dir_path, show_held, summary);
 
 	show_help(help);
 	if (termlines)
 		refresh();
+	return nglocks;
+}
+
+/* Write one export record for a file system instead of its report.
+   Returns the number of glocks read. */
+static unsigned export_glocks_file(struct gt_reader *glocks_rd, const char *fsname,
+			       int dlmwaiters, int dlmgrants)
+{
+	export_start(&export, fsname, hostname);
+	export.dlm_waiters = dlmwaiters;
+	export.dlm_grants = dlmgrants;
+	stacks_begin();
+	while (glock_next(glocks_rd, &ginfo)) {
+		export_glock(&export, &ginfo);
+		stacks_add(&ginfo);
+	}
+	if (export_write(stdout, export_format, &export)) {
+		perror("Failed to write export record");
+		exit(-1);
+	}
+	return export.glocks;
+}
+
+/* Read each file system's glocks file just to take a contention sample */
+static void sample_glocks(void)
+{
+	struct dirent *dent;
+	char *fn;
+	DIR *dir;
+
+	if (asprintf(&fn, "%s/gfs2/", debugfs) == -1)
+		return;
+	dir = opendir(fn);
+	free(fn);
+	if (dir == NULL)
+		return;
+	while ((dent = readdir(dir))) {
+		struct sampler *smp;
+		int fd;
+
+		if (dent->d_name[0] == '.')
+			continue;
+		smp = sampler_get(fs_name(dent->d_name));
+		if (smp == NULL)
+			continue;
+		if (asprintf(&fn, "%s/gfs2/%s/glocks", debugfs, dent->d_name) == -1)
+			continue;
+		fd = open(fn, O_RDONLY);
+		free(fn);
+		if (fd < 0)
+			continue;
+		sampler_begin(smp);
+		stacks_begin();
+		reader_start(&rd, fd);
+		while (glock_next(&rd, &ginfo)) {
+			sampler_add(smp, &ginfo);
+			stacks_add(&ginfo);
+		}
+		sampler_end(smp);
+		close(fd);
+	}
+	closedir(dir);
+}
+
+/* Rewrite the folded stacks file, so it's complete whenever we're stopped */
+static void write_stacks(const char *path, int interactive)
+{
+	if (stacks_write() == 0)
+		return;
+	if (interactive) {
+		refresh();
+		endwin();
+	}
+	fprintf(stderr, "Failed to write folded stacks to %s: %s\n", path,
+		strerror(errno));
+	exit(-1);
+}
+
+/* Wait for a key press or for the next report to be due, taking contention
+   samples in the meantime */
+static int wait_for_report(int refresh_ms, int nfds)
+{
+	struct timeval now, end, tv;
+	fd_set readfds;
+	int retval;
+
+	gettimeofday(&end, NULL);
+	tv.tv_sec = refresh_ms / 1000;
+	tv.tv_usec = (refresh_ms % 1000) * 1000;
+	timeradd(&end, &tv, &end);
+	while (1) {
+		gettimeofday(&now, NULL);
+		if (!timercmp(&now, &end, <))
+			return 0;
+		timersub(&end, &now, &tv);
+		if (sample_ms && tv.tv_sec * 1000 + tv.tv_usec / 1000 > sample_ms) {
+			tv.tv_sec = sample_ms / 1000;
+			tv.tv_usec = (sample_ms % 1000) * 1000;
+		}
+		FD_ZERO(&readfds);
+		if (nfds != 0)
+			FD_SET(STDIN_FILENO, &readfds);
+		retval = select(nfds, &readfds, NULL, NULL, &tv);
+		if (retval != 0 || sample_ms == 0)
+			return retval;
+		sample_glocks();
+	}
+}
+
+/* Report on one file system, or export it. The glocks read and dlm locks
+   indexed are added to @res if it isn't NULL. */
+void report_fs(struct fs_snapshot *snap, int trace_dir_path,
+	       int show_held, int help, int summary,
+	       struct bench_result *res)
+{
+	int dlmwaiters = 0, dlmgrants = 0;
+	unsigned nglocks;
+
+	dlm_index_reset(&dlm);
+	if (snap->have_waiters)
+		dlmwaiters = parse_dlm_waiters(&snap->dlm_waiters, snap->fsname);
+	if (snap->have_locks)
+		dlmgrants = parse_dlm_grants(&snap->dlm_locks, snap->fsname);
+	if (export_format)
+		nglocks = export_glocks_file(&snap->glocks, snap->fsname,
+					     dlmwaiters, dlmgrants);
+	else
+		nglocks = parse_glocks_file(&snap->glocks, snap->fsname,
+					    dlmwaiters, dlmgrants,
+					    trace_dir_path, show_held, help,
+					    summary);
+	if (res != NULL) {
+		res->glocks += nglocks;
+		res->dlm_locks += dlmgrants;
+	}
+}
+
+/**
+ * run_benchmark - report on a generated debugfs tree headless, over and over
+ * @shape: the tree to generate
+ * @count: how many times to report on it
+ * @res: the cost of the reports
+ *
+ * Returns: 0 on success or -1 with errno set
+ */
+int run_benchmark(const struct bench_shape *shape, unsigned count,
+		  struct bench_result *res)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	struct fs_snapshot *snap;
+	struct collection coll;
+	char *dir;
+	unsigned i;
+	int ret = 0;
+
+	if (asprintf(&dir, "%s/glocktop-bench-XXXXXX",
+		     tmpdir ? tmpdir : "/tmp") == -1)
+		return -1;
+	if (bench_generate(dir, shape)) {
+		free(dir);
+		return -1;
+	}
+	termlines = 0;
+	bench_start(res);
+	for (i = 0; i < count && ret == 0; i++) {
+		if (collect_start(&coll, dir, 1)) {
+			ret = -1;
+			break;
+		}
+		while ((snap = collect_next(&coll))) {
+			if (snap->error) {
+				errno = snap->error;
+				ret = -1;
+				break;
+			}
+			report_fs(snap, 0, 1, 0, 1, res);
+		}
+		collect_finish(&coll);
+		iters_done++;
+		bench_iteration(res);
+	}
+	bench_remove(dir, shape);
+	free(dir);
+	return ret;
+}
+
+/* Add a file system's files to the capture, as they were read */
+static void capture_snapshot(struct capture *cap,
+			     const struct fs_snapshot *snap)
+{
+	int ret = 0;
+
+	if (snap->have_waiters)
+		ret |= capture_write(cap, CAPTURE_DLM_WAITERS, snap->time,
+				     snap->dirname, &snap->dlm_waiters);
+	if (snap->have_locks)
+		ret |= capture_write(cap, CAPTURE_DLM_LOCKS, snap->time,
+				     snap->dirname, &snap->dlm_locks);
+	ret |= capture_write(cap, CAPTURE_GLOCKS, snap->time, snap->dirname,
+			     &snap->glocks);
+	if (ret) {
+		fprintf(stderr, "Failed to write to the capture file\n");
+		exit(-1);
+	}
 }
 
 static void usage(void)
 {
 	printf("Usage:\n");
-	printf("glocktop [-i] [-d <delay sec>] [-n <iter>] [-sX] [-c] [-D] [-H] [-r] [-t]\n");
+	printf("glocktop [-i] [-d <delay sec>] [-n <iter>] [-sX] [-S <msec>] [-o json|binary] [-w <file>] [-f <file>] [-c] [-D] [-H] [-r] [-t]\n");
+	printf("glocktop -a <file> [-a <file>]...\n");
+	printf("glocktop -B <shape> [-n <iter>]\n");
 	printf("\n");
+	printf("-a : analyze a capture file made with -w and print the results;\n"
+	       "     with the captures of several nodes, show the glocks that\n"
+	       "     moved between them\n");
+	printf("-B : benchmark glocktop on generated glocks and dlm files of the\n"
+	       "     shape fs=N,glocks=N,held=%%,contended=%%,waiters=N,seed=N\n"
+	       "     (any left out are defaults) and print the time and memory\n"
+	       "     used by -n reports (default 5)\n");
 	printf("-i : Runs glocktop in interactive mode.\n");
-	printf("-d : delay between refreshes, in seconds (default: %d).\n", REFRESH_TIME);
+	printf("-d : delay between refreshes, in seconds, which may be fractional\n"
+	       "     (default: %d).\n", REFRESH_TIME);
 	printf("-n : stop after <iter> refreshes.\n");
 	printf("-H : don't show Held glocks, even if not waited on, excluding "
 	       "iopen\n");
 	printf("-r : show reservations when rgrp glocks are displayed\n");
 	printf("-s : show glock summary information every X iterations\n");
+	printf("-S : sample glock contention every <msec> milliseconds and show the\n"
+	       "     most contended glocks over the last %d samples\n", SAMPLE_HISTORY);
+	printf("-o : write a record per file system and refresh to stdout instead\n"
+	       "     of a report, as newline-delimited json or binary\n");
 	printf("-t : trace directory glocks back\n");
+	printf("-f : sample the kernel stacks of the holders and waiters of\n"
+	       "     contended glocks and write their counts to <file> as\n"
+	       "     folded stacks, for flamegraphs\n");
+	printf("-w : write the raw glocks and dlm files to a compressed capture\n"
+	       "     file instead of a report, to be analyzed later with -a\n");
 	printf("-D : don't show DLM lock status\n");
 	printf("\n");
 	fflush(stdout);
 	exit(0);
 }
 
+#ifndef UNITTESTS
 int main(int argc, char **argv)
 {
-	int fd;
-	DIR *dir = NULL;
-	char *fn;
-	struct dirent *dent;
 	int retval;
-	int refresh_time = REFRESH_TIME;
-	fd_set readfds;
+	int refresh_ms = REFRESH_TIME * 1000;
+	double delay;
 	char string[96];
-	int ch, dlmwaiters = 0, dlmgrants = 0;
+	int ch;
 	int cont = TRUE, optchar;
 	int trace_dir_path = 0;
 	int show_held = 1, help = 0;
 	int interactive = 0;
 	int summary = 10;
+	char *analyze_paths[CORRELATE_NODES];
+	unsigned nanalyze = 0;
+	const char *capture_path = NULL;
+	const char *stacks_path = NULL;
+	struct capture *cap = NULL;
 	int nfds = STDIN_FILENO + 1;
+	struct bench_shape shape;
+	int bench = 0;
 
 	prog_name = argv[0];
 	memset(glock, 0, sizeof(glock));
-	memset(contended_filenames, 0, sizeof(contended_filenames));
-	memset(contended_blocks, 0, sizeof(contended_blocks));
 	UpdateSize(0);
 	/* decode command line arguments */
 	while (cont) {
-		optchar = getopt(argc, argv, "-d:Dn:rs:thHi");
+		optchar = getopt(argc, argv, "-a:B:d:Df:n:o:rs:S:thHiw:");
 
 		switch (optchar) {
+		case 'a':
+			if (nanalyze == CORRELATE_NODES) {
+				fprintf(stderr, "Error: at most %d capture files "
+					"can be analyzed\n", CORRELATE_NODES);
+				exit(-1);
+			}
+			analyze_paths[nanalyze++] = optarg;
+			break;
+		case 'B':
+			bench_shape_default(&shape);
+			if (bench_parse_shape(&shape, optarg)) {
+				fprintf(stderr, "Error: invalid benchmark shape "
+					"'%s'\n", optarg);
+				exit(-1);
+			}
+			bench = 1;
+			break;
 		case 'd':
-			refresh_time = atoi(optarg);
-			if (refresh_time < 1) {
-				fprintf(stderr, "Error: delay %d too small; "
-					"must be at least 1\n", refresh_time);
+			delay = atof(optarg);
+			if (delay < 0.001) {
+				fprintf(stderr, "Error: delay %s too small; "
+					"must be at least 0.001\n", optarg);
 				exit(-1);
 			}
+			refresh_ms = delay * 1000;
 			break;
 		case 'D':
 			print_dlm_grants = 0;
@@ -1705,12 +1677,28 @@ int main(int argc, char **argv)
 		case 'n':
 			iterations = atoi(optarg);
 			break;
+		case 'o':
+			export_format = export_parse_format(optarg);
+			if (export_format < 0) {
+				fprintf(stderr, "Error: unknown export format "
+					"'%s'; must be json or binary\n", optarg);
+				exit(-1);
+			}
+			break;
 		case 'r':
 			show_reservations = 1;
 			break;
 		case 's':
 			summary = atoi(optarg);
 			break;
+		case 'S':
+			sample_ms = atoi(optarg);
+			if (sample_ms < 1) {
+				fprintf(stderr, "Error: sample interval %d too "
+					"small; must be at least 1\n", sample_ms);
+				exit(-1);
+			}
+			break;
 		case 't':
 			trace_dir_path = 1;
 			break;
@@ -1723,6 +1711,12 @@ int main(int argc, char **argv)
 		case 'i':
 			interactive = 1;
 			break;
+		case 'w':
+			capture_path = optarg;
+			break;
+		case 'f':
+			stacks_path = optarg;
+			break;
 		case EOF:
 			cont = FALSE;
 			break;
@@ -1737,6 +1731,34 @@ int main(int argc, char **argv)
 		};
 	}
 
+	if (nanalyze == 1)
+		exit(analyze_capture(analyze_paths[0]) ? -1 : 0);
+	if (nanalyze > 1)
+		exit(correlate_captures(analyze_paths, nanalyze) ? -1 : 0);
+	if (bench) {
+		struct bench_result res;
+
+		/* Make the reports, but only print what they cost */
+		if (freopen("/dev/null", "w", stdout) == NULL ||
+		    run_benchmark(&shape, iterations ? iterations : 5, &res)) {
+			perror("Benchmark failed");
+			exit(-1);
+		}
+		bench_print(stderr, &shape, &res);
+		exit(0);
+	}
+	if (interactive && export_format) {
+		fprintf(stderr, "Error: -i and -o can't be used together.\n");
+		exit(-1);
+	}
+	if (capture_path && (interactive || export_format || stacks_path)) {
+		fprintf(stderr, "Error: -w can't be used with -i, -o or -f.\n");
+		exit(-1);
+	}
+	if (stacks_path && stacks_open(stacks_path)) {
+		perror("Failed to allocate the stack table");
+		exit(-1);
+	}
 	if (interactive) {
 		printf("Initializing. Please wait...");
 		fflush(stdout);
@@ -1747,6 +1769,18 @@ int main(int argc, char **argv)
 	}
 	if (parse_mounts())
 		exit(-1);
+	if (capture_path) {
+		cap = capture_create(capture_path, hostname);
+		if (cap == NULL) {
+			fprintf(stderr, "Failed to create capture file %s: %s\n",
+				capture_path, strerror(errno));
+			exit(-1);
+		}
+	}
+	if (trace_dir_path && pathcache_start()) {
+		perror("Failed to start the directory path lookup thread");
+		exit(-1);
+	}
 
 	if (interactive && (wind = initscr()) == NULL) {
 		fprintf(stderr, "Error: unable to initialize screen.\n");
@@ -1767,34 +1801,19 @@ int main(int argc, char **argv)
 	} else {
 		termlines = 0;
 	}
-	while (!gbuf) {
-		gbuf = malloc(bufsize);
-		if (gbuf) {
-			/*printf("bufsize=%dK\n", bufsize / 1024);*/
-			break;
-		}
+	while (reader_init(&rd, bufsize) != 0) {
 		bufsize /= 2;
-	}
-	while (!dbuf) {
-		dbuf = malloc(bufsize);
-		if (dbuf) {
-			/*printf("bufsize=%dK\n", bufsize / 1024);*/
-			break;
+		if (bufsize < 4096) {
+			perror("Failed to allocate read buffer");
+			exit(-1);
 		}
-		bufsize /= 2;
 	}
 
 	while (!done) {
-		struct timeval tv;
-
-		if (asprintf(&fn, "%s/gfs2/", debugfs) == -1) {
-			perror(argv[0]);
-			exit(-1);
-		}
-		dir = opendir(fn);
-		free(fn);
+		struct fs_snapshot *snap;
+		struct collection coll;
 
-		if (!dir) {
+		if (collect_start(&coll, debugfs, print_dlm_grants)) {
 			if (interactive) {
 				refresh();
 				endwin();
@@ -1803,76 +1822,28 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Check if debugfs and gfs2 are mounted.\n");
 			exit(-1);
 		}
-		display_title_lines();
-		while ((dent = readdir(dir))) {
-			const char *fsname;
-			char *dlm_fn;
-			FILE *dlmf;
-			int dlmfd;
-
-			if (!strcmp(dent->d_name, "."))
-				continue;
-			if (!strcmp(dent->d_name, ".."))
-				continue;
-
-			fsname = strchr(dent->d_name, ':');
-			if (fsname)
-				fsname++;
-			else
-				fsname = dent->d_name;
-
-			if (asprintf(&dlm_fn, "%s/dlm/%s_waiters", debugfs, fsname) == -1) {
-				perror("Failed to construct dlm waiters debugfs path");
-				exit(-1);
-			}
-			dlmf = fopen(dlm_fn, "rt");
-			if (dlmf) {
-				dlmwaiters = parse_dlm_waiters(dlmf, fsname);
-				fclose(dlmf);
-			}
-			free(dlm_fn);
-
-			if (print_dlm_grants) {
-				if (asprintf(&dlm_fn, "%s/dlm/%s_locks", debugfs, fsname) == -1) {
-					perror("Failed to construct dlm locks debugfs path");
-					exit(-1);
-				}
-				dlmfd = open(dlm_fn, O_RDONLY);
-				if (dlmfd > 0) {
-					dlmgrants = parse_dlm_grants(dlmfd,
-								     fsname);
-					close(dlmfd);
-				}
-				free(dlm_fn);
-			}
-
-			if (asprintf(&fn, "%s/gfs2/%s/glocks", debugfs, dent->d_name) == -1) {
-				perror(argv[0]);
-				exit(-1);
-			}
-			fd = open(fn, O_RDONLY);
-			if (fd < 0) {
+		if (!export_format && !cap)
+			display_title_lines();
+		while ((snap = collect_next(&coll))) {
+			if (snap->error) {
 				if (interactive) {
 					refresh();
 					endwin();
 				}
-				perror(fn);
-				free(fn);
+				fprintf(stderr, "%s: %s\n", snap->glocks_path,
+					strerror(snap->error));
 				exit(-1);
 			}
-			free(fn);
-			parse_glocks_file(fd, fsname, dlmwaiters, dlmgrants,
-					  trace_dir_path, show_held, help,
-					  summary);
-			close(fd);
+			if (cap) {
+				capture_snapshot(cap, snap);
+				continue;
+			}
+			report_fs(snap, trace_dir_path, show_held, help,
+				  summary, NULL);
 		}
-		closedir(dir);
-		tv.tv_sec = refresh_time;
-		tv.tv_usec = 0;
-		FD_ZERO(&readfds);
-		if (nfds != 0)
-			FD_SET(STDIN_FILENO, &readfds);
-		retval = select(nfds, &readfds, NULL, NULL, &tv);
+		collect_finish(&coll);
+		write_stacks(stacks_path, interactive);
+		retval = wait_for_report(refresh_ms, nfds);
 		if (retval) {
 			if (interactive)
 				ch = getch();
@@ -1891,12 +1862,12 @@ int main(int argc, char **argv)
 				if (!interactive)
 					break;
 				move(1, 0);
-				printw("Change delay from %d to: ",
-				       refresh_time);
+				printw("Change delay from %g to: ",
+				       refresh_ms / 1000.0);
 				if (bobgets(string, 1, 25, 5, &ch) == 1)
-					refresh_time = atoi(string);
-				if (refresh_time < 1)
-					refresh_time = 1;
+					refresh_ms = atof(string) * 1000;
+				if (refresh_ms < 1)
+					refresh_ms = 1;
 				break;
 			/* When we get EOF on stdin, remove it from the fd_set
 			   to avoid shorting out the select() */
@@ -1909,9 +1880,18 @@ int main(int argc, char **argv)
 		if (iterations && iters_done >= iterations)
 			break;
 	}
+	pathcache_stop();
+	dlm_index_free(&dlm);
+	write_stacks(stacks_path, interactive);
+	stacks_close();
+	if (cap && capture_close(cap)) {
+		fprintf(stderr, "Failed to write capture file %s\n", capture_path);
+		exit(-1);
+	}
 	free_mounts();
-	free(gbuf);
-	free(dbuf);
+	reader_free(&rd);
+	glock_info_free(&ginfo);
+	samplers_free();
 	free(debugfs);
 	if (interactive) {
 		refresh();
@@ -1919,3 +1899,4 @@ int main(int argc, char **argv)
 	}
 	exit(0);
 }
+#endif /* UNITTESTS */
@@ -0,0 +1,358 @@
+#include "clusterautoconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <libgfs2.h>
+
+#include "pathcache.h"
+
+/*
+ * Paths of contended directories. Finding the path of a directory means
+ * reading its ancestors back to the root and then scanning each of their
+ * parents in the mounted file system for its name, which can take seconds
+ * in a directory with millions of entries. So the paths are looked up by a
+ * resolver thread and kept in a cache, keyed by device and inode block and
+ * evicted least recently used first, from which the display takes whatever
+ * is known without waiting. A path is only used while its directory's
+ * generation number is unchanged, so an inode that has been freed and
+ * reused for another directory is looked up again. The paths of the
+ * ancestors are cached too and the next lookup starts from the nearest
+ * ancestor already known.
+ */
+
+#define HASH_SIZE (PATHCACHE_SIZE * 2)
+#define MAX_DEPTH 256
+
+struct path_entry {
+	struct path_entry *hnext;
+	osi_list_t lru;
+	int fd;
+	uint64_t block;
+	uint64_t generation;
+	enum path_state state;
+	char *path;
+};
+
+struct path_request {
+	struct path_mount pm;
+	uint64_t block;
+	uint64_t generation;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t resolver;
+static int running, stopping;
+
+/* All protected by the lock */
+static struct path_entry *hash[HASH_SIZE];
+static osi_list_decl(lru); /* Most recently used first */
+static unsigned count;
+static struct path_request queue[PATHCACHE_QUEUE];
+static unsigned qhead, qlen;
+
+static unsigned hash_key(int fd, uint64_t block)
+{
+	uint64_t h = (block ^ ((uint64_t)fd << 48)) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) % HASH_SIZE;
+}
+
+static struct path_entry *find_entry(int fd, uint64_t block)
+{
+	struct path_entry *e;
+
+	for (e = hash[hash_key(fd, block)]; e != NULL; e = e->hnext)
+		if (e->block == block && e->fd == fd)
+			return e;
+	return NULL;
+}
+
+static void evict_entry(struct path_entry *e)
+{
+	struct path_entry **ep = &hash[hash_key(e->fd, e->block)];
+
+	while (*ep != e)
+		ep = &(*ep)->hnext;
+	*ep = e->hnext;
+	osi_list_del(&e->lru);
+	free(e->path);
+	free(e);
+	count--;
+}
+
+/* Find a directory's entry, or make one, evicting the least recently used */
+static struct path_entry *get_entry(int fd, uint64_t block)
+{
+	struct path_entry *e = find_entry(fd, block);
+	unsigned b;
+
+	if (e != NULL) {
+		osi_list_del(&e->lru);
+		osi_list_add(&e->lru, &lru);
+		return e;
+	}
+	if (count >= PATHCACHE_SIZE)
+		evict_entry(osi_list_entry(lru.prev, struct path_entry, lru));
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	e->fd = fd;
+	e->block = block;
+	b = hash_key(fd, block);
+	e->hnext = hash[b];
+	hash[b] = e;
+	osi_list_add(&e->lru, &lru);
+	count++;
+	return e;
+}
+
+static void set_entry(struct path_entry *e, uint64_t generation,
+		      enum path_state state, char *path)
+{
+	free(e->path);
+	e->generation = generation;
+	e->state = state;
+	e->path = path;
+}
+
+/**
+ * pathcache_get - get the path of a directory without waiting for it
+ * @pm: the file system the directory is in
+ * @block: the directory's inode block
+ * @generation: its generation number
+ * @path: filled in with the path if it is known
+ *
+ * A directory that isn't in the cache, or whose generation has changed, is
+ * queued for the resolver thread.
+ *
+ * Returns: PATH_FOUND if @path was filled in, PATH_PENDING if the path
+ * hasn't been looked up yet or PATH_NOT_FOUND if it couldn't be
+ */
+int pathcache_get(const struct path_mount *pm, uint64_t block,
+		  uint64_t generation, char *path, size_t size)
+{
+	struct path_entry *e;
+	int state;
+
+	pthread_mutex_lock(&lock);
+	e = find_entry(pm->fd, block);
+	if (e == NULL || e->generation != generation) {
+		struct path_request *req;
+
+		if (!running || qlen == PATHCACHE_QUEUE) {
+			/* Try again at the next refresh */
+			pthread_mutex_unlock(&lock);
+			return PATH_PENDING;
+		}
+		e = get_entry(pm->fd, block);
+		if (e == NULL) {
+			pthread_mutex_unlock(&lock);
+			return PATH_NOT_FOUND;
+		}
+		set_entry(e, generation, PATH_PENDING, NULL);
+		req = &queue[(qhead + qlen++) % PATHCACHE_QUEUE];
+		req->pm = *pm;
+		req->block = block;
+		req->generation = generation;
+		pthread_cond_signal(&wake);
+	} else {
+		osi_list_del(&e->lru);
+		osi_list_add(&e->lru, &lru);
+	}
+	state = e->state;
+	if (state == PATH_FOUND)
+		snprintf(path, size, "%s", e->path);
+	pthread_mutex_unlock(&lock);
+	return state;
+}
+
+static int should_stop(void)
+{
+	int stop;
+
+	pthread_mutex_lock(&lock);
+	stop = stopping;
+	pthread_mutex_unlock(&lock);
+	return stop;
+}
+
+static void store_path(int fd, uint64_t block, uint64_t generation,
+		       enum path_state state, const char *path)
+{
+	struct path_entry *e;
+	char *copy = NULL;
+
+	if (path != NULL && (copy = strdup(path)) == NULL)
+		state = PATH_NOT_FOUND;
+	pthread_mutex_lock(&lock);
+	e = get_entry(fd, block);
+	if (e != NULL)
+		set_entry(e, generation, state, copy);
+	else
+		free(copy);
+	pthread_mutex_unlock(&lock);
+}
+
+/* The path of an ancestor found by an earlier lookup, if it is still valid */
+static int cached_path(int fd, uint64_t block, uint64_t generation,
+		       char *path)
+{
+	struct path_entry *e;
+	int found = 0;
+
+	pthread_mutex_lock(&lock);
+	e = find_entry(fd, block);
+	if (e != NULL && e->state == PATH_FOUND && e->generation == generation) {
+		snprintf(path, PATH_MAX, "%s", e->path);
+		found = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+/* Append the name of the entry of directory @path for inode @ino to @path */
+static int find_name(char *path, uint64_t ino)
+{
+	size_t len = strlen(path);
+	struct dirent *dent;
+	int found = 0;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while (!found && (dent = readdir(dir)) != NULL) {
+		if (should_stop())
+			break;
+		if (dent->d_ino != ino)
+			continue;
+		if (len + 1 + strlen(dent->d_name) >= PATH_MAX)
+			break;
+		path[len] = '/';
+		strcpy(path + len + 1, dent->d_name);
+		found = 1;
+	}
+	closedir(dir);
+	return found;
+}
+
+static void resolve(const struct path_request *req)
+{
+	struct gfs2_sbd sbd = { .device_fd = req->pm.fd, .bsize = req->pm.bsize };
+	struct { uint64_t block, generation; } chain[MAX_DEPTH];
+	struct gfs2_inode *ip, *parent;
+	char path[PATH_MAX];
+	int depth = 0, known = 0;
+
+	ip = lgfs2_inode_read(&sbd, req->block);
+	if (ip == NULL)
+		goto not_found;
+	chain[depth].block = req->block;
+	chain[depth++].generation = req->generation;
+	/* Back up to the root, or to an ancestor whose path is known */
+	while (!known) {
+		if (depth == MAX_DEPTH || gfs2_lookupi(ip, "..", 2, &parent)) {
+			inode_put(&ip);
+			goto not_found;
+		}
+		if (parent->i_di.di_num.no_addr == ip->i_di.di_num.no_addr) {
+			/* The root has no name of its own */
+			inode_put(&parent);
+			depth--;
+			break;
+		}
+		inode_put(&ip);
+		ip = parent;
+		known = cached_path(req->pm.fd, ip->i_di.di_num.no_addr,
+				    ip->i_di.di_generation, path);
+		if (!known) {
+			chain[depth].block = ip->i_di.di_num.no_addr;
+			chain[depth++].generation = ip->i_di.di_generation;
+		}
+	}
+	inode_put(&ip);
+
+	if (!known)
+		snprintf(path, sizeof(path), "%s", req->pm.dir);
+	if (depth == 0) {
+		/* The root itself */
+		store_path(req->pm.fd, req->block, req->generation, PATH_FOUND,
+			   path);
+		return;
+	}
+	/* Then down again, finding the name of each directory in its parent */
+	while (depth-- > 0) {
+		if (!find_name(path, chain[depth].block))
+			goto not_found;
+		store_path(req->pm.fd, chain[depth].block,
+			   chain[depth].generation, PATH_FOUND, path);
+	}
+	return;
+not_found:
+	store_path(req->pm.fd, req->block, req->generation, PATH_NOT_FOUND,
+		   NULL);
+}
+
+static void *resolver_thread(void *arg)
+{
+	struct path_request req;
+
+	while (1) {
+		pthread_mutex_lock(&lock);
+		while (qlen == 0 && !stopping)
+			pthread_cond_wait(&wake, &lock);
+		if (stopping) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		req = queue[qhead];
+		qhead = (qhead + 1) % PATHCACHE_QUEUE;
+		qlen--;
+		pthread_mutex_unlock(&lock);
+		resolve(&req);
+	}
+	return NULL;
+}
+
+int pathcache_start(void)
+{
+	sigset_t mask, old;
+	int ret;
+
+	if (running)
+		return 0;
+	stopping = 0;
+	/* Signals, SIGINT in particular, must go to the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+	ret = pthread_create(&resolver, NULL, resolver_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0)
+		return -1;
+	running = 1;
+	return 0;
+}
+
+/**
+ * pathcache_stop - stop the resolver thread and empty the cache
+ * A lookup in progress is abandoned.
+ */
+void pathcache_stop(void)
+{
+	if (running) {
+		pthread_mutex_lock(&lock);
+		stopping = 1;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+		pthread_join(resolver, NULL);
+		running = 0;
+	}
+	while (!osi_list_empty(&lru))
+		evict_entry(osi_list_entry(lru.next, struct path_entry, lru));
+	qhead = qlen = 0;
+}
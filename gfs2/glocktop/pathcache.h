@@ -0,0 +1,28 @@
+#ifndef __PATHCACHE_DOT_H__
+#define __PATHCACHE_DOT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PATHCACHE_SIZE  4096 /* Directory paths kept */
+#define PATHCACHE_QUEUE 256  /* Lookups waiting for the resolver thread */
+
+enum path_state {
+	PATH_PENDING = 0, /* Queued for the resolver thread */
+	PATH_FOUND = 1,
+	PATH_NOT_FOUND = 2,
+};
+
+/* A mounted file system whose directories can be looked up */
+struct path_mount {
+	int fd;          /* The device */
+	const char *dir; /* Where it is mounted */
+	unsigned bsize;
+};
+
+extern int pathcache_start(void);
+extern int pathcache_get(const struct path_mount *pm, uint64_t block,
+			 uint64_t generation, char *path, size_t size);
+extern void pathcache_stop(void);
+
+#endif /* __PATHCACHE_DOT_H__ */
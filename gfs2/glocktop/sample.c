@@ -0,0 +1,374 @@
+#include "clusterautoconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample.h"
+
+/*
+ * Glock contention sampling. Every time a file system's glocks file is read,
+ * each glock that has waiters or a pending demote is looked up in a hash
+ * table, keyed by type and number, which keeps a ring of its last
+ * SAMPLE_HISTORY samples and the pids of its holders and waiters at the
+ * previous sample. That is enough to tell new waiters from ones that are
+ * still waiting, and holders that have kept the glock since the previous
+ * sample, and to rank glocks by how contended they have been over the whole
+ * window rather than at the one instant the screen is drawn. A glock that
+ * hasn't been contended for SAMPLE_HISTORY samples is dropped again.
+ */
+
+static struct sampler *samplers;
+static const struct glock_sample no_sample;
+static const struct type_sample no_type_sample;
+
+struct sampler *sampler_get(const char *fsname)
+{
+	struct sampler *s;
+
+	for (s = samplers; s != NULL; s = s->next)
+		if (strcmp(s->fsname, fsname) == 0)
+			return s;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+	s->fsname = strdup(fsname);
+	s->nbuckets = 1024;
+	s->hash = calloc(s->nbuckets, sizeof(*s->hash));
+	if (s->fsname == NULL || s->hash == NULL) {
+		free(s->fsname);
+		free(s->hash);
+		free(s);
+		return NULL;
+	}
+	s->next = samplers;
+	samplers = s;
+	return s;
+}
+
+static unsigned hash_glock(const struct sampler *s, unsigned type, uint64_t number)
+{
+	uint64_t h = (number ^ ((uint64_t)type << 56)) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (s->nbuckets - 1);
+}
+
+static void grow_hash(struct sampler *s)
+{
+	unsigned nbuckets = s->nbuckets * 2;
+	struct glock_hist **hash = calloc(nbuckets, sizeof(*hash));
+	struct glock_hist **old = s->hash;
+	unsigned i;
+
+	if (hash == NULL)
+		return;
+	s->hash = hash;
+	s->nbuckets = nbuckets;
+	for (i = 0; i < nbuckets / 2; i++) {
+		while (old[i] != NULL) {
+			struct glock_hist *gh = old[i];
+			unsigned b = hash_glock(s, gh->type, gh->number);
+
+			old[i] = gh->next;
+			gh->next = hash[b];
+			hash[b] = gh;
+		}
+	}
+	free(old);
+}
+
+static struct glock_hist *find_glock(const struct sampler *s, unsigned type,
+				     uint64_t number)
+{
+	struct glock_hist *gh;
+
+	for (gh = s->hash[hash_glock(s, type, number)]; gh; gh = gh->next)
+		if (gh->number == number && gh->type == type)
+			return gh;
+	return NULL;
+}
+
+static struct glock_hist *new_glock(struct sampler *s, unsigned type,
+				    uint64_t number)
+{
+	struct glock_hist *gh;
+	unsigned b;
+
+	if (s->count >= SAMPLE_MAX)
+		return NULL;
+	if (s->count >= s->nbuckets)
+		grow_hash(s);
+	gh = calloc(1, sizeof(*gh));
+	if (gh == NULL)
+		return NULL;
+	gh->type = type;
+	gh->number = number;
+	b = hash_glock(s, type, number);
+	gh->next = s->hash[b];
+	s->hash[b] = gh;
+	s->count++;
+	return gh;
+}
+
+/**
+ * sampler_begin - start a new sample of a file system's glocks
+ */
+void sampler_begin(struct sampler *s)
+{
+	s->seq++;
+	memset(s->types[s->seq % SAMPLE_HISTORY], 0,
+	       sizeof(s->types[0]));
+}
+
+static int had_pid(const long *pids, unsigned n, long pid)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		if (pids[i] == pid)
+			return 1;
+	return 0;
+}
+
+/**
+ * sampler_add - add a glock to the current sample
+ */
+void sampler_add(struct sampler *s, const struct glock_info *gi)
+{
+	struct type_sample *ts = &s->types[s->seq % SAMPLE_HISTORY][gi->type];
+	unsigned waiters = 0, holders = 0, new_waiters = 0, held_over = 0;
+	long pids[SAMPLE_PIDS];
+	unsigned nheld = 0, nwait = 0;
+	struct glock_sample *gs;
+	struct glock_hist *gh;
+	int contended;
+	unsigned i;
+	uint64_t q;
+
+	for (i = 0; i < gi->nholders; i++) {
+		if (holder_is_waiter(&gi->holders[i]))
+			waiters++;
+		else if (holder_is_holder(&gi->holders[i]))
+			holders++;
+	}
+	contended = waiters || gi->demote_time;
+	gh = find_glock(s, gi->type, gi->number);
+	if (gh == NULL && contended)
+		gh = new_glock(s, gi->type, gi->number);
+	if (gh == NULL) {
+		/* Not tracked, so every waiter counts as new */
+		new_waiters = waiters;
+		goto out;
+	}
+
+	/* Compare the holders and waiters with the ones at the previous
+	   sample, then remember them for the next one */
+	if (gh->seen + 1 != s->seq)
+		gh->nheld = gh->nwait = 0;
+	for (i = 0; i < gi->nholders; i++) {
+		const struct holder_info *h = &gi->holders[i];
+
+		if (holder_is_holder(h)) {
+			held_over += had_pid(gh->pids, gh->nheld, h->pid);
+			if (nheld < SAMPLE_PIDS / 2)
+				pids[nheld++] = h->pid;
+		}
+	}
+	for (i = 0; i < gi->nholders; i++) {
+		const struct holder_info *h = &gi->holders[i];
+
+		if (holder_is_waiter(h)) {
+			new_waiters += !had_pid(gh->pids + gh->nheld, gh->nwait,
+						h->pid);
+			if (nheld + nwait < SAMPLE_PIDS)
+				pids[nheld + nwait++] = h->pid;
+		}
+	}
+	memcpy(gh->pids, pids, (nheld + nwait) * sizeof(long));
+	gh->nheld = nheld;
+	gh->nwait = nwait;
+
+	/* Clear the samples the glock wasn't in */
+	if (gh->seen == 0) /* New, so all clear */
+		q = s->seq;
+	else if (s->seq - gh->seen > SAMPLE_HISTORY)
+		q = s->seq - SAMPLE_HISTORY + 1;
+	else
+		q = gh->seen + 1;
+	for (; q < s->seq; q++)
+		memset(&gh->s[q % SAMPLE_HISTORY], 0, sizeof(gh->s[0]));
+
+	gs = &gh->s[s->seq % SAMPLE_HISTORY];
+	gs->waiters = waiters > UINT16_MAX ? UINT16_MAX : waiters;
+	gs->new_waiters = new_waiters > UINT16_MAX ? UINT16_MAX : new_waiters;
+	gs->holders = holders > UINT16_MAX ? UINT16_MAX : holders;
+	gs->held_over = held_over;
+	/* The demote time is in microseconds */
+	gs->demote_ms = gi->demote_time / 1000 > UINT32_MAX ? UINT32_MAX :
+			gi->demote_time / 1000;
+	gh->seen = s->seq;
+	if (contended)
+		gh->contended = s->seq;
+out:
+	if (waiters) {
+		ts->contended++;
+		ts->waiters += waiters;
+		ts->new_waiters += new_waiters;
+	}
+	if (gi->demote_time)
+		ts->demoting++;
+}
+
+/**
+ * sampler_end - finish the current sample
+ * Glocks that haven't been contended for the whole history are forgotten.
+ */
+void sampler_end(struct sampler *s)
+{
+	unsigned i;
+
+	if (s->seq < SAMPLE_HISTORY)
+		return;
+	for (i = 0; i < s->nbuckets; i++) {
+		struct glock_hist **ghp = &s->hash[i];
+
+		while (*ghp != NULL) {
+			struct glock_hist *gh = *ghp;
+
+			if (s->seq - gh->contended < SAMPLE_HISTORY) {
+				ghp = &gh->next;
+				continue;
+			}
+			*ghp = gh->next;
+			free(gh);
+			s->count--;
+		}
+	}
+}
+
+/* Number of samples that rankings and time series cover */
+unsigned sampler_window(const struct sampler *s)
+{
+	return s->seq < SAMPLE_HISTORY ? s->seq : SAMPLE_HISTORY;
+}
+
+/**
+ * hist_sample - a glock's sample from @ago samples before the current one
+ */
+const struct glock_sample *hist_sample(const struct sampler *s,
+				       const struct glock_hist *gh, unsigned ago)
+{
+	if (ago >= sampler_window(s) || s->seq - ago > gh->seen)
+		return &no_sample;
+	return &gh->s[(s->seq - ago) % SAMPLE_HISTORY];
+}
+
+/**
+ * type_sample - the totals for a lock type from @ago samples before the
+ * current one
+ */
+const struct type_sample *type_sample(const struct sampler *s, unsigned type,
+				      unsigned ago)
+{
+	if (ago >= sampler_window(s) || type >= GLOCK_TYPES)
+		return &no_type_sample;
+	return &s->types[(s->seq - ago) % SAMPLE_HISTORY][type];
+}
+
+static int rank_cmp(const struct glock_rank *a, const struct glock_rank *b)
+{
+	if (a->score != b->score)
+		return a->score > b->score ? 1 : -1;
+	if (a->demote_ms != b->demote_ms)
+		return a->demote_ms > b->demote_ms ? 1 : -1;
+	return 0;
+}
+
+/**
+ * sampler_top - find the most contended glocks over the window
+ * @top: filled in with up to @n glocks, most contended first
+ *
+ * Returns: the number of glocks in @top
+ */
+unsigned sampler_top(const struct sampler *s, struct glock_rank *top,
+		     unsigned n)
+{
+	unsigned win = sampler_window(s);
+	unsigned found = 0, i, j, ago;
+
+	if (n == 0)
+		return 0;
+	for (i = 0; i < s->nbuckets; i++) {
+		const struct glock_hist *gh;
+
+		for (gh = s->hash[i]; gh != NULL; gh = gh->next) {
+			struct glock_rank r = { .gh = gh };
+
+			for (ago = 0; ago < win; ago++) {
+				const struct glock_sample *gs = hist_sample(s, gh, ago);
+
+				r.score += gs->waiters;
+				if (gs->waiters > r.peak)
+					r.peak = gs->waiters;
+				r.new_waiters += gs->new_waiters;
+				r.held_over += gs->held_over;
+				if (gs->demote_ms > r.demote_ms)
+					r.demote_ms = gs->demote_ms;
+			}
+			if (r.score == 0 && r.demote_ms == 0)
+				continue;
+			/* Insertion into the few places kept */
+			if (found == n && rank_cmp(&r, &top[n - 1]) <= 0)
+				continue;
+			j = (found < n) ? found++ : n - 1;
+			for (; j > 0 && rank_cmp(&r, &top[j - 1]) > 0; j--)
+				top[j] = top[j - 1];
+			top[j] = r;
+		}
+	}
+	return found;
+}
+
+/* Scale a series of values, oldest first, into a line of characters */
+void sparkline(char *out, const unsigned *vals, unsigned n)
+{
+	const char levels[] = " .:-=+*#";
+	unsigned cols = n < SPARK_COLS ? n : SPARK_COLS;
+	unsigned max = 0, c, i;
+
+	for (i = 0; i < n; i++)
+		if (vals[i] > max)
+			max = vals[i];
+	memset(out, ' ', SPARK_COLS);
+	out[SPARK_COLS] = '\0';
+	for (c = 0; c < cols && max; c++) {
+		unsigned v = 0;
+
+		/* Each column shows the peak of the samples it covers */
+		for (i = c * n / cols; i < (c + 1) * n / cols; i++)
+			if (vals[i] > v)
+				v = vals[i];
+		out[SPARK_COLS - cols + c] = levels[(v * 7 + max - 1) / max];
+	}
+}
+
+void samplers_free(void)
+{
+	while (samplers != NULL) {
+		struct sampler *s = samplers;
+		unsigned i;
+
+		for (i = 0; i < s->nbuckets; i++) {
+			while (s->hash[i] != NULL) {
+				struct glock_hist *gh = s->hash[i];
+
+				s->hash[i] = gh->next;
+				free(gh);
+			}
+		}
+		samplers = s->next;
+		free(s->hash);
+		free(s->fsname);
+		free(s);
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef __SAMPLE_DOT_H__
+#define __SAMPLE_DOT_H__
+
+#include <stdint.h>
+#include "glocks.h"
+
+#define SAMPLE_HISTORY 60    /* Samples kept for each glock and lock type */
+#define SAMPLE_PIDS    8     /* Holder and waiter pids remembered per glock */
+#define SAMPLE_MAX     16384 /* Most glocks tracked per file system */
+#define SPARK_COLS     20    /* Width of a line drawn by sparkline() */
+
+/* One sample of one glock */
+struct glock_sample {
+	uint16_t waiters;     /* Holders waiting for the glock */
+	uint16_t new_waiters; /* ...that weren't waiting at the previous sample */
+	uint16_t holders;     /* Holders granted the glock */
+	uint16_t held_over;   /* ...that were holding it at the previous sample */
+	uint32_t demote_ms;   /* How long a demote request has been pending */
+};
+
+/* A glock that has been contended within the last SAMPLE_HISTORY samples */
+struct glock_hist {
+	struct glock_hist *next; /* Hash chain */
+	uint64_t number;
+	unsigned type;
+	uint64_t seen;           /* Last sample the glock was in */
+	uint64_t contended;      /* Last sample it had waiters or a demote */
+	long pids[SAMPLE_PIDS];  /* Holders and then waiters at that sample */
+	unsigned nheld;
+	unsigned nwait;
+	struct glock_sample s[SAMPLE_HISTORY];
+};
+
+/* One sample of all the glocks of one lock type */
+struct type_sample {
+	uint32_t contended;   /* Glocks with waiters */
+	uint32_t waiters;
+	uint32_t new_waiters;
+	uint32_t demoting;    /* Glocks with a demote pending */
+};
+
+struct sampler {
+	struct sampler *next;
+	char *fsname;
+	uint64_t seq;         /* Samples started, the current one included */
+	struct glock_hist **hash;
+	unsigned nbuckets;
+	unsigned count;
+	struct type_sample types[SAMPLE_HISTORY][GLOCK_TYPES];
+};
+
+/* A glock's contention over the samples kept */
+struct glock_rank {
+	const struct glock_hist *gh;
+	unsigned score;       /* Sum of the waiters over the window */
+	unsigned peak;        /* Most waiters in any one sample */
+	unsigned new_waiters;
+	unsigned held_over;
+	uint32_t demote_ms;   /* Longest pending demote */
+};
+
+extern struct sampler *sampler_get(const char *fsname);
+extern void sampler_begin(struct sampler *s);
+extern void sampler_add(struct sampler *s, const struct glock_info *gi);
+extern void sampler_end(struct sampler *s);
+extern unsigned sampler_window(const struct sampler *s);
+extern unsigned sampler_top(const struct sampler *s, struct glock_rank *top,
+			    unsigned n);
+extern const struct glock_sample *hist_sample(const struct sampler *s,
+					      const struct glock_hist *gh,
+					      unsigned ago);
+extern const struct type_sample *type_sample(const struct sampler *s,
+					     unsigned type, unsigned ago);
+extern void sparkline(char *out, const unsigned *vals, unsigned n);
+extern void samplers_free(void);
+
+#endif /* __SAMPLE_DOT_H__ */
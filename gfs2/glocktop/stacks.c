@@ -0,0 +1,271 @@
+#include "clusterautoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stacks.h"
+
+/*
+ * Kernel stacks of the processes holding and waiting for contended glocks.
+ * Each time the glocks are read, the /proc/<pid>/stack of every holder and
+ * waiter of a glock that has waiters is read and folded into one line, with
+ * the glock's lock type and whether the process held or waited for it as the
+ * outermost frames, and the count of each distinct line is kept in a hash
+ * table. Over a long run that shows which code paths keep inode glocks
+ * contended, rather than the one stack on the screen at a time. The table is
+ * written out in the folded format that flamegraph tools read, one line per
+ * stack followed by its count.
+ */
+
+#define STACK_FRAMES 64 /* Most frames folded from one stack */
+
+extern const char *ltype[];
+
+static struct stack_table *table;
+
+/**
+ * stacks_open - start folding stacks, to be written to @path
+ *
+ * Returns: 0 on success or -1 if out of memory
+ */
+int stacks_open(const char *path)
+{
+	table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		return -1;
+	table->path = path;
+	table->nbuckets = 1024;
+	table->hash = calloc(table->nbuckets, sizeof(*table->hash));
+	if (table->hash == NULL) {
+		free(table);
+		table = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Whether stacks are being folded, which needs every glock to be read */
+int stacks_enabled(void)
+{
+	return table != NULL;
+}
+
+/* How many stacks have been read, or failed to be, so far */
+uint64_t stacks_tried(void)
+{
+	if (table == NULL)
+		return 0;
+	return table->samples + table->unreadable;
+}
+
+/* Start a sample; only so many stacks are read from each */
+void stacks_begin(void)
+{
+	if (table != NULL)
+		table->read = 0;
+}
+
+static uint64_t hash_frames(const char *s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*s != '\0')
+		h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+	return h;
+}
+
+static void grow_hash(void)
+{
+	unsigned nbuckets = table->nbuckets * 2;
+	struct folded_stack **hash = calloc(nbuckets, sizeof(*hash));
+	struct folded_stack **old = table->hash;
+	unsigned i;
+
+	if (hash == NULL)
+		return;
+	table->hash = hash;
+	table->nbuckets = nbuckets;
+	for (i = 0; i < nbuckets / 2; i++) {
+		while (old[i] != NULL) {
+			struct folded_stack *fs = old[i];
+			unsigned b = fs->hash & (nbuckets - 1);
+
+			old[i] = fs->next;
+			fs->next = hash[b];
+			hash[b] = fs;
+		}
+	}
+	free(old);
+}
+
+static void count_stack(const char *frames)
+{
+	uint64_t h = hash_frames(frames);
+	struct folded_stack *fs;
+	unsigned b = h & (table->nbuckets - 1);
+
+	for (fs = table->hash[b]; fs != NULL; fs = fs->next) {
+		if (fs->hash == h && strcmp(fs->frames, frames) == 0) {
+			fs->count++;
+			return;
+		}
+	}
+	if (table->count >= table->nbuckets) {
+		grow_hash();
+		b = h & (table->nbuckets - 1);
+	}
+	fs = malloc(sizeof(*fs) + strlen(frames) + 1);
+	if (fs == NULL)
+		return;
+	fs->hash = h;
+	fs->count = 1;
+	strcpy(fs->frames, frames);
+	fs->next = table->hash[b];
+	table->hash[b] = fs;
+	table->count++;
+}
+
+/* Read a process's stack, innermost frame first, into @buf.
+   Returns the number of frames or -1 if the stack couldn't be read. */
+static int read_stack(long pid, char *buf, size_t size, char **frames)
+{
+	char path[32], *p, *end;
+	ssize_t len;
+	int fd, n = 0;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stack", pid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	/* Lines look like "[<0>] gfs2_glock_wait+0x3e/0x80 [gfs2]" */
+	for (p = buf; *p != '\0' && n < STACK_FRAMES; p = end + 1) {
+		end = strchr(p, '\n');
+		if (end == NULL)
+			break;
+		*end = '\0';
+		p = strchr(p, ']');
+		if (p == NULL)
+			continue;
+		p += strspn(p + 1, " ") + 1;
+		p[strcspn(p, "+ ")] = '\0';
+		if (*p != '\0')
+			frames[n++] = p;
+	}
+	return n;
+}
+
+/**
+ * stacks_add - fold in the stacks of a glock's holders and waiters, if it
+ * has waiters
+ */
+void stacks_add(const struct glock_info *gi)
+{
+	char buf[STACK_SIZE], folded[STACK_SIZE + 64], *frames[STACK_FRAMES];
+	unsigned i;
+	int n, len;
+
+	if (table == NULL)
+		return;
+	for (i = 0; i < gi->nholders; i++)
+		if (holder_is_waiter(&gi->holders[i]))
+			break;
+	if (i == gi->nholders)
+		return;
+	for (i = 0; i < gi->nholders; i++) {
+		const struct holder_info *h = &gi->holders[i];
+		const char *role;
+
+		if (holder_is_waiter(h))
+			role = "waiting";
+		else if (holder_is_holder(h))
+			role = "holding";
+		else
+			continue;
+		if (table->read >= STACKS_PER_SAMPLE)
+			return;
+		table->read++;
+		n = read_stack(h->pid, buf, sizeof(buf), frames);
+		if (n < 0) {
+			table->unreadable++;
+			continue;
+		}
+		len = snprintf(folded, sizeof(folded), "%s;%s",
+			       gi->type < GLOCK_TYPES - 1 ? ltype[gi->type] :
+			       ltype[0], role);
+		while (n-- > 0 && len < (int)sizeof(folded))
+			len += snprintf(folded + len, sizeof(folded) - len,
+					";%s", frames[n]);
+		/* flamegraph tools take the last space as the count's */
+		for (n = 0; folded[n] != '\0'; n++)
+			if (folded[n] == ' ')
+				folded[n] = '_';
+		count_stack(folded);
+		table->samples++;
+	}
+}
+
+/**
+ * stacks_write - write out the folded stacks so far, replacing the file
+ *
+ * Returns: 0 on success or -1 with errno set
+ */
+int stacks_write(void)
+{
+	char *tmp;
+	FILE *f;
+	unsigned i;
+
+	if (table == NULL)
+		return 0;
+	if (asprintf(&tmp, "%s.tmp", table->path) == -1)
+		return -1;
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		return -1;
+	}
+	for (i = 0; i < table->nbuckets; i++) {
+		struct folded_stack *fs;
+
+		for (fs = table->hash[i]; fs != NULL; fs = fs->next)
+			fprintf(f, "%s %"PRIu64"\n", fs->frames, fs->count);
+	}
+	if (fclose(f) || rename(tmp, table->path)) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
+
+void stacks_close(void)
+{
+	unsigned i;
+
+	if (table == NULL)
+		return;
+	if (table->samples == 0 && table->unreadable)
+		fprintf(stderr, "No holder stacks could be read; reading "
+			"/proc/<pid>/stack needs root\n");
+	for (i = 0; i < table->nbuckets; i++) {
+		while (table->hash[i] != NULL) {
+			struct folded_stack *fs = table->hash[i];
+
+			table->hash[i] = fs->next;
+			free(fs);
+		}
+	}
+	free(table->hash);
+	free(table);
+	table = NULL;
+}
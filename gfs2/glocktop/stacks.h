@@ -0,0 +1,36 @@
+#ifndef __STACKS_DOT_H__
+#define __STACKS_DOT_H__
+
+#include <stdint.h>
+#include "glocks.h"
+
+#define STACKS_PER_SAMPLE 256  /* Most stacks read from /proc per sample */
+#define STACK_SIZE        4096 /* Most of a /proc/<pid>/stack file read */
+
+/* A folded stack, lock type and role first, and how often it was seen */
+struct folded_stack {
+	struct folded_stack *next; /* Hash chain */
+	uint64_t hash;
+	uint64_t count;
+	char frames[];
+};
+
+struct stack_table {
+	const char *path;          /* Where the folded stacks are written */
+	struct folded_stack **hash;
+	unsigned nbuckets;
+	unsigned count;
+	unsigned read;             /* Stacks read in the current sample */
+	uint64_t samples;          /* Stacks folded in, and ones that */
+	uint64_t unreadable;       /* couldn't be read */
+};
+
+extern int stacks_open(const char *path);
+extern int stacks_enabled(void);
+extern uint64_t stacks_tried(void);
+extern void stacks_begin(void);
+extern void stacks_add(const struct glock_info *gi);
+extern int stacks_write(void);
+extern void stacks_close(void);
+
+#endif /* __STACKS_DOT_H__ */
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -22,6 +23,55 @@
   #endif
 #endif
 
+/**
+ * lgfs2_io_start - note the start of an I/O request for accounting
+ * Returns the start time to pass to lgfs2_io_done(), or 0 if I/O isn't being
+ * counted for this file system.
+ */
+uint64_t lgfs2_io_start(struct gfs2_sbd *sdp)
+{
+	struct timespec ts;
+
+	if (sdp->io_stats == NULL)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * lgfs2_io_done - account for a completed I/O request
+ * @blk: The first block of the request
+ * @count: The number of blocks in the request
+ * @write: Non-zero for a write request
+ * @start: The value returned by lgfs2_io_start() for this request
+ */
+void lgfs2_io_done(struct gfs2_sbd *sdp, uint64_t blk, uint64_t count,
+                   int write, uint64_t start)
+{
+	struct lgfs2_io_stats *st = sdp->io_stats;
+	uint64_t ns, us;
+	unsigned b = 0;
+
+	if (st == NULL)
+		return;
+	st->now = lgfs2_io_start(sdp);
+	ns = st->now - start;
+	if (write) {
+		st->writes++;
+		st->write_blocks += count;
+		st->write_ns += ns;
+	} else {
+		st->reads++;
+		st->read_blocks += count;
+		st->read_ns += ns;
+		for (us = ns / 1000; us && b < LGFS2_IO_LAT_BUCKETS - 1; us >>= 1)
+			b++;
+		st->read_lat[b]++;
+	}
+	if (st->account)
+		st->account(st, blk, count, write, ns);
+}
+
 struct gfs2_buffer_head *bget(struct gfs2_sbd *sdp, uint64_t num)
 {
 	struct gfs2_buffer_head *bh;
@@ -63,6 +113,7 @@ int __breadm(struct gfs2_sbd *sdp, struct gfs2_buffer_head **bhs, size_t n,
 		int j;
 		ssize_t ret;
 		ssize_t size = 0;
+		uint64_t start;
 
 		for (j = 0; (i + j < n) && (j < IOV_MAX); j++) {
 			bhs[i + j] = bget(sdp, block + i + j);
@@ -72,7 +123,9 @@ int __breadm(struct gfs2_sbd *sdp, struct gfs2_buffer_head **bhs, size_t n,
 			size += bhs[i + j]->iov.iov_len;
 		}
 
+		start = lgfs2_io_start(sdp);
 		ret = preadv(sdp->device_fd, iovbase, j, (block + i) * sdp->bsize);
+		lgfs2_io_done(sdp, block + i, j, 0, start);
 		if (ret != size) {
 			fprintf(stderr, "bad read: %s from %s:%d: block %llu (0x%llx) "
 					"count: %d size: %zd ret: %zd\n", strerror(errno),
@@ -102,13 +155,16 @@ struct gfs2_buffer_head *__bread(struct gfs2_sbd *sdp, uint64_t num, int line,
 				 const char *caller)
 {
 	struct gfs2_buffer_head *bh;
+	uint64_t start;
 	ssize_t ret;
 
 	bh = bget(sdp, num);
 	if (bh == NULL)
 		return NULL;
 
+	start = lgfs2_io_start(sdp);
 	ret = pread(sdp->device_fd, bh->b_data, sdp->bsize, num * sdp->bsize);
+	lgfs2_io_done(sdp, num, 1, 0, start);
 	if (ret != sdp->bsize) {
 		fprintf(stderr, "%s:%d: Error reading block %"PRIu64": %s\n",
 		                caller, line, num, strerror(errno));
@@ -121,8 +177,12 @@ struct gfs2_buffer_head *__bread(struct gfs2_sbd *sdp, uint64_t num, int line,
 int bwrite(struct gfs2_buffer_head *bh)
 {
 	struct gfs2_sbd *sdp = bh->sdp;
+	uint64_t start = lgfs2_io_start(sdp);
+	ssize_t ret;
 
-	if (pwritev(sdp->device_fd, &bh->iov, 1, bh->b_blocknr * sdp->bsize) != bh->iov.iov_len)
+	ret = pwritev(sdp->device_fd, &bh->iov, 1, bh->b_blocknr * sdp->bsize);
+	lgfs2_io_done(sdp, bh->b_blocknr, 1, 1, start);
+	if (ret != bh->iov.iov_len)
 		return -1;
 	bh->b_modified = 0;
 	return 0;
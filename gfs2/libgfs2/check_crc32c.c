@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <check.h>
+#include "crc32c.h"
+
+/* Up to two rounds of the three 1024 byte streams and then some */
+#define MAXLEN 8192
+
+Suite *suite_crc32c(void);
+
+/* One byte of the CRC a bit at a time, with the reflected polynomial */
+static uint32_t crc32c_bitwise(uint32_t crc, unsigned char c)
+{
+	unsigned i;
+
+	crc ^= c;
+	for (i = 0; i < 8; i++)
+		crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+	return crc;
+}
+
+START_TEST(test_crc32c)
+{
+	static unsigned char buf[MAXLEN + 16];
+	static uint32_t ref[MAXLEN + 1];
+	unsigned len, off;
+
+	ck_assert((crc32c(~0U, (unsigned char *)"123456789", 9) ^ ~0U) == 0xE3069283);
+	srandom(3);
+	for (len = 0; len < sizeof(buf); len++)
+		buf[len] = random();
+	/* Every length at every alignment, which goes through the ends of the
+	   long and short three-stream rounds and every tail after them */
+	for (off = 0; off < 16; off++) {
+		uint32_t seed = off * 0x9e3779b9;
+
+		ref[0] = seed;
+		for (len = 1; len <= MAXLEN; len++)
+			ref[len] = crc32c_bitwise(ref[len - 1], buf[off + len - 1]);
+		for (len = 0; len <= MAXLEN; len++)
+			ck_assert(crc32c(seed, buf + off, len) == ref[len]);
+	}
+}
+END_TEST
+
+START_TEST(test_crc32c_chained)
+{
+	static unsigned char buf[MAXLEN];
+	uint32_t whole, crc;
+	unsigned split;
+
+	srandom(4);
+	for (split = 0; split < sizeof(buf); split++)
+		buf[split] = random();
+	/* A CRC carried on from one call to the next is the CRC of the lot */
+	whole = crc32c(~0U, buf, sizeof(buf));
+	for (split = 0; split <= sizeof(buf); split += 383) {
+		crc = crc32c(~0U, buf, split);
+		crc = crc32c(crc, buf + split, sizeof(buf) - split);
+		ck_assert(crc == whole);
+	}
+}
+END_TEST
+
+Suite *suite_crc32c(void)
+{
+	Suite *s = suite_create("crc32c.c");
+
+	TCase *tc_crc = tcase_create("crc32c");
+	tcase_add_test(tc_crc, test_crc32c);
+	tcase_add_test(tc_crc, test_crc32c_chained);
+	suite_add_tcase(s, tc_crc);
+
+	return s;
+}
@@ -0,0 +1,643 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <check.h>
+#include "libgfs2.h"
+#include "rgrp.h"
+
+/* Sparse, so only the blocks the tests write take any space */
+#define MOCK_DEV_SIZE (1 << 30)
+#define MAX_WRITES 16
+
+Suite *suite_fs_ops(void);
+
+static struct gfs2_sbd *tc_sdp;
+static lgfs2_rgrps_t tc_rgs;
+
+/* The writes made to a file so far, oldest first */
+struct write_log {
+	unsigned count;
+	struct {
+		uint64_t offset;
+		unsigned size;
+		char *data;
+	} w[MAX_WRITES];
+};
+
+static void mockup_fs(void)
+{
+	struct gfs2_sbd *sdp;
+	lgfs2_rgrps_t rgs;
+	uint32_t rgsize = (100 << 20) / 4096;
+	uint64_t addr;
+	char tmpnam[] = "mockdev-XXXXXX";
+
+	sdp = calloc(1, sizeof(*sdp));
+	ck_assert(sdp != NULL);
+
+	sdp->device.length = MOCK_DEV_SIZE / 4096;
+	sdp->device_fd = mkstemp(tmpnam);
+	ck_assert(sdp->device_fd >= 0);
+	ck_assert(unlink(tmpnam) == 0);
+	ck_assert(ftruncate(sdp->device_fd, MOCK_DEV_SIZE) == 0);
+
+	sdp->bsize = sdp->sd_sb.sb_bsize = 4096;
+	compute_constants(sdp);
+
+	/* The resource groups start straight after the superblock */
+	addr = LGFS2_SB_ADDR(sdp) + 1;
+	rgs = lgfs2_rgrps_init(sdp, 0, 0);
+	ck_assert(rgs != NULL);
+	lgfs2_rgrps_plan(rgs, sdp->device.length - addr, rgsize);
+	for (;;) {
+		struct gfs2_rindex ri = {0};
+		uint64_t next = lgfs2_rindex_entry_new(rgs, &ri, addr, 0);
+		lgfs2_rgrp_t rg;
+
+		if (next == 0)
+			break;
+		rg = lgfs2_rgrps_append(rgs, &ri, next - addr);
+		ck_assert(rg != NULL);
+		ck_assert(lgfs2_rgrp_write(sdp->device_fd, rg) == 0);
+		addr = next;
+	}
+	sdp->fssize = addr;
+	lgfs2_attach_rgrps(sdp, rgs);
+	ck_assert(lgfs2_alloc_begin(sdp) == 0);
+	ck_assert(build_master(sdp) == 0);
+	tc_sdp = sdp;
+	tc_rgs = rgs;
+}
+
+static void teardown_fs(void)
+{
+	struct gfs2_sbd *sdp = tc_sdp;
+
+	inode_put(&sdp->master_dir);
+	lgfs2_alloc_end(sdp);
+	lgfs2_alloc_forget(sdp);
+	lgfs2_rgrps_free(&tc_rgs);
+	close(sdp->device_fd);
+	free(sdp);
+}
+
+static struct gfs2_inode *mock_file(const char *name, unsigned mode)
+{
+	struct gfs2_inode *ip = createi(tc_sdp->master_dir, name, mode, 0);
+	char *zero;
+
+	ck_assert(ip != NULL);
+	/* Start from nothing but zeroes, even for the dirents of a directory */
+	zero = calloc(1, ip->i_di.di_size + 1);
+	ck_assert(zero != NULL);
+	ck_assert(gfs2_writei(ip, zero, 0, ip->i_di.di_size) == (int)ip->i_di.di_size);
+	free(zero);
+	return ip;
+}
+
+/* The bytes a file should hold, from the writes made to it */
+static void expected(const struct write_log *log, uint64_t offset, unsigned size, char *buf)
+{
+	unsigned i;
+
+	memset(buf, 0, size);
+	for (i = 0; i < log->count; i++) {
+		uint64_t start = log->w[i].offset;
+		uint64_t end = start + log->w[i].size;
+
+		if (start < offset)
+			start = offset;
+		if (end > offset + size)
+			end = offset + size;
+		if (start < end)
+			memcpy(buf + (start - offset),
+			       log->w[i].data + (start - log->w[i].offset), end - start);
+	}
+}
+
+/* How gfs2_readi() used to read: a block_map() and a bread() per block */
+static void read_blockwise(struct gfs2_inode *ip, uint64_t offset, unsigned size, char *buf)
+{
+	struct gfs2_sbd *sdp = ip->i_sbd;
+	int isdir = S_ISDIR(ip->i_di.di_mode);
+	unsigned hdr = isdir ? sizeof(struct gfs2_meta_header) : 0;
+	unsigned per = sdp->bsize - hdr;
+	unsigned copied = 0;
+
+	if (ip->i_di.di_height == 0) {
+		memcpy(buf, ip->i_bh->b_data + sizeof(struct gfs2_dinode) + offset, size);
+		return;
+	}
+	while (copied < size) {
+		uint64_t lblock = (offset + copied) / per;
+		unsigned o = (offset + copied) % per;
+		unsigned amount = per - o;
+		uint64_t dblock = 0;
+		uint32_t extlen = 0;
+		int new = 0;
+
+		if (amount > size - copied)
+			amount = size - copied;
+		block_map(ip, lblock, &new, &dblock, &extlen, 0);
+		if (dblock == 0) {
+			memset(buf + copied, 0, amount);
+		} else {
+			struct gfs2_buffer_head *bh = bread(sdp, dblock);
+
+			memcpy(buf + copied, bh->b_data + hdr + o, amount);
+			brelse(bh);
+		}
+		copied += amount;
+	}
+}
+
+/* Write to both files, to @ip in one go and to @ref a block at a time */
+static void log_write(struct write_log *log, struct gfs2_inode *ip, struct gfs2_inode *ref,
+                      uint64_t offset, unsigned size)
+{
+	unsigned per = ip->i_sbd->bsize;
+	unsigned done = 0;
+	char *data;
+	unsigned i;
+
+	if (S_ISDIR(ip->i_di.di_mode))
+		per -= sizeof(struct gfs2_meta_header);
+	ck_assert(log->count < MAX_WRITES);
+	data = malloc(size);
+	ck_assert(data != NULL);
+	for (i = 0; i < size; i++)
+		data[i] = random();
+	log->w[log->count].offset = offset;
+	log->w[log->count].size = size;
+	log->w[log->count].data = data;
+	log->count++;
+
+	ck_assert_int_eq(gfs2_writei(ip, data, offset, size), size);
+	while (done < size) {
+		unsigned amount = per - (offset + done) % per;
+
+		if (amount > size - done)
+			amount = size - done;
+		ck_assert_int_eq(gfs2_writei(ref, data + done, offset + done, amount), amount);
+		done += amount;
+	}
+	ck_assert(ip->i_di.di_size == ref->i_di.di_size);
+}
+
+static void log_free(struct write_log *log)
+{
+	while (log->count > 0)
+		free(log->w[--log->count].data);
+}
+
+/* Read [offset, offset + size) of both files every way there is */
+static void check_range(const struct write_log *log, struct gfs2_inode *ip,
+                        struct gfs2_inode *ref, uint64_t offset, unsigned size)
+{
+	char *want = malloc(size);
+	char *got = malloc(size);
+
+	ck_assert(want != NULL && got != NULL);
+	if (offset + size > ip->i_di.di_size)
+		size = ip->i_di.di_size - offset;
+	expected(log, offset, size, want);
+
+	ck_assert_int_eq(gfs2_readi(ip, got, offset, size), size);
+	ck_assert(memcmp(want, got, size) == 0);
+	ck_assert_int_eq(gfs2_readi(ref, got, offset, size), size);
+	ck_assert(memcmp(want, got, size) == 0);
+	read_blockwise(ip, offset, size, got);
+	ck_assert(memcmp(want, got, size) == 0);
+	read_blockwise(ref, offset, size, got);
+	ck_assert(memcmp(want, got, size) == 0);
+	free(want);
+	free(got);
+}
+
+/* Each extent lgfs2_extent_map() returns must agree block for block with
+   block_map() and be as long as it can be */
+static void check_extents(struct gfs2_inode *ip, uint64_t lblock, uint64_t count)
+{
+	uint64_t end = lblock + count;
+
+	while (lblock < end) {
+		uint64_t dblock, extlen, i;
+		uint64_t next = 0;
+		uint32_t len;
+		int new = 0;
+
+		ck_assert(lgfs2_extent_map(ip, lblock, end - lblock, &dblock, &extlen) == 0);
+		ck_assert(extlen > 0 && extlen <= end - lblock);
+		for (i = 0; i < extlen; i++) {
+			block_map(ip, lblock + i, &new, &next, &len, 0);
+			ck_assert(next == (dblock ? dblock + i : 0));
+		}
+		lblock += extlen;
+		if (lblock < end) {
+			block_map(ip, lblock, &new, &next, &len, 0);
+			ck_assert(next != (dblock ? dblock + extlen : 0));
+		}
+	}
+}
+
+/* Writes that leave holes and need each height of metadata tree in turn,
+   none of them aligned to a block */
+static void sparse_file(unsigned mode)
+{
+	static const struct {
+		uint64_t offset;
+		unsigned size;
+	} writes[] = {
+		{ 100, 1000 },                      /* Stuffed */
+		{ 5000, 3 },                        /* Unstuffs, leaving a hole */
+		{ 4095, 2 },                        /* Straddles a block boundary */
+		{ 40000, 3 << 20 },                 /* Height 2, across indirect blocks */
+		{ (600ULL << 20) + 1, 70000 },      /* Well past the data */
+		{ (1500ULL << 20) + 777, 9000 },    /* Height 3 */
+		{ 3000, 50000 },                    /* Over the top of earlier writes */
+		{ (1500ULL << 20) - 4097, 8194 },   /* Fills a hole next to a run */
+	};
+	struct gfs2_inode *ip = mock_file("a", mode);
+	struct gfs2_inode *ref = mock_file("b", mode);
+	struct write_log log = {0};
+	unsigned per = tc_sdp->bsize;
+	unsigned i, j;
+
+	if (S_ISDIR(mode))
+		per -= sizeof(struct gfs2_meta_header);
+	srandom(42);
+	for (i = 0; i < sizeof(writes) / sizeof(writes[0]); i++) {
+		log_write(&log, ip, ref, writes[i].offset, writes[i].size);
+		/* Everything written so far, with a little either side */
+		for (j = 0; j < log.count; j++) {
+			uint64_t start = log.w[j].offset;
+
+			start = start > 2 * per ? start - 2 * per - 1 : 0;
+			check_range(&log, ip, ref, start, log.w[j].size + 4 * per + 2);
+		}
+	}
+	ck_assert(ip->i_di.di_height == 3);
+	ck_assert(ref->i_di.di_height == 3);
+
+	/* Short reads from random places near the writes */
+	for (i = 0; i < 200; i++) {
+		j = random() % log.count;
+		check_range(&log, ip, ref, log.w[j].offset + random() % log.w[j].size,
+		            1 + random() % (3 * per));
+	}
+	for (j = 0; j < log.count; j++) {
+		uint64_t lblock = log.w[j].offset / per;
+
+		lblock = lblock > 1000 ? lblock - 1000 : 0;
+		check_extents(ip, lblock, log.w[j].size / per + 2000);
+		check_extents(ref, lblock, log.w[j].size / per + 2000);
+	}
+	log_free(&log);
+	inode_put(&ip);
+	inode_put(&ref);
+}
+
+START_TEST(test_rw_file)
+{
+	sparse_file(S_IFREG | 0644);
+}
+END_TEST
+
+START_TEST(test_rw_dir)
+{
+	sparse_file(S_IFDIR | 0755);
+}
+END_TEST
+
+START_TEST(test_mpcache_drop)
+{
+	struct gfs2_inode *ip = mock_file("a", S_IFREG | 0644);
+	struct gfs2_inode *ref = mock_file("b", S_IFREG | 0644);
+	struct write_log log = {0};
+	struct gfs2_buffer_head *bh;
+	uint64_t dblock, extlen, ind;
+
+	srandom(7);
+	log_write(&log, ip, ref, 0, 4 << 20);
+	ck_assert(lgfs2_extent_map(ip, 0, 1, &dblock, &extlen) == 0);
+	ck_assert(dblock != 0);
+
+	/* Clear a pointer behind the cache's back, as fsck does */
+	ind = be64_to_cpu(*(uint64_t *)(ip->i_bh->b_data + sizeof(struct gfs2_dinode)));
+	bh = bread(tc_sdp, ind);
+	*(uint64_t *)(bh->b_data + sizeof(struct gfs2_meta_header)) = 0;
+	bmodified(bh);
+	brelse(bh);
+	lgfs2_mpcache_drop(ip);
+
+	ck_assert(lgfs2_extent_map(ip, 0, 1, &dblock, &extlen) == 0);
+	ck_assert(dblock == 0);
+	check_extents(ip, 0, 1100);
+	log_free(&log);
+	inode_put(&ip);
+	inode_put(&ref);
+}
+END_TEST
+
+/* Entries named @prefix0, @prefix1... pointing nowhere in particular, with
+   their names in one buffer, returned in @names */
+static struct lgfs2_dir_entry *mock_dirents(const char *prefix, unsigned count, char **names)
+{
+	struct lgfs2_dir_entry *ents = calloc(count, sizeof(*ents));
+	unsigned i;
+
+	*names = calloc(count, 16);
+	ck_assert(ents != NULL && *names != NULL);
+	for (i = 0; i < count; i++) {
+		char *name = *names + i * 16;
+
+		ents[i].len = snprintf(name, 16, "%s%u", prefix, i);
+		ents[i].name = name;
+		ents[i].inum.no_formal_ino = 100 + i;
+		ents[i].inum.no_addr = 1000 + i;
+		ents[i].type = i % 2 ? DT_REG : DT_DIR;
+	}
+	return ents;
+}
+
+/* Every entry must be found by name, with the inode and type it was given */
+static void check_dirents(struct gfs2_inode *dip, const struct lgfs2_dir_entry *ents,
+                          unsigned count)
+{
+	struct gfs2_inum inum;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		unsigned type = 0;
+
+		memset(&inum, 0, sizeof(inum));
+		ck_assert_int_eq(dir_search(dip, ents[i].name, ents[i].len, &type, &inum), 0);
+		ck_assert(inum.no_formal_ino == ents[i].inum.no_formal_ino);
+		ck_assert(inum.no_addr == ents[i].inum.no_addr);
+		ck_assert_int_eq(type, ents[i].type);
+	}
+	ck_assert(dir_search(dip, "missing", 7, NULL, &inum) != 0);
+}
+
+/* How many leaves hash table pointer @index leads to */
+static unsigned leaf_chain_len(struct gfs2_inode *dip, uint32_t index)
+{
+	uint64_t leaf_no;
+	unsigned n = 0;
+
+	ck_assert(lgfs2_get_leaf_ptr(dip, index, &leaf_no) == 0);
+	while (leaf_no != 0) {
+		struct gfs2_buffer_head *bh;
+		struct gfs2_leaf leaf;
+
+		ck_assert(gfs2_get_leaf(dip, leaf_no, &bh) == 0);
+		gfs2_leaf_in(&leaf, bh->b_data);
+		leaf_no = leaf.lf_next;
+		brelse(bh);
+		n++;
+	}
+	return n;
+}
+
+START_TEST(test_dir_build)
+{
+	struct gfs2_inode *dip = createi(tc_sdp->master_dir, "d", S_IFDIR | 0755, 0);
+	char *names[3];
+	struct lgfs2_dir_entry *few = mock_dirents("few", 10, &names[0]);
+	struct lgfs2_dir_entry *many = mock_dirents("many", 30000, &names[1]);
+	struct lgfs2_dir_entry *more = mock_dirents("more", 100, &names[2]);
+	struct gfs2_inum inum;
+	unsigned i, depth0;
+
+	ck_assert(dip != NULL);
+	for (i = tc_sdp->sd_hash_ptrs, depth0 = 0; i > 1; i >>= 1)
+		depth0++;
+
+	/* Fits in the dinode block, alongside . and .. */
+	lgfs2_dir_sort(few, 10);
+	ck_assert(lgfs2_dir_build(dip, few, 10) == 0);
+	ck_assert(!(dip->i_di.di_flags & GFS2_DIF_EXHASH));
+	ck_assert_int_eq(dip->i_di.di_entries, 12);
+	check_dirents(dip, few, 10);
+
+	/* Merged with those into more leaves than the first hash table has */
+	lgfs2_dir_sort(many, 30000);
+	ck_assert(lgfs2_dir_build(dip, many, 30000) == 0);
+	ck_assert(dip->i_di.di_flags & GFS2_DIF_EXHASH);
+	ck_assert_int_eq(dip->i_di.di_entries, 30012);
+	ck_assert(dip->i_di.di_depth > depth0);
+	ck_assert(dip->i_di.di_size == sizeof(uint64_t) << dip->i_di.di_depth);
+	for (i = 0; i < 1U << dip->i_di.di_depth; i++)
+		ck_assert_int_eq(leaf_chain_len(dip, i), 1);
+	check_dirents(dip, few, 10);
+	check_dirents(dip, many, 30000);
+	ck_assert_int_eq(dir_search(dip, "..", 2, NULL, &inum), 0);
+
+	/* Added to an exhash directory */
+	lgfs2_dir_sort(more, 100);
+	ck_assert(lgfs2_dir_build(dip, more, 100) == 0);
+	ck_assert_int_eq(dip->i_di.di_entries, 30112);
+	check_dirents(dip, few, 10);
+	check_dirents(dip, many, 30000);
+	check_dirents(dip, more, 100);
+
+	/* Out of hash order */
+	more[0].hash = ~0U;
+	errno = 0;
+	ck_assert(lgfs2_dir_build(dip, more, 2) == -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	for (i = 0; i < 3; i++)
+		free(names[i]);
+	free(few);
+	free(many);
+	free(more);
+	inode_put(&dip);
+}
+END_TEST
+
+START_TEST(test_dir_build_chain)
+{
+	struct gfs2_inode *dip = createi(tc_sdp->master_dir, "d", S_IFDIR | 0755, 0);
+	char *names;
+	struct lgfs2_dir_entry *ents = mock_dirents("c", 5000, &names);
+	const unsigned shift = 32 - GFS2_DIR_MAX_DEPTH;
+	uint32_t target;
+	unsigned i, n;
+
+	ck_assert(dip != NULL);
+	/* Rename the first hundred entries until they share a hash table
+	   pointer even at the greatest depth, so a leaf can't hold them */
+	target = gfs2_disk_hash(ents[0].name, ents[0].len) >> shift;
+	for (i = 1, n = 1; i < 100; i++) {
+		char *name = (char *)ents[i].name;
+
+		do {
+			ents[i].len = snprintf(name, 16, "c%x", n++);
+		} while (gfs2_disk_hash(name, ents[i].len) >> shift != target);
+	}
+	/* Keep clear of those names */
+	for (i = 100; i < 5000; i++)
+		ents[i].len = snprintf((char *)ents[i].name, 16, "o%u", i);
+
+	lgfs2_dir_sort(ents, 5000);
+	ck_assert(lgfs2_dir_build(dip, ents, 5000) == 0);
+	ck_assert(dip->i_di.di_flags & GFS2_DIF_EXHASH);
+	ck_assert_int_eq(dip->i_di.di_depth, GFS2_DIR_MAX_DEPTH);
+	ck_assert_int_eq(dip->i_di.di_entries, 5002);
+	ck_assert(leaf_chain_len(dip, target) > 1);
+	ck_assert_int_eq(leaf_chain_len(dip, target ^ 1), 1);
+	check_dirents(dip, ents, 5000);
+
+	free(names);
+	free(ents);
+	inode_put(&dip);
+}
+END_TEST
+
+/* Look an entry up, returning how many reads it took */
+static uint64_t search_reads(struct gfs2_inode *dip, const struct lgfs2_dir_entry *e)
+{
+	struct lgfs2_io_stats *st = dip->i_sbd->io_stats;
+	struct gfs2_inum inum = {0};
+	uint64_t reads = st->reads;
+
+	ck_assert_int_eq(dir_search(dip, e->name, e->len, NULL, &inum), 0);
+	ck_assert(inum.no_addr == e->inum.no_addr);
+	return st->reads - reads;
+}
+
+/* Find a dirent in the leaves of a hashed directory, as fsck's pass2 would */
+static struct gfs2_buffer_head *find_dirent(struct gfs2_inode *dip, const char *name,
+                                            unsigned len, struct gfs2_dirent **prev,
+                                            struct gfs2_dirent **cur)
+{
+	uint32_t hash = gfs2_disk_hash(name, len);
+	uint64_t leaf_no;
+
+	ck_assert(lgfs2_get_leaf_ptr(dip, hash >> (32 - dip->i_di.di_depth), &leaf_no) == 0);
+	while (leaf_no != 0) {
+		struct gfs2_buffer_head *bh = bread(dip->i_sbd, leaf_no);
+
+		*prev = NULL;
+		ck_assert(gfs2_dirent_first(dip, bh, cur) == IS_LEAF);
+		do {
+			if ((*cur)->de_inum.no_formal_ino != 0 &&
+			    be16_to_cpu((*cur)->de_name_len) == len &&
+			    memcmp(*cur + 1, name, len) == 0)
+				return bh;
+			*prev = *cur;
+		} while (gfs2_dirent_next(dip, bh, cur) == 0);
+		leaf_no = lgfs2_get_lf_next(bh->b_data);
+		brelse(bh);
+	}
+	return NULL;
+}
+
+START_TEST(test_dir_index)
+{
+	struct gfs2_inode *dip = createi(tc_sdp->master_dir, "d", S_IFDIR | 0755, 0);
+	struct lgfs2_io_stats st = {0};
+	char *names[2];
+	struct lgfs2_dir_entry *ents = mock_dirents("e", 3000, &names[0]);
+	struct lgfs2_dir_entry *added = mock_dirents("a", 100, &names[1]);
+	struct gfs2_dirent *prev, *cur;
+	struct gfs2_buffer_head *bh;
+	struct gfs2_inum inum;
+	unsigned i;
+
+	ck_assert(dip != NULL);
+	lgfs2_dir_sort(ents, 3000);
+	ck_assert(lgfs2_dir_build(dip, ents, 3000) == 0);
+	ck_assert(dip->i_di.di_flags & GFS2_DIF_EXHASH);
+	tc_sdp->io_stats = &st;
+
+	/* The first search reads the leaves, the second indexes all of them
+	   and the rest read nothing */
+	ck_assert(search_reads(dip, &ents[0]) > 0);
+	ck_assert(search_reads(dip, &ents[1]) > 1);
+	for (i = 0; i < 3000; i++)
+		ck_assert(search_reads(dip, &ents[i]) == 0);
+	check_dirents(dip, ents, 3000);
+
+	/* Added entries are indexed as they go in */
+	for (i = 0; i < 100; i++) {
+		inum = added[i].inum;
+		ck_assert(dir_add(dip, added[i].name, added[i].len, &inum, added[i].type) == 0);
+	}
+	for (i = 0; i < 100; i++)
+		ck_assert(search_reads(dip, &added[i]) == 0);
+	check_dirents(dip, added, 100);
+
+	/* Removing entries drops the index until the search after next */
+	for (i = 0; i < 100; i += 2)
+		ck_assert(gfs2_dirent_del(dip, added[i].name, added[i].len) == 0);
+	ck_assert(search_reads(dip, &ents[0]) > 0);
+	ck_assert(search_reads(dip, &ents[0]) > 1);
+	ck_assert(search_reads(dip, &ents[0]) == 0);
+	for (i = 0; i < 100; i++) {
+		if (i % 2)
+			ck_assert(search_reads(dip, &added[i]) == 0);
+		else
+			ck_assert(dir_search(dip, added[i].name, added[i].len, NULL, &inum) != 0);
+	}
+
+	/* And they can come back, as other inodes */
+	for (i = 0; i < 100; i += 2) {
+		added[i].inum.no_formal_ino += 5000;
+		added[i].inum.no_addr += 5000;
+		inum = added[i].inum;
+		ck_assert(dir_add(dip, added[i].name, added[i].len, &inum, added[i].type) == 0);
+	}
+	check_dirents(dip, added, 100);
+	check_dirents(dip, ents, 3000);
+
+	/* fsck takes dirents out of the leaves itself */
+	bh = find_dirent(dip, ents[7].name, ents[7].len, &prev, &cur);
+	ck_assert(bh != NULL);
+	dirent2_del(dip, bh, prev, cur);
+	brelse(bh);
+	ck_assert(dir_search(dip, ents[7].name, ents[7].len, NULL, &inum) != 0);
+	ck_assert(dir_search(dip, ents[7].name, ents[7].len, NULL, &inum) != 0);
+	ck_assert(search_reads(dip, &ents[8]) == 0);
+	check_dirents(dip, ents, 7);
+	check_dirents(dip, ents + 8, 3000 - 8);
+	check_dirents(dip, added, 100);
+	ck_assert_int_eq(dip->i_di.di_entries, 3000 + 100 + 2 - 1);
+
+	tc_sdp->io_stats = NULL;
+	free(names[0]);
+	free(names[1]);
+	free(ents);
+	free(added);
+	inode_put(&dip);
+}
+END_TEST
+
+Suite *suite_fs_ops(void)
+{
+	Suite *s = suite_create("fs_ops.c");
+
+	TCase *tc_rw = tcase_create("readi and writei");
+	tcase_add_checked_fixture(tc_rw, mockup_fs, teardown_fs);
+	tcase_add_test(tc_rw, test_rw_file);
+	tcase_add_test(tc_rw, test_rw_dir);
+	tcase_add_test(tc_rw, test_mpcache_drop);
+	tcase_set_timeout(tc_rw, 60);
+	suite_add_tcase(s, tc_rw);
+
+	TCase *tc_dir = tcase_create("lgfs2_dir_build");
+	tcase_add_checked_fixture(tc_dir, mockup_fs, teardown_fs);
+	tcase_add_test(tc_dir, test_dir_build);
+	tcase_add_test(tc_dir, test_dir_build_chain);
+	tcase_set_timeout(tc_dir, 60);
+	suite_add_tcase(s, tc_dir);
+
+	TCase *tc_index = tcase_create("Directory index");
+	tcase_add_checked_fixture(tc_index, mockup_fs, teardown_fs);
+	tcase_add_test(tc_index, test_dir_index);
+	suite_add_tcase(s, tc_index);
+
+	return s;
+}
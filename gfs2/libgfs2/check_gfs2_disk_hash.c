@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <check.h>
+#include "libgfs2.h"
+
+#define NAMES 4096
+
+Suite *suite_gfs2_disk_hash(void);
+
+/* The CRC a bit at a time, as the kernel's crc32_le() defines it */
+static uint32_t crc32_bitwise(const unsigned char *p, unsigned len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	unsigned i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+START_TEST(test_disk_hash)
+{
+	static char buf[8192];
+	unsigned len, off;
+
+	ck_assert(gfs2_disk_hash("123456789", 9) == 0xCBF43926);
+	ck_assert(gfs2_disk_hash("", 0) == 0);
+	srandom(1);
+	for (len = 0; len < sizeof(buf); len++)
+		buf[len] = random();
+	/* Every length and alignment of the short names, every tail after the
+	   16 byte blocks of the long ones */
+	for (off = 0; off < 16; off++) {
+		for (len = 1; len < 300; len++)
+			ck_assert(gfs2_disk_hash(buf + off, len) ==
+			          crc32_bitwise((unsigned char *)buf + off, len));
+		for (len = 4096 - 16; len < 4096 + 16; len++)
+			ck_assert(gfs2_disk_hash(buf + off, len) ==
+			          crc32_bitwise((unsigned char *)buf + off, len));
+	}
+}
+END_TEST
+
+START_TEST(test_disk_hash_batch)
+{
+	static char buf[NAMES * 16 + 512];
+	const char *names[NAMES];
+	unsigned lens[NAMES];
+	uint32_t hashes[NAMES];
+	unsigned i, count;
+
+	srandom(2);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = random();
+	for (i = 0; i < NAMES; i++) {
+		/* Mostly short names, some empty, some long, at any alignment */
+		switch (random() % 8) {
+		case 0:
+			lens[i] = 0;
+			break;
+		case 1:
+			lens[i] = 1 + random() % 3;
+			break;
+		case 2:
+			lens[i] = 64 + random() % 192;
+			break;
+		default:
+			lens[i] = random() % GFS2_FNAMESIZE;
+		}
+		names[i] = buf + random() % (sizeof(buf) - lens[i]);
+	}
+	/* Batches of any size, down to one name and none */
+	for (count = 0; count <= NAMES; count = count * 2 + 1) {
+		memset(hashes, 0xa5, sizeof(hashes));
+		lgfs2_disk_hash_batch(names, lens, hashes, count);
+		for (i = 0; i < count; i++)
+			ck_assert(hashes[i] == gfs2_disk_hash(names[i], lens[i]));
+		for (; i < NAMES; i++)
+			ck_assert(hashes[i] == 0xa5a5a5a5);
+	}
+}
+END_TEST
+
+Suite *suite_gfs2_disk_hash(void)
+{
+	Suite *s = suite_create("gfs2_disk_hash.c");
+
+	TCase *tc_hash = tcase_create("gfs2_disk_hash");
+	tcase_add_test(tc_hash, test_disk_hash);
+	tcase_add_test(tc_hash, test_disk_hash_batch);
+	suite_add_tcase(s, tc_hash);
+
+	return s;
+}
@@ -6,6 +6,9 @@ void print_it(const char *label, const char *fmt, const char *fmt2, ...) {}
 
 extern Suite *suite_meta(void);
 extern Suite *suite_rgrp(void);
+extern Suite *suite_fs_ops(void);
+extern Suite *suite_gfs2_disk_hash(void);
+extern Suite *suite_crc32c(void);
 
 int main(void)
 {
@@ -13,6 +16,9 @@ int main(void)
 
 	SRunner *runner = srunner_create(suite_meta());
 	srunner_add_suite(runner, suite_rgrp());
+	srunner_add_suite(runner, suite_fs_ops());
+	srunner_add_suite(runner, suite_gfs2_disk_hash());
+	srunner_add_suite(runner, suite_crc32c());
 
 	srunner_run_all(runner, CK_ENV);
 	failures = srunner_ntests_failed(runner);
@@ -56,6 +56,44 @@ START_TEST(check_ptrs)
 }
 END_TEST
 
+START_TEST(check_lookups)
+{
+	unsigned i, t, v;
+	int j;
+
+	/* The indexed lookups find the same entries as a search of the table */
+	for (v = 0; v <= (LGFS2_MD_GFS1 | LGFS2_MD_GFS2); v++) {
+		for (t = 0; t < 32; t++) {
+			const struct lgfs2_metadata *first = NULL;
+
+			for (i = 0; i < lgfs2_metadata_size && first == NULL; i++)
+				if ((lgfs2_metadata[i].versions & v) &&
+				    lgfs2_metadata[i].mh_type == t)
+					first = &lgfs2_metadata[i];
+			ck_assert(lgfs2_find_mtype(t, v) == first);
+		}
+		for (i = 0; i < lgfs2_metadata_size; i++) {
+			const struct lgfs2_metadata *m = &lgfs2_metadata[i];
+			const struct lgfs2_metadata *found = lgfs2_find_mtype_name(m->name, v);
+
+			if (m->versions & v)
+				ck_assert(found == m);
+			else
+				ck_assert(found == NULL || found < m);
+		}
+		ck_assert(lgfs2_find_mtype_name("gfs2_nonesuch", v) == NULL);
+	}
+	for (i = 0; i < lgfs2_metadata_size; i++) {
+		const struct lgfs2_metadata *m = &lgfs2_metadata[i];
+
+		for (j = 0; j < m->nfields; j++)
+			ck_assert(lgfs2_find_mfield_name(m->fields[j].name, m) == &m->fields[j]);
+		ck_assert(lgfs2_find_mfield_name("nonesuch", m) == NULL);
+	}
+	ck_assert(lgfs2_find_mfield_name("mh_magic", &lgfs2_metadata[LGFS2_MT_DATA]) == NULL);
+}
+END_TEST
+
 Suite *suite_meta(void)
 {
 	Suite *s = suite_create("meta.c");
@@ -64,6 +102,7 @@ Suite *suite_meta(void)
 	tcase_add_test(tc_meta, check_metadata_sizes);
 	tcase_add_test(tc_meta, check_symtab);
 	tcase_add_test(tc_meta, check_ptrs);
+	tcase_add_test(tc_meta, check_lookups);
 	suite_add_tcase(s, tc_meta);
 
 	return s;
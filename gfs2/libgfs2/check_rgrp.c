@@ -155,6 +155,157 @@ START_TEST(test_rgrps_write_final)
 }
 END_TEST
 
+START_TEST(test_alloc_cursor)
+{
+	struct gfs2_sbd *sdp = tc_rgrps->sdp;
+	lgfs2_rgrp_t rg = lgfs2_rgrp_first(tc_rgrps);
+	uint64_t start, len, blk;
+
+	lgfs2_attach_rgrps(sdp, tc_rgrps);
+
+	ck_assert(lgfs2_alloc_run(sdp, GFS2_BLKST_USED, 10, &start, &len) == 0);
+	ck_assert(start == rg->ri.ri_data0);
+	ck_assert(len == 10);
+	ck_assert(rg->rg.rg_free == rg->ri.ri_data - 10);
+
+	/* Freeing a block behind the cursor makes it the next one allocated */
+	ck_assert(gfs2_set_bitmap(rg, start + 3, GFS2_BLKST_FREE) == 0);
+	rg->rg.rg_free++;
+	ck_assert(lgfs2_dinode_alloc(sdp, 1, &blk) == 0);
+	ck_assert(blk == start + 3);
+	ck_assert(lgfs2_dinode_alloc(sdp, 1, &blk) == 0);
+	ck_assert(blk == start + 10);
+
+	/* No resource group is big enough, so the extent is cut short */
+	ck_assert(lgfs2_alloc_run(sdp, GFS2_BLKST_USED, rg->ri.ri_data, &start, &len) == 0);
+	ck_assert(start == blk + 1);
+	ck_assert(rg->rg.rg_free == 0);
+	ck_assert(lgfs2_dinode_alloc(sdp, 1, &blk) != 0);
+
+	lgfs2_alloc_forget(sdp);
+}
+END_TEST
+
+/* Give a random run of blocks, or a single one, a random state, mostly used or
+   free so that there are runs of both, in the bitmaps and in @shadow.
+   Returns the first block changed, relative to ri_data0. */
+static uint32_t shadow_change(lgfs2_rgrp_t rg, uint8_t *shadow, uint32_t maxlen, int single)
+{
+	uint32_t nblocks = rg->ri.ri_data;
+	uint32_t start = random() % nblocks;
+	uint32_t len = single ? 1 : random() % maxlen + 1;
+	int state = random() % 4;
+
+	if (len > nblocks - start)
+		len = nblocks - start;
+	if (state == GFS2_BLKST_UNLINKED && random() % 3)
+		state = GFS2_BLKST_FREE;
+	if (single)
+		ck_assert(gfs2_set_bitmap(rg, rg->ri.ri_data0 + start, state) == 0);
+	else
+		ck_assert(lgfs2_bitmap_set_range(rg, rg->ri.ri_data0 + start, len, state) == 0);
+	memset(shadow + start, state, len);
+	return start;
+}
+
+START_TEST(test_bitmap_runs)
+{
+	struct gfs2_sbd *sdp = tc_rgrps->sdp;
+	lgfs2_rgrp_t rg = lgfs2_rgrp_first(tc_rgrps);
+	uint32_t nblocks = rg->ri.ri_data;
+	uint8_t *shadow = calloc(nblocks, 1);
+	unsigned i;
+
+	ck_assert(shadow != NULL);
+	ck_assert(rg->rg.rg_free == nblocks);
+	ck_assert(lgfs2_bitmap_set_range(rg, rg->ri.ri_data0 + nblocks - 1, 2, GFS2_BLKST_USED) != 0);
+	srandom(1);
+	for (i = 0; i < 2000; i++) {
+		uint32_t start = shadow_change(rg, shadow, i % 10 ? 100 : 5000, 0);
+		uint32_t j, nfree = 0, ndinode = 0, best = 0, cur = 0;
+		struct lgfs2_rbm rbm = { .rgd = rg };
+		uint64_t run;
+
+		if (i % 50)
+			continue;
+		for (j = 0; j < nblocks; j++) {
+			ck_assert(lgfs2_get_bitmap(sdp, rg->ri.ri_data0 + j, rg) == shadow[j]);
+			nfree += shadow[j] == GFS2_BLKST_FREE;
+			ndinode += shadow[j] == GFS2_BLKST_DINODE;
+			cur = shadow[j] == GFS2_BLKST_FREE ? cur + 1 : 0;
+			if (cur > best)
+				best = cur;
+		}
+		ck_assert(rg->rg.rg_free == nfree);
+		ck_assert(rg->rg.rg_dinodes == ndinode);
+		ck_assert(lgfs2_rgrp_longest_free(rg, &run) == best);
+		for (j = 0; best > 0 && j < best; j++)
+			ck_assert(shadow[run - rg->ri.ri_data0 + j] == GFS2_BLKST_FREE);
+
+		ck_assert(lgfs2_rbm_from_block(&rbm, rg->ri.ri_data0 + start) == 0);
+		for (j = start; j < nblocks && j - start < 3000 && shadow[j] == GFS2_BLKST_FREE; j++)
+			;
+		ck_assert(lgfs2_free_extlen(&rbm, 3000) == j - start);
+	}
+	free(shadow);
+}
+END_TEST
+
+START_TEST(test_bitmap_summary)
+{
+	lgfs2_rgrp_t rg = lgfs2_rgrp_first(tc_rgrps);
+	uint32_t nblocks = rg->ri.ri_data;
+	uint8_t *shadow = calloc(nblocks, 1);
+	uint64_t *ibuf = calloc(nblocks + GFS2_NBBY, sizeof(*ibuf));
+	unsigned i, k;
+
+	ck_assert(shadow != NULL && ibuf != NULL);
+	/* Work the summaries out before the bitmaps change, so they have to be
+	   kept up to date */
+	for (k = 0; k < rg->ri.ri_length; k++)
+		ck_assert(lgfs2_bitmap_count(&rg->bits[k], GFS2_BLKST_FREE) ==
+		          rg->bits[k].bi_len * GFS2_NBBY);
+	srandom(2);
+	for (i = 0; i < 3000; i++) {
+		/* Single blocks as well, which are set another way */
+		shadow_change(rg, shadow, i % 10 ? 50 : 3000, i % 2);
+		if (i % 100)
+			continue;
+		for (k = 0; k < rg->ri.ri_length; k++) {
+			struct gfs2_bitmap *bi = &rg->bits[k];
+			uint32_t first = bi->bi_start * GFS2_NBBY;
+			uint32_t end = first + bi->bi_len * GFS2_NBBY;
+			int state;
+
+			for (state = GFS2_BLKST_FREE; state <= GFS2_BLKST_DINODE; state++) {
+				uint32_t j, n = 0, count;
+
+				if (end > nblocks)
+					end = nblocks;
+				for (j = first; j < end; j++) {
+					if (shadow[j] != state)
+						continue;
+					ck_assert(j - first >= bi->bi_first[state]);
+					ck_assert(j - first <= bi->bi_last[state]);
+					n++;
+				}
+				count = lgfs2_bitmap_count(bi, state);
+				if (state == GFS2_BLKST_FREE) /* Padding at the end */
+					count -= (bi->bi_start + bi->bi_len) * GFS2_NBBY - end;
+				ck_assert(count == n);
+				n = lgfs2_bm_scan(rg, k, ibuf, state);
+				ck_assert(n == lgfs2_bitmap_count(bi, state));
+				for (j = 0; j < n; j++)
+					ck_assert(ibuf[j] - rg->ri.ri_data0 >= nblocks ||
+					          shadow[ibuf[j] - rg->ri.ri_data0] == state);
+			}
+		}
+	}
+	free(ibuf);
+	free(shadow);
+}
+END_TEST
+
 Suite *suite_rgrp(void)
 {
 
@@ -174,5 +325,12 @@ Suite *suite_rgrp(void)
 	tcase_add_test(tc, test_rgrps_write_final);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("lgfs2_alloc");
+	tcase_add_checked_fixture(tc, mockup_rgrps, teardown_rgrps);
+	tcase_add_test(tc, test_alloc_cursor);
+	tcase_add_test(tc, test_bitmap_runs);
+	tcase_add_test(tc, test_bitmap_summary);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
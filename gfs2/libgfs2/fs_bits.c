@@ -156,10 +156,195 @@ int gfs2_set_bitmap(lgfs2_rgrp_t rgd, uint64_t blkno, int state)
 	*byte ^= cur_state << bit;
 	*byte |= state << bit;
 
+	if (bits->bi_summary) {
+		uint32_t off = rgrp_block - bits->bi_start * GFS2_NBBY;
+
+		bits->bi_count[cur_state]--;
+		bits->bi_count[state]++;
+		if (off < bits->bi_first[state])
+			bits->bi_first[state] = off;
+		if (off > bits->bi_last[state])
+			bits->bi_last[state] = off;
+	}
+
+	/* Keep the allocator's cursor behind every free block */
+	if (state == GFS2_BLKST_FREE && rgrp_block < rgd->next_free)
+		rgd->next_free = rgrp_block;
 	bits->bi_modified = 1;
 	return 0;
 }
 
+/* Set blocks off to off + n - 1 of a bitmap to the states in fill, a 64 bit
+   word of them, and add up in was[] the states the blocks had before */
+static void bitmap_fill(uint8_t *buf, uint32_t off, uint32_t n, uint64_t fill,
+                        uint32_t *was)
+{
+	while (n > 0) {
+		uint32_t base = off & ~31U; /* 32 blocks to a 64 bit word */
+		uint32_t lo = off - base;
+		uint32_t hi = n < 32 - lo ? lo + n : 32;
+		unsigned bytes = (hi + GFS2_NBBY - 1) / GFS2_NBBY;
+		uint64_t mask = hi == 32 ? ~0ULL : (1ULL << (hi * GFS2_BIT_SIZE)) - 1;
+		uint64_t w = 0, even;
+
+		mask &= ~((1ULL << (lo * GFS2_BIT_SIZE)) - 1);
+		even = mask & 0x5555555555555555ULL;
+		memcpy(&w, buf + base / GFS2_NBBY, bytes);
+		w = le64_to_cpu(w);
+		was[GFS2_BLKST_FREE] += __builtin_popcountll(~w & ~(w >> 1) & even);
+		was[GFS2_BLKST_USED] += __builtin_popcountll(w & ~(w >> 1) & even);
+		was[GFS2_BLKST_UNLINKED] += __builtin_popcountll(~w & (w >> 1) & even);
+		was[GFS2_BLKST_DINODE] += __builtin_popcountll(w & (w >> 1) & even);
+		w = cpu_to_le64((w & ~mask) | (fill & mask));
+		memcpy(buf + base / GFS2_NBBY, &w, bytes);
+		off += hi - lo;
+		n -= hi - lo;
+	}
+}
+
+/**
+ * lgfs2_bitmap_set_range - set the state of a run of blocks
+ * @rgd: The resource group the blocks are in
+ * @start: The first block
+ * @len: The number of blocks
+ * @state: The state to set them to
+ *
+ * The bitmaps are updated a word at a time rather than block by block, and
+ * rg_free and rg_dinodes, and the bitmaps' summaries, are adjusted for the
+ * blocks whose state changed.
+ * The resource group header isn't written to its buffer.
+ * Returns 0 on success, or -1 with errno set if the blocks aren't all in the
+ * resource group.
+ */
+int lgfs2_bitmap_set_range(lgfs2_rgrp_t rgd, uint64_t start, uint32_t len, int state)
+{
+	static const uint64_t fill[] = {
+		[GFS2_BLKST_FREE] = 0x0000000000000000ULL,
+		[GFS2_BLKST_USED] = 0x5555555555555555ULL,
+		[GFS2_BLKST_UNLINKED] = 0xaaaaaaaaaaaaaaaaULL,
+		[GFS2_BLKST_DINODE] = 0xffffffffffffffffULL,
+	};
+	uint32_t nfree = 0, ndinode = 0;
+	uint32_t rblock, count = len;
+	unsigned i;
+
+	if (rgd == NULL || state < GFS2_BLKST_FREE || state > GFS2_BLKST_DINODE ||
+	    start < rgd->ri.ri_data0 ||
+	    start + len > rgd->ri.ri_data0 + rgd->ri.ri_data) {
+		errno = EINVAL;
+		return -1;
+	}
+	rblock = start - rgd->ri.ri_data0;
+	for (i = 0; i < rgd->ri.ri_length && len > 0; i++) {
+		struct gfs2_bitmap *bi = &rgd->bits[i];
+		uint32_t first = bi->bi_start * GFS2_NBBY;
+		uint32_t end = first + bi->bi_len * GFS2_NBBY;
+		uint32_t was[4] = {0};
+		uint32_t n;
+		int s;
+
+		if (rblock >= end)
+			continue;
+		n = len < end - rblock ? len : end - rblock;
+		bitmap_fill((uint8_t *)bi->bi_data + bi->bi_offset, rblock - first,
+		            n, fill[state], was);
+		bi->bi_modified = 1;
+		nfree += was[GFS2_BLKST_FREE];
+		ndinode += was[GFS2_BLKST_DINODE];
+		if (bi->bi_summary) {
+			for (s = GFS2_BLKST_FREE; s <= GFS2_BLKST_DINODE; s++)
+				bi->bi_count[s] -= was[s];
+			bi->bi_count[state] += n;
+			if (rblock - first < bi->bi_first[state])
+				bi->bi_first[state] = rblock - first;
+			if (rblock - first + n - 1 > bi->bi_last[state])
+				bi->bi_last[state] = rblock - first + n - 1;
+		}
+		rblock += n;
+		len -= n;
+	}
+	if (state == GFS2_BLKST_FREE) {
+		rgd->rg.rg_free += count - nfree;
+		if (start - rgd->ri.ri_data0 < rgd->next_free)
+			rgd->next_free = start - rgd->ri.ri_data0;
+	} else {
+		rgd->rg.rg_free -= nfree;
+	}
+	if (state == GFS2_BLKST_DINODE)
+		rgd->rg.rg_dinodes += count - ndinode;
+	else
+		rgd->rg.rg_dinodes -= ndinode;
+	return 0;
+}
+
+/* Count the blocks in each state in a bitmap block and note the first and
+   last of each, 32 blocks to a 64 bit word as in gfs2_bit_search() */
+static void bitmap_summarise(struct gfs2_bitmap *bi)
+{
+	static const uint64_t search[] = {
+		[0] = 0xffffffffffffffffULL,
+		[1] = 0xaaaaaaaaaaaaaaaaULL,
+		[2] = 0x5555555555555555ULL,
+		[3] = 0x0000000000000000ULL,
+	};
+	const uint8_t *buf = (uint8_t *)bi->bi_data + bi->bi_offset;
+	uint32_t x;
+	int s;
+
+	for (s = GFS2_BLKST_FREE; s <= GFS2_BLKST_DINODE; s++) {
+		bi->bi_count[s] = 0;
+		bi->bi_first[s] = UINT32_MAX;
+		bi->bi_last[s] = 0;
+	}
+	for (x = 0; x < bi->bi_len; x += sizeof(uint64_t)) {
+		unsigned bytes = bi->bi_len - x < sizeof(uint64_t) ?
+		                 bi->bi_len - x : sizeof(uint64_t);
+		uint64_t valid = 0x5555555555555555ULL;
+		uint32_t base = x * GFS2_NBBY;
+		uint64_t w = 0;
+
+		if (bytes < sizeof(uint64_t))
+			valid &= (1ULL << (bytes * 8)) - 1;
+		memcpy(&w, buf + x, bytes);
+		w = le64_to_cpu(w);
+		for (s = GFS2_BLKST_FREE; s <= GFS2_BLKST_DINODE; s++) {
+			uint64_t m = w ^ search[s];
+
+			m &= (m >> 1) & valid;
+			if (m == 0)
+				continue;
+			bi->bi_count[s] += __builtin_popcountll(m);
+			if (bi->bi_first[s] == UINT32_MAX)
+				bi->bi_first[s] = base + __builtin_ctzll(m) / GFS2_BIT_SIZE;
+			bi->bi_last[s] = base + (63 - __builtin_clzll(m)) / GFS2_BIT_SIZE;
+		}
+	}
+	bi->bi_summary = 1;
+}
+
+/**
+ * lgfs2_bitmap_count - count the blocks in a state in a bitmap block
+ * @bi: The bitmap block, which must have been read in
+ * @state: The block state
+ *
+ * The counts for a bitmap block are worked out the first time one is asked
+ * for, along with where the first and last block in each state are, and
+ * gfs2_set_bitmap() and lgfs2_bitmap_set_range() keep them up to date from
+ * then on, so that scans for a state can skip the bitmap blocks with none and
+ * stop after the last one. The first and last positions are bounds: they
+ * aren't moved in when blocks leave a state.
+ * Anything else that changes the bitmap must clear bi_summary.
+ * Returns the number of blocks in @state.
+ */
+uint32_t lgfs2_bitmap_count(struct gfs2_bitmap *bi, int state)
+{
+	if (bi->bi_data == NULL || state < GFS2_BLKST_FREE || state > GFS2_BLKST_DINODE)
+		return 0;
+	if (!bi->bi_summary)
+		bitmap_summarise(bi);
+	return bi->bi_count[state];
+}
+
 /*
  * gfs2_get_bitmap - get value of FS bitmap
  * @sdp: super block
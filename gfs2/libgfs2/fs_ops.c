@@ -105,6 +105,8 @@ void inode_put(struct gfs2_inode **ip_in)
 		   It can also point out a coding problem, but we don't
 		   want to raise alarm in the users either. */
 	}
+	lgfs2_mpcache_drop(ip);
+	lgfs2_dir_index_drop(ip);
 	if (ip->bh_owned)
 		brelse(ip->i_bh);
 	ip->i_bh = NULL;
@@ -112,28 +114,222 @@ void inode_put(struct gfs2_inode **ip_in)
 	*ip_in = NULL; /* make sure the memory isn't accessed again */
 }
 
+/*
+ * The free space index. Allocations want the first resource group, in
+ * address order, with at least a given number of free blocks, so the free
+ * block counts of the resource groups are kept in the leaves of a segment
+ * tree, each inner node holding the largest count below it, and the search
+ * is a walk down the leftmost branch that has enough. Callers also change
+ * rg_free and the rgrp tree behind the index's back (fsck rebuilds both), so
+ * the index only holds the address of each resource group, looks it up again
+ * in the rgrp tree and checks its count when it is chosen, and is rebuilt
+ * when it turns out to be stale or when it has nothing left to offer.
+ *
+ * Between lgfs2_alloc_begin() and lgfs2_alloc_end() the bitmaps that an
+ * allocation had to read stay in memory, rather than being read and written
+ * back for every block, and are written back at the end.
+ */
+struct lgfs2_alloc {
+	uint64_t *addr;          /* ri_addr of each resource group, in order */
+	uint32_t *max;           /* The segment tree, leaves from [leaves] */
+	unsigned count;
+	unsigned leaves;         /* count rounded up to a power of 2 */
+	unsigned resident;       /* lgfs2_alloc_begin() nesting */
+	struct rgrp_tree **held; /* Bitmaps read while resident */
+	unsigned nheld;
+	unsigned maxheld;
+};
+
+static void alloc_index_set(struct lgfs2_alloc *a, unsigned i, uint32_t free)
+{
+	unsigned n = a->leaves + i;
+
+	a->max[n] = free;
+	for (n /= 2; n > 0; n /= 2)
+		a->max[n] = a->max[2 * n] > a->max[2 * n + 1] ?
+		            a->max[2 * n] : a->max[2 * n + 1];
+}
+
+/* The first resource group with at least blksreq free blocks, or -1 */
+static int alloc_index_find(const struct lgfs2_alloc *a, uint64_t blksreq)
+{
+	unsigned n = 1;
+
+	if (a->count == 0 || a->max[1] < blksreq)
+		return -1;
+	while (n < a->leaves)
+		n = (a->max[2 * n] >= blksreq) ? 2 * n : 2 * n + 1;
+	return n - a->leaves;
+}
+
+static int alloc_index_build(struct gfs2_sbd *sdp)
+{
+	struct lgfs2_alloc *a = sdp->alloc;
+	struct osi_node *n;
+	unsigned count = 0, leaves = 1, i;
+
+	if (a == NULL) {
+		a = calloc(1, sizeof(*a));
+		if (a == NULL)
+			return -1;
+		sdp->alloc = a;
+	}
+	for (n = osi_first(&sdp->rgtree); n; n = osi_next(n))
+		count++;
+	while (leaves < count)
+		leaves *= 2;
+	if (leaves > a->leaves) {
+		uint64_t *addr = realloc(a->addr, leaves * sizeof(*addr));
+		uint32_t *max;
+
+		if (addr == NULL)
+			return -1;
+		a->addr = addr;
+		max = realloc(a->max, 2 * leaves * sizeof(*max));
+		if (max == NULL)
+			return -1;
+		a->max = max;
+	}
+	a->count = count;
+	a->leaves = leaves;
+	memset(a->max, 0, 2 * leaves * sizeof(*a->max));
+	for (i = 0, n = osi_first(&sdp->rgtree); n; n = osi_next(n), i++) {
+		struct rgrp_tree *rgd = (struct rgrp_tree *)n;
+
+		a->addr[i] = rgd->ri.ri_addr;
+		a->max[leaves + i] = rgd->rg.rg_free;
+	}
+	for (i = leaves - 1; i > 0; i--)
+		a->max[i] = a->max[2 * i] > a->max[2 * i + 1] ?
+		            a->max[2 * i] : a->max[2 * i + 1];
+	return 0;
+}
+
+/**
+ * Find the first resource group with at least blksreq free blocks.
+ * Returns the resource group with its index in *idx, or NULL.
+ */
+static struct rgrp_tree *alloc_rgrp(struct gfs2_sbd *sdp, uint64_t blksreq, unsigned *idx)
+{
+	struct lgfs2_alloc *a = sdp->alloc;
+	int rebuilt = 0;
+
+	if (a == NULL) {
+		if (alloc_index_build(sdp))
+			return NULL;
+		a = sdp->alloc;
+		rebuilt = 1;
+	}
+	while (1) {
+		struct rgrp_tree *rgd;
+		int i = alloc_index_find(a, blksreq);
+
+		if (i < 0) {
+			if (rebuilt || alloc_index_build(sdp))
+				return NULL;
+			rebuilt = 1;
+			continue;
+		}
+		rgd = gfs2_blk2rgrpd(sdp, a->addr[i]);
+		if (rgd == NULL || rgd->ri.ri_addr != a->addr[i]) {
+			/* The rgrp tree has changed under us */
+			if (rebuilt) {
+				alloc_index_set(a, i, 0);
+				continue;
+			}
+			if (alloc_index_build(sdp))
+				return NULL;
+			rebuilt = 1;
+			continue;
+		}
+		if (rgd->rg.rg_free < blksreq) {
+			alloc_index_set(a, i, rgd->rg.rg_free);
+			continue;
+		}
+		*idx = i;
+		return rgd;
+	}
+}
+
+/* As block_alloc() always has, fall back to the last resource group when
+   none is known to have free blocks: rg_free is only known for the resource
+   groups whose headers have been read. */
+static struct rgrp_tree *alloc_rgrp_any(struct gfs2_sbd *sdp, uint64_t blksreq, unsigned *idx)
+{
+	struct rgrp_tree *rgd;
+
+	rgd = alloc_rgrp(sdp, blksreq, idx);
+	if (rgd == NULL && blksreq > 1)
+		rgd = alloc_rgrp(sdp, 1, idx);
+	if (rgd == NULL && sdp->alloc != NULL && sdp->alloc->count > 0) {
+		rgd = (struct rgrp_tree *)osi_last(&sdp->rgtree);
+		*idx = sdp->alloc->count - 1;
+	}
+	return rgd;
+}
+
+/* Make sure the bitmaps of a resource group are in memory. Returns 1 if the
+   caller should release them after allocating, 0 if not, -1 on error. */
+static int alloc_bitmaps(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
+{
+	struct lgfs2_alloc *a = sdp->alloc;
+
+	if (rgd->bits[0].bi_data != NULL)
+		return 0;
+	if (gfs2_rgrp_read(sdp, rgd))
+		return -1;
+	if (a == NULL || !a->resident)
+		return 1;
+	if (a->nheld == a->maxheld) {
+		unsigned max = a->maxheld ? a->maxheld * 2 : 16;
+		struct rgrp_tree **held = realloc(a->held, max * sizeof(*held));
+
+		if (held == NULL)
+			return 1;
+		a->held = held;
+		a->maxheld = max;
+	}
+	a->held[a->nheld++] = rgd;
+	return 0;
+}
+
+/* Find the first free block in a resource group, starting at its cursor */
 static uint64_t find_free_block(struct rgrp_tree *rgd)
 {
 	unsigned bm;
-	uint64_t blkno = 0;
+	uint32_t goal;
 
 	if (rgd == NULL || rgd->rg.rg_free == 0) {
 		errno = ENOSPC;
 		return 0;
 	}
-
+	goal = rgd->next_free;
+again:
 	for (bm = 0; bm < rgd->ri.ri_length; bm++) {
 		unsigned long blk = 0;
 		struct gfs2_bitmap *bits = &rgd->bits[bm];
+		uint32_t first = bits->bi_start * GFS2_NBBY;
 
+		if (goal >= first + bits->bi_len * GFS2_NBBY ||
+		    lgfs2_bitmap_count(bits, GFS2_BLKST_FREE) == 0)
+			continue;
+		if (goal > first)
+			blk = goal - first;
+		if (blk < bits->bi_first[GFS2_BLKST_FREE])
+			blk = bits->bi_first[GFS2_BLKST_FREE];
 		blk = gfs2_bitfit((uint8_t *)bits->bi_data + bits->bi_offset,
 		                  bits->bi_len, blk, GFS2_BLKST_FREE);
 		if (blk != BFITNOENT) {
-			blkno = blk + (bits->bi_start * GFS2_NBBY) + rgd->ri.ri_data0;
-			break;
+			rgd->next_free = first + blk;
+			return blk + first + rgd->ri.ri_data0;
 		}
 	}
-	return blkno;
+	/* Blocks freed behind the cursor without it being moved back */
+	if (goal != 0) {
+		goal = 0;
+		goto again;
+	}
+	return 0;
 }
 
 static int blk_alloc_in_rg(struct gfs2_sbd *sdp, unsigned state, struct rgrp_tree *rgd, uint64_t blkno, int dinode)
@@ -154,6 +350,7 @@ static int blk_alloc_in_rg(struct gfs2_sbd *sdp, unsigned state, struct rgrp_tre
 	}
 
 	rgd->rg.rg_free--;
+	rgd->next_free = blkno - rgd->ri.ri_data0 + 1;
 	if (sdp->gfs1)
 		gfs_rgrp_out((struct gfs_rgrp *)&rgd->rg, rgd->bits[0].bi_data);
 	else
@@ -171,33 +368,128 @@ static int blk_alloc_in_rg(struct gfs2_sbd *sdp, unsigned state, struct rgrp_tre
 static int block_alloc(struct gfs2_sbd *sdp, const uint64_t blksreq, int state, uint64_t *blkno, int dinode)
 {
 	int ret;
-	int release = 0;
-	struct rgrp_tree *rgt = NULL;
-	struct osi_node *n = NULL;
+	int release;
+	struct rgrp_tree *rgt;
+	unsigned idx;
 	uint64_t bn = 0;
 
-	for (n = osi_first(&sdp->rgtree); n; n = osi_next(n)) {
-		rgt = (struct rgrp_tree *)n;
-		if (rgt->rg.rg_free >= blksreq)
-			break;
-	}
+	rgt = alloc_rgrp_any(sdp, blksreq, &idx);
 	if (rgt == NULL)
 		return -1;
 
-	if (rgt->bits[0].bi_data == NULL) {
-		if (gfs2_rgrp_read(sdp, rgt))
-			return -1;
-		release = 1;
-	}
+	release = alloc_bitmaps(sdp, rgt);
+	if (release < 0)
+		return -1;
 
 	bn = find_free_block(rgt);
 	ret = blk_alloc_in_rg(sdp, state, rgt, bn, dinode);
+	alloc_index_set(sdp->alloc, idx, rgt->rg.rg_free);
 	if (release)
 		gfs2_rgrp_relse(sdp, rgt);
 	*blkno = bn;
 	return ret;
 }
 
+/**
+ * lgfs2_alloc_run - allocate up to @want contiguous blocks
+ * @state: the state to give them, GFS2_BLKST_USED for data
+ * @blkno: the first block allocated
+ * @len: how many were allocated, at least one
+ *
+ * A resource group with @want free blocks is chosen if there is one, so
+ * the extent is only cut short by the blocks already in use there.
+ * Returns 0 on success or -1 if there is no free space.
+ */
+int lgfs2_alloc_run(struct gfs2_sbd *sdp, int state, uint64_t want, uint64_t *blkno, uint64_t *len)
+{
+	struct rgrp_tree *rgt;
+	struct lgfs2_rbm rbm;
+	unsigned idx;
+	uint64_t bn, n;
+	int release;
+
+	rgt = alloc_rgrp_any(sdp, want, &idx);
+	if (rgt == NULL)
+		return -1;
+
+	release = alloc_bitmaps(sdp, rgt);
+	if (release < 0)
+		return -1;
+
+	bn = find_free_block(rgt);
+	rbm.rgd = rgt;
+	if (blk_alloc_in_rg(sdp, state, rgt, bn, 0)) {
+		if (release)
+			gfs2_rgrp_relse(sdp, rgt);
+		return -1;
+	}
+	n = 1;
+	if (want > 1 && lgfs2_rbm_from_block(&rbm, bn + 1) == 0) {
+		n += lgfs2_free_extlen(&rbm, want - 1 < rgt->ri.ri_data ? want - 1 : rgt->ri.ri_data);
+		lgfs2_bitmap_set_range(rgt, bn + 1, n - 1, state);
+		rgt->next_free = bn + n - rgt->ri.ri_data0;
+		sdp->blks_alloced += n - 1;
+		if (sdp->gfs1)
+			gfs_rgrp_out((struct gfs_rgrp *)&rgt->rg, rgt->bits[0].bi_data);
+		else
+			gfs2_rgrp_out(&rgt->rg, rgt->bits[0].bi_data);
+	}
+	alloc_index_set(sdp->alloc, idx, rgt->rg.rg_free);
+	if (release)
+		gfs2_rgrp_relse(sdp, rgt);
+	*blkno = bn;
+	*len = n;
+	return 0;
+}
+
+/**
+ * lgfs2_alloc_begin - keep the bitmaps that allocations read in memory
+ *
+ * Until the matching lgfs2_alloc_end(), a resource group whose bitmaps had
+ * to be read for an allocation keeps them, so a run of allocations reads
+ * and writes each resource group once instead of once per block. The
+ * resource groups must not be freed in between.
+ * Returns 0 on success or -1 if out of memory.
+ */
+int lgfs2_alloc_begin(struct gfs2_sbd *sdp)
+{
+	if (sdp->alloc == NULL && alloc_index_build(sdp))
+		return -1;
+	sdp->alloc->resident++;
+	return 0;
+}
+
+/**
+ * lgfs2_alloc_end - write back and release the bitmaps kept since
+ * lgfs2_alloc_begin()
+ */
+void lgfs2_alloc_end(struct gfs2_sbd *sdp)
+{
+	struct lgfs2_alloc *a = sdp->alloc;
+
+	if (a == NULL || a->resident == 0 || --a->resident > 0)
+		return;
+	while (a->nheld > 0)
+		gfs2_rgrp_relse(sdp, a->held[--a->nheld]);
+}
+
+/**
+ * lgfs2_alloc_forget - drop the free space index, when the resource groups
+ * it was built from go away
+ */
+void lgfs2_alloc_forget(struct gfs2_sbd *sdp)
+{
+	struct lgfs2_alloc *a = sdp->alloc;
+
+	if (a == NULL)
+		return;
+	free(a->addr);
+	free(a->max);
+	free(a->held);
+	free(a);
+	sdp->alloc = NULL;
+}
+
 int lgfs2_dinode_alloc(struct gfs2_sbd *sdp, const uint64_t blksreq, uint64_t *blkno)
 {
 	int ret = block_alloc(sdp, blksreq, GFS2_BLKST_DINODE, blkno, 1);
@@ -244,6 +536,7 @@ void unstuff_dinode(struct gfs2_inode *ip)
 	uint64_t block = 0;
 	int isdir = S_ISDIR(ip->i_di.di_mode) || is_gfs_dir(&ip->i_di);
 
+	lgfs2_mpcache_drop(ip);
 	if (ip->i_di.di_size) {
 		if (lgfs2_meta_alloc(ip, &block))
 			exit(1);
@@ -351,9 +644,6 @@ int lgfs2_file_alloc(lgfs2_rgrp_t rg, uint64_t di_size, struct gfs2_inode *ip, u
 	di->di_height = calc_tree_height(ip, di_size);
 	di->di_flags = flags;
 
-	rg->rg.rg_free -= blocks;
-	rg->rg.rg_dinodes += 1;
-
 	sdp->dinodes_alloced++;
 	sdp->blks_alloced += blocks;
 
@@ -480,6 +770,9 @@ void block_map(struct gfs2_inode *ip, uint64_t lblock, int *new,
 	unsigned int end_of_metadata;
 	unsigned int x;
 
+	/* The tree may change under the cached metadata path */
+	if (create)
+		lgfs2_mpcache_drop(ip);
 	*new = 0;
 	*dblock = 0;
 	if (extlen)
@@ -561,6 +854,152 @@ void block_map(struct gfs2_inode *ip, uint64_t lblock, int *new,
 		brelse(bh);
 }
 
+/**
+ * lgfs2_mpcache_drop - forget the metadata path lgfs2_extent_map() cached
+ *
+ * Must be called when the inode's metadata tree changes other than through
+ * libgfs2's own block_map(), unstuff_dinode() and __gfs2_writei().
+ */
+void lgfs2_mpcache_drop(struct gfs2_inode *ip)
+{
+	struct lgfs2_mpcache *mpc = ip->i_mpcache;
+	unsigned i;
+
+	if (mpc == NULL)
+		return;
+	for (i = 0; i < GFS2_MAX_META_HEIGHT; i++)
+		if (mpc->mc_bh[i] != NULL)
+			brelse(mpc->mc_bh[i]);
+	free(mpc);
+	ip->i_mpcache = NULL;
+}
+
+/* The indirect block at a height of the metadata tree, from the cache if the
+   last path looked up went through it. Every cached block is checked against
+   the pointer to it read from its parent, the dinode's pointers being always
+   current, so a path that has changed is read again from there down. */
+static struct gfs2_buffer_head *mpcache_get(struct gfs2_inode *ip, unsigned height, uint64_t blk)
+{
+	struct lgfs2_mpcache *mpc = ip->i_mpcache;
+
+	if (mpc == NULL) {
+		mpc = calloc(1, sizeof(*mpc));
+		if (mpc == NULL)
+			return NULL;
+		ip->i_mpcache = mpc;
+	}
+	if (mpc->mc_bh[height] != NULL) {
+		if (mpc->mc_bh[height]->b_blocknr == blk)
+			return mpc->mc_bh[height];
+		brelse(mpc->mc_bh[height]);
+	}
+	mpc->mc_bh[height] = bread(ip->i_sbd, blk);
+	return mpc->mc_bh[height];
+}
+
+/* Map a run of blocks, stopping at the end of the indirect block that maps
+   lblock. Holes are mapped as far as a missing indirect block reaches. */
+static int extent_map_one(struct gfs2_inode *ip, uint64_t lblock, uint64_t maxlen,
+                          uint64_t *dblock, uint64_t *extlen)
+{
+	struct gfs2_sbd *sdp = ip->i_sbd;
+	unsigned int height = ip->i_di.di_height;
+	struct gfs2_buffer_head *bh = ip->i_bh;
+	struct metapath mp;
+	uint64_t *ptr, *arr;
+	uint64_t n, i;
+	unsigned int bsize, x;
+
+	*dblock = 0;
+	*extlen = maxlen;
+	if (inode_is_stuffed(ip)) {
+		if (lblock == 0) {
+			*dblock = ip->i_di.di_num.no_addr;
+			*extlen = 1;
+		}
+		return 0;
+	}
+	if (S_ISDIR(ip->i_di.di_mode)) {
+		bsize = sdp->sd_jbsize;
+		arr = sdp->sd_jheightsize;
+		x = sdp->sd_max_jheight;
+	} else {
+		bsize = sdp->bsize;
+		arr = sdp->sd_heightsize;
+		x = sdp->sd_max_height;
+	}
+	if (height >= x) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* Beyond what a tree of this height maps */
+	if ((lblock + 1) * bsize > arr[height])
+		return 0;
+
+	find_metapath(ip, lblock, &mp);
+	for (x = 0; x < height - 1; x++) {
+		uint64_t blk = be64_to_cpu(*metapointer(bh->b_data, x, &mp));
+
+		if (blk == 0) {
+			uint64_t span = 1;
+
+			for (i = x + 1; i < height; i++)
+				span *= sdp->sd_inptrs;
+			span -= lblock % span;
+			if (span < maxlen)
+				*extlen = span;
+			return 0;
+		}
+		bh = mpcache_get(ip, x + 1, blk);
+		if (bh == NULL)
+			return -1;
+	}
+	ptr = metapointer(bh->b_data, height - 1, &mp);
+	n = ((height > 1) ? sdp->sd_inptrs : sdp->sd_diptrs) - mp.mp_list[height - 1];
+	if (n > maxlen)
+		n = maxlen;
+	*dblock = be64_to_cpu(ptr[0]);
+	for (i = 1; i < n; i++) {
+		uint64_t blk = be64_to_cpu(ptr[i]);
+
+		if (*dblock == 0 ? blk != 0 : blk != *dblock + i)
+			break;
+	}
+	*extlen = i;
+	return 0;
+}
+
+/**
+ * lgfs2_extent_map - map a range of an inode's logical blocks
+ * @lblock: The first logical block
+ * @maxlen: The most blocks to map, at least one
+ * @dblock: Set to the first physical block of the run, or 0 for a hole
+ * @extlen: Set to the number of blocks in the run or the hole
+ *
+ * Maps the run of physically contiguous blocks, or of unallocated ones,
+ * starting at @lblock. The indirect blocks on the way are kept with the
+ * inode, so mapping the next run, or the next block, costs no reads unless
+ * it's mapped by other indirect blocks.
+ * Returns 0 on success or -1 if an indirect block couldn't be read.
+ */
+int lgfs2_extent_map(struct gfs2_inode *ip, uint64_t lblock, uint64_t maxlen,
+                     uint64_t *dblock, uint64_t *extlen)
+{
+	if (extent_map_one(ip, lblock, maxlen, dblock, extlen))
+		return -1;
+	/* Runs carry on into the next indirect block */
+	while (*extlen < maxlen && !inode_is_stuffed(ip)) {
+		uint64_t next, len;
+
+		if (extent_map_one(ip, lblock + *extlen, maxlen - *extlen, &next, &len))
+			return -1;
+		if (*dblock == 0 ? next != 0 : next != *dblock + *extlen)
+			break;
+		*extlen += len;
+	}
+	return 0;
+}
+
 static void
 copy2mem(struct gfs2_buffer_head *bh, void **buf, unsigned int offset,
 	 unsigned int size)
@@ -575,30 +1014,22 @@ copy2mem(struct gfs2_buffer_head *bh, void **buf, unsigned int offset,
 	*p += size;
 }
 
-int gfs2_readi(struct gfs2_inode *ip, void *buf,
-			   uint64_t offset, unsigned int size)
+/* gfs1's metadata tree is laid out differently, so gfs1 inodes are still
+   read a block at a time */
+static int gfs1_readi(struct gfs2_inode *ip, void *buf,
+		      uint64_t offset, unsigned int size)
 {
 	struct gfs2_sbd *sdp = ip->i_sbd;
 	struct gfs2_buffer_head *bh;
-	uint64_t lblock, dblock;
+	uint64_t lblock, dblock = 0;
 	unsigned int o;
 	uint32_t extlen = 0;
 	unsigned int amount;
 	int not_new = 0;
-	int isdir = !!(S_ISDIR(ip->i_di.di_mode));
 	int journaled = ip->i_di.di_flags & GFS2_DIF_JDATA;
 	int copied = 0;
 
-	if (offset >= ip->i_di.di_size)
-		return 0;
-
-	if ((offset + size) > ip->i_di.di_size)
-		size = ip->i_di.di_size - offset;
-
-	if (!size)
-		return 0;
-
-	if ((sdp->gfs1 && journaled) || (!sdp->gfs1 && isdir)) {
+	if (journaled) {
 		lblock = offset;
 		o = lblock % sdp->sd_jbsize;
 		lblock /= sdp->sd_jbsize;
@@ -609,7 +1040,7 @@ int gfs2_readi(struct gfs2_inode *ip, void *buf,
 
 	if (inode_is_stuffed(ip))
 		o += sizeof(struct gfs2_dinode);
-	else if ((sdp->gfs1 && journaled) || (!sdp->gfs1 && isdir))
+	else if (journaled)
 		o += sizeof(struct gfs2_meta_header);
 
 	while (copied < size) {
@@ -617,14 +1048,8 @@ int gfs2_readi(struct gfs2_inode *ip, void *buf,
 		if (amount > sdp->bsize - o)
 			amount = sdp->bsize - o;
 
-		if (!extlen) {
-			if (sdp->gfs1)
-				gfs1_block_map(ip, lblock, &not_new, &dblock,
-					       &extlen, 0);
-			else
-				block_map(ip, lblock, &not_new, &dblock,
-					  &extlen, 0);
-		}
+		if (!extlen)
+			gfs1_block_map(ip, lblock, &not_new, &dblock, &extlen, 0);
 
 		if (dblock) {
 			if (dblock == ip->i_di.di_num.no_addr)
@@ -642,24 +1067,171 @@ int gfs2_readi(struct gfs2_inode *ip, void *buf,
 
 		copied += amount;
 		lblock++;
-
-		if (sdp->gfs1)
-			o = (journaled) ? sizeof(struct gfs2_meta_header) : 0;
-		else
-			o = (isdir) ? sizeof(struct gfs2_meta_header) : 0;
+		o = (journaled) ? sizeof(struct gfs2_meta_header) : 0;
 	}
 
 	return copied;
 }
 
-static void copy_from_mem(struct gfs2_buffer_head *bh, void **buf,
-			  unsigned int offset, unsigned int size)
+#define EXTENT_IOVS 256 /* Most iovecs passed to one preadv() */
+
+/**
+ * Read part of a run of contiguous blocks with as few preadv() calls as
+ * possible. The caller's data is at offset hdr in each block, so for
+ * directories the headers between are read into a scratch buffer, and
+ * what's left of the first and last blocks isn't read at all.
+ * o: The offset into the first block's data
+ * amount: The number of bytes of data to read
+ */
+static int read_extent(struct gfs2_inode *ip, uint64_t dblock, unsigned int o,
+                       unsigned int hdr, char *buf, unsigned int amount)
 {
-	char **p = (char **)buf;
+	struct gfs2_sbd *sdp = ip->i_sbd;
+	const unsigned int per = sdp->bsize - hdr;
+	struct iovec iov[EXTENT_IOVS];
+	char scratch[sizeof(struct gfs2_meta_header)];
+	off_t pos = dblock * sdp->bsize + hdr + o;
+	unsigned int seg = (hdr > 0) ? per - o : amount;
+
+	while (amount > 0) {
+		size_t len = 0;
+		uint64_t start;
+		ssize_t ret;
+		int n = 0;
+
+		while (amount > 0 && n < EXTENT_IOVS - 1) {
+			if (len > 0 && hdr > 0) {
+				iov[n].iov_base = scratch;
+				iov[n++].iov_len = hdr;
+				len += hdr;
+			}
+			if (seg > amount)
+				seg = amount;
+			iov[n].iov_base = buf;
+			iov[n++].iov_len = seg;
+			buf += seg;
+			len += seg;
+			amount -= seg;
+			seg = per;
+		}
+		start = lgfs2_io_start(sdp);
+		ret = preadv(sdp->device_fd, iov, n, pos);
+		lgfs2_io_done(sdp, pos / sdp->bsize,
+		              (pos % sdp->bsize + len + sdp->bsize - 1) / sdp->bsize, 0, start);
+		if (ret != (ssize_t)len) {
+			fprintf(stderr, "Error reading block %"PRIu64": %s\n",
+			        (uint64_t)(pos / sdp->bsize), ret < 0 ? strerror(errno) : "short read");
+			if (ret >= 0)
+				errno = EIO;
+			return -1;
+		}
+		pos += len;
+		/* The next batch starts at a block's header */
+		if (hdr > 0)
+			pos += hdr;
+	}
+	return 0;
+}
 
-	memcpy(bh->b_data + offset, *p, size);
-	bmodified(bh);
-	*p += size;
+int gfs2_readi(struct gfs2_inode *ip, void *buf,
+			   uint64_t offset, unsigned int size)
+{
+	struct gfs2_sbd *sdp = ip->i_sbd;
+	uint64_t lblock;
+	unsigned int o, hdr, per;
+	int isdir = !!(S_ISDIR(ip->i_di.di_mode));
+	unsigned int copied = 0;
+
+	if (offset >= ip->i_di.di_size)
+		return 0;
+
+	if ((offset + size) > ip->i_di.di_size)
+		size = ip->i_di.di_size - offset;
+
+	if (!size)
+		return 0;
+
+	if (sdp->gfs1)
+		return gfs1_readi(ip, buf, offset, size);
+
+	if (inode_is_stuffed(ip)) {
+		unsigned int max = sdp->bsize - sizeof(struct gfs2_dinode);
+		unsigned int amount = (offset < max) ? max - offset : 0;
+
+		/* di_size can't be trusted to fit in the block */
+		if (amount > size)
+			amount = size;
+		memcpy(buf, ip->i_bh->b_data + sizeof(struct gfs2_dinode) + offset, amount);
+		memset((char *)buf + amount, 0, size - amount);
+		return size;
+	}
+
+	hdr = isdir ? sizeof(struct gfs2_meta_header) : 0;
+	per = sdp->bsize - hdr;
+	lblock = offset / per;
+	o = offset % per;
+
+	while (copied < size) {
+		uint64_t dblock, extlen;
+		uint64_t amount;
+
+		if (lgfs2_extent_map(ip, lblock, (o + size - copied + per - 1) / per,
+		                     &dblock, &extlen))
+			return -1;
+
+		amount = extlen * per - o;
+		if (amount > size - copied)
+			amount = size - copied;
+
+		if (dblock == 0)
+			memset((char *)buf + copied, 0, amount);
+		else if (read_extent(ip, dblock, o, hdr, (char *)buf + copied, amount))
+			return -1;
+
+		copied += amount;
+		lblock += extlen;
+		o = 0;
+	}
+
+	return copied;
+}
+
+/**
+ * Write part of a run of contiguous, allocated blocks. Regular files'
+ * data is contiguous on disk, so it's one write, but for directories each
+ * block's header is left as it is and the data after it written separately.
+ */
+static int write_extent(struct gfs2_inode *ip, uint64_t dblock, unsigned int o,
+                        unsigned int hdr, const char *buf, unsigned int amount)
+{
+	struct gfs2_sbd *sdp = ip->i_sbd;
+	const unsigned int per = sdp->bsize - hdr;
+	off_t pos = dblock * sdp->bsize + hdr + o;
+	unsigned int seg = (hdr > 0) ? per - o : amount;
+
+	while (amount > 0) {
+		uint64_t start;
+		ssize_t ret;
+
+		if (seg > amount)
+			seg = amount;
+		start = lgfs2_io_start(sdp);
+		ret = pwrite(sdp->device_fd, buf, seg, pos);
+		lgfs2_io_done(sdp, pos / sdp->bsize,
+		              (pos % sdp->bsize + seg + sdp->bsize - 1) / sdp->bsize, 1, start);
+		if (ret != (ssize_t)seg) {
+			fprintf(stderr, "Error writing block %"PRIu64": %s\n",
+			        (uint64_t)(pos / sdp->bsize), ret < 0 ? strerror(errno) : "short write");
+			if (ret >= 0)
+				errno = EIO;
+			return -1;
+		}
+		buf += seg;
+		amount -= seg;
+		pos += seg + hdr;
+		seg = per;
+	}
+	return 0;
 }
 
 int __gfs2_writei(struct gfs2_inode *ip, void *buf,
@@ -667,14 +1239,13 @@ int __gfs2_writei(struct gfs2_inode *ip, void *buf,
 {
 	struct gfs2_sbd *sdp = ip->i_sbd;
 	struct gfs2_buffer_head *bh;
-	uint64_t lblock, dblock;
-	unsigned int o;
-	uint32_t extlen = 0;
-	unsigned int amount;
+	uint64_t lblock, dblock, extlen;
+	unsigned int o, hdr, per;
+	uint64_t amount;
 	int new;
 	int isdir = !!(S_ISDIR(ip->i_di.di_mode));
 	const uint64_t start = offset;
-	int copied = 0;
+	unsigned int copied = 0;
 
 	if (!size)
 		return 0;
@@ -683,32 +1254,47 @@ int __gfs2_writei(struct gfs2_inode *ip, void *buf,
 	    ((start + size) > (sdp->bsize - sizeof(struct gfs2_dinode))))
 		unstuff_dinode(ip);
 
-	if (isdir) {
-		lblock = offset;
-		o = lblock % sdp->sd_jbsize;
-		lblock /= sdp->sd_jbsize;
-	} else {
-		lblock = offset >> sdp->sd_sb.sb_bsize_shift;
-		o = offset & (sdp->bsize - 1);
+	if (inode_is_stuffed(ip)) {
+		memcpy(ip->i_bh->b_data + sizeof(struct gfs2_dinode) + offset, buf, size);
+		bmodified(ip->i_bh);
+		copied = size;
+		goto out;
 	}
 
-	if (inode_is_stuffed(ip))
-		o += sizeof(struct gfs2_dinode);
-	else if (isdir)
-		o += sizeof(struct gfs2_meta_header);
+	hdr = isdir ? sizeof(struct gfs2_meta_header) : 0;
+	per = sdp->bsize - hdr;
+	lblock = offset / per;
+	o = offset % per;
 
 	while (copied < size) {
-		amount = size - copied;
-		if (amount > sdp->bsize - o)
-			amount = sdp->bsize - o;
+		if (lgfs2_extent_map(ip, lblock, (o + size - copied + per - 1) / per,
+		                     &dblock, &extlen))
+			return -1;
 
-		if (!extlen) {
-			new = 1;
-			block_map(ip, lblock, &new, &dblock, &extlen, 0);
+		if (dblock != 0) {
+			amount = extlen * per - o;
+			if (amount > size - copied)
+				amount = size - copied;
+			if (write_extent(ip, dblock, o, hdr, (char *)buf + copied, amount))
+				return -1;
+			copied += amount;
+			lblock += extlen;
+			o = 0;
+			continue;
 		}
 
+		/* Holes are allocated a block at a time */
+		amount = per - o;
+		if (amount > size - copied)
+			amount = size - copied;
+		new = 1;
+		block_map(ip, lblock, &new, &dblock, NULL, 0);
+		if (dblock == 0)
+			return -1;
 		if (new) {
 			bh = bget(sdp, dblock);
+			if (bh == NULL)
+				return -1;
 			if (isdir) {
 				struct gfs2_meta_header mh;
 				mh.mh_magic = GFS2_MAGIC;
@@ -718,23 +1304,20 @@ int __gfs2_writei(struct gfs2_inode *ip, void *buf,
 				bmodified(bh);
 			}
 		} else {
-			if (dblock == ip->i_di.di_num.no_addr)
-				bh = ip->i_bh;
-			else
-				bh = bread(sdp, dblock);
+			bh = bread(sdp, dblock);
+			if (bh == NULL)
+				return -1;
 		}
-		copy_from_mem(bh, &buf, o, amount);
-		if (bh != ip->i_bh)
-			brelse(bh);
+		memcpy(bh->b_data + hdr + o, (char *)buf + copied, amount);
+		bmodified(bh);
+		brelse(bh);
 
 		copied += amount;
 		lblock++;
-		dblock++;
-		extlen--;
-
-		o = (isdir) ? sizeof(struct gfs2_meta_header) : 0;
+		o = 0;
 	}
 
+out:
 	if (resize && ip->i_di.di_size < start + copied) {
 		bmodified(ip->i_bh);
 		ip->i_di.di_size = start + copied;
@@ -853,8 +1436,296 @@ static int dirent_alloc(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
 	return -1;
 }
 
-void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
-		 struct gfs2_dirent *prev, struct gfs2_dirent *cur)
+/*
+ * Directory name indexes. Looking a name up in a hashed directory reads its
+ * hash table pointer and then the chain of leaves it points to, every time,
+ * and mkfs and fsck look one name after another up in the same directories.
+ * So the second time a hashed directory is searched without entries having
+ * been removed from it in between, all of its leaves are read once and its
+ * entries are kept on the inode in an open addressing hash table, keyed by
+ * the hashes stored in them, and that search and the later ones are answered
+ * from the table. Entries added with dir_add() are added to the table as
+ * well. Removing entries, or anything else that changes dirents behind the
+ * directory functions' backs, as fsck does, drops the table with
+ * lgfs2_dir_index_drop(). A directory that doesn't look consistent enough for
+ * the table to give the same answers as reading the leaves is left to be
+ * searched the old way.
+ */
+
+#define DIR_INDEX_CHAIN 65536 /* Most leaves followed on one lf_next chain */
+
+enum {
+	DIR_INDEX_SEARCHED = 1, /* Searched once since the last drop */
+	DIR_INDEX_BUILT,
+	DIR_INDEX_BROKEN,       /* Couldn't be indexed */
+};
+
+struct dir_index_ent {
+	uint32_t hash;
+	uint16_t name_len;
+	uint16_t type;
+	struct gfs2_inum inum;
+	size_t name;            /* Offset of the name in names */
+};
+
+struct lgfs2_dir_index {
+	int state;
+	struct dir_index_ent *ents;
+	unsigned count;
+	unsigned max;
+	uint32_t *slots;        /* Entry number + 1, or 0 if free */
+	unsigned nslots;        /* A power of 2, at least twice count */
+	char *names;
+	size_t names_len;
+	size_t names_max;
+};
+
+/**
+ * lgfs2_dir_index_drop - Forget the names indexed for a directory
+ * @dip: The directory
+ *
+ * Must be called after changing or removing dirents in @dip other than
+ * through dir_add(), gfs2_dirent_del() or dirent2_del().
+ */
+void lgfs2_dir_index_drop(struct gfs2_inode *dip)
+{
+	struct lgfs2_dir_index *di = dip->i_dindex;
+
+	if (di == NULL)
+		return;
+	free(di->ents);
+	free(di->slots);
+	free(di->names);
+	free(di);
+	dip->i_dindex = NULL;
+}
+
+static void dir_index_slot(struct lgfs2_dir_index *di, unsigned n)
+{
+	unsigned mask = di->nslots - 1;
+	unsigned s = di->ents[n].hash & mask;
+
+	/* Entries with the same hash stay in the order they were added */
+	while (di->slots[s] != 0)
+		s = (s + 1) & mask;
+	di->slots[s] = n + 1;
+}
+
+static int dir_index_add(struct lgfs2_dir_index *di, const char *name,
+                         unsigned name_len, uint32_t hash,
+                         const struct gfs2_inum *inum, unsigned type)
+{
+	struct dir_index_ent *e;
+
+	if (di->count == di->max) {
+		unsigned max = di->max ? di->max * 2 : 64;
+
+		e = realloc(di->ents, max * sizeof(*e));
+		if (e == NULL)
+			return -1;
+		di->ents = e;
+		di->max = max;
+	}
+	if (di->names_len + name_len > di->names_max) {
+		size_t max = di->names_max ? di->names_max * 2 : 4096;
+		char *names;
+
+		while (max < di->names_len + name_len)
+			max *= 2;
+		names = realloc(di->names, max);
+		if (names == NULL)
+			return -1;
+		di->names = names;
+		di->names_max = max;
+	}
+	if ((di->count + 1) * 2 > di->nslots) {
+		unsigned nslots = di->nslots ? di->nslots * 2 : 128;
+		uint32_t *slots = calloc(nslots, sizeof(*slots));
+		unsigned i;
+
+		if (slots == NULL)
+			return -1;
+		free(di->slots);
+		di->slots = slots;
+		di->nslots = nslots;
+		for (i = 0; i < di->count; i++)
+			dir_index_slot(di, i);
+	}
+	e = &di->ents[di->count];
+	e->hash = hash;
+	e->name_len = name_len;
+	e->type = type;
+	e->inum = *inum;
+	e->name = di->names_len;
+	memcpy(di->names + di->names_len, name, name_len);
+	di->names_len += name_len;
+	dir_index_slot(di, di->count++);
+	return 0;
+}
+
+/* Returns the entry with the given name, the first one added if there are
+   several, or NULL */
+static struct dir_index_ent *dir_index_find(struct lgfs2_dir_index *di,
+                                            const char *name, unsigned name_len,
+                                            uint32_t hash)
+{
+	unsigned mask = di->nslots - 1;
+	unsigned s;
+
+	for (s = hash & mask; di->slots[s] != 0; s = (s + 1) & mask) {
+		struct dir_index_ent *e = &di->ents[di->slots[s] - 1];
+
+		if (e->hash == hash && e->name_len == name_len &&
+		    memcmp(di->names + e->name, name, name_len) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* Index the entries of a chain of leaves that the hash table points to from
+   lindex start to end - 1, which are the ones a search would find there.
+   Returns 0, or -1 if the leaves don't hold what they should. */
+static int dir_index_chain(struct gfs2_inode *dip, struct lgfs2_dir_index *di,
+                           uint64_t leaf_no, uint32_t start, uint32_t end)
+{
+	struct gfs2_sbd *sdp = dip->i_sbd;
+	unsigned depth = dip->i_di.di_depth;
+	unsigned hops;
+
+	for (hops = 0; hops < DIR_INDEX_CHAIN; hops++) {
+		struct gfs2_buffer_head *bh = bread(sdp, leaf_no);
+		struct gfs2_dirent *dent;
+		unsigned entries, live = 0;
+		uint64_t next;
+
+		if (bh == NULL)
+			return -1;
+		if (gfs2_dirent_first(dip, bh, &dent) != IS_LEAF) {
+			brelse(bh);
+			return -1;
+		}
+		entries = lgfs2_get_lf_entries(bh->b_data);
+		do {
+			struct gfs2_inum inum;
+			uint32_t hash, lindex;
+
+			if (dent->de_inum.no_formal_ino == 0)
+				continue;
+			/* A search gives up on a leaf with more entries in it
+			   than lf_entries says */
+			if (++live > entries) {
+				brelse(bh);
+				return -1;
+			}
+			hash = be32_to_cpu(dent->de_hash);
+			lindex = depth ? hash >> (32 - depth) : 0;
+			if (lindex < start || lindex >= end)
+				continue;
+			gfs2_inum_in(&inum, (char *)&dent->de_inum);
+			if (dir_index_add(di, (char *)(dent + 1),
+			                  be16_to_cpu(dent->de_name_len), hash,
+			                  &inum, be16_to_cpu(dent->de_type))) {
+				brelse(bh);
+				return -1;
+			}
+		} while (gfs2_dirent_next(dip, bh, &dent) == 0);
+		next = lgfs2_get_lf_next(bh->b_data);
+		brelse(bh);
+		if (next == 0 || next == leaf_no)
+			return 0;
+		leaf_no = next;
+	}
+	/* Probably a loop, which is beyond the index */
+	return -1;
+}
+
+static int dir_index_build(struct gfs2_inode *dip, struct lgfs2_dir_index *di)
+{
+	uint32_t hsize = 1 << dip->i_di.di_depth;
+	uint32_t i, j;
+	uint64_t *tbl;
+
+	if (hsize * sizeof(uint64_t) != dip->i_di.di_size)
+		return -1;
+	tbl = malloc(hsize * sizeof(uint64_t));
+	if (tbl == NULL)
+		return -1;
+	if (gfs2_readi(dip, (char *)tbl, 0, hsize * sizeof(uint64_t)) !=
+	    hsize * sizeof(uint64_t))
+		goto fail;
+	for (i = 0; i < hsize; i = j) {
+		for (j = i + 1; j < hsize && tbl[j] == tbl[i]; j++)
+			;
+		if (dir_index_chain(dip, di, be64_to_cpu(tbl[i]), i, j))
+			goto fail;
+	}
+	free(tbl);
+	return 0;
+fail:
+	free(tbl);
+	return -1;
+}
+
+/* Look a name up in the index of a hashed directory, if it has one or it is
+   time to build one. Returns as dir_search() does, or 1 if the leaves need to
+   be searched instead. */
+static int dir_index_search(struct gfs2_inode *dip, const char *filename,
+                            int len, unsigned int *type, struct gfs2_inum *inum)
+{
+	struct lgfs2_dir_index *di = dip->i_dindex;
+	struct dir_index_ent *e;
+
+	if (di == NULL) {
+		di = calloc(1, sizeof(*di));
+		if (di != NULL)
+			di->state = DIR_INDEX_SEARCHED;
+		dip->i_dindex = di;
+		return 1;
+	}
+	if (di->state == DIR_INDEX_SEARCHED) {
+		if (dir_index_build(dip, di) == 0) {
+			di->state = DIR_INDEX_BUILT;
+		} else {
+			lgfs2_dir_index_drop(dip);
+			di = calloc(1, sizeof(*di));
+			if (di != NULL)
+				di->state = DIR_INDEX_BROKEN;
+			dip->i_dindex = di;
+			return 1;
+		}
+	}
+	if (di->state != DIR_INDEX_BUILT)
+		return 1;
+	/* Names compare as gfs2_filecmp() does, up to the first nul */
+	e = dir_index_find(di, filename, strlen(filename),
+	                   gfs2_disk_hash(filename, len));
+	/* Searching the leaves fails at the end of the chain */
+	if (e == NULL)
+		return -1;
+	*inum = e->inum;
+	if (type)
+		*type = e->type;
+	return 0;
+}
+
+/* Keep the index up to date with an entry added by dir_add() */
+static void dir_index_added(struct gfs2_inode *dip, const char *filename,
+                            int len, const struct gfs2_inum *inum,
+                            unsigned int type)
+{
+	struct lgfs2_dir_index *di = dip->i_dindex;
+	uint32_t hash = gfs2_disk_hash(filename, len);
+
+	if (di == NULL || di->state != DIR_INDEX_BUILT)
+		return;
+	/* A second entry with the same name might be found before the first */
+	if (dir_index_find(di, filename, len, hash) != NULL ||
+	    dir_index_add(di, filename, len, hash, inum, type))
+		lgfs2_dir_index_drop(dip);
+}
+
+static void __dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
+			  struct gfs2_dirent *prev, struct gfs2_dirent *cur)
 {
 	uint16_t cur_rec_len, prev_rec_len;
 
@@ -883,6 +1754,13 @@ void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
 	prev->de_rec_len = cpu_to_be16(prev_rec_len);
 }
 
+void dirent2_del(struct gfs2_inode *dip, struct gfs2_buffer_head *bh,
+		 struct gfs2_dirent *prev, struct gfs2_dirent *cur)
+{
+	lgfs2_dir_index_drop(dip);
+	__dirent2_del(dip, bh, prev, cur);
+}
+
 int lgfs2_get_leaf_ptr(struct gfs2_inode *dip, const uint32_t lindex, uint64_t *ptr)
 {
 	uint64_t leaf_no;
@@ -975,7 +1853,8 @@ void dir_split_leaf(struct gfs2_inode *dip, uint32_t start, uint64_t leaf_no,
 			nleaf->lf_entries = be16_to_cpu(nleaf->lf_entries) + 1;
 			nleaf->lf_entries = cpu_to_be16(nleaf->lf_entries);
 
-			dirent2_del(dip, obh, prev, dent);
+			/* Moving entries between leaves leaves the index be */
+			__dirent2_del(dip, obh, prev, dent);
 
 			if (!prev)
 				prev = dent;
@@ -1323,9 +2202,395 @@ int dir_add(struct gfs2_inode *dip, const char *filename, int len,
 		err = dir_e_add(dip, filename, len, inum, type);
 	else
 		err = dir_l_add(dip, filename, len, inum, type);
+	if (err)
+		lgfs2_dir_index_drop(dip);
+	else
+		dir_index_added(dip, filename, len, inum, type);
 	return err;
 }
 
+/*
+ * Building directories in bulk. Adding entries one at a time with dir_add()
+ * reads the leaf for each one through the hash table, scans it for space,
+ * and splits leaves and doubles the hash table through gfs2_writei() as the
+ * directory grows. lgfs2_dir_build() instead takes all the entries at once,
+ * sorted by hash, so that each leaf holds a run of them. It works out how
+ * deep the hash table needs to be and which entries go in which leaf, then
+ * writes each leaf once, into contiguous runs of blocks where the free space
+ * allows, and the hash table with a single gfs2_writei().
+ */
+
+#define DIR_WRITE_BLOCKS 256 /* Most leaves written in one request */
+
+/* A leaf of a directory being built */
+struct dir_leaf {
+	unsigned first;  /* Index of its first entry */
+	unsigned count;  /* and the number of entries */
+	uint32_t index;  /* First hash table pointer to it */
+	uint16_t depth;
+	uint16_t chained; /* Follows the previous leaf on an lf_next chain */
+};
+
+struct dir_layout {
+	const struct lgfs2_dir_entry *ents;
+	unsigned space;  /* For dirents in a leaf */
+	unsigned depth;  /* Of the hash table */
+	struct dir_leaf *leaves;
+	unsigned nleaves;
+	unsigned maxleaves;
+};
+
+static int dir_ent_cmp(const void *a, const void *b)
+{
+	const struct lgfs2_dir_entry *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return 0;
+}
+
+/**
+ * lgfs2_dir_sort - hash directory entries and sort them for lgfs2_dir_build()
+ *
+ * The names are hashed a batch at a time with lgfs2_disk_hash_batch().
+ */
+void lgfs2_dir_sort(struct lgfs2_dir_entry *ents, unsigned count)
+{
+	const char *names[64];
+	unsigned lens[64];
+	uint32_t hashes[64];
+	unsigned i, j, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < 64 ? count - i : 64;
+		for (j = 0; j < n; j++) {
+			names[j] = ents[i + j].name;
+			lens[j] = ents[i + j].len;
+		}
+		lgfs2_disk_hash_batch(names, lens, hashes, n);
+		for (j = 0; j < n; j++)
+			ents[i + j].hash = hashes[j];
+	}
+	qsort(ents, count, sizeof(*ents), dir_ent_cmp);
+}
+
+/* Lay out entries from the start of a block's dirent space */
+static void dir_fill_dirents(char *start, unsigned space,
+                             const struct lgfs2_dir_entry *ents, unsigned count)
+{
+	struct gfs2_dirent *dent = (struct gfs2_dirent *)start;
+	unsigned i, used = 0;
+
+	memset(start, 0, space);
+	if (count == 0) {
+		dent->de_rec_len = cpu_to_be16(space);
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		const struct lgfs2_dir_entry *e = &ents[i];
+		unsigned rec_len = GFS2_DIRENT_SIZE(e->len);
+
+		dent = (struct gfs2_dirent *)(start + used);
+		if (i == count - 1)
+			rec_len = space - used;
+		gfs2_inum_out(&e->inum, (char *)&dent->de_inum);
+		dent->de_hash = cpu_to_be32(e->hash);
+		dent->de_rec_len = cpu_to_be16(rec_len);
+		dent->de_name_len = cpu_to_be16(e->len);
+		dent->de_type = cpu_to_be16(e->type);
+		memcpy((char *)(dent + 1), e->name, e->len);
+		used += rec_len;
+	}
+}
+
+static unsigned dir_ents_size(const struct lgfs2_dir_entry *ents, unsigned count)
+{
+	unsigned i, size = 0;
+
+	for (i = 0; i < count; i++)
+		size += GFS2_DIRENT_SIZE(ents[i].len);
+	return size;
+}
+
+/* Whether any hash table pointer at @depth has more entries than fit a leaf */
+static int dir_depth_overflows(const struct dir_layout *l, unsigned count, unsigned depth)
+{
+	unsigned i = 0;
+
+	while (i < count) {
+		uint32_t index = l->ents[i].hash >> (32 - depth);
+		unsigned used = 0;
+
+		for (; i < count && (l->ents[i].hash >> (32 - depth)) == index; i++) {
+			used += GFS2_DIRENT_SIZE(l->ents[i].len);
+			if (used > l->space)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int dir_add_leaf(struct dir_layout *l, unsigned first, unsigned count,
+                        uint32_t index, unsigned depth, int chained)
+{
+	struct dir_leaf *lf;
+
+	if (l->nleaves == l->maxleaves) {
+		unsigned max = l->maxleaves ? l->maxleaves * 2 : 64;
+
+		lf = realloc(l->leaves, max * sizeof(*lf));
+		if (lf == NULL)
+			return -1;
+		l->leaves = lf;
+		l->maxleaves = max;
+	}
+	lf = &l->leaves[l->nleaves++];
+	lf->first = first;
+	lf->count = count;
+	lf->index = index;
+	lf->depth = depth;
+	lf->chained = chained;
+	return 0;
+}
+
+/*
+ * Place the entries whose hashes fall in the @depth deep part of the hash
+ * table starting at @index: in one leaf if they fit, otherwise in the leaves
+ * for each half, or if the hash table can't be split further, in a chain.
+ */
+static int dir_place(struct dir_layout *l, unsigned first, unsigned count,
+                     uint32_t index, unsigned depth)
+{
+	uint32_t half;
+	unsigned split, used, n;
+
+	if (depth == l->depth || dir_ents_size(l->ents + first, count) <= l->space) {
+		if (dir_add_leaf(l, first, 0, index, depth, 0))
+			return -1;
+		for (n = 0, used = 0; n < count; n++) {
+			unsigned size = GFS2_DIRENT_SIZE(l->ents[first + n].len);
+
+			if (used + size > l->space) {
+				if (dir_add_leaf(l, first + n, 0, index, depth, 1))
+					return -1;
+				used = 0;
+			}
+			l->leaves[l->nleaves - 1].count++;
+			used += size;
+		}
+		return 0;
+	}
+	half = index + (1U << (l->depth - depth - 1));
+	for (split = first; split < first + count; split++)
+		if ((l->ents[split].hash >> (32 - l->depth)) >= half)
+			break;
+	if (dir_place(l, first, split - first, index, depth + 1))
+		return -1;
+	return dir_place(l, split, first + count - split, half, depth + 1);
+}
+
+static int dir_write_leaves(struct gfs2_inode *dip, const struct dir_layout *l,
+                            const uint64_t *blocks)
+{
+	struct gfs2_sbd *sdp = dip->i_sbd;
+	unsigned i = 0, n;
+	char *buf;
+
+	buf = malloc(DIR_WRITE_BLOCKS * sdp->bsize);
+	if (buf == NULL)
+		return -1;
+	while (i < l->nleaves) {
+		uint64_t start;
+		ssize_t ret;
+
+		for (n = 0; i + n < l->nleaves && n < DIR_WRITE_BLOCKS; n++) {
+			const struct dir_leaf *lf = &l->leaves[i + n];
+			char *b = buf + n * sdp->bsize;
+			struct gfs2_leaf *leaf = (struct gfs2_leaf *)b;
+			struct gfs2_meta_header mh = {0};
+
+			if (n > 0 && blocks[i + n] != blocks[i] + n)
+				break;
+			mh.mh_magic = GFS2_MAGIC;
+			mh.mh_type = GFS2_METATYPE_LF;
+			mh.mh_format = GFS2_FORMAT_LF;
+			memset(b, 0, sizeof(struct gfs2_leaf));
+			gfs2_meta_header_out(&mh, b);
+			leaf->lf_depth = cpu_to_be16(lf->depth);
+			leaf->lf_entries = cpu_to_be16(lf->count);
+			leaf->lf_dirent_format = cpu_to_be32(GFS2_FORMAT_DE);
+			if (i + n + 1 < l->nleaves && lf[1].chained)
+				leaf->lf_next = cpu_to_be64(blocks[i + n + 1]);
+			leaf->lf_inode = cpu_to_be64(dip->i_di.di_num.no_addr);
+			dir_fill_dirents(b + sizeof(struct gfs2_leaf), l->space,
+			                 l->ents + lf->first, lf->count);
+		}
+		start = lgfs2_io_start(sdp);
+		ret = pwrite(sdp->device_fd, buf, n * sdp->bsize, blocks[i] * sdp->bsize);
+		lgfs2_io_done(sdp, blocks[i], n, 1, start);
+		if (ret != (ssize_t)(n * sdp->bsize)) {
+			if (ret >= 0)
+				errno = EIO;
+			free(buf);
+			return -1;
+		}
+		i += n;
+	}
+	free(buf);
+	return 0;
+}
+
+/* Give a directory a hash table and leaves holding the entries */
+static int dir_build_exhash(struct gfs2_inode *dip, const struct lgfs2_dir_entry *ents,
+                            unsigned count)
+{
+	struct gfs2_sbd *sdp = dip->i_sbd;
+	struct dir_layout l = {
+		.ents = ents,
+		.space = sdp->bsize - sizeof(struct gfs2_leaf),
+	};
+	uint64_t *blocks = NULL, *table = NULL;
+	uint64_t bn, len;
+	unsigned depth0, i, j;
+	int ret = -1;
+
+	/* Start from the depth dir_make_exhash() gives, with the hash table
+	   filling half the dinode block */
+	for (i = sdp->sd_hash_ptrs, depth0 = 0; i > 1; i >>= 1)
+		depth0++;
+	for (l.depth = depth0; l.depth < GFS2_DIR_MAX_DEPTH; l.depth++)
+		if (!dir_depth_overflows(&l, count, l.depth))
+			break;
+	if (dir_place(&l, 0, count, 0, 0))
+		goto out;
+
+	blocks = malloc(l.nleaves * sizeof(*blocks));
+	table = malloc(sizeof(*table) << l.depth);
+	if (blocks == NULL || table == NULL)
+		goto out;
+	for (i = 0; i < l.nleaves; i += len) {
+		if (lgfs2_alloc_run(sdp, GFS2_BLKST_USED, l.nleaves - i, &bn, &len))
+			goto out;
+		for (j = 0; j < len; j++)
+			blocks[i + j] = bn + j;
+	}
+	if (dir_write_leaves(dip, &l, blocks))
+		goto out;
+
+	for (i = 0; i < l.nleaves; i++) {
+		const struct dir_leaf *lf = &l.leaves[i];
+
+		if (lf->chained)
+			continue;
+		for (j = 0; j < 1U << (l.depth - lf->depth); j++)
+			table[lf->index + j] = cpu_to_be64(blocks[i]);
+	}
+	buffer_clear_tail(sdp, dip->i_bh, sizeof(struct gfs2_dinode));
+	dip->i_di.di_flags |= GFS2_DIF_EXHASH;
+	dip->i_di.di_payload_format = 0;
+	dip->i_di.di_depth = l.depth;
+	dip->i_di.di_entries = count;
+	dip->i_di.di_blocks += l.nleaves;
+	dip->i_di.di_goal_meta = blocks[l.nleaves - 1];
+	dip->i_di.di_size = 0;
+	if (gfs2_writei(dip, table, 0, sizeof(*table) << l.depth) !=
+	    (int)(sizeof(*table) << l.depth))
+		goto out;
+	ret = 0;
+out:
+	free(table);
+	free(blocks);
+	free(l.leaves);
+	return ret;
+}
+
+/**
+ * lgfs2_dir_build - add many entries to a directory at once
+ * @ents: The entries, with their hashes, sorted by lgfs2_dir_sort()
+ * @count: The number of entries
+ *
+ * A new (linear) directory is rebuilt with its entries and the new ones
+ * written in one go. A directory that is already hashed, or a gfs1 one, has
+ * the entries added one at a time with dir_add(), which still gains from them
+ * arriving in hash order.
+ * Returns 0 on success or -1 with errno set.
+ */
+int lgfs2_dir_build(struct gfs2_inode *dip, const struct lgfs2_dir_entry *ents,
+                    unsigned count)
+{
+	struct gfs2_sbd *sdp = dip->i_sbd;
+	const unsigned space = sdp->bsize - sizeof(struct gfs2_dinode);
+	struct lgfs2_dir_entry *all = NULL, *old = NULL;
+	struct gfs2_dirent *dent;
+	unsigned nold = 0, i, j, n;
+	char *copy = NULL;
+	int ret = -1;
+
+	for (i = 1; i < count; i++) {
+		if (ents[i].hash < ents[i - 1].hash) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (sdp->gfs1 || (dip->i_di.di_flags & GFS2_DIF_EXHASH)) {
+		for (i = 0; i < count; i++) {
+			struct gfs2_inum inum = ents[i].inum;
+
+			if (dir_add(dip, ents[i].name, ents[i].len, &inum, ents[i].type))
+				return -1;
+		}
+		return 0;
+	}
+
+	/* Take a copy of the entries already in the dinode block, as it will be
+	   rewritten, and merge them in hash order with the new ones */
+	copy = malloc(space);
+	old = calloc(dip->i_di.di_entries + 1, sizeof(*old));
+	all = calloc(dip->i_di.di_entries + count + 1, sizeof(*all));
+	if (copy == NULL || old == NULL || all == NULL)
+		goto out;
+	memcpy(copy, dip->i_bh->b_data + sizeof(struct gfs2_dinode), space);
+	dent = (struct gfs2_dirent *)copy;
+	for (;;) {
+		unsigned rec_len = be16_to_cpu(dent->de_rec_len);
+
+		if (dent->de_inum.no_formal_ino != 0 && nold <= dip->i_di.di_entries) {
+			struct lgfs2_dir_entry *e = &old[nold++];
+
+			e->name = (char *)(dent + 1);
+			e->len = be16_to_cpu(dent->de_name_len);
+			gfs2_inum_in(&e->inum, (char *)&dent->de_inum);
+			e->type = be16_to_cpu(dent->de_type);
+			e->hash = be32_to_cpu(dent->de_hash);
+		}
+		if (rec_len == 0 || (char *)dent + rec_len >= copy + space)
+			break;
+		dent = (struct gfs2_dirent *)((char *)dent + rec_len);
+	}
+	qsort(old, nold, sizeof(*old), dir_ent_cmp);
+	for (i = 0, j = 0, n = 0; i < nold || j < count; n++) {
+		if (j == count || (i < nold && old[i].hash <= ents[j].hash))
+			all[n] = old[i++];
+		else
+			all[n] = ents[j++];
+	}
+
+	if (dir_ents_size(all, n) <= space) {
+		dir_fill_dirents(dip->i_bh->b_data + sizeof(struct gfs2_dinode),
+		                 space, all, n);
+		dip->i_di.di_entries = n;
+		bmodified(dip->i_bh);
+		ret = 0;
+	} else {
+		ret = dir_build_exhash(dip, all, n);
+	}
+out:
+	free(all);
+	free(old);
+	free(copy);
+	return ret;
+}
+
 static int __init_dinode(struct gfs2_sbd *sdp, struct gfs2_buffer_head **bhp, struct gfs2_inum *inum,
                          unsigned int mode, uint32_t flags, struct gfs2_inum *parent, int gfs1)
 {
@@ -1755,9 +3020,11 @@ int dir_search(struct gfs2_inode *dip, const char *filename, int len,
 	if(!S_ISDIR(dip->i_di.di_mode) && !is_gfs_dir(&dip->i_di))
 		return -1;
 
-	if (dip->i_di.di_flags & GFS2_DIF_EXHASH)
-		error = dir_e_search(dip, filename, len, type, inum);
-	else
+	if (dip->i_di.di_flags & GFS2_DIF_EXHASH) {
+		error = dir_index_search(dip, filename, len, type, inum);
+		if (error == 1)
+			error = dir_e_search(dip, filename, len, type, inum);
+	} else
 		error = dir_l_search(dip, filename, len, type, inum);
 
 	return error;
@@ -1843,6 +3110,7 @@ int gfs2_dirent_del(struct gfs2_inode *dip, const char *filename, int len)
 	if(!S_ISDIR(dip->i_di.di_mode) && !is_gfs_dir(&dip->i_di))
 		return -1;
 
+	lgfs2_dir_index_drop(dip);
 	if (dip->i_di.di_flags & GFS2_DIF_EXHASH)
 		error = dir_e_del(dip, filename, len);
 	else
@@ -1902,6 +3170,34 @@ void gfs2_free_block(struct gfs2_sbd *sdp, uint64_t block)
 	}
 }
 
+/* Free a run of data blocks, which may span resource groups */
+static void free_run(struct gfs2_sbd *sdp, uint64_t block, uint64_t len)
+{
+	while (len > 0) {
+		struct rgrp_tree *rgd = gfs2_blk2rgrpd(sdp, block);
+		uint64_t n;
+
+		if (rgd == NULL || block < rgd->ri.ri_data0) {
+			gfs2_free_block(sdp, block);
+			block++;
+			len--;
+			continue;
+		}
+		n = rgd->ri.ri_data0 + rgd->ri.ri_data - block;
+		if (n > len)
+			n = len;
+		lgfs2_bitmap_set_range(rgd, block, n, GFS2_BLKST_FREE);
+		if (sdp->gfs1)
+			gfs_rgrp_out((struct gfs_rgrp *)&rgd->rg, rgd->bits[0].bi_data);
+		else
+			gfs2_rgrp_out(&rgd->rg, rgd->bits[0].bi_data);
+		rgd->bits[0].bi_modified = 1;
+		sdp->blks_alloced -= n;
+		block += n;
+		len -= n;
+	}
+}
+
 /**
  * gfs2_freedi - unlink a disk inode by block number.
  * Note: currently only works for regular files.
@@ -1911,7 +3207,7 @@ int gfs2_freedi(struct gfs2_sbd *sdp, uint64_t diblock)
 	struct gfs2_inode *ip;
 	struct gfs2_buffer_head *bh, *nbh;
 	int h, head_size;
-	uint64_t *ptr, block;
+	uint64_t *ptr, block, run = 0, run_len = 0;
 	struct rgrp_tree *rgd;
 	uint32_t height;
 	osi_list_t metalist[GFS2_MAX_META_HEIGHT];
@@ -1945,9 +3241,18 @@ int gfs2_freedi(struct gfs2_sbd *sdp, uint64_t diblock)
 					continue;
 
 				block = be64_to_cpu(*ptr);
-				gfs2_free_block(sdp, block);
-				if (h == height - 1) /* if not metadata */
+				if (h == height - 1) { /* if not metadata */
+					/* Data blocks are freed a run at a time */
+					if (run_len && block == run + run_len) {
+						run_len++;
+						continue;
+					}
+					free_run(sdp, run, run_len);
+					run = block;
+					run_len = 1;
 					continue; /* don't queue it up */
+				}
+				gfs2_free_block(sdp, block);
 				/* Read the next metadata block in the chain */
 				nbh = bread(sdp, block);
 				osi_list_add(&nbh->b_altlist, next_list);
@@ -1955,14 +3260,13 @@ int gfs2_freedi(struct gfs2_sbd *sdp, uint64_t diblock)
 			}
 		}
 	}
+	free_run(sdp, run, run_len);
 	rgd = gfs2_blk2rgrpd(sdp, diblock);
-	gfs2_set_bitmap(rgd, diblock, GFS2_BLKST_FREE);
+	lgfs2_bitmap_set_range(rgd, diblock, 1, GFS2_BLKST_FREE);
 	inode_put(&ip);
 	/* inode_put deallocated the extra block used by the disk inode, */
 	/* so adjust it in the superblock struct */
 	sdp->blks_alloced--;
-	rgd->rg.rg_free++;
-	rgd->rg.rg_dinodes--;
 	if (sdp->gfs1)
 		gfs_rgrp_out((struct gfs_rgrp *)&rgd->rg, rgd->bits[0].bi_data);
 	else
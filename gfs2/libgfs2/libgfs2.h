@@ -3,7 +3,9 @@
 
 #include <features.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -167,9 +169,16 @@ struct gfs2_bitmap
 	uint32_t bi_start;   /* The position of the first byte in this block */
 	uint32_t bi_len;     /* The number of bytes in this block */
 	unsigned bi_modified:1;
+	unsigned bi_summary:1; /* The counts and bounds below are valid */
+	uint32_t bi_count[4];  /* Blocks in each state */
+	uint32_t bi_first[4];  /* No block in a state is before bi_first */
+	uint32_t bi_last[4];   /* or after bi_last, counted from bi_start */
 };
 
 struct gfs2_sbd;
+struct lgfs2_alloc;
+struct lgfs2_mpcache;
+struct lgfs2_dir_index;
 struct gfs2_inode;
 typedef struct _lgfs2_rgrps *lgfs2_rgrps_t;
 
@@ -182,6 +191,7 @@ struct rgrp_tree {
 	struct gfs2_rgrp rg;
 	struct gfs2_bitmap *bits;
 	lgfs2_rgrps_t rgrps;
+	uint32_t next_free; /* No data block before this one is known to be free */
 };
 
 typedef struct rgrp_tree *lgfs2_rgrp_t;
@@ -202,6 +212,7 @@ extern int lgfs2_rgrp_write(int fd, lgfs2_rgrp_t rg);
 extern int lgfs2_rgrps_write_final(int fd, lgfs2_rgrps_t rgs);
 extern const struct gfs2_rindex *lgfs2_rgrp_index(lgfs2_rgrp_t rg);
 extern const struct gfs2_rgrp *lgfs2_rgrp_rgrp(lgfs2_rgrp_t rg);
+extern uint32_t lgfs2_rgrp_longest_free(lgfs2_rgrp_t rg, uint64_t *start);
 extern lgfs2_rgrp_t lgfs2_rgrp_first(lgfs2_rgrps_t rgs);
 extern lgfs2_rgrp_t lgfs2_rgrp_last(lgfs2_rgrps_t rgs);
 extern lgfs2_rgrp_t lgfs2_rgrp_next(lgfs2_rgrp_t rg);
@@ -226,6 +237,8 @@ struct gfs2_inode {
 	struct gfs2_sbd *i_sbd;
 	struct rgrp_tree *i_rgd; /* performance hint */
 	int bh_owned; /* Is this bh owned, iow, should we release it later? */
+	struct lgfs2_mpcache *i_mpcache; /* Last metadata path mapped */
+	struct lgfs2_dir_index *i_dindex; /* Names in a searched directory */
 };
 
 struct master_dir
@@ -245,6 +258,25 @@ struct master_dir
 };
 
 #define LGFS2_SB_ADDR(sdp) (GFS2_SB_ADDR >> (sdp)->sd_fsb2bb_shift)
+#define LGFS2_IO_LAT_BUCKETS (24)
+
+/* Optional accounting of the I/O done through buf.c and the rgrp functions */
+struct lgfs2_io_stats {
+	uint64_t reads;        /* Read requests */
+	uint64_t read_blocks;
+	uint64_t read_ns;      /* Total time spent in read requests */
+	uint64_t writes;       /* Write requests */
+	uint64_t write_blocks;
+	uint64_t write_ns;
+	/* Read requests by latency: bucket n counts those taking < 2^n us */
+	uint64_t read_lat[LGFS2_IO_LAT_BUCKETS];
+	uint64_t now;          /* When the last request completed (ns) */
+	/* Called after each request, if set */
+	void (*account)(struct lgfs2_io_stats *st, uint64_t blk, uint64_t count,
+	                int write, uint64_t ns);
+	void *priv;
+};
+
 struct gfs2_sbd {
 	struct gfs2_sb sd_sb;    /* a copy of the ondisk structure */
 
@@ -297,12 +329,30 @@ struct gfs2_sbd {
 	uint64_t rg_one_length;
 	uint64_t rg_length;
 	int gfs1;
+
+	struct lgfs2_io_stats *io_stats; /* NULL unless I/O is to be counted */
+	struct lgfs2_alloc *alloc; /* Free space index, built by the first allocation */
 };
 
 struct metapath {
 	unsigned int mp_list[GFS2_MAX_META_HEIGHT];
 };
 
+/* The indirect blocks on the path to the last block lgfs2_extent_map()
+   looked up, by height. The dinode is the inode's own i_bh. */
+struct lgfs2_mpcache {
+	struct gfs2_buffer_head *mc_bh[GFS2_MAX_META_HEIGHT];
+};
+
+/* A directory entry to be added by lgfs2_dir_build() */
+struct lgfs2_dir_entry {
+	const char *name;
+	unsigned len;
+	struct gfs2_inum inum;
+	unsigned type;   /* DT_* */
+	uint32_t hash;   /* Set by lgfs2_dir_sort() */
+};
+
 
 #define GFS2_DEFAULT_BSIZE          (4096)
 #define GFS2_DEFAULT_JSIZE          (128)
@@ -355,6 +405,9 @@ extern int __breadm_noupdate(struct gfs2_sbd *sdp, struct gfs2_buffer_head **bhs
 extern int bwrite(struct gfs2_buffer_head *bh);
 extern int brelse(struct gfs2_buffer_head *bh);
 extern uint32_t lgfs2_get_block_type(const char *buf);
+extern uint64_t lgfs2_io_start(struct gfs2_sbd *sdp);
+extern void lgfs2_io_done(struct gfs2_sbd *sdp, uint64_t blk, uint64_t count,
+                          int write, uint64_t start);
 
 #define bmodified(bh) do { bh->b_modified = 1; } while(0)
 
@@ -386,6 +439,8 @@ extern int gfs2_check_range(struct gfs2_sbd *sdp, uint64_t blkno);
 /* functions with blk #'s that are file system relative */
 extern int lgfs2_get_bitmap(struct gfs2_sbd *sdp, uint64_t blkno, struct rgrp_tree *rgd);
 extern int gfs2_set_bitmap(lgfs2_rgrp_t rg, uint64_t blkno, int state);
+extern int lgfs2_bitmap_set_range(lgfs2_rgrp_t rg, uint64_t start, uint32_t len, int state);
+extern uint32_t lgfs2_bitmap_count(struct gfs2_bitmap *bi, int state);
 
 extern uint32_t rgblocks2bitblocks(const unsigned int bsize, const uint32_t rgblocks,
                                     uint32_t *ri_data) __attribute__((nonnull(3)));
@@ -398,6 +453,9 @@ extern void find_metapath(struct gfs2_inode *ip, uint64_t block, struct metapath
 extern void lookup_block(struct gfs2_inode *ip, struct gfs2_buffer_head *bh,
 			 unsigned int height, struct metapath *mp,
 			 int create, int *new, uint64_t *block);
+extern int lgfs2_extent_map(struct gfs2_inode *ip, uint64_t lblock, uint64_t maxlen,
+                            uint64_t *dblock, uint64_t *extlen);
+extern void lgfs2_mpcache_drop(struct gfs2_inode *ip);
 extern struct gfs2_inode *lgfs2_inode_get(struct gfs2_sbd *sdp,
 				    struct gfs2_buffer_head *bh);
 extern struct gfs2_inode *lgfs2_inode_read(struct gfs2_sbd *sdp, uint64_t di_addr);
@@ -407,6 +465,10 @@ extern void inode_put(struct gfs2_inode **ip);
 extern uint64_t data_alloc(struct gfs2_inode *ip);
 extern int lgfs2_meta_alloc(struct gfs2_inode *ip, uint64_t *blkno);
 extern int lgfs2_dinode_alloc(struct gfs2_sbd *sdp, const uint64_t blksreq, uint64_t *blkno);
+extern int lgfs2_alloc_run(struct gfs2_sbd *sdp, int state, uint64_t want, uint64_t *blkno, uint64_t *len);
+extern int lgfs2_alloc_begin(struct gfs2_sbd *sdp);
+extern void lgfs2_alloc_end(struct gfs2_sbd *sdp);
+extern void lgfs2_alloc_forget(struct gfs2_sbd *sdp);
 extern uint64_t lgfs2_space_for_data(const struct gfs2_sbd *sdp, unsigned bsize, uint64_t bytes);
 extern int lgfs2_file_alloc(lgfs2_rgrp_t rg, uint64_t di_size, struct gfs2_inode *ip, uint32_t flags, unsigned mode);
 
@@ -431,8 +493,12 @@ extern int gfs2_lookupi(struct gfs2_inode *dip, const char *filename, int len,
 			struct gfs2_inode **ipp);
 extern int dir_add(struct gfs2_inode *dip, const char *filename, int len,
 		    struct gfs2_inum *inum, unsigned int type);
+extern void lgfs2_dir_sort(struct lgfs2_dir_entry *ents, unsigned count);
+extern int lgfs2_dir_build(struct gfs2_inode *dip, const struct lgfs2_dir_entry *ents,
+                           unsigned count);
 extern int gfs2_dirent_del(struct gfs2_inode *dip, const char *filename,
 			   int filename_len);
+extern void lgfs2_dir_index_drop(struct gfs2_inode *dip);
 extern void block_map(struct gfs2_inode *ip, uint64_t lblock, int *new,
 		      uint64_t *dblock, uint32_t *extlen, int prealloc);
 extern int lgfs2_get_leaf_ptr(struct gfs2_inode *dip, uint32_t index, uint64_t *ptr) __attribute__((warn_unused_result));
@@ -694,6 +760,8 @@ extern int write_sb(struct gfs2_sbd *sdp);
 
 /* ondisk.c */
 extern uint32_t gfs2_disk_hash(const char *data, int len);
+extern void lgfs2_disk_hash_batch(const char * const *names, const unsigned *lens,
+                                  uint32_t *hashes, unsigned count);
 extern void print_it(const char *label, const char *fmt, const char *fmt2, ...)
 	__attribute__((format(printf,2,4)));
 
@@ -727,6 +795,63 @@ extern void gfs2_statfs_change_out(struct gfs2_statfs_change *sc, char *buf);
 extern void gfs2_quota_change_in(struct gfs2_quota_change *qc, char *buf);
 extern void gfs2_quota_change_out(struct gfs2_quota_change *qc, char *buf);
 
+/* Field accessors
+
+   These read or update a single field of an on-disk structure in place in a
+   block buffer, for hot paths that only look at a field or two and can't
+   afford to convert the whole structure with the _in/_out functions above.
+   For a field declared as LGFS2_FIELD(name, ...) there is
+   lgfs2_get_name(buf) to read it and lgfs2_set_name(buf, val) to write it,
+   where buf points to the start of the structure, which needn't be
+   aligned. */
+
+#define LGFS2_FIELD(name, type, field, bits) \
+static inline uint##bits##_t lgfs2_get_##name(const char *buf) \
+{ \
+	__be##bits v; \
+	memcpy(&v, buf + offsetof(struct type, field), sizeof(v)); \
+	return be##bits##_to_cpu(v); \
+} \
+static inline void lgfs2_set_##name(char *buf, uint##bits##_t val) \
+{ \
+	__be##bits v = cpu_to_be##bits(val); \
+	memcpy(buf + offsetof(struct type, field), &v, sizeof(v)); \
+}
+
+LGFS2_FIELD(mh_magic, gfs2_meta_header, mh_magic, 32)
+LGFS2_FIELD(mh_type, gfs2_meta_header, mh_type, 32)
+LGFS2_FIELD(mh_format, gfs2_meta_header, mh_format, 32)
+
+LGFS2_FIELD(di_num_addr, gfs2_dinode, di_num.no_addr, 64)
+LGFS2_FIELD(di_num_formal_ino, gfs2_dinode, di_num.no_formal_ino, 64)
+LGFS2_FIELD(di_mode, gfs2_dinode, di_mode, 32)
+LGFS2_FIELD(di_nlink, gfs2_dinode, di_nlink, 32)
+LGFS2_FIELD(di_size, gfs2_dinode, di_size, 64)
+LGFS2_FIELD(di_blocks, gfs2_dinode, di_blocks, 64)
+LGFS2_FIELD(di_goal_meta, gfs2_dinode, di_goal_meta, 64)
+LGFS2_FIELD(di_goal_data, gfs2_dinode, di_goal_data, 64)
+LGFS2_FIELD(di_flags, gfs2_dinode, di_flags, 32)
+LGFS2_FIELD(di_height, gfs2_dinode, di_height, 16)
+LGFS2_FIELD(di_depth, gfs2_dinode, di_depth, 16)
+LGFS2_FIELD(di_entries, gfs2_dinode, di_entries, 32)
+LGFS2_FIELD(di_eattr, gfs2_dinode, di_eattr, 64)
+LGFS2_FIELD(gfs_di_type, gfs_dinode, di_type, 16)
+
+LGFS2_FIELD(de_inum_addr, gfs2_dirent, de_inum.no_addr, 64)
+LGFS2_FIELD(de_inum_formal_ino, gfs2_dirent, de_inum.no_formal_ino, 64)
+LGFS2_FIELD(de_hash, gfs2_dirent, de_hash, 32)
+LGFS2_FIELD(de_rec_len, gfs2_dirent, de_rec_len, 16)
+LGFS2_FIELD(de_name_len, gfs2_dirent, de_name_len, 16)
+LGFS2_FIELD(de_type, gfs2_dirent, de_type, 16)
+
+LGFS2_FIELD(lf_depth, gfs2_leaf, lf_depth, 16)
+LGFS2_FIELD(lf_entries, gfs2_leaf, lf_entries, 16)
+LGFS2_FIELD(lf_next, gfs2_leaf, lf_next, 64)
+
+LGFS2_FIELD(rg_flags, gfs2_rgrp, rg_flags, 32)
+LGFS2_FIELD(rg_free, gfs2_rgrp, rg_free, 32)
+LGFS2_FIELD(rg_dinodes, gfs2_rgrp, rg_dinodes, 32)
+
 /* Printing functions */
 
 extern void gfs2_inum_print(const struct gfs2_inum *no);
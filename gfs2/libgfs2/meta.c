@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <uuid.h>
 #include "libgfs2.h"
@@ -807,13 +809,119 @@ const struct lgfs2_metadata lgfs2_metadata[] = {
 
 const unsigned lgfs2_metadata_size = ARRAY_SIZE(lgfs2_metadata);
 
+/*
+ * The lookups below are made for every block by gfs2_edit and for every
+ * expression by gfs2l, so rather than searching lgfs2_metadata[] and comparing
+ * names each time they go through indexes built from it on first use: a table
+ * of the metadata types by mh_type for each combination of versions, and
+ * open-addressed hash tables of the names of the types and of the fields of
+ * every type. Entries are inserted in table order and probed in the same
+ * order, so where more than one entry matches, the first in the table is
+ * found, as with a linear search.
+ */
+#define MTYPE_MAX    15   /* Highest mh_type indexed */
+#define MTYPE_SLOTS  64   /* At least twice LGFS2_MT_NR, a power of 2 */
+#define MFIELD_SLOTS 1024 /* At least twice the fields of all types, ditto */
+
+/* Each mtype is an index into lgfs2_metadata[] plus one, or 0 if unused */
+static struct {
+	int built;
+	uint8_t by_type[(LGFS2_MD_GFS1 | LGFS2_MD_GFS2) + 1][MTYPE_MAX + 1];
+	uint8_t by_name[MTYPE_SLOTS];
+	struct {
+		uint8_t mtype;
+		uint8_t field;
+	} fields[MFIELD_SLOTS];
+} mindex;
+
+static uint32_t name_hash(const char *name, uint32_t h)
+{
+	h ^= 2166136261U;
+	while (*name != '\0')
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
+}
+
+/* The index sizes above are chosen for the table as it is, so check that it
+   still fits them before relying on them */
+static const char *mindex_misfit(void)
+{
+	unsigned n, nfields = 0;
+
+	if (lgfs2_metadata_size > UINT8_MAX)
+		return "too many types for a uint8_t index";
+	if (2 * lgfs2_metadata_size > MTYPE_SLOTS)
+		return "MTYPE_SLOTS is too small";
+	for (n = 0; n < lgfs2_metadata_size; n++) {
+		const struct lgfs2_metadata *m = &lgfs2_metadata[n];
+
+		if (m->mh_type > MTYPE_MAX)
+			return "an mh_type is above MTYPE_MAX";
+		if (m->nfields > UINT8_MAX + 1)
+			return "too many fields in a type for a uint8_t index";
+		nfields += m->nfields;
+	}
+	if (2 * nfields > MFIELD_SLOTS)
+		return "MFIELD_SLOTS is too small";
+	return NULL;
+}
+
+static void mindex_build(void)
+{
+	const char *misfit = mindex_misfit();
+	unsigned n, v, slot;
+	int j;
+
+	if (misfit != NULL) {
+		fprintf(stderr, "libgfs2: lgfs2_metadata[] doesn't fit its index: %s\n", misfit);
+		abort();
+	}
+	for (n = 0; n < lgfs2_metadata_size; n++) {
+		const struct lgfs2_metadata *m = &lgfs2_metadata[n];
+
+		for (v = 1; v <= (LGFS2_MD_GFS1 | LGFS2_MD_GFS2); v++)
+			if ((m->versions & v) && m->mh_type <= MTYPE_MAX &&
+			    mindex.by_type[v][m->mh_type] == 0)
+				mindex.by_type[v][m->mh_type] = n + 1;
+
+		slot = name_hash(m->name, 0) & (MTYPE_SLOTS - 1);
+		while (mindex.by_name[slot] != 0)
+			slot = (slot + 1) & (MTYPE_SLOTS - 1);
+		mindex.by_name[slot] = n + 1;
+
+		for (j = 0; j < m->nfields; j++) {
+			slot = name_hash(m->fields[j].name, n) & (MFIELD_SLOTS - 1);
+			while (mindex.fields[slot].mtype != 0)
+				slot = (slot + 1) & (MFIELD_SLOTS - 1);
+			mindex.fields[slot].mtype = n + 1;
+			mindex.fields[slot].field = j;
+		}
+	}
+	mindex.built = 1;
+}
+
 const struct lgfs2_metafield *lgfs2_find_mfield_name(const char *name, const struct lgfs2_metadata *mtype)
 {
+	unsigned n = mtype - lgfs2_metadata;
+	unsigned slot;
 	int j;
-	const struct lgfs2_metafield *f;
 
-	for (j = 0; j < mtype->nfields; j++) {
-		f = &mtype->fields[j];
+	if (n >= lgfs2_metadata_size) {
+		/* Not one of ours, so not indexed */
+		for (j = 0; j < mtype->nfields; j++)
+			if (strcmp(mtype->fields[j].name, name) == 0)
+				return &mtype->fields[j];
+		return NULL;
+	}
+	if (!mindex.built)
+		mindex_build();
+	slot = name_hash(name, n) & (MFIELD_SLOTS - 1);
+	for (; mindex.fields[slot].mtype != 0; slot = (slot + 1) & (MFIELD_SLOTS - 1)) {
+		const struct lgfs2_metafield *f;
+
+		if (mindex.fields[slot].mtype != n + 1)
+			continue;
+		f = &mtype->fields[mindex.fields[slot].field];
 		if (strcmp(f->name, name) == 0)
 			return f;
 	}
@@ -822,29 +930,29 @@ const struct lgfs2_metafield *lgfs2_find_mfield_name(const char *name, const str
 
 const struct lgfs2_metadata *lgfs2_find_mtype(uint32_t mh_type, const unsigned versions)
 {
-	const struct lgfs2_metadata *m = lgfs2_metadata;
-	unsigned n = 0;
-
-	do {
-		if ((m[n].versions & versions) && m[n].mh_type == mh_type)
-			return &m[n];
-		n++;
-	} while (n < lgfs2_metadata_size);
-
-	return NULL;
+	unsigned n;
+
+	if (mh_type > MTYPE_MAX)
+		return NULL;
+	if (!mindex.built)
+		mindex_build();
+	n = mindex.by_type[versions & (LGFS2_MD_GFS1 | LGFS2_MD_GFS2)][mh_type];
+	return n ? &lgfs2_metadata[n - 1] : NULL;
 }
 
 const struct lgfs2_metadata *lgfs2_find_mtype_name(const char *name, const unsigned versions)
 {
-	const struct lgfs2_metadata *m = lgfs2_metadata;
-	unsigned n = 0;
+	unsigned slot;
 
-	do {
-		if ((m[n].versions & versions) && !strcmp(m[n].name, name))
-			return &m[n];
-		n++;
-	} while (n < lgfs2_metadata_size);
+	if (!mindex.built)
+		mindex_build();
+	slot = name_hash(name, 0) & (MTYPE_SLOTS - 1);
+	for (; mindex.by_name[slot] != 0; slot = (slot + 1) & (MTYPE_SLOTS - 1)) {
+		const struct lgfs2_metadata *m = &lgfs2_metadata[mindex.by_name[slot] - 1];
 
+		if ((m->versions & versions) && !strcmp(m->name, name))
+			return m;
+	}
 	return NULL;
 }
 
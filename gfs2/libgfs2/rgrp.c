@@ -127,6 +127,7 @@ int lgfs2_rgrp_bitbuf_alloc(lgfs2_rgrp_t rg)
 	for (i = 0; i < rg->ri.ri_length; i++) {
 		rg->bits[i].bi_data = bufs + (i * sdp->bsize);
 		rg->bits[i].bi_modified = 0;
+		rg->bits[i].bi_summary = 0;
 	}
 	return 0;
 }
@@ -146,6 +147,7 @@ void lgfs2_rgrp_bitbuf_free(lgfs2_rgrp_t rg)
 	for (i = 0; i < rg->ri.ri_length; i++) {
 		rg->bits[i].bi_data = NULL;
 		rg->bits[i].bi_modified = 0;
+		rg->bits[i].bi_summary = 0;
 	}
 }
 
@@ -191,6 +193,8 @@ uint64_t gfs2_rgrp_read(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
 {
 	unsigned length = rgd->ri.ri_length * sdp->bsize;
 	off_t offset = rgd->ri.ri_addr * sdp->bsize;
+	uint64_t start;
+	ssize_t ret;
 	char *buf;
 
 	if (length == 0 || gfs2_check_range(sdp, rgd->ri.ri_addr))
@@ -200,7 +204,10 @@ uint64_t gfs2_rgrp_read(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
 	if (buf == NULL)
 		return -1;
 
-	if (pread(sdp->device_fd, buf, length, offset) != length) {
+	start = lgfs2_io_start(sdp);
+	ret = pread(sdp->device_fd, buf, length, offset);
+	lgfs2_io_done(sdp, rgd->ri.ri_addr, rgd->ri.ri_length, 0, start);
+	if (ret != length) {
 		free(buf);
 		return -1;
 	}
@@ -209,6 +216,7 @@ uint64_t gfs2_rgrp_read(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
 		int mtype = (i ? GFS2_METATYPE_RB : GFS2_METATYPE_RG);
 
 		rgd->bits[i].bi_data = buf + (i * sdp->bsize);
+		rgd->bits[i].bi_summary = 0;
 		if (gfs2_check_meta(rgd->bits[i].bi_data, mtype)) {
 			free(buf);
 			return rgd->ri.ri_addr + i;
@@ -232,12 +240,15 @@ void gfs2_rgrp_relse(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
 		return;
 	for (unsigned i = 0; i < rgd->ri.ri_length; i++) {
 		off_t offset = sdp->bsize * (rgd->ri.ri_addr + i);
+		uint64_t start;
 		ssize_t ret;
 
 		if (rgd->bits[i].bi_data == NULL || !rgd->bits[i].bi_modified)
 			continue;
 
+		start = lgfs2_io_start(sdp);
 		ret = pwrite(sdp->device_fd, rgd->bits[i].bi_data, sdp->bsize, offset);
+		lgfs2_io_done(sdp, rgd->ri.ri_addr + i, 1, 1, start);
 		if (ret != sdp->bsize) {
 			fprintf(stderr, "Failed to write modified resource group at block %"PRIu64": %s\n",
 			        (uint64_t)rgd->ri.ri_addr, strerror(errno));
@@ -245,8 +256,10 @@ void gfs2_rgrp_relse(struct gfs2_sbd *sdp, struct rgrp_tree *rgd)
 		rgd->bits[i].bi_modified = 0;
 	}
 	free(rgd->bits[0].bi_data);
-	for (unsigned i = 0; i < rgd->ri.ri_length; i++)
+	for (unsigned i = 0; i < rgd->ri.ri_length; i++) {
 		rgd->bits[i].bi_data = NULL;
+		rgd->bits[i].bi_summary = 0;
+	}
 }
 
 struct rgrp_tree *rgrp_insert(struct osi_root *rgtree, uint64_t rgblock)
@@ -283,6 +296,8 @@ void gfs2_rgrp_free(struct gfs2_sbd *sdp, struct osi_root *rgrp_tree)
 	struct rgrp_tree *rgd;
 	struct osi_node *n;
 
+	if (sdp != NULL && rgrp_tree == &sdp->rgtree)
+		lgfs2_alloc_forget(sdp);
 	if (OSI_EMPTY_ROOT(rgrp_tree))
 		return;
 	while ((n = osi_first(rgrp_tree))) {
@@ -770,7 +785,6 @@ lgfs2_rgrp_t lgfs2_rgrp_last(lgfs2_rgrps_t rgs)
 int lgfs2_rbm_from_block(struct lgfs2_rbm *rbm, uint64_t block)
 {
 	uint64_t rblock = block - rbm->rgd->ri.ri_data0;
-	struct gfs2_sbd *sdp = rbm->rgd->rgrps->sdp;
 
 	if (rblock > UINT_MAX) {
 		errno = EINVAL;
@@ -783,98 +797,54 @@ int lgfs2_rbm_from_block(struct lgfs2_rbm *rbm, uint64_t block)
 
 	rbm->bii = 0;
 	rbm->offset = (uint32_t)(rblock);
-	/* Check if the block is within the first block */
-	if (rbm->offset < (rbm_bi(rbm)->bi_len * GFS2_NBBY))
-		return 0;
-
-	/* Adjust for the size diff between gfs2_meta_header and gfs2_rgrp */
-	rbm->offset += (sizeof(struct gfs2_rgrp) -
-			sizeof(struct gfs2_meta_header)) * GFS2_NBBY;
-	rbm->bii = rbm->offset / sdp->sd_blocks_per_bitmap;
-	rbm->offset -= rbm->bii * sdp->sd_blocks_per_bitmap;
-	return 0;
-}
-
-/**
- * lgfs2_rbm_incr - increment an rbm structure
- * @rbm: The rbm with rgd already set correctly
- *
- * This function takes an existing rbm structure and increments it to the next
- * viable block offset.
- *
- * Returns: If incrementing the offset would cause the rbm to go past the
- *          end of the rgrp, true is returned, otherwise false.
- *
- */
-static int lgfs2_rbm_incr(struct lgfs2_rbm *rbm)
-{
-	if (rbm->offset + 1 < (rbm_bi(rbm)->bi_len * GFS2_NBBY)) { /* in the same bitmap */
-		rbm->offset++;
-		return 0;
+	/* Going by the bitmaps' lengths rather than the file system's block
+	   size lets this work for resource groups read from the rindex,
+	   which don't have an lgfs2_rgrps_t */
+	while (rbm->offset >= rbm_bi(rbm)->bi_len * GFS2_NBBY) {
+		if (rbm->bii == rbm->rgd->ri.ri_length - 1) {
+			errno = E2BIG;
+			return 1;
+		}
+		rbm->offset -= rbm_bi(rbm)->bi_len * GFS2_NBBY;
+		rbm->bii++;
 	}
-	if (rbm->bii == rbm->rgd->ri.ri_length - 1) /* at the last bitmap */
-		return 1;
-
-	rbm->offset = 0;
-	rbm->bii++;
 	return 0;
 }
 
-/**
- * lgfs2_testbit - test a bit in the bitmaps
- * @rbm: The bit to test
- *
- * Returns: The two bit block state of the requested bit
- */
-static inline uint8_t lgfs2_testbit(const struct lgfs2_rbm *rbm)
+/* The free blocks among the 32 from block base, a multiple of 32, of a
+   bitmap of nblocks, as a bit at the even position of each */
+static uint64_t bitmap_free_bits(const uint8_t *buf, uint32_t base, uint32_t nblocks)
 {
-	struct gfs2_bitmap *bi = rbm_bi(rbm);
-	const uint8_t *buffer = (uint8_t *)bi->bi_data + bi->bi_offset;
-	const uint8_t *byte;
-	unsigned int bit;
-
-	byte = buffer + (rbm->offset / GFS2_NBBY);
-	bit = (rbm->offset % GFS2_NBBY) * GFS2_BIT_SIZE;
-
-	return (*byte >> bit) & GFS2_BIT_MASK;
+	uint32_t valid = nblocks - base < 32 ? nblocks - base : 32;
+	uint64_t w = 0, f;
+
+	memcpy(&w, buf + base / GFS2_NBBY, (valid + GFS2_NBBY - 1) / GFS2_NBBY);
+	w = le64_to_cpu(w);
+	f = ~w & ~(w >> 1) & 0x5555555555555555ULL;
+	if (valid < 32)
+		f &= (1ULL << (valid * GFS2_BIT_SIZE)) - 1;
+	return f;
 }
 
-/**
- * lgfs2_unaligned_extlen - Look for free blocks which are not byte aligned
- * @rbm: Position to search (value/result)
- * @n_unaligned: Number of unaligned blocks to check
- * @len: Decremented for each block found (terminate on zero)
- *
- * Returns: true if a non-free block is encountered
- */
-static int lgfs2_unaligned_extlen(struct lgfs2_rbm *rbm, uint32_t n_unaligned, uint32_t *len)
+/* The number of free blocks in a row from block off of a bitmap, up to max */
+static uint32_t bitmap_free_run(const uint8_t *buf, uint32_t off, uint32_t nblocks,
+                                uint32_t max)
 {
-	uint32_t n;
-	uint8_t res;
-
-	for (n = 0; n < n_unaligned; n++) {
-		res = lgfs2_testbit(rbm);
-		if (res != GFS2_BLKST_FREE)
-			return 1;
-		(*len)--;
-		if (*len == 0)
-			return 1;
-		if (lgfs2_rbm_incr(rbm))
-			return 1;
-	}
-
-	return 0;
-}
-
-static uint8_t *check_bytes8(const uint8_t *start, uint8_t value, unsigned bytes)
-{
-	while (bytes) {
-		if (*start != value)
-			return (void *)start;
-		start++;
-		bytes--;
+	uint32_t run = 0;
+
+	while (off < nblocks && run < max) {
+		uint32_t base = off & ~31U;
+		uint32_t lo = off - base;
+		uint64_t f = bitmap_free_bits(buf, base, nblocks) >> (lo * GFS2_BIT_SIZE);
+		uint64_t used = ~f & 0x5555555555555555ULL;
+		uint32_t n = used ? __builtin_ctzll(used) / GFS2_BIT_SIZE : 32;
+
+		run += n;
+		off += n;
+		if (lo + n < 32)
+			break;
 	}
-	return NULL;
+	return run < max ? run : max;
 }
 
 /**
@@ -883,60 +853,99 @@ static uint8_t *check_bytes8(const uint8_t *start, uint8_t value, unsigned bytes
  * @len: Max length to check
  *
  * Starting at the block specified by the rbm, see how many free blocks
- * there are, not reading more than len blocks ahead. This can be done
- * using check_bytes8 when the blocks are byte aligned, but has to be done
- * on a block by block basis in case of unaligned blocks. Also this
- * function can cope with bitmap boundaries (although it must stop on
- * a resource group boundary)
+ * there are, not reading more than len blocks ahead. The bitmaps are
+ * checked 32 blocks at a time, whatever their alignment, and the extent
+ * can cross bitmap boundaries (although it must stop on a resource group
+ * boundary)
  *
  * Returns: Number of free blocks in the extent
  */
-static uint32_t lgfs2_free_extlen(const struct lgfs2_rbm *rrbm, uint32_t len)
+uint32_t lgfs2_free_extlen(const struct lgfs2_rbm *rrbm, uint32_t len)
 {
 	struct lgfs2_rbm rbm = *rrbm;
-	uint32_t n_unaligned = rbm.offset & 3;
-	uint32_t size = len;
-	uint32_t bytes;
-	uint32_t chunk_size;
-	uint8_t *ptr, *start, *end;
-	uint64_t block;
-	struct gfs2_bitmap *bi;
-	struct gfs2_sbd *sdp = rbm.rgd->rgrps->sdp;
-
-	if (n_unaligned &&
-	    lgfs2_unaligned_extlen(&rbm, 4 - n_unaligned, &len))
-		goto out;
-
-	n_unaligned = len & 3;
-	/* Start is now byte aligned */
-	while (len > 3) {
-		bi = rbm_bi(&rbm);
-		start = (uint8_t *)bi->bi_data;
-		end = start + sdp->bsize;
-		start += bi->bi_offset;
-		start += (rbm.offset / GFS2_NBBY);
-		bytes = (len / GFS2_NBBY) < (end - start) ? (len / GFS2_NBBY):(end - start);
-		ptr = check_bytes8(start, 0, bytes);
-		chunk_size = ((ptr == NULL) ? bytes : (ptr - start));
-		chunk_size *= GFS2_NBBY;
-		len -= chunk_size;
-		block = lgfs2_rbm_to_block(&rbm);
-		if (lgfs2_rbm_from_block(&rbm, block + chunk_size)) {
-			n_unaligned = 0;
+	uint32_t run = 0;
+
+	while (run < len) {
+		struct gfs2_bitmap *bi = rbm_bi(&rbm);
+		uint32_t nblocks = bi->bi_len * GFS2_NBBY;
+		uint32_t n;
+
+		n = bitmap_free_run((uint8_t *)bi->bi_data + bi->bi_offset,
+		                    rbm.offset, nblocks, len - run);
+		run += n;
+		if (rbm.offset + n < nblocks || rbm.bii == rbm.rgd->ri.ri_length - 1)
 			break;
-		}
-		if (ptr) {
-			n_unaligned = 3;
+		rbm.offset = 0;
+		rbm.bii++;
+	}
+	return run;
+}
+
+/**
+ * lgfs2_rgrp_longest_free - find the longest run of free blocks
+ * @rg: The resource group, with its bitmaps read
+ * @start: Set to the first block of the run
+ *
+ * Words of the bitmaps whose blocks are all free or all in use are taken
+ * whole, and the runs within the others are found a run rather than a block
+ * at a time.
+ * Returns: The number of blocks in the run, or 0 if none are free
+ */
+uint32_t lgfs2_rgrp_longest_free(lgfs2_rgrp_t rg, uint64_t *start)
+{
+	uint32_t best = 0, best_start = 0, cur = 0, cur_start = 0;
+	unsigned i;
+
+	for (i = 0; i < rg->ri.ri_length; i++) {
+		struct gfs2_bitmap *bi = &rg->bits[i];
+		const uint8_t *buf = (uint8_t *)bi->bi_data + bi->bi_offset;
+		uint32_t first = bi->bi_start * GFS2_NBBY;
+		uint32_t nblocks = bi->bi_len * GFS2_NBBY;
+		uint32_t base;
+
+		if (first >= rg->ri.ri_data)
 			break;
+		if (nblocks > rg->ri.ri_data - first)
+			nblocks = rg->ri.ri_data - first;
+		for (base = 0; base < nblocks; base += 32) {
+			uint64_t f = bitmap_free_bits(buf, base, nblocks);
+			uint32_t valid = nblocks - base < 32 ? nblocks - base : 32;
+			uint32_t k = 0;
+
+			while (k < valid) {
+				uint64_t rest = f >> (k * GFS2_BIT_SIZE);
+				uint64_t used = ~rest & 0x5555555555555555ULL;
+				uint32_t n;
+
+				if (rest & 1) {
+					n = used ? __builtin_ctzll(used) / GFS2_BIT_SIZE : 32;
+					if (n > valid - k)
+						n = valid - k;
+					if (cur == 0)
+						cur_start = first + base + k;
+					cur += n;
+					k += n;
+					if (k == valid)
+						break; /* The run may go on */
+				} else if (rest == 0) {
+					k = valid;
+				} else {
+					k += __builtin_ctzll(rest) / GFS2_BIT_SIZE;
+				}
+				if (cur > best) {
+					best = cur;
+					best_start = cur_start;
+				}
+				cur = 0;
+			}
 		}
-		n_unaligned = len & 3;
 	}
-
-	/* Deal with any bits left over at the end */
-	if (n_unaligned)
-		lgfs2_unaligned_extlen(&rbm, n_unaligned, &len);
-out:
-	return size - len;
+	if (cur > best) {
+		best = cur;
+		best_start = cur_start;
+	}
+	*start = rg->ri.ri_data0 + best_start;
+	return best;
 }
 
 /**
@@ -1022,21 +1031,18 @@ res_covered_end_of_rgrp:
  * @rbm: the resource group information
  * @state: The state of the first block, GFS2_BLKST_DINODE or GFS2_BLKST_USED
  * @elen: The requested extent length
- * Returns the length of the extent allocated.
+ * Returns the length of the extent allocated, which is taken off rg_free.
  */
 unsigned lgfs2_alloc_extent(const struct lgfs2_rbm *rbm, int state, const unsigned elen)
 {
-	struct lgfs2_rbm pos = { .rgd = rbm->rgd, };
+	struct lgfs2_rbm pos = *rbm;
 	const uint64_t block = lgfs2_rbm_to_block(rbm);
-	unsigned len;
-
-	gfs2_set_bitmap(rbm->rgd, block, state);
+	unsigned len = 1;
 
-	for (len = 1; len < elen; len++) {
-		int ret = lgfs2_rbm_from_block(&pos, block + len);
-		if (ret || lgfs2_testbit(&pos) != GFS2_BLKST_FREE)
-			break;
-		gfs2_set_bitmap(pos.rgd, block + len, GFS2_BLKST_USED);
+	lgfs2_bitmap_set_range(rbm->rgd, block, 1, state);
+	if (elen > 1 && lgfs2_rbm_from_block(&pos, block + 1) == 0) {
+		len += lgfs2_free_extlen(&pos, elen - 1);
+		lgfs2_bitmap_set_range(rbm->rgd, block + 1, len - 1, GFS2_BLKST_USED);
 	}
 	return len;
 }
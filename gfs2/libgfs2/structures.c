@@ -305,8 +305,9 @@ int build_journal(struct gfs2_sbd *sdp, int j, struct gfs2_inode *jindex)
  */
 int lgfs2_build_jindex(struct gfs2_inode *master, struct gfs2_inum *jnls, size_t nmemb)
 {
-	char fname[GFS2_FNAMESIZE + 1];
+	struct lgfs2_dir_entry *ents;
 	struct gfs2_inode *jindex;
+	char *names;
 	unsigned j;
 	int ret;
 
@@ -318,15 +319,31 @@ int lgfs2_build_jindex(struct gfs2_inode *master, struct gfs2_inum *jnls, size_t
 	if (jindex == NULL)
 		return 1;
 
-	fname[GFS2_FNAMESIZE] = '\0';
-
+	/* Add the journals' entries all at once rather than one at a time */
+	ents = calloc(nmemb, sizeof(*ents));
+	names = malloc(nmemb * (GFS2_FNAMESIZE + 1));
+	if (ents == NULL || names == NULL) {
+		free(ents);
+		free(names);
+		inode_put(&jindex);
+		return 1;
+	}
 	for (j = 0; j < nmemb; j++) {
-		snprintf(fname, GFS2_FNAMESIZE, "journal%u", j);
-		ret = dir_add(jindex, fname, strlen(fname), &jnls[j], IF2DT(S_IFREG | 0600));
-		if (ret) {
-			inode_put(&jindex);
-			return 1;
-		}
+		char *fname = names + j * (GFS2_FNAMESIZE + 1);
+
+		snprintf(fname, GFS2_FNAMESIZE + 1, "journal%u", j);
+		ents[j].name = fname;
+		ents[j].len = strlen(fname);
+		ents[j].inum = jnls[j];
+		ents[j].type = IF2DT(S_IFREG | 0600);
+	}
+	lgfs2_dir_sort(ents, nmemb);
+	ret = lgfs2_dir_build(jindex, ents, nmemb);
+	free(ents);
+	free(names);
+	if (ret) {
+		inode_put(&jindex);
+		return 1;
 	}
 
 	if (cfg_debug) {
@@ -690,13 +707,23 @@ int gfs2_check_meta(const char *buf, int type)
 	return 0;
 }
 
+/**
+ * lgfs2_bm_scan - list the blocks in a state in one of an rgrp's bitmaps
+ * The bitmap's summary is used to skip it if it has no blocks in @state,
+ * or else to start at the first and stop after the last one.
+ * Returns the number of blocks put in @buf.
+ */
 unsigned lgfs2_bm_scan(struct rgrp_tree *rgd, unsigned idx, uint64_t *buf, uint8_t state)
 {
 	struct gfs2_bitmap *bi = &rgd->bits[idx];
+	uint32_t count = lgfs2_bitmap_count(bi, state);
 	unsigned n = 0;
-	uint32_t blk = 0;
+	uint32_t blk;
 
-	while(blk < (bi->bi_len * GFS2_NBBY)) {
+	if (count == 0)
+		return 0;
+	blk = bi->bi_first[state];
+	while (n < count && blk < (bi->bi_len * GFS2_NBBY)) {
 		blk = gfs2_bitfit((uint8_t *)bi->bi_data + bi->bi_offset,
 				  bi->bi_len, blk, state);
 		if (blk == BFITNOENT)
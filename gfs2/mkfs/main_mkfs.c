@@ -1194,6 +1194,11 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	lgfs2_attach_rgrps(&sbd, rgs); // Temporary
+	/* Read each resource group's bitmaps once for the system files */
+	if (lgfs2_alloc_begin(&sbd) != 0) {
+		perror(_("Failed to allocate memory"));
+		exit(EXIT_FAILURE);
+	}
 
 	error = build_master(&sbd);
 	if (error) {
@@ -1258,6 +1263,8 @@ int main(int argc, char *argv[])
 	inode_put(&sbd.md.inum);
 	inode_put(&sbd.md.statfs);
 
+	lgfs2_alloc_end(&sbd);
+	lgfs2_alloc_forget(&sbd);
 	lgfs2_rgrps_free(&rgs);
 
 	if (!opts.quiet) {